@@ -0,0 +1,99 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "batch.h"
+#include "hurdle.h"
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+#include "tea_simd.h"
+#include "tune.h"
+#include "workpool.h"
+
+typedef struct {
+    uint32_t dwTeaType;
+    const uint32_t *adwIvs;
+    const uint8_t *lpKeys;
+    uint32_t dwNumKsBytes;
+    uint8_t *lpKsOut;
+} KeystreamJob;
+
+static void batch_keystream_chunk(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd) {
+    KeystreamJob *lpJob = lpArg;
+    uint32_t dwNumLanes = qwEnd - qwBegin;
+    const uint32_t *adwIvs = &lpJob->adwIvs[qwBegin];
+    const uint8_t *lpKeys = &lpJob->lpKeys[qwBegin * 10];
+    uint8_t *lpKsOut = &lpJob->lpKsOut[qwBegin * lpJob->dwNumKsBytes];
+
+    // A chunk is one or more passes of the byte-lane kernels
+    switch (lpJob->dwTeaType) {
+    case 1:
+        tea1_keystream_lanes(dwNumLanes, adwIvs, lpKeys, lpJob->dwNumKsBytes, lpKsOut);
+        break;
+    case 2:
+        tea2_keystream_lanes(dwNumLanes, adwIvs, lpKeys, lpJob->dwNumKsBytes, lpKsOut);
+        break;
+    case 3:
+        tea3_keystream_lanes(dwNumLanes, adwIvs, lpKeys, lpJob->dwNumKsBytes, lpKsOut);
+        break;
+    }
+}
+
+void batch_keystream(WORKPOOL *lpPool, uint32_t dwTeaType, uint32_t dwNumLanes, const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    KeystreamJob stJob = { dwTeaType, adwIvs, lpKeys, dwNumKsBytes, lpKsOut };
+    TuneProfile stTune;
+    tune_get(&stTune);
+    workpool_run(lpPool, 0, dwNumLanes, stTune.dwBatchChunkLanes, batch_keystream_chunk, &stJob);
+}
+
+typedef struct {
+    const uint8_t *lpKeys;
+    const uint8_t *lpInput;
+    uint8_t *lpOutput;
+    uint8_t eEncryptMode;
+    uint32_t eImpl;
+} HurdleJob;
+
+static void batch_hurdle_chunk(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd) {
+    HurdleJob *lpJob = lpArg;
+    HURDLE_CTX stCtx;
+    HURDLE_COMPACT_CTX stCompact;
+
+    // Every lane has its own key; by default the round keys are derived on the fly instead of expanding a schedule per lane
+    for (uint64_t i = qwBegin; i < qwEnd; i++) {
+        switch (lpJob->eImpl) {
+        case TUNE_HURDLE_SCHEDULE:
+            HURDLE_set_key((uint8_t *)&lpJob->lpKeys[i * 16], &stCtx);
+            HURDLE_encrypt(&lpJob->lpOutput[i * 8], &lpJob->lpInput[i * 8], &stCtx, lpJob->eEncryptMode);
+            break;
+        case TUNE_HURDLE_COMPACT:
+            HURDLE_set_key_compact(&lpJob->lpKeys[i * 16], &stCompact);
+            HURDLE_encrypt_compact(&lpJob->lpOutput[i * 8], &lpJob->lpInput[i * 8], &stCompact, lpJob->eEncryptMode);
+            break;
+        default:
+            HURDLE_encrypt_otf(&lpJob->lpOutput[i * 8], &lpJob->lpInput[i * 8], &lpJob->lpKeys[i * 16], lpJob->eEncryptMode);
+            break;
+        }
+    }
+}
+
+void batch_hurdle(WORKPOOL *lpPool, uint32_t dwNumLanes, const uint8_t *lpKeys, const uint8_t *lpInput, uint8_t *lpOutput, uint8_t eEncryptMode) {
+    TuneProfile stTune;
+    tune_get(&stTune);
+    HurdleJob stJob = { lpKeys, lpInput, lpOutput, eEncryptMode, stTune.eHurdleImpl };
+    workpool_run(lpPool, 0, dwNumLanes, stTune.dwBatchChunkLanes, batch_hurdle_chunk, &stJob);
+}
@@ -0,0 +1,15 @@
+#ifndef HAVE_BATCH_H
+#define HAVE_BATCH_H
+
+#include <inttypes.h>
+
+#include "workpool.h"
+
+/*
+ * Batch keystream and HURDLE primitives. Lane n uses the n-th IV / key / block
+ * of the input arrays. A NULL pool runs the whole batch on the calling thread.
+ */
+void batch_keystream(WORKPOOL *lpPool, uint32_t dwTeaType, uint32_t dwNumLanes, const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
+void batch_hurdle(WORKPOOL *lpPool, uint32_t dwNumLanes, const uint8_t *lpKeys, const uint8_t *lpInput, uint8_t *lpOutput, uint8_t eEncryptMode);
+
+#endif /* HAVE_BATCH_H */
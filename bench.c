@@ -0,0 +1,540 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "common.h"
+#include "hugemem.h"
+#include "hurdle.h"
+#include "ivsync.h"
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+#include "tea_simd.h"
+#include "tea1_orbit.h"
+#include "tea1_search.h"
+#include "tea1_targets.h"
+
+#define KS_LEN 54
+
+/*
+ * Micro benchmarks for the primitives. Each case reports throughput and,
+ * where the kernel allows perf events, branch misses per unit of work.
+ */
+
+typedef struct {
+    const char *lpszName;
+    const char *lpszUnit;       // unit of work, e.g. "byte" of keystream
+    uint64_t (*fnRun)(uint64_t qwIterations);  // returns units of work done
+} BenchCase;
+
+static volatile uint8_t g_bSink;
+
+static uint64_t bench_tea1(uint64_t qwIterations) {
+    uint8_t abKey[10] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA };
+    uint8_t abKs[KS_LEN];
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        abKey[0] = i;
+        tea1(i, abKey, KS_LEN, abKs);
+        g_bSink ^= abKs[KS_LEN - 1];
+    }
+    return qwIterations * KS_LEN;
+}
+
+static uint64_t bench_tea2(uint64_t qwIterations) {
+    uint8_t abKey[10] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA };
+    uint8_t abKs[KS_LEN];
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        abKey[0] = i;
+        tea2(i, abKey, KS_LEN, abKs);
+        g_bSink ^= abKs[KS_LEN - 1];
+    }
+    return qwIterations * KS_LEN;
+}
+
+static uint64_t bench_tea3(uint64_t qwIterations) {
+    uint8_t abKey[10] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA };
+    uint8_t abKs[KS_LEN];
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        abKey[0] = i;
+        tea3(i, abKey, KS_LEN, abKs);
+        g_bSink ^= abKs[KS_LEN - 1];
+    }
+    return qwIterations * KS_LEN;
+}
+
+/*
+ * Batches of independent (key, IV) lanes on the byte-lane vector kernels, the
+ * widest the cpu runs unless capped with TETRA_SIMD (see tea_simd.c)
+ */
+static uint64_t bench_tea_lanes(uint64_t qwIterations, uint32_t dwTeaType, uint32_t dwNumLanes) {
+    static uint32_t adwIvs[TEA_SIMD_MAX_LANES];
+    static uint8_t abKeys[TEA_SIMD_MAX_LANES * 10];
+    static uint8_t abKs[TEA_SIMD_MAX_LANES * KS_LEN];
+    for (int i = 0; i < sizeof(abKeys); i++) {
+        abKeys[i] = i * 37 + 5;
+    }
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        for (uint32_t j = 0; j < dwNumLanes; j++) {
+            adwIvs[j] = i * dwNumLanes + j;
+        }
+        if (dwTeaType == 1) tea1_keystream_lanes(dwNumLanes, adwIvs, abKeys, KS_LEN, abKs);
+        if (dwTeaType == 2) tea2_keystream_lanes(dwNumLanes, adwIvs, abKeys, KS_LEN, abKs);
+        if (dwTeaType == 3) tea3_keystream_lanes(dwNumLanes, adwIvs, abKeys, KS_LEN, abKs);
+        g_bSink ^= abKs[KS_LEN - 1];
+    }
+    return qwIterations * dwNumLanes * KS_LEN;
+}
+
+static uint64_t bench_tea1_lanes_16(uint64_t qwIterations) { return bench_tea_lanes(qwIterations, 1, 16); }
+static uint64_t bench_tea1_lanes_64(uint64_t qwIterations) { return bench_tea_lanes(qwIterations, 1, 64); }
+static uint64_t bench_tea2_lanes_64(uint64_t qwIterations) { return bench_tea_lanes(qwIterations, 2, 64); }
+static uint64_t bench_tea3_lanes_64(uint64_t qwIterations) { return bench_tea_lanes(qwIterations, 3, 64); }
+
+static uint64_t bench_hurdle_encrypt(uint64_t qwIterations) {
+    uint8_t abKey[16] = { 0xab, 0xcd, 0xef, 0x12, 0xc0, 0x01, 0xf0, 0x0d, 0xde, 0xad, 0xbe, 0xef, 0xca, 0xfe, 0xba, 0xbe };
+    uint8_t abBlock[8] = { 0 };
+    HURDLE_CTX stCipher;
+    HURDLE_set_key(abKey, &stCipher);
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        HURDLE_encrypt(abBlock, abBlock, &stCipher, HURDLE_ENCRYPT);
+    }
+    g_bSink ^= abBlock[0];
+    return qwIterations;
+}
+
+static uint64_t bench_hurdle_set_key(uint64_t qwIterations) {
+    uint8_t abKey[16] = { 0 };
+    HURDLE_CTX stCipher;
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        abKey[0] = i;
+        HURDLE_set_key(abKey, &stCipher);
+        g_bSink ^= stCipher.abRoundKeys[255];
+    }
+    return qwIterations;
+}
+
+static uint64_t bench_hurdle_decrypt(uint64_t qwIterations) {
+    uint8_t abKey[16] = { 0xab, 0xcd, 0xef, 0x12, 0xc0, 0x01, 0xf0, 0x0d, 0xde, 0xad, 0xbe, 0xef, 0xca, 0xfe, 0xba, 0xbe };
+    uint8_t abBlock[8] = { 0 };
+    HURDLE_CTX stCipher;
+    HURDLE_set_key(abKey, &stCipher);
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        HURDLE_encrypt(abBlock, abBlock, &stCipher, HURDLE_DECRYPT);
+    }
+    g_bSink ^= abBlock[0];
+    return qwIterations;
+}
+
+static uint64_t bench_hurdle_encrypt_compact(uint64_t qwIterations) {
+    uint8_t abKey[16] = { 0xab, 0xcd, 0xef, 0x12, 0xc0, 0x01, 0xf0, 0x0d, 0xde, 0xad, 0xbe, 0xef, 0xca, 0xfe, 0xba, 0xbe };
+    uint8_t abBlock[8] = { 0 };
+    HURDLE_COMPACT_CTX stCipher;
+    HURDLE_set_key_compact(abKey, &stCipher);
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        HURDLE_encrypt_compact(abBlock, abBlock, &stCipher, HURDLE_ENCRYPT);
+    }
+    g_bSink ^= abBlock[0];
+    return qwIterations;
+}
+
+static uint64_t bench_hurdle_encrypt_otf(uint64_t qwIterations) {
+    uint8_t abKey[16] = { 0xab, 0xcd, 0xef, 0x12, 0xc0, 0x01, 0xf0, 0x0d, 0xde, 0xad, 0xbe, 0xef, 0xca, 0xfe, 0xba, 0xbe };
+    uint8_t abBlock[8] = { 0 };
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        HURDLE_encrypt_otf(abBlock, abBlock, abKey, HURDLE_ENCRYPT);
+    }
+    g_bSink ^= abBlock[0];
+    return qwIterations;
+}
+
+/*
+ * One candidate key checked against BENCH_IVS independent observations (one
+ * known keystream byte each), per IV from scratch or sharing the key side of
+ * the rounds through a TeaKeyStream.
+ */
+#define BENCH_IVS 8
+
+static uint64_t bench_multi_iv(uint64_t qwIterations, uint32_t dwTeaType, int bShared) {
+    uint8_t abKey[10] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA };
+    static const uint8_t abMask[1] = { 0xFF };
+    uint8_t abKs[BENCH_IVS];
+    TeaKeyStream stStream;
+    uint32_t dwHits = 0;
+
+    for (int f = 0; f < BENCH_IVS; f++) {
+        abKs[f] = f * 0x35;
+    }
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        abKey[0] = i;
+        abKey[1] = i >> 8;
+        if (bShared) {
+            dwTeaType == 2 ? tea2_key_stream_init(&stStream, abKey) : tea3_key_stream_init(&stStream, abKey);
+        }
+        for (uint32_t f = 0; f < BENCH_IVS; f++) {
+            if (bShared) {
+                dwHits += (dwTeaType == 2 ? tea2_match_key_stream : tea3_match_key_stream)(&stStream, 0x1234 + f, &abKs[f], abMask, 1);
+            } else {
+                dwHits += (dwTeaType == 2 ? tea2_match : tea3_match)(0x1234 + f, abKey, &abKs[f], abMask, 1);
+            }
+        }
+    }
+    g_bSink ^= dwHits;
+    return qwIterations;
+}
+
+static uint64_t bench_tea2_match_ivs(uint64_t qwIterations) { return bench_multi_iv(qwIterations, 2, 0); }
+static uint64_t bench_tea2_match_ivs_shared(uint64_t qwIterations) { return bench_multi_iv(qwIterations, 2, 1); }
+static uint64_t bench_tea3_match_ivs(uint64_t qwIterations) { return bench_multi_iv(qwIterations, 3, 0); }
+static uint64_t bench_tea3_match_ivs_shared(uint64_t qwIterations) { return bench_multi_iv(qwIterations, 3, 1); }
+
+/*
+ * TEA1 reduced-key search over one 4 byte filter, scanning registers in
+ * order or walking the key register cycles. Units are registers tested.
+ */
+static void bench_tea1_filter(Tea1Filter *lpFilter) {
+    memset(lpFilter, 0, sizeof(*lpFilter));
+    lpFilter->dwIv = 0x96724FA1;
+    lpFilter->dwNumKsBytes = 4;
+    memcpy(lpFilter->abKs, "\x12\x34\x56\x78", 4);
+    memset(lpFilter->abMask, 0xFF, 4);
+}
+
+static uint64_t bench_tea1_search_linear(uint64_t qwIterations) {
+    static TEA1_SEARCH_CTX stCtx;
+    Tea1Filter stFilter;
+
+    if (stCtx.dwNumFilters == 0 || tea1_search_done(&stCtx)) {
+        tea1_search_free(&stCtx);
+        tea1_search_init(&stCtx);
+        bench_tea1_filter(&stFilter);
+        tea1_search_set_filters(&stCtx, &stFilter, 1);
+    }
+    return tea1_search_run(&stCtx, qwIterations);
+}
+
+/*
+ * TEA1_TARGETS_BENCH targets sharing one IV, with random 4 byte prefixes.
+ * Units are candidates, each tested against all targets at once.
+ */
+#define TEA1_TARGETS_BENCH 4096
+
+static uint64_t bench_tea1_targets(uint64_t qwIterations) {
+    static TEA1_TARGETS_CTX stCtx;
+
+    if (stCtx.dwNumGroups == 0 || tea1_targets_done(&stCtx)) {
+        static Tea1Filter astTargets[TEA1_TARGETS_BENCH];
+        tea1_targets_free(&stCtx);
+        for (uint32_t i = 0; i < TEA1_TARGETS_BENCH; i++) {
+            uint32_t dwPrefix = i * 2654435761u;
+            bench_tea1_filter(&astTargets[i]);
+            memcpy(astTargets[i].abKs, &dwPrefix, 4);
+        }
+        if (tea1_targets_init(&stCtx, astTargets, TEA1_TARGETS_BENCH) != 0) {
+            return 0;
+        }
+    }
+    return tea1_targets_run(&stCtx, qwIterations);
+}
+
+static uint64_t bench_tea1_search_orbit(uint64_t qwIterations) {
+    static TEA1_ORBIT_CTX stCtx;
+    Tea1Filter stFilter;
+
+    if (stCtx.lpqwVisited == NULL || tea1_orbit_done(&stCtx)) {
+        tea1_orbit_free(&stCtx);
+        bench_tea1_filter(&stFilter);
+        if (tea1_orbit_init(&stCtx, &stFilter, 1) != 0) {
+            return 0;
+        }
+    }
+    uint64_t qwVisited = stCtx.qwNumVisited;
+    tea1_orbit_run(&stCtx, qwIterations);
+    return stCtx.qwNumVisited - qwVisited;
+}
+
+/*
+ * Frame number sync for a known TEA1 key over the whole (hn, mn, fn, tn, dir)
+ * space against a 4 byte burst that never matches. Units are IVs tested.
+ */
+static uint64_t bench_ivsync_tea1(uint64_t qwIterations) {
+    static IVSYNC_CTX stCtx;
+
+    if (stCtx.qwNumCandidates == 0 || ivsync_done(&stCtx)) {
+        IvsyncBurst stBurst;
+        FrameNumbers stMin, stMax;
+        memset(&stBurst, 0, sizeof(stBurst));
+        stBurst.dwNumKsBytes = 4;
+        memcpy(stBurst.abKs, "\x12\x34\x56\x78", 4);
+        memset(stBurst.abMask, 0xFF, 4);
+        ivsync_space_all(&stMin, &stMax);
+        ivsync_free(&stCtx);
+        ivsync_init_tea1_reg(&stCtx, 0x12345678, &stBurst, 1, &stMin, &stMax);
+    }
+    return ivsync_run(&stCtx, qwIterations);
+}
+
+/*
+ * Heterogeneous key batches: every block uses the next of HURDLE_LANES keys,
+ * with the key schedules precomputed (full or compact) or derived per block.
+ * The full contexts take 4 MiB, the compact ones 3 MiB and the raw keys 256 KiB.
+ */
+#define HURDLE_LANES (1 << 14)
+
+static uint8_t *bench_hurdle_lane_keys(void) {
+    static uint8_t *lpKeys;
+    if (lpKeys == NULL) {
+        HugememBlock stBlock;
+        hugemem_alloc(&stBlock, HURDLE_LANES * 16, 0, -1);
+        lpKeys = stBlock.lpBase;
+        for (int i = 0; i < HURDLE_LANES * 16; i++) {
+            lpKeys[i] = i * 2654435761u >> 24;
+        }
+    }
+    return lpKeys;
+}
+
+static uint64_t bench_hurdle_lanes(uint64_t qwIterations, uint32_t dwSchedule, uint8_t eEncryptMode) {
+    static HURDLE_CTX *lpFull;
+    static HURDLE_COMPACT_CTX *lpCompact;
+    uint8_t *lpKeys = bench_hurdle_lane_keys();
+    uint8_t abBlock[8] = { 0 };
+
+    HugememBlock stBlock;
+
+    if (dwSchedule == 0 && lpFull == NULL) {
+        hugemem_alloc(&stBlock, HURDLE_LANES * sizeof(HURDLE_CTX), 0, -1);
+        lpFull = stBlock.lpBase;
+        for (int i = 0; i < HURDLE_LANES; i++) {
+            HURDLE_set_key(&lpKeys[16 * i], &lpFull[i]);
+        }
+    }
+    if (dwSchedule == 1 && lpCompact == NULL) {
+        hugemem_alloc(&stBlock, HURDLE_LANES * sizeof(HURDLE_COMPACT_CTX), 0, -1);
+        lpCompact = stBlock.lpBase;
+        for (int i = 0; i < HURDLE_LANES; i++) {
+            HURDLE_set_key_compact(&lpKeys[16 * i], &lpCompact[i]);
+        }
+    }
+
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        uint32_t dwLane = i & (HURDLE_LANES - 1);
+        switch (dwSchedule) {
+        case 0:
+            HURDLE_encrypt(abBlock, abBlock, &lpFull[dwLane], eEncryptMode);
+            break;
+        case 1:
+            HURDLE_encrypt_compact(abBlock, abBlock, &lpCompact[dwLane], eEncryptMode);
+            break;
+        default:
+            HURDLE_encrypt_otf(abBlock, abBlock, &lpKeys[16 * dwLane], eEncryptMode);
+            break;
+        }
+    }
+    g_bSink ^= abBlock[0];
+    return qwIterations;
+}
+
+static uint64_t bench_hurdle_lanes_full_enc(uint64_t qwIterations) { return bench_hurdle_lanes(qwIterations, 0, HURDLE_ENCRYPT); }
+static uint64_t bench_hurdle_lanes_full_dec(uint64_t qwIterations) { return bench_hurdle_lanes(qwIterations, 0, HURDLE_DECRYPT); }
+static uint64_t bench_hurdle_lanes_compact_enc(uint64_t qwIterations) { return bench_hurdle_lanes(qwIterations, 1, HURDLE_ENCRYPT); }
+static uint64_t bench_hurdle_lanes_compact_dec(uint64_t qwIterations) { return bench_hurdle_lanes(qwIterations, 1, HURDLE_DECRYPT); }
+static uint64_t bench_hurdle_lanes_otf_enc(uint64_t qwIterations) { return bench_hurdle_lanes(qwIterations, 2, HURDLE_ENCRYPT); }
+static uint64_t bench_hurdle_lanes_otf_dec(uint64_t qwIterations) { return bench_hurdle_lanes(qwIterations, 2, HURDLE_DECRYPT); }
+
+/*
+ * Dependent random lookups into a TABLE_BYTES table, as in a search loop
+ * probing a large filter table or bitmap, with the table on 4 KiB pages,
+ * transparent huge pages or reserved huge pages (falling back to THP when
+ * none are reserved). The dTLB-misses column shows the difference.
+ */
+#define TABLE_BYTES (128 << 20)
+#define TABLE_ENTRIES (TABLE_BYTES / sizeof(uint32_t))
+
+static uint64_t bench_table_random(uint64_t qwIterations, uint32_t dwFlags) {
+    static uint32_t *alpTables[3];
+    uint32_t dwKind = dwFlags & HUGEMEM_FLAG_HUGETLB ? 2 : dwFlags & HUGEMEM_FLAG_NO_THP ? 0 : 1;
+    uint32_t *lpTable = alpTables[dwKind];
+
+    if (lpTable == NULL) {
+        HugememBlock stBlock;
+        if (hugemem_alloc(&stBlock, TABLE_BYTES, dwFlags | HUGEMEM_FLAG_POPULATE, -1) != 0) {
+            return 0;
+        }
+        if ((dwFlags & HUGEMEM_FLAG_HUGETLB) && stBlock.ePages != HUGEMEM_PAGES_HUGETLB) {
+            fprintf(stderr, "no reserved huge pages, table uses %s pages\n", hugemem_pages_name(stBlock.ePages));
+        }
+        lpTable = alpTables[dwKind] = stBlock.lpBase;
+        for (uint32_t i = 0; i < TABLE_ENTRIES; i++) {
+            lpTable[i] = (i * 2654435761u + 0x9E3779B9) & (TABLE_ENTRIES - 1);
+        }
+    }
+
+    uint32_t dwIndex = 0;
+    for (uint64_t i = 0; i < qwIterations; i++) {
+        dwIndex = lpTable[dwIndex ^ (i & 0xFF)];
+    }
+    g_bSink ^= dwIndex;
+    return qwIterations;
+}
+
+static uint64_t bench_table_random_4k(uint64_t qwIterations) { return bench_table_random(qwIterations, HUGEMEM_FLAG_NO_THP); }
+static uint64_t bench_table_random_thp(uint64_t qwIterations) { return bench_table_random(qwIterations, 0); }
+static uint64_t bench_table_random_hugetlb(uint64_t qwIterations) { return bench_table_random(qwIterations, HUGEMEM_FLAG_HUGETLB); }
+
+static const BenchCase g_astCases[] = {
+    { "tea1",                     "byte",  bench_tea1 },
+    { "tea2",                     "byte",  bench_tea2 },
+    { "tea3",                     "byte",  bench_tea3 },
+    { "tea1_lanes_16",            "byte",  bench_tea1_lanes_16 },
+    { "tea1_lanes_64",            "byte",  bench_tea1_lanes_64 },
+    { "tea2_lanes_64",            "byte",  bench_tea2_lanes_64 },
+    { "tea3_lanes_64",            "byte",  bench_tea3_lanes_64 },
+    { "tea2_match_8iv",           "key",   bench_tea2_match_ivs },
+    { "tea2_match_8iv_shared",    "key",   bench_tea2_match_ivs_shared },
+    { "tea3_match_8iv",           "key",   bench_tea3_match_ivs },
+    { "tea3_match_8iv_shared",    "key",   bench_tea3_match_ivs_shared },
+    { "tea1_search_linear",       "key",   bench_tea1_search_linear },
+    { "tea1_search_orbit",        "key",   bench_tea1_search_orbit },
+    { "tea1_targets_4096",        "key",   bench_tea1_targets },
+    { "ivsync_tea1",              "iv",    bench_ivsync_tea1 },
+    { "HURDLE_encrypt",           "block", bench_hurdle_encrypt },
+    { "HURDLE_set_key",           "key",   bench_hurdle_set_key },
+    { "HURDLE_decrypt",           "block", bench_hurdle_decrypt },
+    { "HURDLE_encrypt_compact",   "block", bench_hurdle_encrypt_compact },
+    { "HURDLE_encrypt_otf",       "block", bench_hurdle_encrypt_otf },
+    { "hurdle_lanes_full_enc",    "block", bench_hurdle_lanes_full_enc },
+    { "hurdle_lanes_full_dec",    "block", bench_hurdle_lanes_full_dec },
+    { "hurdle_lanes_compact_enc", "block", bench_hurdle_lanes_compact_enc },
+    { "hurdle_lanes_compact_dec", "block", bench_hurdle_lanes_compact_dec },
+    { "hurdle_lanes_otf_enc",     "block", bench_hurdle_lanes_otf_enc },
+    { "hurdle_lanes_otf_dec",     "block", bench_hurdle_lanes_otf_dec },
+    { "table_random_4k",          "lookup", bench_table_random_4k },
+    { "table_random_thp",         "lookup", bench_table_random_thp },
+    { "table_random_hugetlb",     "lookup", bench_table_random_hugetlb },
+};
+
+typedef struct {
+    uint32_t dwType;
+    uint64_t qwConfig;
+    const char *lpszName;
+} BenchCounter;
+
+static const BenchCounter g_astCounters[] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "dTLB-misses" },
+};
+
+#define BENCH_NUM_COUNTERS (sizeof(g_astCounters) / sizeof(g_astCounters[0]))
+
+static int perf_open(uint32_t dwType, uint64_t qwConfig) {
+    struct perf_event_attr stAttr;
+    memset(&stAttr, 0, sizeof(stAttr));
+    stAttr.type = dwType;
+    stAttr.size = sizeof(stAttr);
+    stAttr.config = qwConfig;
+    stAttr.disabled = 1;
+    stAttr.exclude_kernel = 1;
+    stAttr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &stAttr, 0, -1, -1, 0);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_run(const BenchCase *lpCase, double dSeconds) {
+    int afdCounters[BENCH_NUM_COUNTERS];
+    uint64_t aqwCounts[BENCH_NUM_COUNTERS] = { 0 };
+    uint64_t qwIterations = 1;
+    uint64_t qwUnits = 0;
+    double dElapsed = 0;
+
+    for (int c = 0; c < BENCH_NUM_COUNTERS; c++) {
+        afdCounters[c] = perf_open(g_astCounters[c].dwType, g_astCounters[c].qwConfig);
+    }
+
+    // Grow the iteration count until a run lasts long enough to be meaningful
+    for (;;) {
+        for (int c = 0; c < BENCH_NUM_COUNTERS; c++) {
+            if (afdCounters[c] >= 0) {
+                ioctl(afdCounters[c], PERF_EVENT_IOC_RESET, 0);
+                ioctl(afdCounters[c], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+        double dStart = now();
+        qwUnits = lpCase->fnRun(qwIterations);
+        dElapsed = now() - dStart;
+        for (int c = 0; c < BENCH_NUM_COUNTERS; c++) {
+            if (afdCounters[c] >= 0) {
+                ioctl(afdCounters[c], PERF_EVENT_IOC_DISABLE, 0);
+                if (read(afdCounters[c], &aqwCounts[c], sizeof(aqwCounts[c])) != sizeof(aqwCounts[c])) {
+                    aqwCounts[c] = 0;
+                }
+            }
+        }
+        if (dElapsed >= dSeconds || qwUnits == 0) {
+            break;
+        }
+        qwIterations *= dElapsed > dSeconds / 16 ? 2 : 8;
+    }
+
+    if (qwUnits == 0) {
+        printf("%-26s failed\n", lpCase->lpszName);
+    } else {
+        printf("%-26s %12.2f M%s/s %10.2f ns/%s", lpCase->lpszName, qwUnits / dElapsed / 1e6, lpCase->lpszUnit,
+               dElapsed * 1e9 / qwUnits, lpCase->lpszUnit);
+        for (int c = 0; c < BENCH_NUM_COUNTERS; c++) {
+            if (afdCounters[c] >= 0) {
+                printf(" %10.4f %s/%s", (double)aqwCounts[c] / qwUnits, g_astCounters[c].lpszName, lpCase->lpszUnit);
+            } else {
+                printf("        n/a %s/%s", g_astCounters[c].lpszName, lpCase->lpszUnit);
+            }
+        }
+        printf("\n");
+    }
+    for (int c = 0; c < BENCH_NUM_COUNTERS; c++) {
+        if (afdCounters[c] >= 0) {
+            close(afdCounters[c]);
+        }
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    double dSeconds = 0.5;
+
+    if (argc > 2 || (argc == 2 && !strcmp(argv[1], "-h"))) {
+        printf("[+] Benchmark TETRA primitives\n");
+        printf("    Usage: %s [case]\n", argv[0]);
+        exit(1);
+    }
+
+    for (int i = 0; i < sizeof(g_astCases) / sizeof(g_astCases[0]); i++) {
+        if (argc == 2 && strcmp(argv[1], g_astCases[i].lpszName)) {
+            continue;
+        }
+        bench_run(&g_astCases[i], dSeconds);
+    }
+    return 0;
+}
@@ -0,0 +1,269 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "common.h"
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+#include "capture.h"
+
+#define CAPTURE_MAX_GROUP 16            // records sharing one keystream
+
+int capture_load_schedule(const char *lpszPath, CaptureKeyChange **lppSchedule, uint32_t *lpdwNumChanges, uint32_t *lpdwLine) {
+    char szLine[256];
+    CaptureKeyChange *lpSchedule = NULL;
+    uint32_t dwNum = 0, dwCapacity = 0;
+
+    *lpdwLine = 0;
+    FILE *lpFile = fopen(lpszPath, "r");
+    if (lpFile == NULL) {
+        return -1;
+    }
+
+    while (fgets(szLine, sizeof(szLine), lpFile)) {
+        unsigned long long qwFirst;
+        unsigned int dwTeaType;
+        char szKey[21];
+        int iEnd = 0;
+
+        (*lpdwLine)++;
+        if (szLine[0] == '#' || strspn(szLine, " \t\r\n") == strlen(szLine)) {
+            continue;
+        }
+        if (sscanf(szLine, "%llu %u %20[0-9a-fA-F]%n", &qwFirst, &dwTeaType, szKey, &iEnd) != 3 ||
+            strlen(szKey) != 20 || strspn(szLine + iEnd, " \t\r\n") != strlen(szLine + iEnd) || dwTeaType > 3 ||
+            (dwNum && qwFirst <= lpSchedule[dwNum - 1].qwFirstRecord)) {
+            goto fail;
+        }
+
+        if (dwNum == dwCapacity) {
+            dwCapacity = dwCapacity ? 2 * dwCapacity : 16;
+            CaptureKeyChange *lpGrown = realloc(lpSchedule, dwCapacity * sizeof(CaptureKeyChange));
+            if (lpGrown == NULL) {
+                goto fail;
+            }
+            lpSchedule = lpGrown;
+        }
+        CaptureKeyChange *lpChange = &lpSchedule[dwNum++];
+        lpChange->qwFirstRecord = qwFirst;
+        lpChange->dwTeaType = dwTeaType;
+        for (int i = 0; i < 10; i++) {
+            unsigned int bByte;
+            sscanf(&szKey[2 * i], "%2x", &bByte);
+            lpChange->abKey[i] = bByte;
+        }
+    }
+
+    fclose(lpFile);
+    *lppSchedule = lpSchedule;
+    *lpdwNumChanges = dwNum;
+    return 0;
+
+fail:
+    fclose(lpFile);
+    free(lpSchedule);
+    return -1;
+}
+
+static int capture_read_record_header(const uint8_t *lpIn, CaptureRecordHeader *lpHeader) {
+    memcpy(lpHeader, lpIn, CAPTURE_RECORD_HEADER_LEN);
+    lpHeader->hn = le16(lpHeader->hn);
+    lpHeader->wBitLen = le16(lpHeader->wBitLen);
+    lpHeader->wKsBitOffset = le16(lpHeader->wKsBitOffset);
+
+    // build_iv asserts on out of range frame numbers
+    return (lpHeader->tn >= 1 && lpHeader->tn <= 4 && lpHeader->fn >= 1 && lpHeader->fn <= 18 &&
+            lpHeader->mn >= 1 && lpHeader->mn <= 60 && lpHeader->dir <= 1) ? 0 : -1;
+}
+
+typedef struct {
+    uint64_t qwOffset;
+    uint64_t qwFirstRecord;
+} CaptureChunk;
+
+typedef struct {
+    const uint8_t *lpIn;
+    uint8_t *lpOut;
+    const CaptureKeyChange *lpSchedule;
+    uint32_t dwNumChanges;
+    const CaptureChunk *lpChunks;       // one past the last chunk marks the end of the records
+    uint64_t qwKeystreams;
+} CaptureJob;
+
+static void capture_xor_group(uint32_t dwTeaType, uint32_t dwIv, const uint8_t *lpKey, const TeaXorSegment *lpSegments, uint32_t dwNumSegments) {
+    switch (dwTeaType) {
+    case 1:
+        tea1_xor_scatter(dwIv, lpKey, lpSegments, dwNumSegments);
+        break;
+    case 2:
+        tea2_xor_scatter(dwIv, lpKey, lpSegments, dwNumSegments);
+        break;
+    case 3:
+        tea3_xor_scatter(dwIv, lpKey, lpSegments, dwNumSegments);
+        break;
+    }
+}
+
+/*
+ * Copy one chunk to the output and decrypt it there. Consecutive records of
+ * the same frame under the same key are xored from a single keystream run.
+ */
+static void capture_decrypt_chunk(CaptureJob *lpJob, const CaptureChunk *lpChunk) {
+    uint64_t qwOffset = lpChunk->qwOffset;
+    uint64_t qwEnd = lpChunk[1].qwOffset;
+    uint64_t qwRecord = lpChunk->qwFirstRecord;
+    uint64_t qwKeystreams = 0;
+
+    if (lpJob->lpOut != lpJob->lpIn) {
+        memcpy(lpJob->lpOut + qwOffset, lpJob->lpIn + qwOffset, qwEnd - qwOffset);
+    }
+
+    // Last schedule entry at or before the first record, -1 if there is none
+    int64_t k = -1;
+    for (int64_t lo = 0, hi = lpJob->dwNumChanges - 1; lo <= hi; ) {
+        int64_t mid = (lo + hi) / 2;
+        if (lpJob->lpSchedule[mid].qwFirstRecord <= qwRecord) {
+            k = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    TeaXorSegment astGroup[CAPTURE_MAX_GROUP];
+    uint32_t dwGroupLen = 0, dwGroupIv = 0;
+    int64_t qwGroupKey = -1;
+
+    for (; qwOffset < qwEnd; qwRecord++) {
+        CaptureRecordHeader stHeader;
+        capture_read_record_header(lpJob->lpOut + qwOffset, &stHeader);
+        uint8_t *lpPayload = lpJob->lpOut + qwOffset + CAPTURE_RECORD_HEADER_LEN;
+        qwOffset += CAPTURE_RECORD_HEADER_LEN + (stHeader.wBitLen + 7) / 8;
+
+        while (k + 1 < lpJob->dwNumChanges && lpJob->lpSchedule[k + 1].qwFirstRecord <= qwRecord) {
+            k++;
+        }
+        if (k < 0 || lpJob->lpSchedule[k].dwTeaType == 0 || stHeader.wBitLen == 0) {
+            continue;
+        }
+
+        FrameNumbers stFn = { stHeader.tn, stHeader.fn, stHeader.mn, stHeader.hn, stHeader.dir };
+        uint32_t dwIv = build_iv(&stFn);
+        if (dwGroupLen && (dwIv != dwGroupIv || k != qwGroupKey || dwGroupLen == CAPTURE_MAX_GROUP)) {
+            const CaptureKeyChange *lpChange = &lpJob->lpSchedule[qwGroupKey];
+            capture_xor_group(lpChange->dwTeaType, dwGroupIv, lpChange->abKey, astGroup, dwGroupLen);
+            qwKeystreams++;
+            dwGroupLen = 0;
+        }
+        TeaXorSegment stSegment = { stHeader.wKsBitOffset, 0, stHeader.wBitLen, lpPayload };
+        astGroup[dwGroupLen++] = stSegment;
+        dwGroupIv = dwIv;
+        qwGroupKey = k;
+    }
+
+    if (dwGroupLen) {
+        const CaptureKeyChange *lpChange = &lpJob->lpSchedule[qwGroupKey];
+        capture_xor_group(lpChange->dwTeaType, dwGroupIv, lpChange->abKey, astGroup, dwGroupLen);
+        qwKeystreams++;
+    }
+    __atomic_fetch_add(&lpJob->qwKeystreams, qwKeystreams, __ATOMIC_RELAXED);
+}
+
+static void capture_chunks(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd) {
+    CaptureJob *lpJob = lpArg;
+
+    for (uint64_t i = qwBegin; i < qwEnd; i++) {
+        capture_decrypt_chunk(lpJob, &lpJob->lpChunks[i]);
+    }
+}
+
+int capture_decrypt(WORKPOOL *lpPool, const uint8_t *lpIn, uint8_t *lpOut, uint64_t qwLen,
+                    const CaptureKeyChange *lpSchedule, uint32_t dwNumChanges, uint32_t dwChunkBytes, CaptureSummary *lpSummary) {
+    CaptureChunk *lpChunks = NULL;
+    uint64_t qwNumChunks = 0, qwCapacity = 0;
+    uint64_t qwOffset = CAPTURE_FILE_HEADER_LEN;
+    uint64_t qwRecord = 0;
+    uint32_t dwVersion;
+
+    memset(lpSummary, 0, sizeof(*lpSummary));
+    if (qwLen < CAPTURE_FILE_HEADER_LEN || memcmp(lpIn, CAPTURE_MAGIC, 8) != 0) {
+        return -1;
+    }
+    memcpy(&dwVersion, lpIn + 8, 4);
+    if (le32(dwVersion) != CAPTURE_VERSION) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < dwNumChanges; i++) {
+        if (lpSchedule[i].dwTeaType > 3 || (i && lpSchedule[i].qwFirstRecord <= lpSchedule[i - 1].qwFirstRecord)) {
+            return -1;
+        }
+    }
+    if (dwChunkBytes == 0) {
+        dwChunkBytes = CAPTURE_CHUNK_BYTES;
+    }
+
+    /*
+     * Records have no sync marker, so chunk boundaries come from one pass over
+     * the record headers. Every record is validated here, the workers then
+     * decrypt without further checks.
+     */
+    uint64_t qwChunkStart = qwOffset;
+    while (1) {
+        if (qwOffset == qwLen || qwOffset - qwChunkStart >= dwChunkBytes || qwNumChunks == 0) {
+            if (qwNumChunks == qwCapacity) {
+                qwCapacity = qwCapacity ? 2 * qwCapacity : 64;
+                CaptureChunk *lpGrown = realloc(lpChunks, qwCapacity * sizeof(CaptureChunk));
+                if (lpGrown == NULL) {
+                    free(lpChunks);
+                    return -1;
+                }
+                lpChunks = lpGrown;
+            }
+            CaptureChunk stChunk = { qwOffset, qwRecord };
+            lpChunks[qwNumChunks++] = stChunk;
+            qwChunkStart = qwOffset;
+        }
+        if (qwOffset == qwLen) {
+            break;
+        }
+
+        CaptureRecordHeader stHeader;
+        if (qwLen - qwOffset < CAPTURE_RECORD_HEADER_LEN || capture_read_record_header(lpIn + qwOffset, &stHeader) != 0 ||
+            qwLen - qwOffset - CAPTURE_RECORD_HEADER_LEN < (stHeader.wBitLen + 7) / 8) {
+            lpSummary->qwErrorOffset = qwOffset;
+            free(lpChunks);
+            return -1;
+        }
+        qwOffset += CAPTURE_RECORD_HEADER_LEN + (stHeader.wBitLen + 7) / 8;
+        qwRecord++;
+    }
+
+    if (lpOut != lpIn) {
+        memcpy(lpOut, lpIn, CAPTURE_FILE_HEADER_LEN);
+    }
+
+    // The final entry only marks the end of the last chunk
+    CaptureJob stJob = { lpIn, lpOut, lpSchedule, dwNumChanges, lpChunks, 0 };
+    int bStopped = workpool_run(lpPool, 0, qwNumChunks - 1, 1, capture_chunks, &stJob);
+    free(lpChunks);
+
+    lpSummary->qwRecords = qwRecord;
+    lpSummary->qwKeystreams = stJob.qwKeystreams;
+    return bStopped ? -1 : 0;
+}
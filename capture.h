@@ -0,0 +1,72 @@
+#ifndef HAVE_CAPTURE_H
+#define HAVE_CAPTURE_H
+
+#include <inttypes.h>
+
+#include "workpool.h"
+
+/*
+ * Capture file format, all fields little endian:
+ *
+ *   file header   8 bytes "TETRACAP", u32 version (1), u32 reserved (0)
+ *   record        u8 tn, u8 fn, u8 mn, u8 dir, u16 hn,
+ *                 u16 payload length in bits, u16 first keystream bit,
+ *                 u16 reserved (0), then (bits + 7) / 8 payload bytes
+ *
+ * Records follow each other without padding. Payload bits are MSB first and
+ * bit n is xored with keystream bit (first keystream bit + n) of the frame's
+ * IV, so both halves of a split burst can be stored as separate records.
+ */
+
+#define CAPTURE_MAGIC             "TETRACAP"
+#define CAPTURE_VERSION           1
+#define CAPTURE_FILE_HEADER_LEN   16
+#define CAPTURE_RECORD_HEADER_LEN 12
+#define CAPTURE_CHUNK_BYTES       (1 << 20)    // default work unit, cut at the next record boundary
+
+typedef struct {
+    uint8_t tn;
+    uint8_t fn;
+    uint8_t mn;
+    uint8_t dir;
+    uint16_t hn;
+    uint16_t wBitLen;
+    uint16_t wKsBitOffset;
+    uint16_t wReserved;
+} CaptureRecordHeader;
+
+/*
+ * Key schedule entry: records from qwFirstRecord up to the next entry are
+ * decrypted with this key. Type 0 entries, and records before the first
+ * entry, pass through unchanged, for clear stretches of a capture.
+ */
+typedef struct {
+    uint64_t qwFirstRecord;
+    uint32_t dwTeaType;
+    uint8_t abKey[10];
+} CaptureKeyChange;
+
+typedef struct {
+    uint64_t qwRecords;
+    uint64_t qwKeystreams;              // keystreams generated, records of one frame share one
+    uint64_t qwErrorOffset;             // file offset of the first malformed record
+} CaptureSummary;
+
+/*
+ * Schedule side file, one entry per line: "<first record> <tea type> <key hex>",
+ * with lines starting with '#' ignored. Entries must be in increasing record
+ * order. Returns 0 and a malloc'd array, or -1 with the failing line in *lpdwLine.
+ */
+int capture_load_schedule(const char *lpszPath, CaptureKeyChange **lppSchedule, uint32_t *lpdwNumChanges, uint32_t *lpdwLine);
+
+/*
+ * Decrypt a whole capture image into lpOut (same length, may equal lpIn). The
+ * record stream is first cut into chunks of about dwChunkBytes (0 = default)
+ * at record boundaries, which are then decrypted in parallel on lpPool, or
+ * on the calling thread with a NULL pool. Returns 0, or -1 for a malformed
+ * capture or schedule in which case lpOut is incomplete.
+ */
+int capture_decrypt(WORKPOOL *lpPool, const uint8_t *lpIn, uint8_t *lpOut, uint64_t qwLen,
+                    const CaptureKeyChange *lpSchedule, uint32_t dwNumChanges, uint32_t dwChunkBytes, CaptureSummary *lpSummary);
+
+#endif /* HAVE_CAPTURE_H */
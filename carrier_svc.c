@@ -0,0 +1,515 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "carrier_svc.h"
+#include "common.h"
+#include "hugemem.h"
+#include "lathist.h"
+#include "taa1.h"
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+#include "tea_core.h"
+
+#define CACHE_LINE 64
+
+#define CARRIER_SVC_TIMESLOTS   4
+#define CARRIER_SVC_MAX_SHARDS  (CARRIER_SVC_MAX_CARRIERS * CARRIER_SVC_TIMESLOTS)
+#define CARRIER_SVC_KS_BYTES    (2 * CARRIER_SVC_MAX_BURST_BYTES)
+#define CARRIER_SVC_SHARD_BATCH 4       // bursts taken from one shard before moving to the next
+#define CARRIER_SVC_SPIN        1000    // idle rounds before a worker goes to sleep
+#define CARRIER_SVC_SLEEP_NS    10000000
+
+#define FRAMES_PER_HYPERFRAME   (60 * 18)
+#define FRAMES_PER_RING         (FRAMES_PER_HYPERFRAME * 65536)   // hn wraps after 0xFFFF
+
+/*
+ * Bounded multi-producer single-consumer ring. Every slot carries a sequence
+ * number: pos when free for the producer claiming position pos, pos + 1 once
+ * that producer filled it. Producers claim positions with a CAS on qwTail, the
+ * owning worker consumes at qwHead without atomics on the index.
+ */
+typedef struct {
+    _Atomic uint64_t qwSeq;
+    CarrierBurst stBurst;
+} CarrierSlot;
+
+typedef struct {
+    int bValid;
+    uint16_t wHn;
+    uint32_t dwPos;                     // frame within the hyperframe, 0 .. FRAMES_PER_HYPERFRAME - 1
+} CarrierFnTracker;
+
+typedef struct {
+    // Producer side
+    _Atomic uint64_t qwTail __attribute__((aligned(CACHE_LINE)));
+    _Atomic uint64_t qwDropped;
+
+    // Worker side
+    uint64_t qwHead __attribute__((aligned(CACHE_LINE)));
+    _Atomic uint64_t qwDone;            // bursts handed to the output function
+    uint32_t dwCarrier;
+    uint32_t dwTeaType;
+    uint8_t abEck[10];
+    CarrierFnTracker astTrackers[2];    // per direction
+    int bKsValid;
+    uint32_t dwKsIv;
+    uint32_t dwKsBytes;
+    uint8_t abKs[CARRIER_SVC_KS_BYTES];
+    _Atomic uint64_t qwBursts;
+    _Atomic uint64_t qwLate;
+    _Atomic uint64_t qwSkippedFrames;
+    _Atomic uint64_t qwTotalLatencyNs;
+    _Atomic uint64_t qwMaxLatencyNs;
+
+    CarrierSlot astSlots[CARRIER_SVC_QUEUE_LEN] __attribute__((aligned(CACHE_LINE)));
+} __attribute__((aligned(CACHE_LINE))) CarrierShard;
+
+typedef struct {
+    pthread_t hThread;
+    uint32_t dwIndex;
+    struct CARRIER_SVC *lpSvc;
+
+    CarrierShard *alpShards[CARRIER_SVC_MAX_SHARDS];
+    _Atomic uint32_t dwNumShards;
+
+    _Atomic int bSleeping;
+    pthread_mutex_t hLock;
+    pthread_cond_t hWake;
+} __attribute__((aligned(CACHE_LINE))) CarrierWorker;
+
+struct CARRIER_SVC {
+    CarrierWorker *lpWorkers;
+    uint32_t dwNumWorkers;
+    CarrierSvcOutputFn fnOutput;
+    void *lpArg;
+
+    pthread_mutex_t hAddLock;           // serializes carrier_svc_add_carrier
+    HUGEMEM_ARENA *lpShardArena;        // shards are hit at random by every submitter
+    CarrierShard *alpShards[CARRIER_SVC_MAX_SHARDS];
+    _Atomic uint32_t dwNumCarriers;
+    atomic_int bShutdown;
+};
+
+// Single writer counters: plain read-modify-write, atomic only so readers see whole values
+#define SHARD_STAT_ADD(field, v) atomic_store_explicit(&(field), atomic_load_explicit(&(field), memory_order_relaxed) + (v), memory_order_relaxed)
+
+static uint64_t carrier_svc_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int carrier_queue_push(CarrierShard *lpShard, const CarrierBurst *lpBurst) {
+    uint64_t qwPos = atomic_load_explicit(&lpShard->qwTail, memory_order_relaxed);
+    for (;;) {
+        CarrierSlot *lpSlot = &lpShard->astSlots[qwPos & (CARRIER_SVC_QUEUE_LEN - 1)];
+        uint64_t qwSeq = atomic_load_explicit(&lpSlot->qwSeq, memory_order_acquire);
+        int64_t qwDiff = (int64_t)(qwSeq - qwPos);
+        if (qwDiff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&lpShard->qwTail, &qwPos, qwPos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                lpSlot->stBurst = *lpBurst;
+                atomic_store_explicit(&lpSlot->qwSeq, qwPos + 1, memory_order_release);
+                return 0;
+            }
+        } else if (qwDiff < 0) {
+            return -1;
+        } else {
+            qwPos = atomic_load_explicit(&lpShard->qwTail, memory_order_relaxed);
+        }
+    }
+}
+
+static CarrierBurst *carrier_queue_peek(CarrierShard *lpShard) {
+    CarrierSlot *lpSlot = &lpShard->astSlots[lpShard->qwHead & (CARRIER_SVC_QUEUE_LEN - 1)];
+    if (atomic_load_explicit(&lpSlot->qwSeq, memory_order_acquire) != lpShard->qwHead + 1) {
+        return NULL;
+    }
+    return &lpSlot->stBurst;
+}
+
+static void carrier_queue_pop(CarrierShard *lpShard) {
+    CarrierSlot *lpSlot = &lpShard->astSlots[lpShard->qwHead & (CARRIER_SVC_QUEUE_LEN - 1)];
+    atomic_store_explicit(&lpSlot->qwSeq, lpShard->qwHead + CARRIER_SVC_QUEUE_LEN, memory_order_release);
+    lpShard->qwHead++;
+}
+
+/*
+ * Fill in the hyperframe number if the burst lacks it: a jump back by more
+ * than half a hyperframe is a wrap into the next one, a jump forward by more
+ * than half is a late burst from the previous one.
+ */
+static void carrier_track_frame(CarrierShard *lpShard, CarrierFnTracker *lpTracker, FrameNumbers *lpFn, int bHnKnown) {
+    uint32_t dwPos = (lpFn->mn - 1) * 18 + (lpFn->fn - 1);
+
+    if (!bHnKnown) {
+        lpFn->hn = lpTracker->bValid ? lpTracker->wHn : 0;
+        if (lpTracker->bValid && dwPos < lpTracker->dwPos && lpTracker->dwPos - dwPos > FRAMES_PER_HYPERFRAME / 2) {
+            lpFn->hn++;
+        } else if (lpTracker->bValid && dwPos > lpTracker->dwPos && dwPos - lpTracker->dwPos > FRAMES_PER_HYPERFRAME / 2) {
+            lpFn->hn--;
+        }
+    }
+
+    // Distance from the last frame seen, taken around the ring so hn 0xFFFF -> 0 is one frame forward
+    int64_t qwFrame = (int64_t)lpFn->hn * FRAMES_PER_HYPERFRAME + dwPos;
+    int64_t qwLast = (int64_t)lpTracker->wHn * FRAMES_PER_HYPERFRAME + lpTracker->dwPos;
+    int64_t qwDiff = (qwFrame - qwLast + FRAMES_PER_RING + FRAMES_PER_RING / 2) % FRAMES_PER_RING - FRAMES_PER_RING / 2;
+    if (lpTracker->bValid && qwDiff < 0) {
+        SHARD_STAT_ADD(lpShard->qwLate, 1);
+        return;
+    }
+    if (lpTracker->bValid && qwDiff > 1) {
+        SHARD_STAT_ADD(lpShard->qwSkippedFrames, qwDiff - 1);
+    }
+    lpTracker->bValid = 1;
+    lpTracker->wHn = lpFn->hn;
+    lpTracker->dwPos = dwPos;
+}
+
+static void carrier_svc_process(CARRIER_SVC *lpSvc, CarrierWorker *lpWorker, CarrierShard *lpShard, CarrierBurst *lpBurst) {
+    // Per-stage timing only when switched on, the always-on latency stats below need just one clock read
+    int bLathist = lathist_enabled();
+    uint64_t qwStageNs = bLathist ? lathist_now_ns() : 0;
+    uint64_t qwNowNs;
+    if (bLathist) {
+        lathist_record(LATHIST_QUEUE, qwStageNs - lpBurst->qwSubmitNs);
+    }
+
+    carrier_track_frame(lpShard, &lpShard->astTrackers[lpBurst->stFn.dir], &lpBurst->stFn, lpBurst->bHnKnown);
+    lpBurst->bHnKnown = 1;
+    uint32_t dwIv = build_iv(&lpBurst->stFn);
+    if (bLathist) {
+        qwNowNs = lathist_now_ns();
+        lathist_record(LATHIST_IV, qwNowNs - qwStageNs);
+        qwStageNs = qwNowNs;
+    }
+
+    // Both halves of a slot share the IV, so keep the keystream of the last frame around
+    uint32_t dwKsBytes = (lpBurst->dwKsBitOffset + lpBurst->dwBitLen + 7) / 8;
+    if (!lpShard->bKsValid || lpShard->dwKsIv != dwIv || lpShard->dwKsBytes < dwKsBytes) {
+        switch (lpShard->dwTeaType) {
+            case 1: tea1(dwIv, lpShard->abEck, dwKsBytes, lpShard->abKs); break;
+            case 2: tea2(dwIv, lpShard->abEck, dwKsBytes, lpShard->abKs); break;
+            case 3: tea3(dwIv, lpShard->abEck, dwKsBytes, lpShard->abKs); break;
+        }
+        lpShard->bKsValid = 1;
+        lpShard->dwKsIv = dwIv;
+        lpShard->dwKsBytes = dwKsBytes;
+        if (bLathist) {
+            qwNowNs = lathist_now_ns();
+            lathist_record(LATHIST_KEYSTREAM, qwNowNs - qwStageNs);
+            qwStageNs = qwNowNs;
+        }
+    }
+    TeaXorSegment stSegment = { lpBurst->dwKsBitOffset, 0, lpBurst->dwBitLen, lpBurst->abData };
+    for (uint32_t i = lpBurst->dwKsBitOffset / 8; i < dwKsBytes; i++) {
+        tea_core_xor_segment(&stSegment, i, lpShard->abKs[i]);
+    }
+
+    qwNowNs = carrier_svc_now_ns();
+    if (bLathist) {
+        lathist_record(LATHIST_XOR, qwNowNs - qwStageNs);
+        qwStageNs = qwNowNs;
+    }
+    uint64_t qwLatency = qwNowNs - lpBurst->qwSubmitNs;
+    SHARD_STAT_ADD(lpShard->qwBursts, 1);
+    SHARD_STAT_ADD(lpShard->qwTotalLatencyNs, qwLatency);
+    if (qwLatency > atomic_load_explicit(&lpShard->qwMaxLatencyNs, memory_order_relaxed)) {
+        atomic_store_explicit(&lpShard->qwMaxLatencyNs, qwLatency, memory_order_relaxed);
+    }
+
+    lpSvc->fnOutput(lpSvc->lpArg, lpWorker->dwIndex, lpBurst);
+    if (bLathist) {
+        qwNowNs = lathist_now_ns();
+        lathist_record(LATHIST_OUTPUT, qwNowNs - qwStageNs);
+        lathist_record(LATHIST_TOTAL, qwNowNs - lpBurst->qwSubmitNs);
+    }
+}
+
+static uint32_t carrier_svc_serve(CARRIER_SVC *lpSvc, CarrierWorker *lpWorker, CarrierShard *lpShard) {
+    uint32_t dwServed = 0;
+    CarrierBurst *lpBurst;
+
+    while (dwServed < CARRIER_SVC_SHARD_BATCH && (lpBurst = carrier_queue_peek(lpShard)) != NULL) {
+        carrier_svc_process(lpSvc, lpWorker, lpShard, lpBurst);
+        carrier_queue_pop(lpShard);
+        atomic_store_explicit(&lpShard->qwDone, lpShard->qwHead, memory_order_release);
+        dwServed++;
+    }
+    return dwServed;
+}
+
+static int carrier_svc_pending(CarrierWorker *lpWorker) {
+    uint32_t dwNumShards = atomic_load_explicit(&lpWorker->dwNumShards, memory_order_acquire);
+    for (uint32_t i = 0; i < dwNumShards; i++) {
+        if (carrier_queue_peek(lpWorker->alpShards[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *carrier_svc_thread(void *lpArg) {
+    CarrierWorker *lpWorker = lpArg;
+    CARRIER_SVC *lpSvc = lpWorker->lpSvc;
+    uint32_t dwIdle = 0;
+
+    for (;;) {
+        int bShutdown = atomic_load_explicit(&lpSvc->bShutdown, memory_order_acquire);
+        uint32_t dwNumShards = atomic_load_explicit(&lpWorker->dwNumShards, memory_order_acquire);
+        uint32_t dwServed = 0;
+
+        for (uint32_t i = 0; i < dwNumShards; i++) {
+            dwServed += carrier_svc_serve(lpSvc, lpWorker, lpWorker->alpShards[i]);
+        }
+        if (dwServed) {
+            dwIdle = 0;
+            continue;
+        }
+        if (bShutdown) {
+            break;
+        }
+        if (++dwIdle < CARRIER_SVC_SPIN) {
+            sched_yield();
+            continue;
+        }
+
+        // Announce the sleep before the last look at the queues, submitters check the flag after pushing
+        pthread_mutex_lock(&lpWorker->hLock);
+        atomic_store(&lpWorker->bSleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!carrier_svc_pending(lpWorker) && !atomic_load(&lpSvc->bShutdown)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += CARRIER_SVC_SLEEP_NS;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&lpWorker->hWake, &lpWorker->hLock, &ts);
+        }
+        atomic_store(&lpWorker->bSleeping, 0);
+        pthread_mutex_unlock(&lpWorker->hLock);
+        dwIdle = 0;
+    }
+    return NULL;
+}
+
+static void carrier_svc_wake(CarrierWorker *lpWorker) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&lpWorker->bSleeping)) {
+        pthread_mutex_lock(&lpWorker->hLock);
+        pthread_cond_signal(&lpWorker->hWake);
+        pthread_mutex_unlock(&lpWorker->hLock);
+    }
+}
+
+CARRIER_SVC *carrier_svc_create(uint32_t dwNumWorkers, uint32_t dwFlags, CarrierSvcOutputFn fnOutput, void *lpArg) {
+    cpu_set_t stCpus;
+    int aiCpus[CPU_SETSIZE];
+    int dwNumCpus = 0;
+
+    CPU_ZERO(&stCpus);
+    if (sched_getaffinity(0, sizeof(stCpus), &stCpus) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &stCpus)) {
+                aiCpus[dwNumCpus++] = i;
+            }
+        }
+    }
+    if (dwNumWorkers == 0) {
+        dwNumWorkers = dwNumCpus ? dwNumCpus : 1;
+    }
+    if (dwNumWorkers > CARRIER_SVC_MAX_WORKERS) {
+        dwNumWorkers = CARRIER_SVC_MAX_WORKERS;
+    }
+
+    CARRIER_SVC *lpSvc = calloc(1, sizeof(CARRIER_SVC));
+    if (lpSvc == NULL) {
+        return NULL;
+    }
+    lpSvc->lpWorkers = aligned_alloc(CACHE_LINE, dwNumWorkers * sizeof(CarrierWorker));
+    if (lpSvc->lpWorkers == NULL) {
+        free(lpSvc);
+        return NULL;
+    }
+    memset(lpSvc->lpWorkers, 0, dwNumWorkers * sizeof(CarrierWorker));
+    lpSvc->lpShardArena = hugemem_arena_create(0, 0, -1);
+    if (lpSvc->lpShardArena == NULL) {
+        free(lpSvc->lpWorkers);
+        free(lpSvc);
+        return NULL;
+    }
+    lpSvc->fnOutput = fnOutput;
+    lpSvc->lpArg = lpArg;
+    pthread_mutex_init(&lpSvc->hAddLock, NULL);
+
+    for (uint32_t i = 0; i < dwNumWorkers; i++) {
+        CarrierWorker *lpWorker = &lpSvc->lpWorkers[i];
+        lpWorker->dwIndex = i;
+        lpWorker->lpSvc = lpSvc;
+        pthread_mutex_init(&lpWorker->hLock, NULL);
+        pthread_cond_init(&lpWorker->hWake, NULL);
+
+        if (pthread_create(&lpWorker->hThread, NULL, carrier_svc_thread, lpWorker) != 0) {
+            lpSvc->dwNumWorkers = i;
+            carrier_svc_destroy(lpSvc);
+            return NULL;
+        }
+        lpSvc->dwNumWorkers = i + 1;
+
+        if ((dwFlags & CARRIER_SVC_FLAG_PIN) && dwNumCpus) {
+            cpu_set_t stPin;
+            CPU_ZERO(&stPin);
+            CPU_SET(aiCpus[i % dwNumCpus], &stPin);
+            pthread_setaffinity_np(lpWorker->hThread, sizeof(stPin), &stPin);
+        }
+    }
+    return lpSvc;
+}
+
+void carrier_svc_destroy(CARRIER_SVC *lpSvc) {
+    // Workers drain their queues before they exit
+    atomic_store(&lpSvc->bShutdown, 1);
+    for (uint32_t i = 0; i < lpSvc->dwNumWorkers; i++) {
+        CarrierWorker *lpWorker = &lpSvc->lpWorkers[i];
+        pthread_mutex_lock(&lpWorker->hLock);
+        pthread_cond_signal(&lpWorker->hWake);
+        pthread_mutex_unlock(&lpWorker->hLock);
+        pthread_join(lpWorker->hThread, NULL);
+        pthread_mutex_destroy(&lpWorker->hLock);
+        pthread_cond_destroy(&lpWorker->hWake);
+    }
+    hugemem_arena_destroy(lpSvc->lpShardArena);
+    pthread_mutex_destroy(&lpSvc->hAddLock);
+    free(lpSvc->lpWorkers);
+    free(lpSvc);
+}
+
+int carrier_svc_add_carrier(CARRIER_SVC *lpSvc, const CarrierConfig *lpConfig) {
+    uint8_t abEck[10];
+    CarrierConfig stConfig = *lpConfig;
+
+    if (stConfig.dwTeaType < 1 || stConfig.dwTeaType > 3) {
+        return -1;
+    }
+    uint64_t qwKeyStartNs = lathist_enabled() ? lathist_now_ns() : 0;
+    if (stConfig.bSck) {
+        tb6(stConfig.abKey, stConfig.abCn, stConfig.abSsi, abEck);
+    } else {
+        tb5(stConfig.abCn, stConfig.abLa, &stConfig.bCc, stConfig.abKey, abEck);
+    }
+    if (qwKeyStartNs) {
+        lathist_record(LATHIST_KEY, lathist_now_ns() - qwKeyStartNs);
+    }
+
+    pthread_mutex_lock(&lpSvc->hAddLock);
+    uint32_t dwCarrier = atomic_load(&lpSvc->dwNumCarriers);
+    if (dwCarrier == CARRIER_SVC_MAX_CARRIERS) {
+        pthread_mutex_unlock(&lpSvc->hAddLock);
+        return -1;
+    }
+
+    // Arena memory is zeroed, and only returned when the service is destroyed
+    CarrierShard *alpShards[CARRIER_SVC_TIMESLOTS];
+    for (uint32_t dwTs = 0; dwTs < CARRIER_SVC_TIMESLOTS; dwTs++) {
+        alpShards[dwTs] = hugemem_arena_alloc(lpSvc->lpShardArena, sizeof(CarrierShard));
+        if (alpShards[dwTs] == NULL) {
+            pthread_mutex_unlock(&lpSvc->hAddLock);
+            return -1;
+        }
+        for (uint32_t i = 0; i < CARRIER_SVC_QUEUE_LEN; i++) {
+            atomic_init(&alpShards[dwTs]->astSlots[i].qwSeq, i);
+        }
+        alpShards[dwTs]->dwTeaType = stConfig.dwTeaType;
+        memcpy(alpShards[dwTs]->abEck, abEck, sizeof(abEck));
+    }
+    for (uint32_t dwTs = 0; dwTs < CARRIER_SVC_TIMESLOTS; dwTs++) {
+        CarrierShard *lpShard = alpShards[dwTs];
+        lpShard->dwCarrier = dwCarrier;
+
+        // Consecutive shards go to consecutive workers, so the timeslots of one carrier spread out
+        uint32_t dwShard = dwCarrier * CARRIER_SVC_TIMESLOTS + dwTs;
+        CarrierWorker *lpWorker = &lpSvc->lpWorkers[dwShard % lpSvc->dwNumWorkers];
+        uint32_t dwNumShards = atomic_load_explicit(&lpWorker->dwNumShards, memory_order_relaxed);
+        lpWorker->alpShards[dwNumShards] = lpShard;
+        atomic_store_explicit(&lpWorker->dwNumShards, dwNumShards + 1, memory_order_release);
+        lpSvc->alpShards[dwShard] = lpShard;
+    }
+    atomic_store_explicit(&lpSvc->dwNumCarriers, dwCarrier + 1, memory_order_release);
+    pthread_mutex_unlock(&lpSvc->hAddLock);
+    return dwCarrier;
+}
+
+int carrier_svc_submit(CARRIER_SVC *lpSvc, const CarrierBurst *lpBurst) {
+    const FrameNumbers *lpFn = &lpBurst->stFn;
+
+    if (lpBurst->dwCarrier >= atomic_load_explicit(&lpSvc->dwNumCarriers, memory_order_acquire) ||
+            lpFn->tn < 1 || lpFn->tn > 4 || lpFn->fn < 1 || lpFn->fn > 18 || lpFn->mn < 1 || lpFn->mn > 60 || lpFn->dir > 1 ||
+            lpBurst->dwBitLen > 8 * CARRIER_SVC_MAX_BURST_BYTES ||
+            (uint64_t)lpBurst->dwKsBitOffset + lpBurst->dwBitLen > 8 * CARRIER_SVC_KS_BYTES) {
+        return -1;
+    }
+
+    uint32_t dwShard = lpBurst->dwCarrier * CARRIER_SVC_TIMESLOTS + lpFn->tn - 1;
+    CarrierShard *lpShard = lpSvc->alpShards[dwShard];
+    CarrierBurst stBurst = *lpBurst;
+    stBurst.qwSubmitNs = carrier_svc_now_ns();
+    if (carrier_queue_push(lpShard, &stBurst) != 0) {
+        atomic_fetch_add_explicit(&lpShard->qwDropped, 1, memory_order_relaxed);
+        return -1;
+    }
+    carrier_svc_wake(&lpSvc->lpWorkers[dwShard % lpSvc->dwNumWorkers]);
+    return 0;
+}
+
+void carrier_svc_flush(CARRIER_SVC *lpSvc) {
+    uint32_t dwNumShards = atomic_load_explicit(&lpSvc->dwNumCarriers, memory_order_acquire) * CARRIER_SVC_TIMESLOTS;
+    for (uint32_t i = 0; i < dwNumShards; i++) {
+        CarrierShard *lpShard = lpSvc->alpShards[i];
+        uint64_t qwTarget = atomic_load_explicit(&lpShard->qwTail, memory_order_acquire);
+        while (atomic_load_explicit(&lpShard->qwDone, memory_order_acquire) < qwTarget) {
+            sched_yield();
+        }
+    }
+}
+
+int carrier_svc_get_stats(CARRIER_SVC *lpSvc, uint32_t dwCarrier, CarrierStats *lpStats) {
+    if (dwCarrier >= atomic_load_explicit(&lpSvc->dwNumCarriers, memory_order_acquire)) {
+        return -1;
+    }
+    memset(lpStats, 0, sizeof(*lpStats));
+    for (uint32_t dwTs = 0; dwTs < CARRIER_SVC_TIMESLOTS; dwTs++) {
+        CarrierShard *lpShard = lpSvc->alpShards[dwCarrier * CARRIER_SVC_TIMESLOTS + dwTs];
+        uint64_t qwMax = atomic_load_explicit(&lpShard->qwMaxLatencyNs, memory_order_relaxed);
+        lpStats->qwBursts += atomic_load_explicit(&lpShard->qwBursts, memory_order_relaxed);
+        lpStats->qwDropped += atomic_load_explicit(&lpShard->qwDropped, memory_order_relaxed);
+        lpStats->qwLate += atomic_load_explicit(&lpShard->qwLate, memory_order_relaxed);
+        lpStats->qwSkippedFrames += atomic_load_explicit(&lpShard->qwSkippedFrames, memory_order_relaxed);
+        lpStats->qwTotalLatencyNs += atomic_load_explicit(&lpShard->qwTotalLatencyNs, memory_order_relaxed);
+        lpStats->qwMaxLatencyNs = qwMax > lpStats->qwMaxLatencyNs ? qwMax : lpStats->qwMaxLatencyNs;
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef HAVE_CARRIER_SVC_H
+#define HAVE_CARRIER_SVC_H
+
+#include <inttypes.h>
+
+#include "common.h"
+
+/*
+ * Multi-carrier burst decrypt service. Every carrier is split into one shard
+ * per timeslot; a shard owns its ECK, frame number tracker and keystream
+ * buffer and is only ever touched by the worker thread it was assigned to.
+ * Bursts reach a shard through its own bounded lock-free multi-producer queue,
+ * and workers serve their shards round robin a few bursts at a time, so a
+ * saturated shard fills its own queue without delaying the others.
+ */
+
+#define CARRIER_SVC_MAX_CARRIERS    256
+#define CARRIER_SVC_MAX_WORKERS     256
+#define CARRIER_SVC_QUEUE_LEN       256     // bursts per shard queue, power of 2
+#define CARRIER_SVC_MAX_BURST_BYTES 64      // enough for a 432-bit burst
+#define CARRIER_SVC_FLAG_PIN        1       // pin worker n to the n-th allowed cpu
+
+typedef struct {
+    uint32_t dwTeaType;
+    uint32_t bSck;                      // ECK = tb6(SCK, cn, ssi) instead of tb5(cn, la, cc, CK)
+    uint8_t abCn[2];                    // big endian, as taken by tb5/tb6
+    uint8_t abLa[2];
+    uint8_t bCc;
+    uint8_t abSsi[3];
+    uint8_t abKey[10];                  // CK (CCK or DCK) or SCK
+} CarrierConfig;
+
+/*
+ * One burst. dwBitLen bits of abData are decrypted in place with keystream
+ * bits dwKsBitOffset onwards. With bHnKnown clear the shard's tracker supplies
+ * the hyperframe number from the frames it saw before.
+ */
+typedef struct {
+    uint32_t dwCarrier;
+    FrameNumbers stFn;
+    uint8_t bHnKnown;
+    uint32_t dwKsBitOffset;
+    uint32_t dwBitLen;
+    uint64_t qwTag;                     // passed through for the caller
+    uint64_t qwSubmitNs;                // set by carrier_svc_submit
+    uint8_t abData[CARRIER_SVC_MAX_BURST_BYTES];
+} CarrierBurst;
+
+typedef struct {
+    uint64_t qwBursts;                  // decrypted
+    uint64_t qwDropped;                 // rejected because the shard queue was full
+    uint64_t qwLate;                    // frame numbers older than the last one seen
+    uint64_t qwSkippedFrames;           // frames missing between consecutive bursts
+    uint64_t qwTotalLatencyNs;          // submit to end of decryption
+    uint64_t qwMaxLatencyNs;
+} CarrierStats;
+
+// Called on the worker thread; lpBurst is only valid during the call
+typedef void (*CarrierSvcOutputFn)(void *lpArg, uint32_t dwWorker, const CarrierBurst *lpBurst);
+
+typedef struct CARRIER_SVC CARRIER_SVC;
+
+CARRIER_SVC *carrier_svc_create(uint32_t dwNumWorkers, uint32_t dwFlags, CarrierSvcOutputFn fnOutput, void *lpArg);
+void carrier_svc_destroy(CARRIER_SVC *lpSvc);
+
+// Returns the carrier id, or -1. Carriers can be added while bursts are flowing but never removed.
+int carrier_svc_add_carrier(CARRIER_SVC *lpSvc, const CarrierConfig *lpConfig);
+
+// Returns 0, or -1 if the carrier is unknown, the burst malformed or the shard queue full
+int carrier_svc_submit(CARRIER_SVC *lpSvc, const CarrierBurst *lpBurst);
+
+// Wait until every burst submitted so far has been handed to the output function
+void carrier_svc_flush(CARRIER_SVC *lpSvc);
+
+// Sum over the shards of one carrier
+int carrier_svc_get_stats(CARRIER_SVC *lpSvc, uint32_t dwCarrier, CarrierStats *lpStats);
+
+#endif /* HAVE_CARRIER_SVC_H */
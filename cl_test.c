@@ -0,0 +1,124 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+#include "common.h"
+#include "tea1_search.h"
+#include "tea_cl.h"
+
+// Checks tea.cl against the scalar implementation, e.g. on pocl before trusting it on a GPU host
+
+static void print_result(uint8_t bSuccess) {
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_cl_keystream(TEA_CL *lpCl) {
+    enum { NUM_LANES = 1000, KS_BYTES = TEA1_SEARCH_MAX_KS_BYTES };
+    static uint32_t adwIvs[NUM_LANES];
+    static uint8_t abKeys[NUM_LANES * 10], abOut[NUM_LANES * KS_BYTES];
+
+    srand(1);
+    for (int i = 0; i < NUM_LANES; i++) {
+        adwIvs[i] = ((uint32_t)rand() << 16) ^ rand();
+    }
+    for (int i = 0; i < sizeof(abKeys); i++) {
+        abKeys[i] = rand();
+    }
+
+    for (uint32_t dwTeaType = 1; dwTeaType <= 3; dwTeaType++) {
+        char szTag[40];
+        snprintf(szTag, sizeof(szTag), "OpenCL TEA%u keystream", dwTeaType);
+        printf("Testing %s...%*c", szTag, (int)(40 - strlen(szTag)), ' ');
+
+        // Odd lane count so the last work group is partially idle
+        uint8_t bSuccess = tea_cl_keystream(lpCl, dwTeaType, NUM_LANES - 1, adwIvs, abKeys, KS_BYTES, abOut) == 0;
+        for (int i = 0; bSuccess && i < NUM_LANES - 1; i++) {
+            uint8_t abKs[KS_BYTES];
+            if (dwTeaType == 1) tea1(adwIvs[i], &abKeys[i * 10], KS_BYTES, abKs);
+            if (dwTeaType == 2) tea2(adwIvs[i], &abKeys[i * 10], KS_BYTES, abKs);
+            if (dwTeaType == 3) tea3(adwIvs[i], &abKeys[i * 10], KS_BYTES, abKs);
+            bSuccess &= (memcmp(abKs, &abOut[i * KS_BYTES], KS_BYTES) == 0);
+        }
+        print_result(bSuccess);
+    }
+}
+
+void test_cl_search(TEA_CL *lpCl) {
+    const char *lpTag = "OpenCL TEA1 search";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    FrameNumbers astFn[] = { { 1, 6, 30, 110, 0 }, { 2, 6, 30, 110, 0 } };
+    uint32_t dwKeyReg = 0x00C0FFEE;
+    uint64_t qwStart = dwKeyReg - 10000000, qwEnd = dwKeyReg + 10000000;
+    uint8_t bSuccess = 1;
+
+    // A weak first filter with many hits and a second one narrowing them down, over several kernel passes
+    Tea1Filter astFilters[2] = {
+        { build_iv(&astFn[0]), 2, { 0 }, { 0xFF, 0xFF } },
+        { build_iv(&astFn[1]), 3, { 0 }, { 0xFF, 0xFF, 0xFF } },
+    };
+    for (int i = 0; i < 2; i++) {
+        tea1_inner(tea1_expand_iv(astFilters[i].dwIv), dwKeyReg, astFilters[i].dwNumKsBytes, astFilters[i].abKs);
+        for (int j = 0; j < astFilters[i].dwNumKsBytes; j++) {
+            astFilters[i].abKs[j] &= astFilters[i].abMask[j];
+        }
+    }
+
+    for (uint32_t dwNumFilters = 1; dwNumFilters <= 2; dwNumFilters++) {
+        TEA1_SEARCH_CTX stRef;
+        tea1_search_init_range(&stRef, qwStart, qwEnd);
+        tea1_search_set_filters(&stRef, astFilters, dwNumFilters);
+        tea1_search_run(&stRef, UINT64_MAX);
+
+        uint32_t adwHits[1024];
+        uint64_t qwNumHits = 0;
+        bSuccess &= (tea_cl_search(lpCl, astFilters, dwNumFilters, qwStart, qwEnd, adwHits, 1024, &qwNumHits) == 0);
+        bSuccess &= (qwNumHits == stRef.dwNumHits && qwNumHits >= 1 && qwNumHits <= 1024);
+        bSuccess &= bSuccess && (memcmp(adwHits, stRef.lpdwHits, qwNumHits * sizeof(uint32_t)) == 0);
+
+        // A full hit buffer still reports the total count
+        bSuccess &= (tea_cl_search(lpCl, astFilters, dwNumFilters, qwStart, qwEnd, adwHits, 0, &qwNumHits) == 0);
+        bSuccess &= (qwNumHits == stRef.dwNumHits);
+        tea1_search_free(&stRef);
+    }
+    print_result(bSuccess);
+}
+
+int main(int argc, char **argv) {
+    const char *lpszKernelPath = argc > 1 ? argv[1] : "tea.cl";
+    uint32_t dwPlatform = argc > 2 ? atoi(argv[2]) : 0;
+    uint32_t dwDevice = argc > 3 ? atoi(argv[3]) : 0;
+
+    TEA_CL *lpCl = tea_cl_create(lpszKernelPath, dwPlatform, dwDevice);
+    if (lpCl == NULL) {
+        fprintf(stderr, "Can't set up OpenCL platform %u device %u with %s\n", dwPlatform, dwDevice, lpszKernelPath);
+        return 1;
+    }
+
+    test_cl_keystream(lpCl);
+    test_cl_search(lpCl);
+    tea_cl_destroy(lpCl);
+    return 0;
+}
@@ -1,6 +1,7 @@
 #ifndef HAVE_COMMON_H
 #define HAVE_COMMON_H
 
+#include <inttypes.h>
 
 
 #define rol32(x, n) ((x << n) | (x >> (32 - n)))
@@ -36,6 +37,37 @@ typedef struct {
     uint8_t  dir; // 0 or 1; 0 = downlink, 1 = uplink
 } FrameNumbers;
 
+/*
+ * One logical channel for the teaN_xor_scatter functions: dwBitLen keystream
+ * bits starting at keystream bit dwKsBitOffset are xored into lpBuf starting at
+ * bit dwBitOffset. Bits are numbered MSB first, bit 0 is the top bit of byte 0.
+ */
+typedef struct {
+    uint32_t dwKsBitOffset;
+    uint32_t dwBitOffset;
+    uint32_t dwBitLen;
+    uint8_t *lpBuf;
+} TeaXorSegment;
+
+/*
+ * Key side of the TEA rounds, recorded once per key for the teaN_match_key_stream
+ * functions: sbox output bytes abSboxOut[dwFirst .. dwNumRounds-1] are rounds
+ * 0, 1, ... of the current key, and the key register is the one after the last
+ * recorded round. Sliding the stream by one round turns it into the stream of
+ * the successor key register, so walking a sequence of successive registers
+ * reuses what was recorded for the previous one. Holds enough rounds for
+ * TEA_KEY_STREAM_MAX_KS_BYTES keystream bytes.
+ */
+#define TEA_KEY_STREAM_MAX_KS_BYTES 54
+#define TEA_KEY_STREAM_MAX_ROUNDS   (54 + 19 * (TEA_KEY_STREAM_MAX_KS_BYTES - 1))
+
+typedef struct {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+    uint32_t dwFirst;
+    uint32_t dwNumRounds;
+    uint8_t abSboxOut[2 * TEA_KEY_STREAM_MAX_ROUNDS];
+} TeaKeyStream;
 
 uint32_t build_iv(FrameNumbers *f);
 
@@ -0,0 +1,184 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+
+/*
+ * dudect-style timing leakage test: interleave measurements of a fixed input
+ * class and a random input class, crop outliers and compare both timing
+ * distributions with Welch's t-test. |t| above 4.5 indicates that the timing
+ * depends on the input.
+ */
+
+#define T_THRESHOLD 4.5
+#define BATCH_SIZE  10000
+#define INPUT_LEN   16
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles(void) {
+    _mm_lfence();
+    uint64_t qwTsc = __rdtsc();
+    _mm_lfence();
+    return qwTsc;
+}
+#else
+static inline uint64_t cycles(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+typedef struct {
+    double dN;
+    double dMean;
+    double dM2;
+} Welford;
+
+static void welford_push(Welford *lpW, double x) {
+    lpW->dN += 1;
+    double dDelta = x - lpW->dMean;
+    lpW->dMean += dDelta / lpW->dN;
+    lpW->dM2 += dDelta * (x - lpW->dMean);
+}
+
+static double welch_t(const Welford *a, const Welford *b) {
+    double dVarA = a->dM2 / (a->dN - 1);
+    double dVarB = b->dM2 / (b->dN - 1);
+    return (a->dMean - b->dMean) / sqrt(dVarA / a->dN + dVarB / b->dN);
+}
+
+static uint64_t g_qwRng = 0x9E3779B97F4A7C15ULL;
+static uint64_t rng(void) {
+    g_qwRng ^= g_qwRng << 13;
+    g_qwRng ^= g_qwRng >> 7;
+    g_qwRng ^= g_qwRng << 17;
+    return g_qwRng;
+}
+
+static volatile uint8_t g_bSink;
+
+static void target_newbyte(const uint8_t *lpInput) {
+    g_bSink ^= tea1_state_word_to_newbyte(lpInput[0] | (lpInput[1] << 8), g_awTea1LutA);
+}
+
+static void target_tea1(const uint8_t *lpInput) {
+    uint8_t abKs[8];
+    tea1(0x01234567, lpInput, sizeof(abKs), abKs);
+    g_bSink ^= abKs[7];
+}
+
+static void target_tea2(const uint8_t *lpInput) {
+    uint8_t abKs[8];
+    tea2(0x01234567, (uint8_t *)lpInput, sizeof(abKs), abKs);
+    g_bSink ^= abKs[7];
+}
+
+static void target_tea3(const uint8_t *lpInput) {
+    uint8_t abKs[8];
+    tea3(0x01234567, (uint8_t *)lpInput, sizeof(abKs), abKs);
+    g_bSink ^= abKs[7];
+}
+
+static const struct {
+    const char *lpszName;
+    void (*fnTarget)(const uint8_t *lpInput);
+} g_astTargets[] = {
+    { "tea1_state_word_to_newbyte", target_newbyte },
+    { "tea1 (key)",                 target_tea1 },
+    { "tea2 (key)",                 target_tea2 },
+    { "tea3 (key)",                 target_tea3 },
+};
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double run_target(void (*fnTarget)(const uint8_t *), uint32_t dwNumMeasurements) {
+    static uint8_t aabInputs[BATCH_SIZE][INPUT_LEN];
+    static uint8_t abClasses[BATCH_SIZE];
+    static uint64_t aqwTimes[BATCH_SIZE];
+    Welford astClasses[2];
+    memset(astClasses, 0, sizeof(astClasses));
+
+    // Crop at the 90th percentile of a warmup run to drop interrupts and migrations
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        for (int j = 0; j < INPUT_LEN; j++) {
+            aabInputs[i][j] = rng();
+        }
+    }
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        uint64_t qwStart = cycles();
+        fnTarget(aabInputs[i]);
+        aqwTimes[i] = cycles() - qwStart;
+    }
+    qsort(aqwTimes, BATCH_SIZE, sizeof(uint64_t), cmp_u64);
+    uint64_t qwCrop = aqwTimes[BATCH_SIZE * 9 / 10];
+
+    for (uint32_t dwDone = 0; dwDone < dwNumMeasurements; dwDone += BATCH_SIZE) {
+        // Inputs are prepared up front so both classes run the exact same measurement loop
+        for (int i = 0; i < BATCH_SIZE; i++) {
+            abClasses[i] = rng() & 1;
+            for (int j = 0; j < INPUT_LEN; j++) {
+                aabInputs[i][j] = abClasses[i] ? rng() : 0;
+            }
+        }
+        for (int i = 0; i < BATCH_SIZE; i++) {
+            uint64_t qwStart = cycles();
+            fnTarget(aabInputs[i]);
+            aqwTimes[i] = cycles() - qwStart;
+        }
+        for (int i = 0; i < BATCH_SIZE; i++) {
+            if (aqwTimes[i] <= qwCrop) {
+                welford_push(&astClasses[abClasses[i]], aqwTimes[i]);
+            }
+        }
+    }
+    return welch_t(&astClasses[0], &astClasses[1]);
+}
+
+int main(int argc, const char* argv[]) {
+    uint32_t dwNumMeasurements = 1000000;
+    int bLeak = 0;
+
+    if (argc > 2) {
+        printf("[+] dudect-style constant time test for the TEA filter and keystream\n");
+        printf("    Usage: %s [measurements]\n", argv[0]);
+        exit(1);
+    }
+    if (argc == 2) {
+        dwNumMeasurements = strtoul(argv[1], NULL, 0);
+    }
+
+    for (int i = 0; i < sizeof(g_astTargets) / sizeof(g_astTargets[0]); i++) {
+        double dT = run_target(g_astTargets[i].fnTarget, dwNumMeasurements);
+        int bTargetLeaks = fabs(dT) > T_THRESHOLD;
+        printf("%-30s t = %8.3f  %s\n", g_astTargets[i].lpszName, dT,
+               bTargetLeaks ? "[\x1b[31mLEAK\x1b[0m]" : "[\x1b[32m OK \x1b[0m]");
+        bLeak |= bTargetLeaks;
+    }
+    return bLeak;
+}
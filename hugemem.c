@@ -0,0 +1,303 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "hugemem.h"
+
+#define CACHE_LINE 64
+
+typedef struct {
+    uint32_t dwNumNodes;
+    int aiNodes[HUGEMEM_MAX_NODES];
+    int16_t awCpuNode[HUGEMEM_MAX_CPUS];
+} HugememTopology;
+
+static HugememTopology g_stTopology;
+static pthread_once_t g_hTopologyOnce = PTHREAD_ONCE_INIT;
+
+// Parse a sysfs list like "0-3,8,10-11", calling fnAdd for every member
+static void hugemem_parse_list(const char *lpszPath, void (*fnAdd)(int iValue, void *lpArg), void *lpArg) {
+    char szLine[4096];
+    FILE *fp = fopen(lpszPath, "r");
+    if (fp == NULL) {
+        return;
+    }
+    if (fgets(szLine, sizeof(szLine), fp)) {
+        char *lpszPos = szLine;
+        while (*lpszPos >= '0' && *lpszPos <= '9') {
+            int iFirst = strtol(lpszPos, &lpszPos, 10);
+            int iLast = iFirst;
+            if (*lpszPos == '-') {
+                iLast = strtol(lpszPos + 1, &lpszPos, 10);
+            }
+            for (int i = iFirst; i <= iLast; i++) {
+                fnAdd(i, lpArg);
+            }
+            if (*lpszPos == ',') {
+                lpszPos++;
+            }
+        }
+    }
+    fclose(fp);
+}
+
+static void hugemem_add_node(int iNode, void *lpArg) {
+    if (g_stTopology.dwNumNodes < HUGEMEM_MAX_NODES) {
+        g_stTopology.aiNodes[g_stTopology.dwNumNodes++] = iNode;
+    }
+}
+
+static void hugemem_add_cpu(int iCpu, void *lpArg) {
+    if (iCpu < HUGEMEM_MAX_CPUS) {
+        g_stTopology.awCpuNode[iCpu] = *(int *)lpArg;
+    }
+}
+
+static void hugemem_read_topology(void) {
+    hugemem_parse_list("/sys/devices/system/node/online", hugemem_add_node, NULL);
+    for (uint32_t i = 0; i < g_stTopology.dwNumNodes; i++) {
+        char szPath[64];
+        snprintf(szPath, sizeof(szPath), "/sys/devices/system/node/node%d/cpulist", g_stTopology.aiNodes[i]);
+        hugemem_parse_list(szPath, hugemem_add_cpu, &g_stTopology.aiNodes[i]);
+    }
+    // No sysfs (or no NUMA support): a single node 0 holding every cpu
+    if (g_stTopology.dwNumNodes == 0) {
+        g_stTopology.dwNumNodes = 1;
+    }
+}
+
+uint32_t hugemem_num_nodes(void) {
+    pthread_once(&g_hTopologyOnce, hugemem_read_topology);
+    return g_stTopology.dwNumNodes;
+}
+
+int hugemem_current_node(void) {
+    pthread_once(&g_hTopologyOnce, hugemem_read_topology);
+    int iCpu = sched_getcpu();
+    return iCpu >= 0 && iCpu < HUGEMEM_MAX_CPUS ? g_stTopology.awCpuNode[iCpu] : 0;
+}
+
+const char *hugemem_pages_name(HugememPages ePages) {
+    switch (ePages) {
+        case HUGEMEM_PAGES_THP:     return "thp";
+        case HUGEMEM_PAGES_HUGETLB: return "hugetlb";
+        default:                    return "4k";
+    }
+}
+
+static int hugemem_bind(void *lpBase, size_t qwSize, int iNode) {
+    unsigned long aqwMask[HUGEMEM_MAX_NODES / (8 * sizeof(unsigned long)) + 1] = { 0 };
+    if (iNode < 0 || iNode >= HUGEMEM_MAX_NODES) {
+        return -1;
+    }
+    aqwMask[iNode / (8 * sizeof(unsigned long))] |= 1UL << (iNode % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, lpBase, qwSize, MPOL_BIND, aqwMask, HUGEMEM_MAX_NODES + 1, 0) == 0 ? 0 : -1;
+}
+
+int hugemem_alloc(HugememBlock *lpBlock, size_t qwSize, uint32_t dwFlags, int iNode) {
+    memset(lpBlock, 0, sizeof(*lpBlock));
+    lpBlock->iNode = -1;
+    if (qwSize == 0) {
+        qwSize = 1;
+    }
+    size_t qwHugeSize = (qwSize + HUGEMEM_HUGE_PAGE - 1) & ~(size_t)(HUGEMEM_HUGE_PAGE - 1);
+    void *lpBase = MAP_FAILED;
+
+    // Reserved huge pages only exist if the admin set some aside, so this fails quietly
+    if (dwFlags & HUGEMEM_FLAG_HUGETLB) {
+        lpBase = mmap(NULL, qwHugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (lpBase != MAP_FAILED) {
+            lpBlock->ePages = HUGEMEM_PAGES_HUGETLB;
+            lpBlock->qwSize = qwHugeSize;
+        }
+    }
+
+    if (lpBase == MAP_FAILED && !(dwFlags & HUGEMEM_FLAG_NO_THP) && qwSize >= HUGEMEM_HUGE_PAGE) {
+        // THP only backs 2 MiB aligned ranges, so over-map and trim to alignment
+        uint8_t *lpMap = mmap(NULL, qwHugeSize + HUGEMEM_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (lpMap != MAP_FAILED) {
+            uint8_t *lpAligned = (uint8_t *)(((uintptr_t)lpMap + HUGEMEM_HUGE_PAGE - 1) & ~(uintptr_t)(HUGEMEM_HUGE_PAGE - 1));
+            if (lpAligned > lpMap) {
+                munmap(lpMap, lpAligned - lpMap);
+            }
+            munmap(lpAligned + qwHugeSize, lpMap + HUGEMEM_HUGE_PAGE - lpAligned);
+            lpBase = lpAligned;
+            lpBlock->qwSize = qwHugeSize;
+            lpBlock->ePages = madvise(lpBase, qwHugeSize, MADV_HUGEPAGE) == 0 ? HUGEMEM_PAGES_THP : HUGEMEM_PAGES_SMALL;
+        }
+    }
+
+    if (lpBase == MAP_FAILED) {
+        size_t qwPage = sysconf(_SC_PAGESIZE);
+        lpBlock->qwSize = (qwSize + qwPage - 1) & ~(qwPage - 1);
+        lpBase = mmap(NULL, lpBlock->qwSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (lpBase == MAP_FAILED) {
+            return -1;
+        }
+        lpBlock->ePages = HUGEMEM_PAGES_SMALL;
+    }
+    lpBlock->lpBase = lpBase;
+
+    // Bind before the first touch, pages are placed when they fault in
+    if (iNode >= 0 && hugemem_num_nodes() > 1 && hugemem_bind(lpBase, lpBlock->qwSize, iNode) == 0) {
+        lpBlock->iNode = iNode;
+    }
+    if (dwFlags & HUGEMEM_FLAG_POPULATE) {
+        size_t qwStep = lpBlock->ePages == HUGEMEM_PAGES_SMALL ? (size_t)sysconf(_SC_PAGESIZE) : HUGEMEM_HUGE_PAGE;
+        for (size_t i = 0; i < lpBlock->qwSize; i += qwStep) {
+            ((volatile uint8_t *)lpBase)[i] = 0;
+        }
+    }
+    return 0;
+}
+
+void hugemem_free(HugememBlock *lpBlock) {
+    if (lpBlock->lpBase) {
+        munmap(lpBlock->lpBase, lpBlock->qwSize);
+    }
+    memset(lpBlock, 0, sizeof(*lpBlock));
+    lpBlock->iNode = -1;
+}
+
+typedef struct HugememChunk {
+    struct HugememChunk *lpNext;
+    HugememBlock stBlock;
+} HugememChunk;
+
+struct HUGEMEM_ARENA {
+    size_t qwChunkSize;
+    uint32_t dwFlags;
+    int iNode;
+    HugememChunk *lpChunks;             // most recent first, new allocations come from its tail
+    size_t qwUsed;                      // in the most recent chunk
+};
+
+HUGEMEM_ARENA *hugemem_arena_create(size_t qwChunkSize, uint32_t dwFlags, int iNode) {
+    HUGEMEM_ARENA *lpArena = calloc(1, sizeof(HUGEMEM_ARENA));
+    if (lpArena == NULL) {
+        return NULL;
+    }
+    lpArena->qwChunkSize = qwChunkSize ? qwChunkSize : HUGEMEM_HUGE_PAGE;
+    lpArena->dwFlags = dwFlags;
+    lpArena->iNode = iNode;
+    return lpArena;
+}
+
+static HugememChunk *hugemem_arena_chunk(HUGEMEM_ARENA *lpArena, size_t qwSize) {
+    HugememChunk *lpChunk = malloc(sizeof(HugememChunk));
+    if (lpChunk == NULL) {
+        return NULL;
+    }
+    if (hugemem_alloc(&lpChunk->stBlock, qwSize, lpArena->dwFlags, lpArena->iNode) != 0) {
+        free(lpChunk);
+        return NULL;
+    }
+    return lpChunk;
+}
+
+void *hugemem_arena_alloc(HUGEMEM_ARENA *lpArena, size_t qwSize) {
+    qwSize = (qwSize + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+
+    // Oversized tables get their own block, linked behind the current chunk so it stays in use
+    if (qwSize > lpArena->qwChunkSize) {
+        HugememChunk *lpChunk = hugemem_arena_chunk(lpArena, qwSize);
+        if (lpChunk == NULL) {
+            return NULL;
+        }
+        if (lpArena->lpChunks) {
+            lpChunk->lpNext = lpArena->lpChunks->lpNext;
+            lpArena->lpChunks->lpNext = lpChunk;
+        } else {
+            lpChunk->lpNext = NULL;
+            lpArena->lpChunks = lpChunk;
+            lpArena->qwUsed = lpChunk->stBlock.qwSize;
+        }
+        return lpChunk->stBlock.lpBase;
+    }
+
+    if (lpArena->lpChunks == NULL || lpArena->qwUsed + qwSize > lpArena->lpChunks->stBlock.qwSize) {
+        HugememChunk *lpChunk = hugemem_arena_chunk(lpArena, lpArena->qwChunkSize);
+        if (lpChunk == NULL) {
+            return NULL;
+        }
+        lpChunk->lpNext = lpArena->lpChunks;
+        lpArena->lpChunks = lpChunk;
+        lpArena->qwUsed = 0;
+    }
+    void *lpResult = (uint8_t *)lpArena->lpChunks->stBlock.lpBase + lpArena->qwUsed;
+    lpArena->qwUsed += qwSize;
+    return lpResult;
+}
+
+void hugemem_arena_destroy(HUGEMEM_ARENA *lpArena) {
+    if (lpArena == NULL) {
+        return;
+    }
+    while (lpArena->lpChunks) {
+        HugememChunk *lpChunk = lpArena->lpChunks;
+        lpArena->lpChunks = lpChunk->lpNext;
+        hugemem_free(&lpChunk->stBlock);
+        free(lpChunk);
+    }
+    free(lpArena);
+}
+
+int hugemem_replicate(HugememReplica *lpReplica, const void *lpSrc, size_t qwSize, uint32_t dwFlags) {
+    uint32_t dwNumNodes = hugemem_num_nodes();
+
+    memset(lpReplica, 0, sizeof(*lpReplica));
+    for (uint32_t i = 0; i < dwNumNodes; i++) {
+        // With a single node there is nothing to bind to
+        int iNode = dwNumNodes > 1 ? g_stTopology.aiNodes[i] : -1;
+        HugememBlock *lpCopy = &lpReplica->astCopies[i];
+        if (hugemem_alloc(lpCopy, qwSize, dwFlags & ~HUGEMEM_FLAG_POPULATE, iNode) != 0) {
+            hugemem_replica_free(lpReplica);
+            return -1;
+        }
+        lpReplica->dwNumCopies = i + 1;
+        memcpy(lpCopy->lpBase, lpSrc, qwSize);
+        mprotect(lpCopy->lpBase, lpCopy->qwSize, PROT_READ);
+    }
+    return 0;
+}
+
+const void *hugemem_replica_local(const HugememReplica *lpReplica) {
+    if (lpReplica->dwNumCopies > 1) {
+        int iNode = hugemem_current_node();
+        for (uint32_t i = 0; i < lpReplica->dwNumCopies; i++) {
+            if (lpReplica->astCopies[i].iNode == iNode) {
+                return lpReplica->astCopies[i].lpBase;
+            }
+        }
+    }
+    return lpReplica->astCopies[0].lpBase;
+}
+
+void hugemem_replica_free(HugememReplica *lpReplica) {
+    for (uint32_t i = 0; i < lpReplica->dwNumCopies; i++) {
+        hugemem_free(&lpReplica->astCopies[i]);
+    }
+    lpReplica->dwNumCopies = 0;
+}
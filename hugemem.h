@@ -0,0 +1,68 @@
+#ifndef HAVE_HUGEMEM_H
+#define HAVE_HUGEMEM_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+ * Allocator for large internal tables and buffers. Search loops that hit a
+ * big table at random pay a TLB miss per access with 4 KiB pages, so blocks
+ * are backed by huge pages where the system allows: explicit MAP_HUGETLB pages
+ * if asked for and reserved, otherwise transparent huge pages requested with
+ * madvise on a 2 MiB aligned mapping, otherwise plain pages. Memory is zeroed
+ * and can be bound to a NUMA node. Read-only tables can be replicated once
+ * per node so every worker reads a local copy.
+ */
+
+#define HUGEMEM_HUGE_PAGE       (2 << 20)
+#define HUGEMEM_MAX_NODES       64
+#define HUGEMEM_MAX_CPUS        1024
+
+#define HUGEMEM_FLAG_HUGETLB    1       // try reserved MAP_HUGETLB pages first
+#define HUGEMEM_FLAG_NO_THP     2       // never ask for transparent huge pages
+#define HUGEMEM_FLAG_POPULATE   4       // fault everything in now rather than on first touch
+
+typedef enum {
+    HUGEMEM_PAGES_SMALL,
+    HUGEMEM_PAGES_THP,                  // requested, the kernel may still use small pages
+    HUGEMEM_PAGES_HUGETLB,
+} HugememPages;
+
+typedef struct {
+    void *lpBase;
+    size_t qwSize;                      // mapped size, a multiple of the page size used
+    HugememPages ePages;
+    int iNode;                          // node the memory is bound to, -1 if not bound
+} HugememBlock;
+
+// iNode -1 leaves placement to the kernel. Returns 0, or -1 if no memory could be mapped at all.
+int hugemem_alloc(HugememBlock *lpBlock, size_t qwSize, uint32_t dwFlags, int iNode);
+void hugemem_free(HugememBlock *lpBlock);
+const char *hugemem_pages_name(HugememPages ePages);
+
+// Online NUMA nodes (at least 1), and the node of the cpu the caller runs on
+uint32_t hugemem_num_nodes(void);
+int hugemem_current_node(void);
+
+/*
+ * Bump allocator over huge page backed chunks, for many tables that live
+ * as long as their owner. Allocations are zeroed and cache line aligned;
+ * ones larger than a chunk get a block of their own.
+ */
+typedef struct HUGEMEM_ARENA HUGEMEM_ARENA;
+
+HUGEMEM_ARENA *hugemem_arena_create(size_t qwChunkSize, uint32_t dwFlags, int iNode);
+void *hugemem_arena_alloc(HUGEMEM_ARENA *lpArena, size_t qwSize);
+void hugemem_arena_destroy(HUGEMEM_ARENA *lpArena);
+
+// One copy of a read-only table per node
+typedef struct {
+    uint32_t dwNumCopies;
+    HugememBlock astCopies[HUGEMEM_MAX_NODES];
+} HugememReplica;
+
+int hugemem_replicate(HugememReplica *lpReplica, const void *lpSrc, size_t qwSize, uint32_t dwFlags);
+const void *hugemem_replica_local(const HugememReplica *lpReplica);
+void hugemem_replica_free(HugememReplica *lpReplica);
+
+#endif /* HAVE_HUGEMEM_H */
@@ -15,9 +15,11 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "hurdle.h"
 #include "common.h"
+#include "stats.h"
 
 const uint8_t g_abHurdleSbox[256] = {
     0xF4, 0x65, 0x01, 0x00, 0xBA, 0x7A, 0xA7, 0x47, 0x98, 0xDD, 0x9D, 0xAD, 0x96, 0x5D, 0xAA, 0x3D, 
@@ -46,6 +48,31 @@ static const uint8_t g_abRoundConstant[16] = {
     0x3C, 0xA7, 0xEC, 0x25, 0x79, 0x57, 0xDF, 0xC0, 0x38, 0x0A, 0x33, 0x1E, 0xF3, 0x8C, 0xF4, 0xF7,
 };
 
+// Xor constant of every round key byte, i.e. the accumulated round constants of HURDLE_set_key_fw
+static const uint8_t g_abRoundKeyXor[256] = {
+    // 0      1      2      3      4      5      6      7      8      9     10     11     12     13     14     15
+    0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,   // rk00
+    0x3C,  0xA7,  0xEC,  0x25,  0x79,  0x57,  0xDF,  0xC0,  0x38,  0x0A,  0x33,  0x1E,  0xF3,  0x8C,  0xF4,  0xF7,   // rk01
+    0x6B,  0x78,  0x2C,  0x1D,  0x73,  0x64,  0xC1,  0x33,  0xB4,  0xFE,  0xC4,  0x22,  0x54,  0x60,  0xD1,  0x8E,   // rk02
+    0x58,  0x66,  0xDF,  0x91,  0x87,  0x93,  0xFD,  0x94,  0x58,  0xDB,  0xBD,  0x75,  0x8B,  0xA0,  0xE9,  0x84,   // rk03
+    0xAF,  0x5A,  0x78,  0x7D,  0xA2,  0xEA,  0xAA,  0x4B,  0x98,  0xE3,  0xB7,  0x46,  0x95,  0x53,  0x65,  0x70,   // rk04
+    0x41,  0x05,  0x06,  0x8F,  0x32,  0xCF,  0x3C,  0x77,  0x7E,  0x9F,  0x60,  0x7B,  0x83,  0x23,  0xAE,  0x8F,   // rk05
+    0x4B,  0xD9,  0x73,  0x45,  0x02,  0xD4,  0xFC,  0x6E,  0xB7,  0x4B,  0x36,  0x18,  0x7C,  0xBE,  0x3B,  0xCB,   // rk06
+    0xE8,  0x5B,  0x82,  0x92,  0x32,  0x61,  0xC7,  0xBC,  0x86,  0x31,  0xF8,  0x55,  0x2A,  0xFF,  0xB1,  0xF5,   // rk07
+    0x5D,  0x60,  0x50,  0xA3,  0x48,  0xAF,  0x8A,  0xEA,  0xC7,  0xBB,  0xC6,  0xF6,  0xA8,  0x0E,  0x66,  0xC5,   // rk08
+    0x93,  0x2D,  0x06,  0xE2,  0xC2,  0x91,  0x29,  0x68,  0x36,  0x6C,  0xF6,  0x43,  0x93,  0xDC,  0x57,  0xBF,   // rk09
+    0xAD,  0x8E,  0x84,  0x13,  0x15,  0xA1,  0x9C,  0x53,  0xE4,  0x5D,  0x8C,  0x8D,  0xDE,  0x8A,  0x16,  0x35,   // rk10
+    0x6F,  0x43,  0xB1,  0xA9,  0xF4,  0x89,  0x55,  0xD6,  0x0D,  0xA7,  0xBD,  0x9A,  0xE0,  0x99,  0x55,  0x6B,   // rk11
+    0x95,  0x53,  0x65,  0x70,  0xAF,  0x5A,  0x78,  0x7D,  0xA2,  0xEA,  0xAA,  0x4B,  0x98,  0xE3,  0xB7,  0x46,   // rk12
+    0x66,  0xDF,  0x91,  0x87,  0x93,  0xFD,  0x94,  0x58,  0xDB,  0xBD,  0x75,  0x8B,  0xA0,  0xE9,  0x84,  0x58,   // rk13
+    0xC1,  0x33,  0xB4,  0xFE,  0xC4,  0x22,  0x54,  0x60,  0xD1,  0x8E,  0x6B,  0x78,  0x2C,  0x1D,  0x73,  0x64,   // rk14
+    0x1E,  0xF3,  0x8C,  0xF4,  0xF7,  0x3C,  0xA7,  0xEC,  0x25,  0x79,  0x57,  0xDF,  0xC0,  0x38,  0x0A,  0x33};  // rk15
+
+// Key byte at the start of every round key, i.e. the accumulated rotations
+static const uint8_t g_abRoundKeyOffset[16] = {
+    0, 5, 10, 15, 4, 7, 14, 3, 8, 13, 2, 9, 12, 1, 6, 11
+};
+
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 static const uint32_t g_adwReorder[16] = {
     0x00000000, 0x80000000, 0x00800000, 0x80800000,
@@ -80,6 +107,7 @@ void HURDLE_set_key_fw(uint8_t *k, HURDLE_CTX *lpContextOut) {
 
     /* round key 0 is the actual key */
     int i, j;
+    STATS_COUNT(HURDLE_SET_KEY_FW, 0, 0, 0, 1);
     *(uint32_t *)&lpContextOut->abRoundKeys[0] = *(uint32_t *)&k[0];
     *(uint32_t *)&lpContextOut->abRoundKeys[4] = *(uint32_t *)&k[4];
     *(uint32_t *)&lpContextOut->abRoundKeys[8] = *(uint32_t *)&k[8];
@@ -101,6 +129,8 @@ void HURDLE_set_key_fw(uint8_t *k, HURDLE_CTX *lpContextOut) {
 
 void HURDLE_set_key(uint8_t *k, HURDLE_CTX *lpContextOut) {
 
+    STATS_COUNT(HURDLE_SET_KEY, 0, 0, 0, 1);
+
     // Simplified key schedule by precomputing rotates and xor constants
     uint8_t abKeyBytes[256] = {
         /*  0      1      2      3      4      5      6      7      8      9     10     11     12     13     14     15
@@ -121,28 +151,10 @@ void HURDLE_set_key(uint8_t *k, HURDLE_CTX *lpContextOut) {
         k[ 1], k[ 2], k[ 3], k[ 4], k[ 5], k[ 6], k[ 7], k[ 8], k[ 9], k[10], k[11], k[12], k[13], k[14], k[15], k[ 0], 
         k[ 6], k[ 7], k[ 8], k[ 9], k[10], k[11], k[12], k[13], k[14], k[15], k[ 0], k[ 1], k[ 2], k[ 3], k[ 4], k[ 5], 
         k[11], k[12], k[13], k[14], k[15], k[ 0], k[ 1], k[ 2], k[ 3], k[ 4], k[ 5], k[ 6], k[ 7], k[ 8], k[ 9], k[10]}; 
-    static const uint8_t abKeyXorConsts[256] = {
-        // 0      1      2      3      4      5      6      7      8      9     10     11     12     13     14     15
-        0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,  0x00,   // rk00
-        0x3C,  0xA7,  0xEC,  0x25,  0x79,  0x57,  0xDF,  0xC0,  0x38,  0x0A,  0x33,  0x1E,  0xF3,  0x8C,  0xF4,  0xF7,   // rk01
-        0x6B,  0x78,  0x2C,  0x1D,  0x73,  0x64,  0xC1,  0x33,  0xB4,  0xFE,  0xC4,  0x22,  0x54,  0x60,  0xD1,  0x8E,   // rk02
-        0x58,  0x66,  0xDF,  0x91,  0x87,  0x93,  0xFD,  0x94,  0x58,  0xDB,  0xBD,  0x75,  0x8B,  0xA0,  0xE9,  0x84,   // rk03
-        0xAF,  0x5A,  0x78,  0x7D,  0xA2,  0xEA,  0xAA,  0x4B,  0x98,  0xE3,  0xB7,  0x46,  0x95,  0x53,  0x65,  0x70,   // rk04
-        0x41,  0x05,  0x06,  0x8F,  0x32,  0xCF,  0x3C,  0x77,  0x7E,  0x9F,  0x60,  0x7B,  0x83,  0x23,  0xAE,  0x8F,   // rk05
-        0x4B,  0xD9,  0x73,  0x45,  0x02,  0xD4,  0xFC,  0x6E,  0xB7,  0x4B,  0x36,  0x18,  0x7C,  0xBE,  0x3B,  0xCB,   // rk06
-        0xE8,  0x5B,  0x82,  0x92,  0x32,  0x61,  0xC7,  0xBC,  0x86,  0x31,  0xF8,  0x55,  0x2A,  0xFF,  0xB1,  0xF5,   // rk07
-        0x5D,  0x60,  0x50,  0xA3,  0x48,  0xAF,  0x8A,  0xEA,  0xC7,  0xBB,  0xC6,  0xF6,  0xA8,  0x0E,  0x66,  0xC5,   // rk08
-        0x93,  0x2D,  0x06,  0xE2,  0xC2,  0x91,  0x29,  0x68,  0x36,  0x6C,  0xF6,  0x43,  0x93,  0xDC,  0x57,  0xBF,   // rk09
-        0xAD,  0x8E,  0x84,  0x13,  0x15,  0xA1,  0x9C,  0x53,  0xE4,  0x5D,  0x8C,  0x8D,  0xDE,  0x8A,  0x16,  0x35,   // rk10
-        0x6F,  0x43,  0xB1,  0xA9,  0xF4,  0x89,  0x55,  0xD6,  0x0D,  0xA7,  0xBD,  0x9A,  0xE0,  0x99,  0x55,  0x6B,   // rk11
-        0x95,  0x53,  0x65,  0x70,  0xAF,  0x5A,  0x78,  0x7D,  0xA2,  0xEA,  0xAA,  0x4B,  0x98,  0xE3,  0xB7,  0x46,   // rk12
-        0x66,  0xDF,  0x91,  0x87,  0x93,  0xFD,  0x94,  0x58,  0xDB,  0xBD,  0x75,  0x8B,  0xA0,  0xE9,  0x84,  0x58,   // rk13
-        0xC1,  0x33,  0xB4,  0xFE,  0xC4,  0x22,  0x54,  0x60,  0xD1,  0x8E,  0x6B,  0x78,  0x2C,  0x1D,  0x73,  0x64,   // rk14
-        0x1E,  0xF3,  0x8C,  0xF4,  0xF7,  0x3C,  0xA7,  0xEC,  0x25,  0x79,  0x57,  0xDF,  0xC0,  0x38,  0x0A,  0x33};  // rk15
 
     // Xor original key byte with round- and offset-specific xor byte
     for (int i = 0; i < 256; i++) {
-        lpContextOut->abRoundKeys[i] = abKeyBytes[i] ^ abKeyXorConsts[i];
+        lpContextOut->abRoundKeys[i] = abKeyBytes[i] ^ g_abRoundKeyXor[i];
     }
 
     // The first four bytes of each round key are not used and can be zeroed if desired
@@ -154,34 +166,45 @@ void HURDLE_set_key(uint8_t *k, HURDLE_CTX *lpContextOut) {
     // }
 }
 
+#define PUSH_OUTPUT_NIBBLE(x) do { \
+    dwOutputBits >>= 1; \
+    dwOutputBits |= g_adwReorder[(x) & 0xf]; \
+} while (0);
+
+/*
+ * Round function body, RK(n) evaluates to byte n of the round key. Shared by
+ * the full, compact and on-the-fly key schedules, which only differ in where
+ * the round key bytes come from.
+ */
+#define HURDLE_F_BODY(abOutput, abRhs, RK) do { \
+    uint32_t dwOutputBits = 0; \
+    uint8_t bSboxState = 0; \
+    bSboxState = g_abHurdleSbox[(abRhs[3] + RK(15)) & 0xff]; \
+    bSboxState = g_abHurdleSbox[((abRhs[2] + RK(14)) ^ bSboxState) & 0xff]; \
+    bSboxState = g_abHurdleSbox[((abRhs[1] + RK(13)) ^ bSboxState) & 0xff]; \
+    bSboxState = g_abHurdleSbox[((abRhs[0] + RK(12)) ^ bSboxState) & 0xff]; \
+    bSboxState = g_abHurdleSbox[((abRhs[3] + RK(11)) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); /* dwOutputBits & 0x01010101 */ \
+    bSboxState = g_abHurdleSbox[((abRhs[1] + RK(10)) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); /* dwOutputBits & 0x02020202 */ \
+    bSboxState = g_abHurdleSbox[((abRhs[2] + RK( 9)) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); /* dwOutputBits & 0x04040404 */ \
+    bSboxState = g_abHurdleSbox[((abRhs[0] + RK( 8)) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); /* dwOutputBits & 0x08080808 */ \
+    bSboxState = g_abHurdleSbox[((abRhs[1] + RK( 7)) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); /* dwOutputBits & 0x10101010 */ \
+    bSboxState = g_abHurdleSbox[((abRhs[3] + RK( 6)) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); /* dwOutputBits & 0x20202020 */ \
+    bSboxState = g_abHurdleSbox[((abRhs[0] + RK( 5)) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); /* dwOutputBits & 0x40404040 */ \
+    bSboxState = g_abHurdleSbox[((abRhs[2] + RK( 4)) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); /* dwOutputBits & 0x80808080 */ \
+    *(uint32_t *)abOutput = dwOutputBits; \
+} while (0)
+
 void HURDLE_f(uint8_t abOutput[4], const uint8_t abRhs[4], const uint8_t *lpRoundKey) {
-    #define PUSH_OUTPUT_NIBBLE(x) do { \
-        dwOutputBits >>= 1; \
-        dwOutputBits |= g_adwReorder[(x) & 0xf]; \
-    } while (0);
-
-    uint32_t dwOutputBits = 0;
-    uint8_t bSboxState = 0;
-
-    bSboxState = g_abHurdleSbox[(abRhs[3] + lpRoundKey[15]) & 0xff];
-    bSboxState = g_abHurdleSbox[((abRhs[2] + lpRoundKey[14]) ^ bSboxState) & 0xff];
-    bSboxState = g_abHurdleSbox[((abRhs[1] + lpRoundKey[13]) ^ bSboxState) & 0xff];
-    bSboxState = g_abHurdleSbox[((abRhs[0] + lpRoundKey[12]) ^ bSboxState) & 0xff];
-    bSboxState = g_abHurdleSbox[((abRhs[3] + lpRoundKey[11]) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); // Generates dwOutputBits & 0x01010101
-    bSboxState = g_abHurdleSbox[((abRhs[1] + lpRoundKey[10]) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); // Generates dwOutputBits & 0x02020202
-    bSboxState = g_abHurdleSbox[((abRhs[2] + lpRoundKey[ 9]) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); // Generates dwOutputBits & 0x04040404
-    bSboxState = g_abHurdleSbox[((abRhs[0] + lpRoundKey[ 8]) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); // Generates dwOutputBits & 0x08080808
-    bSboxState = g_abHurdleSbox[((abRhs[1] + lpRoundKey[ 7]) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); // Generates dwOutputBits & 0x10101010
-    bSboxState = g_abHurdleSbox[((abRhs[3] + lpRoundKey[ 6]) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); // Generates dwOutputBits & 0x20202020
-    bSboxState = g_abHurdleSbox[((abRhs[0] + lpRoundKey[ 5]) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); // Generates dwOutputBits & 0x40404040
-    bSboxState = g_abHurdleSbox[((abRhs[2] + lpRoundKey[ 4]) ^ bSboxState) & 0xff]; PUSH_OUTPUT_NIBBLE(bSboxState); // Generates dwOutputBits & 0x80808080
-
-    *(uint32_t *)abOutput = dwOutputBits;
+    STATS_COUNT(HURDLE_F, 0, 1, 0, 0);
+    #define RK_FULL(n) lpRoundKey[n]
+    HURDLE_F_BODY(abOutput, abRhs, RK_FULL);
+    #undef RK_FULL
 }
 
 void HURDLE_encrypt(uint8_t abOutput[8], const uint8_t abInput[8], HURDLE_CTX *lpKey, uint8_t eEncryptMode) {
     uint32_t dwLhs, dwRhs, dwTemp;
     int i;
+    STATS_COUNT(HURDLE_ENCRYPT, 0, 16, 1, 0);
 
     /* start at first/last round key depending on encrypt/decrypt mode */
     uint8_t *lpRoundKey = (eEncryptMode == HURDLE_DECRYPT) ? &lpKey->abRoundKeys[240] : lpKey->abRoundKeys;
@@ -209,16 +232,83 @@ void HURDLE_encrypt(uint8_t abOutput[8], const uint8_t abInput[8], HURDLE_CTX *l
 }
 
 
+void HURDLE_set_key_compact(const uint8_t *k, HURDLE_COMPACT_CTX *lpContextOut) {
+    STATS_COUNT(HURDLE_SET_KEY_COMPACT, 0, 0, 0, 1);
+
+    // Bytes 4..15 of every round key, same values as HURDLE_set_key
+    for (int i = 0; i < 16; i++) {
+        for (int j = 4; j < 16; j++) {
+            lpContextOut->abRoundKeys[i * 12 + j - 4] = k[(g_abRoundKeyOffset[i] + j) & 0xf] ^ g_abRoundKeyXor[i * 16 + j];
+        }
+    }
+}
+
+void HURDLE_encrypt_compact(uint8_t abOutput[8], const uint8_t abInput[8], const HURDLE_COMPACT_CTX *lpKey, uint8_t eEncryptMode) {
+    uint32_t dwLhs, dwRhs, dwTemp;
+    STATS_COUNT(HURDLE_ENCRYPT_COMPACT, 0, 16, 1, 0);
+
+    dwLhs = *(uint32_t *)&abInput[0];
+    dwRhs = *(uint32_t *)&abInput[4];
+
+    for (int i = 0; i < 16; i++) {
+        const uint8_t *lpRoundKey = &lpKey->abRoundKeys[12 * (eEncryptMode == HURDLE_DECRYPT ? 15 - i : i)];
+        const uint8_t *abRhs = (const uint8_t *)&dwRhs;
+        #define RK_COMPACT(n) lpRoundKey[(n) - 4]
+        HURDLE_F_BODY(&dwTemp, abRhs, RK_COMPACT);
+        #undef RK_COMPACT
+
+        dwTemp ^= dwLhs;
+        dwLhs = dwRhs;
+        dwRhs = dwTemp;
+    }
+
+    *(uint32_t *)&abOutput[0] = dwRhs;
+    *(uint32_t *)&abOutput[4] = dwLhs;
+}
+
+void HURDLE_encrypt_otf(uint8_t abOutput[8], const uint8_t abInput[8], const uint8_t abKey[16], uint8_t eEncryptMode) {
+    uint32_t dwLhs, dwRhs, dwTemp;
+    uint8_t abKeyTwice[32];
+    STATS_COUNT(HURDLE_ENCRYPT_OTF, 0, 16, 1, 1);
+
+    // Two copies of the key turn every rotated round key into a plain window
+    memcpy(abKeyTwice, abKey, 16);
+    memcpy(abKeyTwice + 16, abKey, 16);
+
+    dwLhs = *(uint32_t *)&abInput[0];
+    dwRhs = *(uint32_t *)&abInput[4];
+
+    for (int i = 0; i < 16; i++) {
+        int r = (eEncryptMode == HURDLE_DECRYPT) ? 15 - i : i;
+        const uint8_t *lpKeyBytes = &abKeyTwice[g_abRoundKeyOffset[r]];
+        const uint8_t *lpXor = &g_abRoundKeyXor[16 * r];
+        const uint8_t *abRhs = (const uint8_t *)&dwRhs;
+        #define RK_OTF(n) (uint8_t)(lpKeyBytes[n] ^ lpXor[n])
+        HURDLE_F_BODY(&dwTemp, abRhs, RK_OTF);
+        #undef RK_OTF
+
+        dwTemp ^= dwLhs;
+        dwLhs = dwRhs;
+        dwRhs = dwTemp;
+    }
+
+    *(uint32_t *)&abOutput[0] = dwRhs;
+    *(uint32_t *)&abOutput[4] = dwLhs;
+}
+
+
 void HURDLE_enc_cbc(uint8_t abCiphertext[16], const uint8_t abPlaintext[16], uint8_t abKey[16]) {
     // 0x8100a0
     uint8_t abIntermediate[8];
     HURDLE_CTX stCipher;
+    STATS_BEGIN();
 
     HURDLE_set_key(abKey, &stCipher);
     HURDLE_encrypt(abCiphertext, abPlaintext, &stCipher, HURDLE_ENCRYPT);
     *(uint32_t *)&abIntermediate[0] = *(uint32_t *)&abCiphertext[0] ^ *(uint32_t *)&abPlaintext[8];
     *(uint32_t *)&abIntermediate[4] = *(uint32_t *)&abCiphertext[4] ^ *(uint32_t *)&abPlaintext[12];
     HURDLE_encrypt(&abCiphertext[8], abIntermediate, &stCipher, HURDLE_ENCRYPT);
+    STATS_END(HURDLE_ENC_CBC, 0, 32, 2, 1);
 }
 
 
@@ -226,6 +316,7 @@ void HURDLE_dec_cts(uint8_t abPlaintext[15], const uint8_t abCiphertext[15], uin
     // 0x8100a0
     uint8_t abIntermediate[16];
     HURDLE_CTX stCipher;
+    STATS_BEGIN();
     HURDLE_set_key(abKey, &stCipher);
 
     HURDLE_encrypt(&abIntermediate[8], &abCiphertext[7], &stCipher, HURDLE_DECRYPT);
@@ -242,4 +333,5 @@ void HURDLE_dec_cts(uint8_t abPlaintext[15], const uint8_t abCiphertext[15], uin
     *(uint32_t *)&abPlaintext[8]  = *(uint32_t *)&abIntermediate[8];
     *(uint16_t *)&abPlaintext[12] = *(uint16_t *)&abIntermediate[12];
     *(uint8_t  *)&abPlaintext[14] = *(uint8_t  *)&abIntermediate[14];
+    STATS_END(HURDLE_DEC_CTS, 0, 32, 2, 1);
 }
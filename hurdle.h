@@ -7,11 +7,25 @@ typedef struct {
     uint8_t abRoundKeys[256];
 } HURDLE_CTX;
 
+/*
+ * Only bytes 4..15 of every round key are used, so the compact context keeps
+ * 12 bytes per round (192 instead of 256 bytes). The on-the-fly variant needs
+ * no context at all and derives each round key from the 16-byte key with a
+ * byte rotation and an xor, which keeps large batches where every block has a
+ * different key down to 16 bytes of key material per lane.
+ */
+typedef struct {
+    uint8_t abRoundKeys[16 * 12];
+} HURDLE_COMPACT_CTX;
+
 #define HURDLE_ENCRYPT 0
 #define HURDLE_DECRYPT 1
 
 void HURDLE_set_key(uint8_t *k, HURDLE_CTX *lpContextOut);
 void HURDLE_encrypt(uint8_t abOutput[8], const uint8_t abInput[8], HURDLE_CTX *lpKey, uint8_t eEncryptMode);
+void HURDLE_set_key_compact(const uint8_t *k, HURDLE_COMPACT_CTX *lpContextOut);
+void HURDLE_encrypt_compact(uint8_t abOutput[8], const uint8_t abInput[8], const HURDLE_COMPACT_CTX *lpKey, uint8_t eEncryptMode);
+void HURDLE_encrypt_otf(uint8_t abOutput[8], const uint8_t abInput[8], const uint8_t abKey[16], uint8_t eEncryptMode);
 void HURDLE_enc_cbc(uint8_t abCiphertext[16], const uint8_t abPlaintext[16], uint8_t abKey[16]);
 void HURDLE_dec_cts(uint8_t abPlaintext[15], const uint8_t abCiphertext[15], uint8_t abKey[16]);
 
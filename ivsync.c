@@ -0,0 +1,208 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+#include "ivsync.h"
+
+#define IVSYNC_CHUNK        4096        // candidates per workpool chunk
+#define IVSYNC_SLOTS_PER_HN (60 * 18 * 4)
+#define IVSYNC_NUM_SLOTS    ((int64_t)(IVSYNC_HN_MASK + 1) * IVSYNC_SLOTS_PER_HN)
+
+typedef int (*IvsyncMatchFn)(TeaKeyStream *lpStream, uint32_t dwFrameNumbers, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes);
+
+void ivsync_space_all(FrameNumbers *lpMin, FrameNumbers *lpMax) {
+    FrameNumbers stMin = { 1, 1, 1, 0, 0 };
+    FrameNumbers stMax = { 4, 18, 60, IVSYNC_HN_MASK, 1 };
+    *lpMin = stMin;
+    *lpMax = stMax;
+}
+
+void ivsync_advance(const FrameNumbers *lpFn, int64_t qwSlots, FrameNumbers *lpFnOut) {
+    int64_t qwSlot = (((int64_t)(lpFn->hn & IVSYNC_HN_MASK) * 60 + lpFn->mn - 1) * 18 + lpFn->fn - 1) * 4 + lpFn->tn - 1;
+    qwSlot = ((qwSlot + qwSlots) % IVSYNC_NUM_SLOTS + IVSYNC_NUM_SLOTS) % IVSYNC_NUM_SLOTS;
+
+    lpFnOut->dir = lpFn->dir;
+    lpFnOut->tn = qwSlot % 4 + 1;
+    qwSlot /= 4;
+    lpFnOut->fn = qwSlot % 18 + 1;
+    qwSlot /= 18;
+    lpFnOut->mn = qwSlot % 60 + 1;
+    lpFnOut->hn = qwSlot / 60;
+}
+
+static int ivsync_init_common(IVSYNC_CTX *lpCtx, uint32_t dwTeaType, const IvsyncBurst *lpBursts, uint32_t dwNumBursts,
+                              const FrameNumbers *lpMin, const FrameNumbers *lpMax) {
+    if (dwTeaType < 1 || dwTeaType > 3 || dwNumBursts == 0 || dwNumBursts > IVSYNC_MAX_BURSTS) {
+        return -1;
+    }
+    if (    lpMin->tn < 1 || lpMin->tn > lpMax->tn || lpMax->tn > 4 ||
+            lpMin->fn < 1 || lpMin->fn > lpMax->fn || lpMax->fn > 18 ||
+            lpMin->mn < 1 || lpMin->mn > lpMax->mn || lpMax->mn > 60 ||
+            lpMin->hn > lpMax->hn || lpMax->hn > IVSYNC_HN_MASK ||
+            lpMin->dir > lpMax->dir || lpMax->dir > 1) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < dwNumBursts; i++) {
+        if (lpBursts[i].dwNumKsBytes == 0 || lpBursts[i].dwNumKsBytes > IVSYNC_MAX_KS_BYTES) {
+            return -1;
+        }
+    }
+
+    lpCtx->dwTeaType = dwTeaType;
+    memcpy(lpCtx->astBursts, lpBursts, dwNumBursts * sizeof(IvsyncBurst));
+    lpCtx->dwNumBursts = dwNumBursts;
+    lpCtx->stMin = *lpMin;
+    lpCtx->stMax = *lpMax;
+    lpCtx->qwNumCandidates = (uint64_t)(lpMax->tn - lpMin->tn + 1) * (lpMax->fn - lpMin->fn + 1) * (lpMax->mn - lpMin->mn + 1) *
+                             (lpMax->hn - lpMin->hn + 1) * (lpMax->dir - lpMin->dir + 1);
+    return 0;
+}
+
+int ivsync_init(IVSYNC_CTX *lpCtx, uint32_t dwTeaType, const uint8_t *lpKey, const IvsyncBurst *lpBursts, uint32_t dwNumBursts,
+                const FrameNumbers *lpMin, const FrameNumbers *lpMax) {
+    memset(lpCtx, 0, sizeof(*lpCtx));
+    if (ivsync_init_common(lpCtx, dwTeaType, lpBursts, dwNumBursts, lpMin, lpMax) != 0) {
+        return -1;
+    }
+    memcpy(lpCtx->abKey, lpKey, sizeof(lpCtx->abKey));
+    if (dwTeaType == 1) {
+        lpCtx->dwKeyReg = tea1_init_key_register(lpKey);
+    }
+    return 0;
+}
+
+int ivsync_init_tea1_reg(IVSYNC_CTX *lpCtx, uint32_t dwKeyReg, const IvsyncBurst *lpBursts, uint32_t dwNumBursts,
+                         const FrameNumbers *lpMin, const FrameNumbers *lpMax) {
+    memset(lpCtx, 0, sizeof(*lpCtx));
+    if (ivsync_init_common(lpCtx, 1, lpBursts, dwNumBursts, lpMin, lpMax) != 0) {
+        return -1;
+    }
+    lpCtx->dwKeyReg = dwKeyReg;
+    return 0;
+}
+
+void ivsync_free(IVSYNC_CTX *lpCtx) {
+    free(lpCtx->lpHits);
+    lpCtx->lpHits = NULL;
+    lpCtx->dwNumHits = 0;
+    lpCtx->dwHitsCapacity = 0;
+}
+
+int ivsync_done(const IVSYNC_CTX *lpCtx) {
+    return lpCtx->qwNextIndex >= lpCtx->qwNumCandidates;
+}
+
+static void ivsync_candidate(const IVSYNC_CTX *lpCtx, uint64_t qwIndex, FrameNumbers *lpFnOut) {
+    const FrameNumbers *lpMin = &lpCtx->stMin;
+    const FrameNumbers *lpMax = &lpCtx->stMax;
+
+    lpFnOut->tn = lpMin->tn + qwIndex % (lpMax->tn - lpMin->tn + 1);
+    qwIndex /= lpMax->tn - lpMin->tn + 1;
+    lpFnOut->fn = lpMin->fn + qwIndex % (lpMax->fn - lpMin->fn + 1);
+    qwIndex /= lpMax->fn - lpMin->fn + 1;
+    lpFnOut->mn = lpMin->mn + qwIndex % (lpMax->mn - lpMin->mn + 1);
+    qwIndex /= lpMax->mn - lpMin->mn + 1;
+    lpFnOut->hn = lpMin->hn + qwIndex % (lpMax->hn - lpMin->hn + 1);
+    qwIndex /= lpMax->hn - lpMin->hn + 1;
+    lpFnOut->dir = lpMin->dir + qwIndex;
+}
+
+/*
+ * Test candidates [qwBegin, qwEnd), appending hits. Returns the index of the
+ * first candidate not fully processed, which is qwEnd unless storing a hit
+ * failed.
+ */
+static uint64_t ivsync_scan(const IVSYNC_CTX *lpCtx, uint64_t qwBegin, uint64_t qwEnd,
+                            void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity) {
+    IvsyncMatchFn fnMatch = lpCtx->dwTeaType == 1 ? tea1_match_key_stream : lpCtx->dwTeaType == 2 ? tea2_match_key_stream : tea3_match_key_stream;
+    TeaKeyStream stStream;
+
+    // The key never changes, so its side of the rounds is recorded once for the whole range
+    switch (lpCtx->dwTeaType) {
+        case 1: tea1_key_stream_init(&stStream, lpCtx->dwKeyReg); break;
+        case 2: tea2_key_stream_init(&stStream, lpCtx->abKey); break;
+        case 3: tea3_key_stream_init(&stStream, lpCtx->abKey); break;
+    }
+
+    for (uint64_t qwIndex = qwBegin; qwIndex < qwEnd; qwIndex++) {
+        IvsyncHit stHit = { qwIndex };
+        ivsync_candidate(lpCtx, qwIndex, &stHit.stFn);
+
+        uint32_t b;
+        for (b = 0; b < lpCtx->dwNumBursts; b++) {
+            const IvsyncBurst *lpBurst = &lpCtx->astBursts[b];
+            FrameNumbers stBurstFn;
+            ivsync_advance(&stHit.stFn, lpBurst->dwSlotOffset, &stBurstFn);
+            if (!fnMatch(&stStream, build_iv(&stBurstFn), lpBurst->abKs, lpBurst->abMask, lpBurst->dwNumKsBytes)) {
+                break;
+            }
+        }
+        if (b == lpCtx->dwNumBursts && workpool_hits_append(lppHits, lpdwNum, lpdwCapacity, &stHit, sizeof(stHit))) {
+            return qwIndex;
+        }
+    }
+    return qwEnd;
+}
+
+uint64_t ivsync_run(IVSYNC_CTX *lpCtx, uint64_t qwMaxCandidates) {
+    uint64_t qwBegin = lpCtx->qwNextIndex;
+    uint64_t qwEnd = lpCtx->qwNumCandidates;
+
+    if (qwEnd - qwBegin > qwMaxCandidates) {
+        qwEnd = qwBegin + qwMaxCandidates;
+    }
+
+    // A candidate has at most one hit, so one that failed to store is simply retried
+    uint64_t qwStop = ivsync_scan(lpCtx, qwBegin, qwEnd, &lpCtx->lpHits, &lpCtx->dwNumHits, &lpCtx->dwHitsCapacity);
+    lpCtx->qwNextIndex = qwStop;
+    return qwStop - qwBegin;
+}
+
+static int ivsync_collect(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd,
+                          void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity) {
+    return ivsync_scan(lpArg, qwBegin, qwEnd, lppHits, lpdwNum, lpdwCapacity) == qwEnd ? 0 : -1;
+}
+
+static int ivsync_cmp_hit(const void *a, const void *b) {
+    const IvsyncHit *x = a;
+    const IvsyncHit *y = b;
+    return (x->qwIndex > y->qwIndex) - (x->qwIndex < y->qwIndex);
+}
+
+uint64_t ivsync_run_parallel(IVSYNC_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxCandidates) {
+    uint64_t qwBegin = lpCtx->qwNextIndex;
+    uint64_t qwEnd = lpCtx->qwNumCandidates;
+
+    if (qwEnd - qwBegin > qwMaxCandidates) {
+        qwEnd = qwBegin + qwMaxCandidates;
+    }
+    if (qwBegin >= qwEnd) {
+        return 0;
+    }
+
+    // A stopped or failed pass is discarded and rescanned later
+    if (workpool_run_collect(lpPool, qwBegin, qwEnd, IVSYNC_CHUNK, ivsync_collect, lpCtx,
+                             &lpCtx->lpHits, &lpCtx->dwNumHits, &lpCtx->dwHitsCapacity, sizeof(IvsyncHit), ivsync_cmp_hit)) {
+        return 0;
+    }
+    lpCtx->qwNextIndex = qwEnd;
+    return qwEnd - qwBegin;
+}
@@ -0,0 +1,77 @@
+#ifndef HAVE_IVSYNC_H
+#define HAVE_IVSYNC_H
+
+#include <inttypes.h>
+
+#include "common.h"
+#include "workpool.h"
+
+/*
+ * Frame number synchronization for a known key: find the (hn, mn, fn, tn, dir)
+ * under which one or more bursts with known keystream bits were encrypted.
+ * Bursts are placed relative to the first one in timeslots, so a candidate
+ * for the first burst fixes the frame numbers of all others; a candidate is
+ * rejected at the first mismatching keystream byte of the first burst that
+ * fails. The key side of the rounds is generated once per worker and shared
+ * by every IV it tests.
+ *
+ * The candidates are the frame numbers of the first burst between stMin and
+ * stMax, every field ranging independently. The IV only holds 15 bits of hn,
+ * so hn is searched in 0 .. 0x7FFF and found modulo 0x8000. The whole space
+ * is about 2^28 IVs; fixing the fields that are known (usually tn and dir,
+ * often mn and fn from the sync bursts) shrinks it accordingly.
+ */
+
+#define IVSYNC_MAX_BURSTS   8
+#define IVSYNC_MAX_KS_BYTES TEA_KEY_STREAM_MAX_KS_BYTES
+#define IVSYNC_HN_MASK      0x7FFF
+
+typedef struct {
+    int32_t dwSlotOffset;               // timeslots after the first burst, negative if before; 0 for the first
+    uint32_t dwNumKsBytes;
+    uint8_t abKs[IVSYNC_MAX_KS_BYTES];  // known keystream bits, see Tea1Filter
+    uint8_t abMask[IVSYNC_MAX_KS_BYTES];
+} IvsyncBurst;
+
+typedef struct {
+    uint64_t qwIndex;                   // candidate index
+    FrameNumbers stFn;                  // of the first burst
+} IvsyncHit;
+
+/*
+ * Candidates [0, qwNumCandidates) enumerate the space with tn varying fastest,
+ * then fn, mn, hn and dir; [0, qwNextIndex) have been tested. Hits are kept in
+ * candidate order.
+ */
+typedef struct {
+    uint32_t dwTeaType;
+    uint8_t abKey[10];
+    uint32_t dwKeyReg;                  // TEA1 only
+    IvsyncBurst astBursts[IVSYNC_MAX_BURSTS];
+    uint32_t dwNumBursts;
+    FrameNumbers stMin;
+    FrameNumbers stMax;
+    uint64_t qwNumCandidates;
+    uint64_t qwNextIndex;
+    IvsyncHit *lpHits;
+    uint32_t dwNumHits;
+    uint32_t dwHitsCapacity;
+} IVSYNC_CTX;
+
+// Returns 0, or -1 if the TEA type, the burst count or a field range is invalid
+int ivsync_init(IVSYNC_CTX *lpCtx, uint32_t dwTeaType, const uint8_t *lpKey, const IvsyncBurst *lpBursts, uint32_t dwNumBursts,
+                const FrameNumbers *lpMin, const FrameNumbers *lpMax);
+// TEA1 with only the reduced 32-bit key register known
+int ivsync_init_tea1_reg(IVSYNC_CTX *lpCtx, uint32_t dwKeyReg, const IvsyncBurst *lpBursts, uint32_t dwNumBursts,
+                         const FrameNumbers *lpMin, const FrameNumbers *lpMax);
+void ivsync_free(IVSYNC_CTX *lpCtx);
+uint64_t ivsync_run(IVSYNC_CTX *lpCtx, uint64_t qwMaxCandidates);
+uint64_t ivsync_run_parallel(IVSYNC_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxCandidates);
+int ivsync_done(const IVSYNC_CTX *lpCtx);
+
+// Full range of every field, to narrow down before ivsync_init
+void ivsync_space_all(FrameNumbers *lpMin, FrameNumbers *lpMax);
+// Frame numbers dwSlots timeslots after lpFn (before if negative), hn wrapping at 0x8000
+void ivsync_advance(const FrameNumbers *lpFn, int64_t qwSlots, FrameNumbers *lpFnOut);
+
+#endif /* HAVE_IVSYNC_H */
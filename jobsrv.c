@@ -0,0 +1,1138 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "common.h"
+#include "ivsync.h"
+#include "jobsrv.h"
+#include "tea1.h"
+#include "tea1_search.h"
+#include "workpool.h"
+
+#define JOBSRV_POLL_MS          50      // lease expiry and shutdown latency
+#define JOBSRV_IDLE_MS          100     // worker back-off while every job is leased out
+#define JOBSRV_RECV_TIMEOUT_MS  1000    // a client taking longer to send one message is dropped
+#define JOBSRV_SEND_TIMEOUT_MS  5000    // a client taking longer to read one reply is dropped
+#define JOBSRV_RECV_CHUNK       65536   // payload buffer growth, so a bogus length costs nothing up front
+#define JOBSRV_MAX_MSG          (64 << 20)
+#define JOBSRV_RATE_SECONDS     8       // job throughput window
+#define JOBSRV_PRECOMPUTE_CHUNK 1024
+
+#define JOBSRV_CMD_SUBMIT       1
+#define JOBSRV_CMD_STATUS       2
+#define JOBSRV_CMD_HITS         3
+#define JOBSRV_CMD_REMOVE       4
+#define JOBSRV_CMD_LEASE        5
+#define JOBSRV_CMD_REPORT       6
+
+// Results of JOBSRV_CMD_LEASE besides -1
+#define JOBSRV_LEASE_GRANTED    0
+#define JOBSRV_LEASE_RETRY      1       // every running job is leased out, leases may still expire
+#define JOBSRV_LEASE_IDLE       2       // no running job
+
+/*
+ * Wire format, host byte order since both ends run on the same machine or
+ * the same build: a JobsrvMsgHeader followed by dwLen payload bytes, in both
+ * directions. A reply starts with an int32 result.
+ */
+typedef struct {
+    uint32_t dwCmd;
+    uint32_t dwLen;
+} JobsrvMsgHeader;
+
+typedef struct {
+    int32_t iJob;
+    uint32_t dwMaxHits;
+    uint64_t qwFirst;
+} JobsrvHitsRequest;
+
+typedef struct {
+    int32_t iResult;
+    JobsrvJobStatus stStatus;
+} JobsrvStatusReply;
+
+typedef struct {
+    int32_t iResult;
+    uint32_t dwJob;
+    uint64_t qwLeaseId;
+    uint64_t qwBegin;
+    uint64_t qwEnd;
+    uint32_t dwMaxHits;                 // hits the report may carry
+    JobsrvJob stJob;
+} JobsrvLeaseReply;
+
+typedef struct {
+    uint64_t qwLeaseId;
+    uint64_t qwElapsedNs;
+    uint32_t dwNumHits;
+    uint32_t bTruncated;                // the lease found more hits than it may report
+} JobsrvReport;                         // followed by the hits
+
+typedef struct {
+    uint64_t qwBegin;
+    uint64_t qwEnd;
+} JobsrvRange;
+
+typedef struct {
+    int bUsed;
+    uint32_t eState;
+    JobsrvJob stJob;
+    uint64_t qwNext;                    // first unit never leased
+    JobsrvRange *lpReclaimed;           // ranges of expired leases, handed out first
+    uint32_t dwNumReclaimed;
+    uint32_t dwReclaimedCapacity;
+    uint64_t qwUnitsDone;
+    uint32_t dwActiveLeases;
+    JobsrvHit *lpHits;
+    uint64_t qwNumHits;
+    uint64_t qwHitsCapacity;
+    uint64_t aqwRateUnits[JOBSRV_RATE_SECONDS];
+    uint64_t aqwRateSecond[JOBSRV_RATE_SECONDS];
+    uint64_t qwStartNs;
+} JobsrvJobSlot;
+
+typedef struct {
+    uint64_t qwId;                      // 0 if the slot is free
+    uint32_t dwJob;
+    uint32_t dwClient;
+    uint64_t qwBegin;
+    uint64_t qwEnd;
+    uint64_t qwDeadlineNs;
+} JobsrvLeaseSlot;
+
+/*
+ * Client sockets are non-blocking and each message is assembled across polls,
+ * so a client dripping its request or not reading its reply only holds its
+ * own connection, until the deadline drops it. The next request is read once
+ * the previous reply is out.
+ */
+typedef struct {
+    int fd;
+    int bWorker;
+    double dUnitsPerSec;                // measured on the worker's reports, 0 before the first
+
+    JobsrvMsgHeader stInHeader;
+    uint8_t *lpInPayload;
+    uint32_t dwInCapacity;
+    uint32_t dwInGot;                   // header and payload bytes received
+    uint64_t qwInStartNs;               // first byte of the message, 0 between messages
+
+    uint8_t *lpOut;                     // reply not fully sent yet, NULL if none
+    uint32_t dwOutLen;
+    uint32_t dwOutSent;
+    uint64_t qwOutStartNs;
+} JobsrvConn;
+
+struct JOBSRV_SERVER {
+    JobsrvConfig stConfig;
+    int fdListen;
+    char szSocketPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    pthread_t hThread;
+    int bThreadStarted;
+    atomic_int bShutdown;
+
+    // Only the server thread touches these
+    JobsrvJobSlot astJobs[JOBSRV_MAX_JOBS];
+    JobsrvLeaseSlot astLeases[JOBSRV_MAX_LEASES];
+    JobsrvConn astConns[JOBSRV_MAX_CLIENTS];
+    uint64_t qwNextLeaseId;
+
+    _Atomic uint64_t qwLeases;
+    _Atomic uint64_t qwExpired;
+    _Atomic uint64_t qwLateReports;
+    _Atomic uint64_t qwUnitsDone;
+    _Atomic uint32_t dwWorkers;
+};
+
+struct JOBSRV_CLIENT {
+    int fd;
+    char szOutputDir[sizeof(((JobsrvJob *)0)->stPrecompute.szPath)];
+};
+
+static uint64_t jobsrv_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Socket helpers
+ */
+
+// "/path" or "./path" is a Unix socket, "host:port" TCP with a numeric host or localhost
+static int jobsrv_address(const char *lpszAddress, struct sockaddr_storage *lpAddr, socklen_t *lpdwLen) {
+    memset(lpAddr, 0, sizeof(*lpAddr));
+    if (strchr(lpszAddress, '/')) {
+        struct sockaddr_un *lpUnix = (struct sockaddr_un *)lpAddr;
+        if (strlen(lpszAddress) >= sizeof(lpUnix->sun_path)) {
+            return -1;
+        }
+        lpUnix->sun_family = AF_UNIX;
+        strcpy(lpUnix->sun_path, lpszAddress);
+        *lpdwLen = sizeof(*lpUnix);
+        return 0;
+    }
+
+    char szHost[64];
+    const char *lpszPort = strrchr(lpszAddress, ':');
+    if (lpszPort == NULL || lpszPort - lpszAddress >= sizeof(szHost) || atoi(lpszPort + 1) <= 0 || atoi(lpszPort + 1) > 65535) {
+        return -1;
+    }
+    memcpy(szHost, lpszAddress, lpszPort - lpszAddress);
+    szHost[lpszPort - lpszAddress] = 0;
+
+    struct sockaddr_in *lpInet = (struct sockaddr_in *)lpAddr;
+    lpInet->sin_family = AF_INET;
+    lpInet->sin_port = htons(atoi(lpszPort + 1));
+    if (inet_pton(AF_INET, strcmp(szHost, "localhost") ? szHost : "127.0.0.1", &lpInet->sin_addr) != 1) {
+        return -1;
+    }
+    *lpdwLen = sizeof(*lpInet);
+    return 0;
+}
+
+static int jobsrv_recv_all(int fd, void *lpBuf, size_t qwLen) {
+    uint8_t *lpPos = lpBuf;
+    while (qwLen) {
+        ssize_t iRecv = recv(fd, lpPos, qwLen, 0);
+        if (iRecv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (iRecv <= 0) {
+            return -1;
+        }
+        lpPos += iRecv;
+        qwLen -= iRecv;
+    }
+    return 0;
+}
+
+// One sendmsg per message, so a peer never sees a small message only partly written
+static int jobsrv_send_msg(int fd, uint32_t dwCmd, const void *lpHead, uint32_t dwHeadLen, const void *lpTail, uint32_t dwTailLen) {
+    JobsrvMsgHeader stHeader = { dwCmd, dwHeadLen + dwTailLen };
+    struct iovec astIov[3] = { { &stHeader, sizeof(stHeader) }, { (void *)lpHead, dwHeadLen }, { (void *)lpTail, dwTailLen } };
+    struct msghdr stMsg;
+    memset(&stMsg, 0, sizeof(stMsg));
+    stMsg.msg_iov = astIov;
+    stMsg.msg_iovlen = 3;
+
+    while (stMsg.msg_iovlen) {
+        ssize_t iSent = sendmsg(fd, &stMsg, MSG_NOSIGNAL);
+        if (iSent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (iSent <= 0) {
+            return -1;
+        }
+        while (stMsg.msg_iovlen && (size_t)iSent >= stMsg.msg_iov->iov_len) {
+            iSent -= stMsg.msg_iov->iov_len;
+            stMsg.msg_iov++;
+            stMsg.msg_iovlen--;
+        }
+        if (stMsg.msg_iovlen) {
+            stMsg.msg_iov->iov_base = (uint8_t *)stMsg.msg_iov->iov_base + iSent;
+            stMsg.msg_iov->iov_len -= iSent;
+        }
+    }
+    return 0;
+}
+
+// Receives a message into a malloc'd buffer, NULL if the connection failed or the message is too long
+static void *jobsrv_recv_msg(int fd, JobsrvMsgHeader *lpHeader) {
+    if (jobsrv_recv_all(fd, lpHeader, sizeof(*lpHeader)) || lpHeader->dwLen > JOBSRV_MAX_MSG) {
+        return NULL;
+    }
+    void *lpPayload = malloc(lpHeader->dwLen ? lpHeader->dwLen : 1);
+    if (lpPayload && jobsrv_recv_all(fd, lpPayload, lpHeader->dwLen)) {
+        free(lpPayload);
+        return NULL;
+    }
+    return lpPayload;
+}
+
+/*
+ * Server
+ */
+
+// A PRECOMPUTE path comes off the wire, so it has to stay inside the worker's output directory
+static int jobsrv_path_ok(const char *lpszPath) {
+    if (lpszPath[0] == 0 || lpszPath[0] == '/') {
+        return 0;
+    }
+    for (const char *lpszPart = lpszPath; lpszPart; lpszPart = strchr(lpszPart, '/') ? strchr(lpszPart, '/') + 1 : NULL) {
+        if (!strncmp(lpszPart, "..", 2) && (lpszPart[2] == '/' || lpszPart[2] == 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int jobsrv_validate(JobsrvJob *lpJob) {
+    switch (lpJob->eType) {
+    case JOBSRV_TEA1_SEARCH:
+        if (lpJob->stSearch.dwNumFilters == 0 || lpJob->stSearch.dwNumFilters > TEA1_SEARCH_MAX_FILTERS) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < lpJob->stSearch.dwNumFilters; i++) {
+            if (lpJob->stSearch.astFilters[i].dwNumKsBytes == 0 || lpJob->stSearch.astFilters[i].dwNumKsBytes > TEA1_SEARCH_MAX_KS_BYTES) {
+                return -1;
+            }
+        }
+        break;
+    case JOBSRV_PRECOMPUTE:
+        if (lpJob->stPrecompute.dwNumKsBytes == 0 || lpJob->stPrecompute.dwNumKsBytes > TEA1_SEARCH_MAX_KS_BYTES ||
+                !memchr(lpJob->stPrecompute.szPath, 0, sizeof(lpJob->stPrecompute.szPath)) || !jobsrv_path_ok(lpJob->stPrecompute.szPath)) {
+            return -1;
+        }
+        break;
+    case JOBSRV_IVSYNC: {
+        // The candidate count follows from the ranges
+        IVSYNC_CTX stCtx;
+        if (ivsync_init(&stCtx, lpJob->stIvsync.dwTeaType, lpJob->stIvsync.abKey, lpJob->stIvsync.astBursts, lpJob->stIvsync.dwNumBursts,
+                        &lpJob->stIvsync.stMin, &lpJob->stIvsync.stMax) != 0) {
+            return -1;
+        }
+        lpJob->qwNumUnits = stCtx.qwNumCandidates;
+        lpJob->qwStartKey = 0;
+        ivsync_free(&stCtx);
+        return 0;
+    }
+    default:
+        return -1;
+    }
+    if (lpJob->qwNumUnits == 0 || lpJob->qwStartKey >= TEA1_SEARCH_KEYSPACE || lpJob->qwNumUnits > TEA1_SEARCH_KEYSPACE - lpJob->qwStartKey) {
+        return -1;
+    }
+    return 0;
+}
+
+static int jobsrv_reclaim(JobsrvJobSlot *lpJob, uint64_t qwBegin, uint64_t qwEnd) {
+    if (lpJob->dwNumReclaimed == lpJob->dwReclaimedCapacity) {
+        uint32_t dwCapacity = lpJob->dwReclaimedCapacity ? lpJob->dwReclaimedCapacity * 2 : 16;
+        JobsrvRange *lpRanges = realloc(lpJob->lpReclaimed, dwCapacity * sizeof(JobsrvRange));
+        if (lpRanges == NULL) {
+            return -1;
+        }
+        lpJob->lpReclaimed = lpRanges;
+        lpJob->dwReclaimedCapacity = dwCapacity;
+    }
+    JobsrvRange stRange = { qwBegin, qwEnd };
+    lpJob->lpReclaimed[lpJob->dwNumReclaimed++] = stRange;
+    return 0;
+}
+
+// Hand the lease's range back to its job; a job that was removed meanwhile doesn't want it
+static void jobsrv_drop_lease(JOBSRV_SERVER *lpServer, JobsrvLeaseSlot *lpLease, int bReclaim) {
+    JobsrvJobSlot *lpJob = &lpServer->astJobs[lpLease->dwJob];
+    if (lpJob->bUsed) {
+        lpJob->dwActiveLeases--;
+        if (bReclaim && jobsrv_reclaim(lpJob, lpLease->qwBegin, lpLease->qwEnd) != 0) {
+            // Out of memory: rewind the cursor instead, which redoes some finished work
+            lpJob->qwNext = lpJob->qwNext < lpLease->qwBegin ? lpJob->qwNext : lpLease->qwBegin;
+        }
+    }
+    lpLease->qwId = 0;
+}
+
+static void jobsrv_free_job(JobsrvJobSlot *lpJob) {
+    free(lpJob->lpReclaimed);
+    free(lpJob->lpHits);
+    memset(lpJob, 0, sizeof(*lpJob));
+}
+
+static int jobsrv_has_work(const JobsrvJobSlot *lpJob) {
+    return lpJob->bUsed && lpJob->eState == JOBSRV_RUNNING && (lpJob->dwNumReclaimed || lpJob->qwNext < lpJob->stJob.qwNumUnits);
+}
+
+static int32_t jobsrv_lease(JOBSRV_SERVER *lpServer, uint32_t dwClient, JobsrvLeaseReply *lpReply) {
+    JobsrvConn *lpConn = &lpServer->astConns[dwClient];
+    int iJob = -1, iRunning = 0;
+
+    if (!lpConn->bWorker) {
+        lpConn->bWorker = 1;
+        atomic_fetch_add(&lpServer->dwWorkers, 1);
+    }
+
+    // Highest priority first; among equals the job with the fewest leases out, so they share the workers
+    for (int i = 0; i < JOBSRV_MAX_JOBS; i++) {
+        JobsrvJobSlot *lpJob = &lpServer->astJobs[i];
+        iRunning |= lpJob->bUsed && lpJob->eState == JOBSRV_RUNNING;
+        if (!jobsrv_has_work(lpJob)) {
+            continue;
+        }
+        if (iJob < 0 || lpJob->stJob.dwPriority > lpServer->astJobs[iJob].stJob.dwPriority ||
+                (lpJob->stJob.dwPriority == lpServer->astJobs[iJob].stJob.dwPriority &&
+                 lpJob->dwActiveLeases < lpServer->astJobs[iJob].dwActiveLeases)) {
+            iJob = i;
+        }
+    }
+    int iSlot = -1;
+    for (int i = 0; i < JOBSRV_MAX_LEASES && iSlot < 0; i++) {
+        iSlot = lpServer->astLeases[i].qwId == 0 ? i : -1;
+    }
+    if (iJob < 0 || iSlot < 0) {
+        return iRunning ? JOBSRV_LEASE_RETRY : JOBSRV_LEASE_IDLE;
+    }
+
+    // Sized to last about dwLeaseMs at the rate this worker reported so far
+    JobsrvJobSlot *lpJob = &lpServer->astJobs[iJob];
+    uint64_t qwSize = lpConn->dUnitsPerSec * lpServer->stConfig.dwLeaseMs / 1000;
+    qwSize = qwSize < lpServer->stConfig.qwMinLeaseUnits ? lpServer->stConfig.qwMinLeaseUnits : qwSize;
+    qwSize = qwSize > lpServer->stConfig.qwMaxLeaseUnits ? lpServer->stConfig.qwMaxLeaseUnits : qwSize;
+
+    JobsrvLeaseSlot *lpLease = &lpServer->astLeases[iSlot];
+    if (lpJob->dwNumReclaimed) {
+        JobsrvRange *lpRange = &lpJob->lpReclaimed[lpJob->dwNumReclaimed - 1];
+        lpLease->qwBegin = lpRange->qwBegin;
+        if (lpRange->qwEnd - lpRange->qwBegin > qwSize) {
+            lpRange->qwBegin += qwSize;
+        } else {
+            lpJob->dwNumReclaimed--;
+        }
+        lpLease->qwEnd = lpLease->qwBegin + qwSize < lpRange->qwEnd ? lpLease->qwBegin + qwSize : lpRange->qwEnd;
+    } else {
+        lpLease->qwBegin = lpJob->qwNext;
+        lpLease->qwEnd = lpJob->stJob.qwNumUnits - lpJob->qwNext > qwSize ? lpJob->qwNext + qwSize : lpJob->stJob.qwNumUnits;
+        lpJob->qwNext = lpLease->qwEnd;
+    }
+    lpLease->qwId = ++lpServer->qwNextLeaseId;
+    lpLease->dwJob = iJob;
+    lpLease->dwClient = dwClient;
+    lpLease->qwDeadlineNs = jobsrv_now_ns() + lpServer->stConfig.dwLeaseTimeoutMs * 1000000ULL;
+    lpJob->dwActiveLeases++;
+    atomic_fetch_add(&lpServer->qwLeases, 1);
+
+    lpReply->dwJob = iJob;
+    lpReply->qwLeaseId = lpLease->qwId;
+    lpReply->qwBegin = lpLease->qwBegin;
+    lpReply->qwEnd = lpLease->qwEnd;
+    lpReply->dwMaxHits = lpServer->stConfig.dwMaxReportHits;
+    lpReply->stJob = lpJob->stJob;
+    return JOBSRV_LEASE_GRANTED;
+}
+
+static int32_t jobsrv_report(JOBSRV_SERVER *lpServer, uint32_t dwClient, const JobsrvReport *lpReport, const JobsrvHit *lpHits) {
+    JobsrvLeaseSlot *lpLease = NULL;
+    for (int i = 0; i < JOBSRV_MAX_LEASES && lpLease == NULL; i++) {
+        lpLease = lpServer->astLeases[i].qwId == lpReport->qwLeaseId ? &lpServer->astLeases[i] : NULL;
+    }
+    if (lpLease == NULL || lpLease->dwClient != dwClient) {
+        // Expired and handed out again, or the job is gone
+        atomic_fetch_add(&lpServer->qwLateReports, 1);
+        return 1;
+    }
+
+    JobsrvJobSlot *lpJob = &lpServer->astJobs[lpLease->dwJob];
+    if (lpJob->qwNumHits + lpReport->dwNumHits > lpJob->qwHitsCapacity) {
+        uint64_t qwCapacity = lpJob->qwHitsCapacity ? lpJob->qwHitsCapacity : 16;
+        while (qwCapacity < lpJob->qwNumHits + lpReport->dwNumHits) {
+            qwCapacity *= 2;
+        }
+        JobsrvHit *lpNewHits = realloc(lpJob->lpHits, qwCapacity * sizeof(JobsrvHit));
+        if (lpNewHits == NULL) {
+            jobsrv_drop_lease(lpServer, lpLease, 1);
+            return -1;
+        }
+        lpJob->lpHits = lpNewHits;
+        lpJob->qwHitsCapacity = qwCapacity;
+    }
+    memcpy(&lpJob->lpHits[lpJob->qwNumHits], lpHits, lpReport->dwNumHits * sizeof(JobsrvHit));
+    lpJob->qwNumHits += lpReport->dwNumHits;
+
+    // Filters this weak would fail every lease the same way; the job stops with the hits so far
+    if (lpReport->bTruncated) {
+        lpJob->eState = JOBSRV_FAILED;
+        for (int i = 0; i < JOBSRV_MAX_LEASES; i++) {
+            if (lpServer->astLeases[i].qwId && lpServer->astLeases[i].dwJob == lpLease->dwJob) {
+                jobsrv_drop_lease(lpServer, &lpServer->astLeases[i], 0);
+            }
+        }
+        return 0;
+    }
+
+    uint64_t qwUnits = lpLease->qwEnd - lpLease->qwBegin;
+    uint64_t qwSecond = jobsrv_now_ns() / 1000000000ULL;
+    uint32_t dwBucket = qwSecond % JOBSRV_RATE_SECONDS;
+    if (lpJob->aqwRateSecond[dwBucket] != qwSecond) {
+        lpJob->aqwRateSecond[dwBucket] = qwSecond;
+        lpJob->aqwRateUnits[dwBucket] = 0;
+    }
+    lpJob->aqwRateUnits[dwBucket] += qwUnits;
+    lpJob->qwUnitsDone += qwUnits;
+    if (lpJob->qwUnitsDone >= lpJob->stJob.qwNumUnits) {
+        lpJob->eState = JOBSRV_DONE;
+    }
+    atomic_fetch_add(&lpServer->qwUnitsDone, qwUnits);
+
+    // The next lease of this worker is sized from a running average of its rate
+    JobsrvConn *lpConn = &lpServer->astConns[dwClient];
+    double dRate = qwUnits * 1e9 / (lpReport->qwElapsedNs ? lpReport->qwElapsedNs : 1);
+    lpConn->dUnitsPerSec = lpConn->dUnitsPerSec ? (lpConn->dUnitsPerSec + dRate) / 2 : dRate;
+
+    jobsrv_drop_lease(lpServer, lpLease, 0);
+    return 0;
+}
+
+static void jobsrv_status(JOBSRV_SERVER *lpServer, const JobsrvJobSlot *lpJob, JobsrvJobStatus *lpStatus) {
+    uint64_t qwNow = jobsrv_now_ns();
+    uint64_t qwSecond = qwNow / 1000000000ULL;
+    uint64_t qwUnits = 0;
+
+    // Units reported over the last full seconds of the window, or since the job started
+    for (int i = 0; i < JOBSRV_RATE_SECONDS; i++) {
+        if (lpJob->aqwRateSecond[i] + JOBSRV_RATE_SECONDS > qwSecond) {
+            qwUnits += lpJob->aqwRateUnits[i];
+        }
+    }
+    double dWindow = (qwNow - lpJob->qwStartNs) / 1e9;
+    dWindow = dWindow > JOBSRV_RATE_SECONDS ? JOBSRV_RATE_SECONDS : dWindow;
+
+    lpStatus->eState = lpJob->eState;
+    lpStatus->qwUnitsDone = lpJob->qwUnitsDone;
+    lpStatus->qwNumUnits = lpJob->stJob.qwNumUnits;
+    lpStatus->qwNumHits = lpJob->qwNumHits;
+    lpStatus->dwActiveLeases = lpJob->dwActiveLeases;
+    lpStatus->qwUnitsPerSec = dWindow > 0 ? qwUnits / dWindow : 0;
+}
+
+static void jobsrv_disconnect(JOBSRV_SERVER *lpServer, uint32_t dwClient) {
+    JobsrvConn *lpConn = &lpServer->astConns[dwClient];
+
+    // A worker that went away won't report its leases, so they are handed out again right away
+    for (int i = 0; i < JOBSRV_MAX_LEASES; i++) {
+        if (lpServer->astLeases[i].qwId && lpServer->astLeases[i].dwClient == dwClient) {
+            jobsrv_drop_lease(lpServer, &lpServer->astLeases[i], 1);
+            atomic_fetch_add(&lpServer->qwExpired, 1);
+        }
+    }
+    if (lpConn->bWorker) {
+        atomic_fetch_sub(&lpServer->dwWorkers, 1);
+    }
+    close(lpConn->fd);
+    free(lpConn->lpInPayload);
+    free(lpConn->lpOut);
+    memset(lpConn, 0, sizeof(*lpConn));
+    lpConn->fd = -1;
+}
+
+// Reads what has arrived of the current request; returns 1 once it is complete, 0 if more is to come, -1 if the connection failed or the message is too long
+static int jobsrv_conn_recv(JobsrvConn *lpConn) {
+    for (;;) {
+        uint8_t *lpBuf;
+        size_t qwWant;
+        if (lpConn->dwInGot < sizeof(JobsrvMsgHeader)) {
+            lpBuf = (uint8_t *)&lpConn->stInHeader + lpConn->dwInGot;
+            qwWant = sizeof(JobsrvMsgHeader) - lpConn->dwInGot;
+        } else {
+            uint32_t dwPayloadGot = lpConn->dwInGot - sizeof(JobsrvMsgHeader);
+            if (dwPayloadGot == lpConn->stInHeader.dwLen) {
+                return 1;
+            }
+            if (dwPayloadGot == lpConn->dwInCapacity) {
+                uint32_t dwCapacity = lpConn->dwInCapacity * 2 > JOBSRV_RECV_CHUNK ? lpConn->dwInCapacity * 2 : JOBSRV_RECV_CHUNK;
+                dwCapacity = dwCapacity < lpConn->stInHeader.dwLen ? dwCapacity : lpConn->stInHeader.dwLen;
+                uint8_t *lpPayload = realloc(lpConn->lpInPayload, dwCapacity);
+                if (lpPayload == NULL) {
+                    return -1;
+                }
+                lpConn->lpInPayload = lpPayload;
+                lpConn->dwInCapacity = dwCapacity;
+            }
+            lpBuf = lpConn->lpInPayload + dwPayloadGot;
+            qwWant = lpConn->dwInCapacity - dwPayloadGot;
+        }
+
+        ssize_t iRecv = recv(lpConn->fd, lpBuf, qwWant, MSG_DONTWAIT);
+        if (iRecv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (iRecv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (iRecv <= 0) {
+            return -1;
+        }
+        if (lpConn->dwInGot == 0) {
+            lpConn->qwInStartNs = jobsrv_now_ns();
+        }
+        lpConn->dwInGot += iRecv;
+        if (lpConn->dwInGot == sizeof(JobsrvMsgHeader) && lpConn->stInHeader.dwLen > JOBSRV_MAX_MSG) {
+            return -1;
+        }
+    }
+}
+
+// Ready for the next request; a large payload buffer is not kept around
+static void jobsrv_conn_recv_reset(JobsrvConn *lpConn) {
+    if (lpConn->dwInCapacity > JOBSRV_RECV_CHUNK) {
+        free(lpConn->lpInPayload);
+        lpConn->lpInPayload = NULL;
+        lpConn->dwInCapacity = 0;
+    }
+    lpConn->dwInGot = 0;
+    lpConn->qwInStartNs = 0;
+}
+
+// Sends as much of the pending reply as the socket takes; returns -1 if the connection failed
+static int jobsrv_conn_flush(JobsrvConn *lpConn) {
+    while (lpConn->dwOutSent < lpConn->dwOutLen) {
+        ssize_t iSent = send(lpConn->fd, lpConn->lpOut + lpConn->dwOutSent, lpConn->dwOutLen - lpConn->dwOutSent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (iSent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (iSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (iSent <= 0) {
+            return -1;
+        }
+        lpConn->dwOutSent += iSent;
+    }
+    free(lpConn->lpOut);
+    lpConn->lpOut = NULL;
+    lpConn->dwOutLen = 0;
+    lpConn->dwOutSent = 0;
+    lpConn->qwOutStartNs = 0;
+    return 0;
+}
+
+// Queues a reply and starts sending it; returns -1 if the connection has to be dropped
+static int jobsrv_conn_reply(JobsrvConn *lpConn, uint32_t dwCmd, const void *lpHead, uint32_t dwHeadLen, const void *lpTail, uint32_t dwTailLen) {
+    JobsrvMsgHeader stHeader = { dwCmd, dwHeadLen + dwTailLen };
+    lpConn->lpOut = malloc(sizeof(stHeader) + stHeader.dwLen);
+    if (lpConn->lpOut == NULL) {
+        return -1;
+    }
+    memcpy(lpConn->lpOut, &stHeader, sizeof(stHeader));
+    memcpy(lpConn->lpOut + sizeof(stHeader), lpHead, dwHeadLen);
+    if (dwTailLen) {
+        memcpy(lpConn->lpOut + sizeof(stHeader) + dwHeadLen, lpTail, dwTailLen);
+    }
+    lpConn->dwOutLen = sizeof(stHeader) + stHeader.dwLen;
+    lpConn->dwOutSent = 0;
+    lpConn->qwOutStartNs = jobsrv_now_ns();
+    return jobsrv_conn_flush(lpConn);
+}
+
+// Returns -1 if the connection has to be dropped
+static int jobsrv_command(JOBSRV_SERVER *lpServer, uint32_t dwClient, const JobsrvMsgHeader *lpHeader, const void *lpPayload) {
+    JobsrvConn *lpConn = &lpServer->astConns[dwClient];
+    int32_t iResult = -1;
+
+    switch (lpHeader->dwCmd) {
+    case JOBSRV_CMD_SUBMIT: {
+        JobsrvJob stJob;
+        if (lpHeader->dwLen != sizeof(JobsrvJob)) {
+            return -1;
+        }
+        memcpy(&stJob, lpPayload, sizeof(stJob));
+        for (int i = 0; i < JOBSRV_MAX_JOBS && iResult < 0; i++) {
+            iResult = lpServer->astJobs[i].bUsed ? -1 : i;
+        }
+        if (iResult >= 0 && jobsrv_validate(&stJob) == 0) {
+            JobsrvJobSlot *lpJob = &lpServer->astJobs[iResult];
+            memset(lpJob, 0, sizeof(*lpJob));
+            lpJob->bUsed = 1;
+            lpJob->eState = JOBSRV_RUNNING;
+            lpJob->stJob = stJob;
+            lpJob->qwStartNs = jobsrv_now_ns();
+        } else {
+            iResult = -1;
+        }
+        return jobsrv_conn_reply(lpConn, lpHeader->dwCmd, &iResult, sizeof(iResult), NULL, 0);
+    }
+    case JOBSRV_CMD_STATUS:
+    case JOBSRV_CMD_REMOVE: {
+        int32_t iJob;
+        if (lpHeader->dwLen != sizeof(iJob)) {
+            return -1;
+        }
+        memcpy(&iJob, lpPayload, sizeof(iJob));
+        JobsrvJobSlot *lpJob = iJob >= 0 && iJob < JOBSRV_MAX_JOBS && lpServer->astJobs[iJob].bUsed ? &lpServer->astJobs[iJob] : NULL;
+        if (lpHeader->dwCmd == JOBSRV_CMD_STATUS) {
+            JobsrvStatusReply stReply;
+            memset(&stReply, 0, sizeof(stReply));
+            stReply.iResult = lpJob ? 0 : -1;
+            if (lpJob) {
+                jobsrv_status(lpServer, lpJob, &stReply.stStatus);
+            }
+            return jobsrv_conn_reply(lpConn, lpHeader->dwCmd, &stReply, sizeof(stReply), NULL, 0);
+        }
+        if (lpJob) {
+            // Leases still out become late reports
+            for (int i = 0; i < JOBSRV_MAX_LEASES; i++) {
+                if (lpServer->astLeases[i].qwId && lpServer->astLeases[i].dwJob == iJob) {
+                    lpServer->astLeases[i].qwId = 0;
+                }
+            }
+            jobsrv_free_job(lpJob);
+            iResult = 0;
+        }
+        return jobsrv_conn_reply(lpConn, lpHeader->dwCmd, &iResult, sizeof(iResult), NULL, 0);
+    }
+    case JOBSRV_CMD_HITS: {
+        JobsrvHitsRequest stRequest;
+        if (lpHeader->dwLen != sizeof(stRequest)) {
+            return -1;
+        }
+        memcpy(&stRequest, lpPayload, sizeof(stRequest));
+        const JobsrvJobSlot *lpJob = NULL;
+        if (stRequest.iJob >= 0 && stRequest.iJob < JOBSRV_MAX_JOBS && lpServer->astJobs[stRequest.iJob].bUsed) {
+            lpJob = &lpServer->astJobs[stRequest.iJob];
+        }
+        if (lpJob) {
+            uint64_t qwAvail = stRequest.qwFirst < lpJob->qwNumHits ? lpJob->qwNumHits - stRequest.qwFirst : 0;
+            uint32_t dwMax = stRequest.dwMaxHits < JOBSRV_MAX_HITS_REPLY ? stRequest.dwMaxHits : JOBSRV_MAX_HITS_REPLY;
+            iResult = qwAvail < dwMax ? qwAvail : dwMax;
+        }
+        return jobsrv_conn_reply(lpConn, lpHeader->dwCmd, &iResult, sizeof(iResult),
+                                 iResult > 0 ? &lpJob->lpHits[stRequest.qwFirst] : NULL, iResult > 0 ? iResult * sizeof(JobsrvHit) : 0);
+    }
+    case JOBSRV_CMD_LEASE: {
+        JobsrvLeaseReply stReply;
+        memset(&stReply, 0, sizeof(stReply));
+        stReply.iResult = jobsrv_lease(lpServer, dwClient, &stReply);
+        return jobsrv_conn_reply(lpConn, lpHeader->dwCmd, &stReply, sizeof(stReply), NULL, 0);
+    }
+    case JOBSRV_CMD_REPORT: {
+        JobsrvReport stReport;
+        if (lpHeader->dwLen < sizeof(stReport)) {
+            return -1;
+        }
+        memcpy(&stReport, lpPayload, sizeof(stReport));
+        if (lpHeader->dwLen != sizeof(stReport) + (uint64_t)stReport.dwNumHits * sizeof(JobsrvHit) ||
+                stReport.dwNumHits > lpServer->stConfig.dwMaxReportHits) {
+            return -1;
+        }
+        iResult = jobsrv_report(lpServer, dwClient, &stReport, (const JobsrvHit *)((const uint8_t *)lpPayload + sizeof(stReport)));
+        return jobsrv_conn_reply(lpConn, lpHeader->dwCmd, &iResult, sizeof(iResult), NULL, 0);
+    }
+    }
+    return -1;
+}
+
+static void jobsrv_expire(JOBSRV_SERVER *lpServer) {
+    uint64_t qwNow = jobsrv_now_ns();
+    for (int i = 0; i < JOBSRV_MAX_LEASES; i++) {
+        JobsrvLeaseSlot *lpLease = &lpServer->astLeases[i];
+        if (lpLease->qwId && lpLease->qwDeadlineNs < qwNow) {
+            jobsrv_drop_lease(lpServer, lpLease, 1);
+            atomic_fetch_add(&lpServer->qwExpired, 1);
+        }
+    }
+}
+
+static void *jobsrv_server_thread(void *lpArg) {
+    JOBSRV_SERVER *lpServer = lpArg;
+    struct pollfd astPoll[JOBSRV_MAX_CLIENTS + 1];
+
+    while (!atomic_load(&lpServer->bShutdown)) {
+        astPoll[0].fd = lpServer->fdListen;
+        astPoll[0].events = POLLIN;
+        for (uint32_t i = 0; i < JOBSRV_MAX_CLIENTS; i++) {
+            astPoll[i + 1].fd = lpServer->astConns[i].fd;
+            astPoll[i + 1].events = lpServer->astConns[i].lpOut ? POLLOUT : POLLIN;
+            astPoll[i + 1].revents = 0;
+        }
+        astPoll[0].revents = 0;
+        poll(astPoll, JOBSRV_MAX_CLIENTS + 1, JOBSRV_POLL_MS);
+        jobsrv_expire(lpServer);
+
+        for (uint32_t i = 0; i < JOBSRV_MAX_CLIENTS; i++) {
+            JobsrvConn *lpConn = &lpServer->astConns[i];
+            int iResult = 0;
+            if (lpConn->fd < 0) {
+                continue;
+            }
+            if (lpConn->lpOut && astPoll[i + 1].revents) {
+                iResult = jobsrv_conn_flush(lpConn);
+            } else if (astPoll[i + 1].revents) {
+                iResult = jobsrv_conn_recv(lpConn);
+                if (iResult == 1) {
+                    iResult = jobsrv_command(lpServer, i, &lpConn->stInHeader, lpConn->lpInPayload);
+                    jobsrv_conn_recv_reset(lpConn);
+                }
+            }
+
+            // Deadlines are per message, however the bytes trickle in or out
+            uint64_t qwNow = jobsrv_now_ns();
+            if ((lpConn->qwInStartNs && qwNow - lpConn->qwInStartNs > JOBSRV_RECV_TIMEOUT_MS * 1000000ULL) ||
+                    (lpConn->lpOut && qwNow - lpConn->qwOutStartNs > JOBSRV_SEND_TIMEOUT_MS * 1000000ULL)) {
+                iResult = -1;
+            }
+            if (iResult < 0) {
+                jobsrv_disconnect(lpServer, i);
+            }
+        }
+
+        if (astPoll[0].revents & POLLIN) {
+            int fdClient = accept4(lpServer->fdListen, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fdClient < 0) {
+                continue;
+            }
+            uint32_t i = 0;
+            while (i < JOBSRV_MAX_CLIENTS && lpServer->astConns[i].fd >= 0) {
+                i++;
+            }
+            if (i == JOBSRV_MAX_CLIENTS) {
+                close(fdClient);
+                continue;
+            }
+            int iOne = 1;
+            setsockopt(fdClient, IPPROTO_TCP, TCP_NODELAY, &iOne, sizeof(iOne));
+            memset(&lpServer->astConns[i], 0, sizeof(JobsrvConn));
+            lpServer->astConns[i].fd = fdClient;
+        }
+    }
+    return NULL;
+}
+
+JOBSRV_SERVER *jobsrv_server_create(const char *lpszAddress, const JobsrvConfig *lpConfig) {
+    struct sockaddr_storage stAddr;
+    socklen_t dwAddrLen;
+
+    if (jobsrv_address(lpszAddress, &stAddr, &dwAddrLen) != 0) {
+        return NULL;
+    }
+    // Anyone who can connect can make the workers write files, so the server stays on this machine
+    if (stAddr.ss_family == AF_INET && ntohl(((struct sockaddr_in *)&stAddr)->sin_addr.s_addr) >> 24 != 127) {
+        errno = EADDRNOTAVAIL;
+        return NULL;
+    }
+    JOBSRV_SERVER *lpServer = calloc(1, sizeof(JOBSRV_SERVER));
+    if (lpServer == NULL) {
+        return NULL;
+    }
+    if (lpConfig) {
+        lpServer->stConfig = *lpConfig;
+    }
+    JobsrvConfig *lpCfg = &lpServer->stConfig;
+    lpCfg->dwLeaseMs = lpCfg->dwLeaseMs ? lpCfg->dwLeaseMs : 2000;
+    lpCfg->dwLeaseTimeoutMs = lpCfg->dwLeaseTimeoutMs ? lpCfg->dwLeaseTimeoutMs : 30000;
+    lpCfg->qwMinLeaseUnits = lpCfg->qwMinLeaseUnits ? lpCfg->qwMinLeaseUnits : 4096;
+    lpCfg->qwMaxLeaseUnits = lpCfg->qwMaxLeaseUnits ? lpCfg->qwMaxLeaseUnits : TEA1_SEARCH_KEYSPACE;
+    lpCfg->dwMaxReportHits = lpCfg->dwMaxReportHits && lpCfg->dwMaxReportHits < JOBSRV_MAX_REPORT_HITS ?
+                             lpCfg->dwMaxReportHits : JOBSRV_MAX_REPORT_HITS;
+    for (uint32_t i = 0; i < JOBSRV_MAX_CLIENTS; i++) {
+        lpServer->astConns[i].fd = -1;
+    }
+
+    lpServer->fdListen = socket(stAddr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (stAddr.ss_family == AF_UNIX) {
+        strcpy(lpServer->szSocketPath, ((struct sockaddr_un *)&stAddr)->sun_path);
+        unlink(lpServer->szSocketPath);
+    } else {
+        int iOne = 1;
+        setsockopt(lpServer->fdListen, SOL_SOCKET, SO_REUSEADDR, &iOne, sizeof(iOne));
+    }
+    if (lpServer->fdListen < 0 || bind(lpServer->fdListen, (struct sockaddr *)&stAddr, dwAddrLen) != 0 ||
+            listen(lpServer->fdListen, 64) != 0) {
+        lpServer->szSocketPath[0] = 0;
+        jobsrv_server_destroy(lpServer);
+        return NULL;
+    }
+
+    if (pthread_create(&lpServer->hThread, NULL, jobsrv_server_thread, lpServer) != 0) {
+        jobsrv_server_destroy(lpServer);
+        return NULL;
+    }
+    lpServer->bThreadStarted = 1;
+    return lpServer;
+}
+
+void jobsrv_server_destroy(JOBSRV_SERVER *lpServer) {
+    atomic_store(&lpServer->bShutdown, 1);
+    if (lpServer->bThreadStarted) {
+        pthread_join(lpServer->hThread, NULL);
+    }
+    for (uint32_t i = 0; i < JOBSRV_MAX_CLIENTS; i++) {
+        if (lpServer->astConns[i].fd >= 0) {
+            close(lpServer->astConns[i].fd);
+        }
+        free(lpServer->astConns[i].lpInPayload);
+        free(lpServer->astConns[i].lpOut);
+    }
+    if (lpServer->fdListen >= 0) {
+        close(lpServer->fdListen);
+        if (lpServer->szSocketPath[0]) {
+            unlink(lpServer->szSocketPath);
+        }
+    }
+    for (uint32_t i = 0; i < JOBSRV_MAX_JOBS; i++) {
+        jobsrv_free_job(&lpServer->astJobs[i]);
+    }
+    free(lpServer);
+}
+
+void jobsrv_server_get_stats(JOBSRV_SERVER *lpServer, JobsrvStats *lpStats) {
+    lpStats->qwLeases = atomic_load(&lpServer->qwLeases);
+    lpStats->qwExpired = atomic_load(&lpServer->qwExpired);
+    lpStats->qwLateReports = atomic_load(&lpServer->qwLateReports);
+    lpStats->qwUnitsDone = atomic_load(&lpServer->qwUnitsDone);
+    lpStats->dwWorkers = atomic_load(&lpServer->dwWorkers);
+}
+
+/*
+ * Client
+ */
+
+JOBSRV_CLIENT *jobsrv_client_connect(const char *lpszAddress) {
+    struct sockaddr_storage stAddr;
+    socklen_t dwAddrLen;
+
+    if (jobsrv_address(lpszAddress, &stAddr, &dwAddrLen) != 0) {
+        return NULL;
+    }
+    JOBSRV_CLIENT *lpClient = calloc(1, sizeof(JOBSRV_CLIENT));
+    if (lpClient == NULL) {
+        return NULL;
+    }
+    strcpy(lpClient->szOutputDir, ".");
+    lpClient->fd = socket(stAddr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lpClient->fd < 0 || connect(lpClient->fd, (struct sockaddr *)&stAddr, dwAddrLen) != 0) {
+        jobsrv_client_close(lpClient);
+        return NULL;
+    }
+    int iOne = 1;
+    setsockopt(lpClient->fd, IPPROTO_TCP, TCP_NODELAY, &iOne, sizeof(iOne));
+    return lpClient;
+}
+
+void jobsrv_client_close(JOBSRV_CLIENT *lpClient) {
+    if (lpClient->fd >= 0) {
+        close(lpClient->fd);
+    }
+    free(lpClient);
+}
+
+// Round trip; the reply payload is copied to lpReply up to dwReplyLen, the rest to lpTail. Returns the reply length or -1.
+static int64_t jobsrv_client_call(JOBSRV_CLIENT *lpClient, uint32_t dwCmd, const void *lpHead, uint32_t dwHeadLen, const void *lpTail, uint32_t dwTailLen,
+                                  void *lpReply, uint32_t dwReplyLen, void *lpReplyTail, uint32_t dwReplyTailLen) {
+    JobsrvMsgHeader stHeader;
+
+    if (lpClient->fd < 0 || jobsrv_send_msg(lpClient->fd, dwCmd, lpHead, dwHeadLen, lpTail, dwTailLen) != 0) {
+        return -1;
+    }
+    uint8_t *lpPayload = jobsrv_recv_msg(lpClient->fd, &stHeader);
+    if (lpPayload == NULL || stHeader.dwCmd != dwCmd || stHeader.dwLen < dwReplyLen || stHeader.dwLen > dwReplyLen + dwReplyTailLen) {
+        free(lpPayload);
+        close(lpClient->fd);
+        lpClient->fd = -1;
+        return -1;
+    }
+    memcpy(lpReply, lpPayload, dwReplyLen);
+    if (stHeader.dwLen > dwReplyLen && lpReplyTail) {
+        memcpy(lpReplyTail, lpPayload + dwReplyLen, stHeader.dwLen - dwReplyLen);
+    }
+    free(lpPayload);
+    return stHeader.dwLen;
+}
+
+int jobsrv_client_submit(JOBSRV_CLIENT *lpClient, const JobsrvJob *lpJob) {
+    int32_t iResult;
+    if (jobsrv_client_call(lpClient, JOBSRV_CMD_SUBMIT, lpJob, sizeof(*lpJob), NULL, 0, &iResult, sizeof(iResult), NULL, 0) < 0) {
+        return -1;
+    }
+    return iResult;
+}
+
+int jobsrv_client_status(JOBSRV_CLIENT *lpClient, int iJob, JobsrvJobStatus *lpStatus) {
+    int32_t iJobId = iJob;
+    JobsrvStatusReply stReply;
+    if (jobsrv_client_call(lpClient, JOBSRV_CMD_STATUS, &iJobId, sizeof(iJobId), NULL, 0, &stReply, sizeof(stReply), NULL, 0) < 0 || stReply.iResult) {
+        return -1;
+    }
+    *lpStatus = stReply.stStatus;
+    return 0;
+}
+
+int jobsrv_client_hits(JOBSRV_CLIENT *lpClient, int iJob, uint64_t qwFirst, JobsrvHit *lpHits, uint32_t dwMaxHits) {
+    JobsrvHitsRequest stRequest = { iJob, dwMaxHits, qwFirst };
+    int32_t iResult;
+    uint32_t dwMax = dwMaxHits < JOBSRV_MAX_HITS_REPLY ? dwMaxHits : JOBSRV_MAX_HITS_REPLY;
+    int64_t qwLen = jobsrv_client_call(lpClient, JOBSRV_CMD_HITS, &stRequest, sizeof(stRequest), NULL, 0, &iResult, sizeof(iResult),
+                                       lpHits, dwMax * sizeof(JobsrvHit));
+    if (qwLen < 0 || iResult < 0 || qwLen != sizeof(iResult) + (int64_t)iResult * sizeof(JobsrvHit)) {
+        return -1;
+    }
+    return iResult;
+}
+
+int jobsrv_client_remove(JOBSRV_CLIENT *lpClient, int iJob) {
+    int32_t iJobId = iJob, iResult;
+    if (jobsrv_client_call(lpClient, JOBSRV_CMD_REMOVE, &iJobId, sizeof(iJobId), NULL, 0, &iResult, sizeof(iResult), NULL, 0) < 0) {
+        return -1;
+    }
+    return iResult;
+}
+
+int jobsrv_client_set_output_dir(JOBSRV_CLIENT *lpClient, const char *lpszDir) {
+    if (strlen(lpszDir) >= sizeof(lpClient->szOutputDir)) {
+        return -1;
+    }
+    strcpy(lpClient->szOutputDir, lpszDir);
+    return 0;
+}
+
+/*
+ * Worker side: run one lease and collect its hits
+ */
+
+typedef struct {
+    JobsrvHit *lpHits;
+    uint32_t dwNumHits;
+    uint32_t dwCapacity;
+} JobsrvHitList;
+
+static int jobsrv_hits_append(JobsrvHitList *lpList, uint64_t qwUnit, uint32_t dwValue) {
+    JobsrvHit stHit = { qwUnit, dwValue };
+    return workpool_hits_append(&lpList->lpHits, &lpList->dwNumHits, &lpList->dwCapacity, &stHit, sizeof(stHit));
+}
+
+typedef struct {
+    const JobsrvLeaseReply *lpLease;
+    int fd;
+    atomic_int bFailed;
+} JobsrvPrecomputeJob;
+
+static void jobsrv_precompute_chunk(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd) {
+    JobsrvPrecomputeJob *lpJob = lpArg;
+    const JobsrvJob *lpDesc = &lpJob->lpLease->stJob;
+    uint32_t dwNumKsBytes = lpDesc->stPrecompute.dwNumKsBytes;
+    uint64_t qwIvReg = tea1_expand_iv(lpDesc->stPrecompute.dwIv);
+    uint8_t abKs[JOBSRV_PRECOMPUTE_CHUNK * TEA1_SEARCH_MAX_KS_BYTES];
+
+    for (uint64_t qwUnit = qwBegin; qwUnit < qwEnd; qwUnit++) {
+        tea1_inner(qwIvReg, (uint32_t)(lpDesc->qwStartKey + qwUnit), dwNumKsBytes, &abKs[(qwUnit - qwBegin) * dwNumKsBytes]);
+    }
+    size_t qwLen = (qwEnd - qwBegin) * dwNumKsBytes;
+    if (pwrite(lpJob->fd, abKs, qwLen, qwBegin * dwNumKsBytes) != qwLen) {
+        atomic_store(&lpJob->bFailed, 1);
+    }
+}
+
+// Returns 0, or -1 if the lease could not be completed
+static int jobsrv_run_lease(const JobsrvLeaseReply *lpLease, const char *lpszOutputDir, WORKPOOL *lpPool, JobsrvHitList *lpHits) {
+    const JobsrvJob *lpJob = &lpLease->stJob;
+
+    switch (lpJob->eType) {
+    case JOBSRV_TEA1_SEARCH: {
+        TEA1_SEARCH_CTX stCtx;
+        tea1_search_init_range(&stCtx, lpJob->qwStartKey + lpLease->qwBegin, lpJob->qwStartKey + lpLease->qwEnd);
+        if (tea1_search_set_filters(&stCtx, lpJob->stSearch.astFilters, lpJob->stSearch.dwNumFilters) != 0) {
+            return -1;
+        }
+        while (!tea1_search_done(&stCtx)) {
+            if (tea1_search_run_parallel(&stCtx, lpPool, UINT64_MAX) == 0) {
+                tea1_search_free(&stCtx);
+                return -1;
+            }
+        }
+        int iResult = 0;
+        for (uint32_t i = 0; i < stCtx.dwNumHits && iResult == 0; i++) {
+            iResult = jobsrv_hits_append(lpHits, stCtx.lpdwHits[i] - lpJob->qwStartKey, stCtx.lpdwHits[i]);
+        }
+        tea1_search_free(&stCtx);
+        return iResult;
+    }
+    case JOBSRV_IVSYNC: {
+        IVSYNC_CTX stCtx;
+        if (ivsync_init(&stCtx, lpJob->stIvsync.dwTeaType, lpJob->stIvsync.abKey, lpJob->stIvsync.astBursts, lpJob->stIvsync.dwNumBursts,
+                        &lpJob->stIvsync.stMin, &lpJob->stIvsync.stMax) != 0 || lpLease->qwEnd > stCtx.qwNumCandidates) {
+            return -1;
+        }
+        stCtx.qwNextIndex = lpLease->qwBegin;
+        while (stCtx.qwNextIndex < lpLease->qwEnd) {
+            if (ivsync_run_parallel(&stCtx, lpPool, lpLease->qwEnd - stCtx.qwNextIndex) == 0) {
+                ivsync_free(&stCtx);
+                return -1;
+            }
+        }
+        int iResult = 0;
+        for (uint32_t i = 0; i < stCtx.dwNumHits && iResult == 0; i++) {
+            iResult = jobsrv_hits_append(lpHits, stCtx.lpHits[i].qwIndex, build_iv(&stCtx.lpHits[i].stFn));
+        }
+        ivsync_free(&stCtx);
+        return iResult;
+    }
+    case JOBSRV_PRECOMPUTE: {
+        char szPath[2 * sizeof(lpJob->stPrecompute.szPath) + 1];   // output directory, '/', path
+        if (!memchr(lpJob->stPrecompute.szPath, 0, sizeof(lpJob->stPrecompute.szPath)) || !jobsrv_path_ok(lpJob->stPrecompute.szPath)) {
+            return -1;
+        }
+        snprintf(szPath, sizeof(szPath), "%s/%s", lpszOutputDir, lpJob->stPrecompute.szPath);
+        JobsrvPrecomputeJob stJob = { lpLease, open(szPath, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644) };
+        if (stJob.fd < 0) {
+            return -1;
+        }
+        int bStopped = workpool_run(lpPool, lpLease->qwBegin, lpLease->qwEnd, JOBSRV_PRECOMPUTE_CHUNK, jobsrv_precompute_chunk, &stJob);
+        close(stJob.fd);
+        return bStopped || atomic_load(&stJob.bFailed) ? -1 : 0;
+    }
+    }
+    return -1;
+}
+
+uint64_t jobsrv_client_work(JOBSRV_CLIENT *lpClient, WORKPOOL *lpPool, int bExitWhenIdle) {
+    JobsrvLeaseReply stLease;
+    uint64_t qwCompleted = 0;
+
+    for (;;) {
+        if (jobsrv_client_call(lpClient, JOBSRV_CMD_LEASE, NULL, 0, NULL, 0, &stLease, sizeof(stLease), NULL, 0) < 0 || stLease.iResult < 0) {
+            break;
+        }
+        if (stLease.iResult == JOBSRV_LEASE_IDLE && bExitWhenIdle) {
+            break;
+        }
+        if (stLease.iResult != JOBSRV_LEASE_GRANTED) {
+            usleep(JOBSRV_IDLE_MS * 1000);
+            continue;
+        }
+
+        // A lease that fails here is left to expire, another worker will get it
+        JobsrvHitList stHits = { NULL, 0, 0 };
+        uint64_t qwStart = jobsrv_now_ns();
+        if (jobsrv_run_lease(&stLease, lpClient->szOutputDir, lpPool, &stHits) == 0) {
+            JobsrvReport stReport = { stLease.qwLeaseId, jobsrv_now_ns() - qwStart, stHits.dwNumHits, stHits.dwNumHits > stLease.dwMaxHits };
+            stReport.dwNumHits = stReport.bTruncated ? stLease.dwMaxHits : stReport.dwNumHits;
+            int32_t iResult;
+            if (jobsrv_client_call(lpClient, JOBSRV_CMD_REPORT, &stReport, sizeof(stReport), stHits.lpHits, stReport.dwNumHits * sizeof(JobsrvHit),
+                                   &iResult, sizeof(iResult), NULL, 0) < 0) {
+                free(stHits.lpHits);
+                break;
+            }
+            qwCompleted += iResult == 0;
+        }
+        free(stHits.lpHits);
+    }
+    return qwCompleted;
+}
@@ -0,0 +1,143 @@
+#ifndef HAVE_JOBSRV_H
+#define HAVE_JOBSRV_H
+
+#include <inttypes.h>
+
+#include "common.h"
+#include "ivsync.h"
+#include "tea1_search.h"
+#include "workpool.h"
+
+/*
+ * Job server for long searches shared by any number of worker processes.
+ * Clients submit jobs over a Unix socket ("/path") or local TCP ("host:port",
+ * the server only binds loopback hosts since the protocol has no authentication);
+ * a job is a range of qwNumUnits units (keys or candidates). Workers ask for
+ * leases, process them and report back, and the server hands out the next
+ * lease from the highest priority job with work left. Jobs of equal priority
+ * share the workers.
+ *
+ * A lease is sized from the reporting worker's measured rate so it lasts
+ * about dwLeaseMs, which keeps fast and slow machines busy alike and lets
+ * workers join or leave at any time. A lease not reported within
+ * dwLeaseTimeoutMs goes back to its job and is handed out again; a late
+ * report for it is ignored.
+ *
+ * A lease reports at most dwMaxReportHits hits. One that finds more means
+ * the filters or bursts are too weak to be of use: the job fails with the
+ * hits reported so far instead of being leased out again and again.
+ *
+ * Job types:
+ *   TEA1_SEARCH  key registers qwStartKey + unit against up to 8 filters,
+ *                hits are the matching registers
+ *   IVSYNC       ivsync candidates, hits are the IVs of the first burst
+ *   PRECOMPUTE   TEA1 keystream of key register qwStartKey + unit under one
+ *                IV, written to szPath at unit * dwNumKsBytes; no hits. szPath
+ *                is relative to each worker's output directory, absolute paths
+ *                and ".." components are refused
+ */
+
+#define JOBSRV_MAX_JOBS         64
+#define JOBSRV_MAX_LEASES       256
+#define JOBSRV_MAX_CLIENTS      64
+#define JOBSRV_MAX_HITS_REPLY   4096    // hits per jobsrv_client_hits call
+#define JOBSRV_MAX_REPORT_HITS  (1 << 20)   // hits per lease, keeps a report well below the message limit
+
+typedef enum {
+    JOBSRV_TEA1_SEARCH = 1,
+    JOBSRV_IVSYNC,
+    JOBSRV_PRECOMPUTE,
+} JobsrvJobType;
+
+typedef struct {
+    uint32_t eType;                     // JobsrvJobType
+    uint32_t dwPriority;                // higher first
+    uint64_t qwNumUnits;
+    uint64_t qwStartKey;                // TEA1_SEARCH and PRECOMPUTE
+    union {
+        struct {
+            Tea1Filter astFilters[TEA1_SEARCH_MAX_FILTERS];
+            uint32_t dwNumFilters;
+        } stSearch;
+        struct {
+            uint32_t dwTeaType;
+            uint8_t abKey[10];
+            IvsyncBurst astBursts[IVSYNC_MAX_BURSTS];
+            uint32_t dwNumBursts;
+            FrameNumbers stMin;
+            FrameNumbers stMax;
+        } stIvsync;
+        struct {
+            uint32_t dwIv;
+            uint32_t dwNumKsBytes;
+            char szPath[256];
+        } stPrecompute;
+    };
+} JobsrvJob;
+
+typedef struct {
+    uint64_t qwUnit;
+    uint32_t dwValue;                   // key register or IV
+} JobsrvHit;
+
+typedef enum {
+    JOBSRV_RUNNING,
+    JOBSRV_DONE,
+    JOBSRV_FAILED,                      // a lease found more than dwMaxReportHits hits
+} JobsrvJobState;
+
+typedef struct {
+    uint32_t eState;                    // JobsrvJobState
+    uint64_t qwUnitsDone;
+    uint64_t qwNumUnits;
+    uint64_t qwNumHits;
+    uint32_t dwActiveLeases;
+    uint64_t qwUnitsPerSec;             // over the last completed leases of all workers
+} JobsrvJobStatus;
+
+typedef struct {
+    uint32_t dwLeaseMs;                 // target lease duration, 0 = 2000
+    uint32_t dwLeaseTimeoutMs;          // 0 = 30000
+    uint64_t qwMinLeaseUnits;           // first lease of a worker, 0 = 4096
+    uint64_t qwMaxLeaseUnits;           // 0 = 2^32
+    uint32_t dwMaxReportHits;           // 0 = JOBSRV_MAX_REPORT_HITS, also the upper bound
+} JobsrvConfig;
+
+typedef struct {
+    uint64_t qwLeases;
+    uint64_t qwExpired;                 // leases reassigned after their timeout
+    uint64_t qwLateReports;             // reports for expired leases, ignored
+    uint64_t qwUnitsDone;
+    uint32_t dwWorkers;                 // connections that asked for work and are still open
+} JobsrvStats;
+
+typedef struct JOBSRV_SERVER JOBSRV_SERVER;
+typedef struct JOBSRV_CLIENT JOBSRV_CLIENT;
+
+// An existing Unix socket is replaced, a TCP host must be 127.x.x.x or localhost. lpConfig may be NULL for the defaults.
+JOBSRV_SERVER *jobsrv_server_create(const char *lpszAddress, const JobsrvConfig *lpConfig);
+void jobsrv_server_destroy(JOBSRV_SERVER *lpServer);
+void jobsrv_server_get_stats(JOBSRV_SERVER *lpServer, JobsrvStats *lpStats);
+
+JOBSRV_CLIENT *jobsrv_client_connect(const char *lpszAddress);
+void jobsrv_client_close(JOBSRV_CLIENT *lpClient);
+
+// Returns the job id >= 0, or -1 if the job is invalid, the server is full or the connection failed
+int jobsrv_client_submit(JOBSRV_CLIENT *lpClient, const JobsrvJob *lpJob);
+int jobsrv_client_status(JOBSRV_CLIENT *lpClient, int iJob, JobsrvJobStatus *lpStatus);
+// Hits from index qwFirst on, in the order they were reported. Returns the number copied or -1.
+int jobsrv_client_hits(JOBSRV_CLIENT *lpClient, int iJob, uint64_t qwFirst, JobsrvHit *lpHits, uint32_t dwMaxHits);
+// Drops the job and its hits, outstanding leases are ignored when reported
+int jobsrv_client_remove(JOBSRV_CLIENT *lpClient, int iJob);
+
+// Directory PRECOMPUTE paths are relative to, the current directory by default
+int jobsrv_client_set_output_dir(JOBSRV_CLIENT *lpClient, const char *lpszDir);
+
+/*
+ * Work leases on lpPool (NULL runs on the calling thread) until the
+ * connection closes, or until no job has work left if bExitWhenIdle is set.
+ * Returns the number of leases completed.
+ */
+uint64_t jobsrv_client_work(JOBSRV_CLIENT *lpClient, WORKPOOL *lpPool, int bExitWhenIdle);
+
+#endif /* HAVE_JOBSRV_H */
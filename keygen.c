@@ -0,0 +1,356 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "keygen.h"
+
+#define KEYGEN_MAX_POSITIONS (2 * KEYGEN_KEY_LEN)
+
+/*
+ * Mask generator: the key is the fixed bits plus one value per variable
+ * position, placed dwShift bits below the top of the 80-bit key.
+ */
+typedef struct {
+    uint32_t dwShift;
+    uint32_t dwWidth;
+    uint32_t dwNumValues;
+    uint8_t abValues[256];
+} KeygenPosition;
+
+typedef struct {
+    uint8_t abFixed[KEYGEN_KEY_LEN];
+    KeygenPosition astPositions[KEYGEN_MAX_POSITIONS];
+    uint32_t dwNumPositions;
+} KeygenMask;
+
+// Or an 8-bit or 4-bit value into the key, dwShift counted from the MSB of byte 0
+static void keygen_put(uint8_t *abKey, uint32_t dwShift, uint32_t dwWidth, uint8_t bValue) {
+    abKey[dwShift / 8] |= bValue << (8 - dwWidth - dwShift % 8);
+}
+
+static void keygen_mask_fill(const void *lpCtx, uint64_t qwIndex, uint32_t dwCount, uint8_t *lpKeys) {
+    const KeygenMask *lpMask = lpCtx;
+    uint32_t adwDigits[KEYGEN_MAX_POSITIONS];
+
+    // Mixed radix digits of the first index, then count up like an odometer
+    for (int i = lpMask->dwNumPositions - 1; i >= 0; i--) {
+        adwDigits[i] = qwIndex % lpMask->astPositions[i].dwNumValues;
+        qwIndex /= lpMask->astPositions[i].dwNumValues;
+    }
+
+    for (uint32_t n = 0; n < dwCount; n++) {
+        uint8_t *abKey = lpKeys + n * KEYGEN_KEY_LEN;
+        memcpy(abKey, lpMask->abFixed, KEYGEN_KEY_LEN);
+        for (uint32_t i = 0; i < lpMask->dwNumPositions; i++) {
+            const KeygenPosition *lpPos = &lpMask->astPositions[i];
+            keygen_put(abKey, lpPos->dwShift, lpPos->dwWidth, lpPos->abValues[adwDigits[i]]);
+        }
+        for (int i = lpMask->dwNumPositions - 1; i >= 0; i--) {
+            if (++adwDigits[i] < lpMask->astPositions[i].dwNumValues) {
+                break;
+            }
+            adwDigits[i] = 0;
+        }
+    }
+}
+
+static uint32_t keygen_class(char cClass, uint8_t *abValues) {
+    uint32_t dwNum = 0;
+    for (uint32_t c = 0; c < 256; c++) {
+        int bIn = (cClass == 'b') ||
+                  (cClass == 'd' && c >= '0' && c <= '9') ||
+                  (cClass == 'l' && c >= 'a' && c <= 'z') ||
+                  (cClass == 'u' && c >= 'A' && c <= 'Z') ||
+                  (cClass == 'a' && c >= 0x20 && c <= 0x7E);
+        if (bIn) {
+            abValues[dwNum++] = c;
+        }
+    }
+    return dwNum;
+}
+
+static int keygen_hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int keygen_mask_parse(KeygenMask *lpMask, const char *lpszMask, uint64_t *lpqwNumCandidates) {
+    uint64_t qwNumCandidates = 1;
+    uint32_t dwBits = 0;
+
+    for (const char *p = lpszMask; *p; p++) {
+        int iNibble = keygen_hex_digit(*p);
+        if (iNibble >= 0) {
+            if (dwBits + 4 > 80) {
+                return -1;
+            }
+            keygen_put(lpMask->abFixed, dwBits, 4, iNibble);
+            dwBits += 4;
+            continue;
+        }
+        if (*p != '?' || !p[1] || lpMask->dwNumPositions == KEYGEN_MAX_POSITIONS) {
+            return -1;
+        }
+
+        // ?h is nibble wide, all other classes are byte wide and byte aligned
+        p++;
+        KeygenPosition *lpPos = &lpMask->astPositions[lpMask->dwNumPositions++];
+        if (*p == 'h') {
+            for (uint32_t i = 0; i < 16; i++) {
+                lpPos->abValues[i] = i;
+            }
+            lpPos->dwNumValues = 16;
+            lpPos->dwWidth = 4;
+        } else {
+            lpPos->dwNumValues = keygen_class(*p, lpPos->abValues);
+            lpPos->dwWidth = 8;
+        }
+        if (lpPos->dwNumValues == 0 || dwBits + lpPos->dwWidth > 80 || (lpPos->dwWidth == 8 && dwBits % 8)) {
+            return -1;
+        }
+        lpPos->dwShift = dwBits;
+        dwBits += lpPos->dwWidth;
+
+        if (qwNumCandidates > UINT64_MAX / lpPos->dwNumValues) {
+            return -1;
+        }
+        qwNumCandidates *= lpPos->dwNumValues;
+    }
+
+    *lpqwNumCandidates = qwNumCandidates;
+    return dwBits == 80 ? 0 : -1;
+}
+
+int keygen_mask_init(KeyGenerator *lpGen, const char *lpszMask) {
+    KeygenMask *lpMask = calloc(1, sizeof(KeygenMask));
+    uint64_t qwNumCandidates;
+
+    if (lpMask == NULL) {
+        return -1;
+    }
+    if (keygen_mask_parse(lpMask, lpszMask, &qwNumCandidates) != 0) {
+        free(lpMask);
+        return -1;
+    }
+    lpGen->qwNumCandidates = qwNumCandidates;
+    lpGen->fnFill = keygen_mask_fill;
+    lpGen->lpCtx = lpMask;
+    lpGen->fnFree = free;
+    return 0;
+}
+
+/*
+ * Wordlist generator: the file stays mapped and only the start offset of every
+ * usable line is kept, candidate n being the n-th usable line.
+ */
+typedef struct {
+    const char *lpData;
+    size_t qwSize;
+    uint64_t *lpqwLines;
+    uint32_t dwFormat;
+} KeygenWordlist;
+
+static size_t keygen_line_len(const char *lpLine, size_t qwMax) {
+    const char *lpEnd = memchr(lpLine, '\n', qwMax);
+    size_t qwLen = lpEnd ? (size_t)(lpEnd - lpLine) : qwMax;
+    if (qwLen && lpLine[qwLen - 1] == '\r') {
+        qwLen--;
+    }
+    return qwLen;
+}
+
+static int keygen_parse_hex(const char *lpLine, size_t qwLen, uint8_t *abKey) {
+    if (qwLen != 2 * KEYGEN_KEY_LEN) {
+        return -1;
+    }
+    for (int i = 0; i < 2 * KEYGEN_KEY_LEN; i++) {
+        int iNibble = keygen_hex_digit(lpLine[i]);
+        if (iNibble < 0) {
+            return -1;
+        }
+        abKey[i / 2] = (abKey[i / 2] << 4) | iNibble;
+    }
+    return 0;
+}
+
+static void keygen_wordlist_fill(const void *lpCtx, uint64_t qwIndex, uint32_t dwCount, uint8_t *lpKeys) {
+    const KeygenWordlist *lpList = lpCtx;
+
+    for (uint32_t n = 0; n < dwCount; n++) {
+        uint64_t qwOffset = lpList->lpqwLines[qwIndex + n];
+        const char *lpLine = lpList->lpData + qwOffset;
+        size_t qwLen = keygen_line_len(lpLine, lpList->qwSize - qwOffset);
+        uint8_t *abKey = lpKeys + n * KEYGEN_KEY_LEN;
+
+        if (lpList->dwFormat == KEYGEN_WORDLIST_HEX) {
+            keygen_parse_hex(lpLine, qwLen, abKey);
+        } else {
+            memset(abKey, 0, KEYGEN_KEY_LEN);
+            memcpy(abKey, lpLine, qwLen < KEYGEN_KEY_LEN ? qwLen : KEYGEN_KEY_LEN);
+        }
+    }
+}
+
+static void keygen_wordlist_free(void *lpCtx) {
+    KeygenWordlist *lpList = lpCtx;
+    if (lpList->qwSize) {
+        munmap((void *)lpList->lpData, lpList->qwSize);
+    }
+    free(lpList->lpqwLines);
+    free(lpList);
+}
+
+int keygen_wordlist_open(KeyGenerator *lpGen, const char *lpszPath, uint32_t dwFormat) {
+    struct stat stStat;
+    uint64_t qwNumLines = 0, qwCapacity = 0;
+
+    int fd = open(lpszPath, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    KeygenWordlist *lpList = calloc(1, sizeof(KeygenWordlist));
+    if (lpList == NULL || fstat(fd, &stStat) != 0) {
+        free(lpList);
+        close(fd);
+        return -1;
+    }
+    lpList->dwFormat = dwFormat;
+    if (stStat.st_size > 0) {
+        void *lpData = mmap(NULL, stStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (lpData != MAP_FAILED) {
+            lpList->lpData = lpData;
+            lpList->qwSize = stStat.st_size;
+            madvise(lpData, stStat.st_size, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+    if (stStat.st_size > 0 && lpList->qwSize == 0) {
+        free(lpList);
+        return -1;
+    }
+
+    // Index usable lines: non-empty, and for hex lists exactly 20 hex digits
+    for (size_t qwOffset = 0; qwOffset < lpList->qwSize;) {
+        size_t qwRemaining = lpList->qwSize - qwOffset;
+        size_t qwLen = keygen_line_len(lpList->lpData + qwOffset, qwRemaining);
+        uint8_t abKey[KEYGEN_KEY_LEN];
+
+        int bUsable = qwLen > 0 && (dwFormat != KEYGEN_WORDLIST_HEX || keygen_parse_hex(lpList->lpData + qwOffset, qwLen, abKey) == 0);
+        if (bUsable) {
+            if (qwNumLines == qwCapacity) {
+                qwCapacity = qwCapacity ? 2 * qwCapacity : 1024;
+                uint64_t *lpqwLines = realloc(lpList->lpqwLines, qwCapacity * sizeof(uint64_t));
+                if (lpqwLines == NULL) {
+                    keygen_wordlist_free(lpList);
+                    return -1;
+                }
+                lpList->lpqwLines = lpqwLines;
+            }
+            lpList->lpqwLines[qwNumLines++] = qwOffset;
+        }
+
+        const char *lpEnd = memchr(lpList->lpData + qwOffset, '\n', qwRemaining);
+        qwOffset = lpEnd ? (size_t)(lpEnd - lpList->lpData) + 1 : lpList->qwSize;
+    }
+    madvise((void *)lpList->lpData, lpList->qwSize, MADV_RANDOM);
+
+    lpGen->qwNumCandidates = qwNumLines;
+    lpGen->fnFill = keygen_wordlist_fill;
+    lpGen->lpCtx = lpList;
+    lpGen->fnFree = keygen_wordlist_free;
+    return 0;
+}
+
+typedef struct {
+    uint32_t dwModel;
+    uint32_t dwFirstSeed;
+} KeygenPrng;
+
+// glibc srand()/rand(): the TYPE_3 additive feedback generator seeded through a Park-Miller LCG
+static void keygen_glibc_rand(uint32_t dwSeed, uint8_t *abKey) {
+    int32_t aiR[344 + KEYGEN_KEY_LEN];
+
+    aiR[0] = dwSeed ? dwSeed : 1;
+    for (int i = 1; i < 31; i++) {
+        int32_t iHi = aiR[i - 1] / 127773;
+        int32_t iLo = aiR[i - 1] % 127773;
+        int32_t iWord = 16807 * iLo - 2836 * iHi;
+        aiR[i] = iWord < 0 ? iWord + 2147483647 : iWord;
+    }
+    for (int i = 31; i < 34; i++) {
+        aiR[i] = aiR[i - 31];
+    }
+    for (int i = 34; i < 344 + KEYGEN_KEY_LEN; i++) {
+        aiR[i] = (uint32_t)aiR[i - 31] + (uint32_t)aiR[i - 3];
+    }
+    for (int i = 0; i < KEYGEN_KEY_LEN; i++) {
+        abKey[i] = ((uint32_t)aiR[344 + i] >> 1) & 0xFF;
+    }
+}
+
+static void keygen_msvc_rand(uint32_t dwSeed, uint8_t *abKey) {
+    uint32_t dwState = dwSeed;
+    for (int i = 0; i < KEYGEN_KEY_LEN; i++) {
+        dwState = dwState * 214013 + 2531011;
+        abKey[i] = (dwState >> 16) & 0xFF;
+    }
+}
+
+static void keygen_prng_fill(const void *lpCtx, uint64_t qwIndex, uint32_t dwCount, uint8_t *lpKeys) {
+    const KeygenPrng *lpPrng = lpCtx;
+
+    for (uint32_t n = 0; n < dwCount; n++) {
+        uint32_t dwSeed = lpPrng->dwFirstSeed + (uint32_t)(qwIndex + n);
+        if (lpPrng->dwModel == KEYGEN_PRNG_GLIBC) {
+            keygen_glibc_rand(dwSeed, lpKeys + n * KEYGEN_KEY_LEN);
+        } else {
+            keygen_msvc_rand(dwSeed, lpKeys + n * KEYGEN_KEY_LEN);
+        }
+    }
+}
+
+int keygen_prng_init(KeyGenerator *lpGen, uint32_t dwModel, uint32_t dwFirstSeed, uint64_t qwNumSeeds) {
+    if (dwModel > KEYGEN_PRNG_MSVC || qwNumSeeds > (1ULL << 32)) {
+        return -1;
+    }
+    KeygenPrng *lpPrng = malloc(sizeof(KeygenPrng));
+    if (lpPrng == NULL) {
+        return -1;
+    }
+    lpPrng->dwModel = dwModel;
+    lpPrng->dwFirstSeed = dwFirstSeed;
+
+    lpGen->qwNumCandidates = qwNumSeeds;
+    lpGen->fnFill = keygen_prng_fill;
+    lpGen->lpCtx = lpPrng;
+    lpGen->fnFree = free;
+    return 0;
+}
+
+void keygen_free(KeyGenerator *lpGen) {
+    if (lpGen->fnFree) {
+        lpGen->fnFree(lpGen->lpCtx);
+    }
+    memset(lpGen, 0, sizeof(*lpGen));
+}
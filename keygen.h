@@ -0,0 +1,44 @@
+#ifndef HAVE_KEYGEN_H
+#define HAVE_KEYGEN_H
+
+#include <inttypes.h>
+
+/*
+ * Candidate 80-bit key generators for dictionary style TEA2/TEA3 searches.
+ * A generator enumerates qwNumCandidates keys by index; fnFill writes the 10
+ * byte keys for indices qwIndex .. qwIndex + dwCount - 1 and must be safe to
+ * call from several threads at once, so every search worker generates its own
+ * share of the candidates.
+ */
+
+#define KEYGEN_KEY_LEN 10
+
+typedef void (*KeygenFillFn)(const void *lpCtx, uint64_t qwIndex, uint32_t dwCount, uint8_t *lpKeys);
+
+typedef struct {
+    uint64_t qwNumCandidates;
+    KeygenFillFn fnFill;
+    void *lpCtx;
+    void (*fnFree)(void *lpCtx);
+} KeyGenerator;
+
+// Wordlist line formats
+#define KEYGEN_WORDLIST_HEX    0   // 20 hex digits per line, other lines are skipped
+#define KEYGEN_WORDLIST_ASCII  1   // first 10 bytes of the line, zero padded
+
+// Seed based models, candidate n is the key generated after seeding with qwFirstSeed + n
+#define KEYGEN_PRNG_GLIBC  0   // srand(seed), byte i = rand() & 0xFF
+#define KEYGEN_PRNG_MSVC   1   // srand(seed), byte i = rand() & 0xFF with the MSVC LCG
+
+/*
+ * Mask of 80 bits, MSB first. A hex digit is a fixed nibble, ?h any nibble;
+ * byte wide classes must start on a byte boundary: ?b any byte, ?d ASCII
+ * digit, ?l lowercase, ?u uppercase, ?a printable ASCII. The last position
+ * varies fastest.
+ */
+int keygen_mask_init(KeyGenerator *lpGen, const char *lpszMask);
+int keygen_wordlist_open(KeyGenerator *lpGen, const char *lpszPath, uint32_t dwFormat);
+int keygen_prng_init(KeyGenerator *lpGen, uint32_t dwModel, uint32_t dwFirstSeed, uint64_t qwNumSeeds);
+void keygen_free(KeyGenerator *lpGen);
+
+#endif /* HAVE_KEYGEN_H */
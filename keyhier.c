@@ -0,0 +1,412 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "keyhier.h"
+#include "taa1.h"
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+
+#define KEYHIER_SET_FREE        0
+#define KEYHIER_SET_DERIVING    1       // scheduled, keys not published yet
+#define KEYHIER_SET_READY       2
+
+typedef struct {
+    KeyhierTeaKey stCck;
+    KeyhierTeaKey astScks[KEYHIER_NUM_SCKS];
+    KeyhierTeaKey astGcks[KEYHIER_MAX_GROUPS];  // in the order of the set's sorted GSSIs
+} KeyhierCellKeys;
+
+/*
+ * One key set and everything derived from it. Readers only use a set in the
+ * READY state and copy what they need between two reads of an even dwSeq;
+ * writers make dwSeq odd while they change a set readers may be using.
+ */
+typedef struct {
+    _Atomic uint32_t dwSeq;
+    _Atomic uint32_t eState;
+    uint16_t wRolloverHn;
+    KeyhierKeySet stKeys;               // groups sorted by GSSI
+    KeyhierCellKeys astCells[KEYHIER_MAX_CELLS];
+} KeyhierSet;
+
+struct KEYHIER {
+    pthread_mutex_t hLock;              // serializes everything but lookups
+    pthread_cond_t hWake;
+    pthread_t hThread;
+    int bShutdown;
+    uint32_t dwSchedule;                // bumped by every keyhier_schedule
+
+    KeyhierCell astCells[KEYHIER_MAX_CELLS];
+    _Atomic uint32_t dwNumCells;
+    _Atomic uint32_t dwCurrent;         // index of the active set, the other one is scheduled or free
+    KeyhierSet astSets[2];
+
+    // Background derivation works on copies so it never holds the lock for long
+    KeyhierKeySet stScratchKeys;
+    KeyhierCell astScratchCells[KEYHIER_MAX_CELLS];
+    KeyhierCellKeys astScratch[KEYHIER_MAX_CELLS];
+
+    _Atomic uint64_t qwDerived;
+    _Atomic uint64_t qwStalls;
+    _Atomic uint64_t qwRollovers;
+};
+
+static void keyhier_tea_key(uint32_t dwTeaType, const uint8_t *lpEck, KeyhierTeaKey *lpKeyOut) {
+    lpKeyOut->dwTeaType = dwTeaType;
+    memcpy(lpKeyOut->abEck, lpEck, sizeof(lpKeyOut->abEck));
+    lpKeyOut->dwKeyReg = dwTeaType == 1 ? tea1_init_key_register(lpEck) : 0;
+}
+
+// One key of a cell; dwIndex is the SCK index (SCKN - 1) or the position of the GSSI in the sorted set
+static void keyhier_derive(const KeyhierKeySet *lpKeys, const KeyhierCell *lpCell, KeyhierKind eKind, uint32_t dwIndex, KeyhierTeaKey *lpKeyOut) {
+    KeyhierCell stCell = *lpCell;
+    uint8_t abCk[10], abEck[10];
+
+    switch (eKind) {
+        case KEYHIER_CCK:
+            memcpy(abCk, lpKeys->abCck, sizeof(abCk));
+            tb5(stCell.abCn, stCell.abLa, &stCell.bCc, abCk, abEck);
+            break;
+        case KEYHIER_SCK:
+            memcpy(abCk, lpKeys->aabScks[dwIndex], sizeof(abCk));
+            tb6(abCk, stCell.abCn, stCell.abSsi, abEck);
+            break;
+        case KEYHIER_GCK: {
+            uint8_t abGck[10], abCck[10];
+            memcpy(abGck, lpKeys->aabGcks[dwIndex], sizeof(abGck));
+            memcpy(abCck, lpKeys->abCck, sizeof(abCck));
+            ta71(abGck, abCck, abCk);
+            tb5(stCell.abCn, stCell.abLa, &stCell.bCc, abCk, abEck);
+            break;
+        }
+    }
+    keyhier_tea_key(stCell.dwTeaType, abEck, lpKeyOut);
+}
+
+static uint64_t keyhier_derive_cell(const KeyhierKeySet *lpKeys, const KeyhierCell *lpCell, KeyhierCellKeys *lpOut) {
+    uint64_t qwDerived = 1;
+
+    keyhier_derive(lpKeys, lpCell, KEYHIER_CCK, 0, &lpOut->stCck);
+    for (uint32_t i = 0; i < KEYHIER_NUM_SCKS; i++) {
+        if (lpKeys->dwSckMask & (1u << i)) {
+            keyhier_derive(lpKeys, lpCell, KEYHIER_SCK, i, &lpOut->astScks[i]);
+            qwDerived++;
+        }
+    }
+    for (uint32_t i = 0; i < lpKeys->dwNumGroups; i++) {
+        keyhier_derive(lpKeys, lpCell, KEYHIER_GCK, i, &lpOut->astGcks[i]);
+    }
+    return qwDerived + lpKeys->dwNumGroups;
+}
+
+static int keyhier_cmp_group(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Copy a key set with its groups sorted by GSSI. Returns -1 on too many groups or duplicate GSSIs.
+static int keyhier_sort_keys(const KeyhierKeySet *lpKeys, KeyhierKeySet *lpOut) {
+    struct {
+        uint32_t dwGssi;
+        uint8_t abGck[10];
+    } astGroups[KEYHIER_MAX_GROUPS];
+
+    if (lpKeys->dwNumGroups > KEYHIER_MAX_GROUPS) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < lpKeys->dwNumGroups; i++) {
+        astGroups[i].dwGssi = lpKeys->adwGssis[i];
+        memcpy(astGroups[i].abGck, lpKeys->aabGcks[i], 10);
+    }
+    qsort(astGroups, lpKeys->dwNumGroups, sizeof(astGroups[0]), keyhier_cmp_group);
+
+    *lpOut = *lpKeys;
+    for (uint32_t i = 0; i < lpKeys->dwNumGroups; i++) {
+        if (astGroups[i].dwGssi > 0xFFFFFF || (i && astGroups[i].dwGssi == astGroups[i - 1].dwGssi)) {
+            return -1;
+        }
+        lpOut->adwGssis[i] = astGroups[i].dwGssi;
+        memcpy(lpOut->aabGcks[i], astGroups[i].abGck, 10);
+    }
+    return 0;
+}
+
+// Index of a key in its set: the SCK index or the GSSI position, -1 if the set has no such key
+static int keyhier_key_index(const KeyhierKeySet *lpKeys, KeyhierKind eKind, uint32_t dwId) {
+    switch (eKind) {
+        case KEYHIER_CCK:
+            return 0;
+        case KEYHIER_SCK:
+            return dwId >= 1 && dwId <= KEYHIER_NUM_SCKS && (lpKeys->dwSckMask & (1u << (dwId - 1))) ? (int)dwId - 1 : -1;
+        case KEYHIER_GCK: {
+            int lo = 0, hi = (int)lpKeys->dwNumGroups - 1;
+            while (lo <= hi) {
+                int mid = (lo + hi) / 2;
+                if (lpKeys->adwGssis[mid] == dwId) {
+                    return mid;
+                }
+                if (lpKeys->adwGssis[mid] < dwId) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid - 1;
+                }
+            }
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static void keyhier_set_begin_write(KeyhierSet *lpSet) {
+    atomic_fetch_add_explicit(&lpSet->dwSeq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void keyhier_set_end_write(KeyhierSet *lpSet) {
+    atomic_fetch_add_explicit(&lpSet->dwSeq, 1, memory_order_release);
+}
+
+static void *keyhier_thread(void *lpArg) {
+    KEYHIER *lpMgr = lpArg;
+
+    pthread_mutex_lock(&lpMgr->hLock);
+    for (;;) {
+        uint32_t dwNext = 1 - atomic_load(&lpMgr->dwCurrent);
+        KeyhierSet *lpSet = &lpMgr->astSets[dwNext];
+        if (lpMgr->bShutdown) {
+            break;
+        }
+        if (atomic_load(&lpSet->eState) != KEYHIER_SET_DERIVING) {
+            pthread_cond_wait(&lpMgr->hWake, &lpMgr->hLock);
+            continue;
+        }
+
+        uint32_t dwSchedule = lpMgr->dwSchedule;
+        uint32_t dwNumCells = atomic_load(&lpMgr->dwNumCells);
+        uint64_t qwDerived = 0;
+        lpMgr->stScratchKeys = lpSet->stKeys;
+        memcpy(lpMgr->astScratchCells, lpMgr->astCells, dwNumCells * sizeof(KeyhierCell));
+        pthread_mutex_unlock(&lpMgr->hLock);
+
+        for (uint32_t i = 0; i < dwNumCells; i++) {
+            qwDerived += keyhier_derive_cell(&lpMgr->stScratchKeys, &lpMgr->astScratchCells[i], &lpMgr->astScratch[i]);
+        }
+
+        pthread_mutex_lock(&lpMgr->hLock);
+        atomic_fetch_add(&lpMgr->qwDerived, qwDerived);
+        if (dwSchedule != lpMgr->dwSchedule) {
+            continue;                   // superseded by a newer schedule, start over
+        }
+
+        // Cells added meanwhile are few, derive them right here
+        keyhier_set_begin_write(lpSet);
+        memcpy(lpSet->astCells, lpMgr->astScratch, dwNumCells * sizeof(KeyhierCellKeys));
+        for (uint32_t i = dwNumCells; i < atomic_load(&lpMgr->dwNumCells); i++) {
+            atomic_fetch_add(&lpMgr->qwDerived, keyhier_derive_cell(&lpSet->stKeys, &lpMgr->astCells[i], &lpSet->astCells[i]));
+        }
+        atomic_store(&lpSet->eState, KEYHIER_SET_READY);
+        keyhier_set_end_write(lpSet);
+    }
+    pthread_mutex_unlock(&lpMgr->hLock);
+    return NULL;
+}
+
+KEYHIER *keyhier_create(const KeyhierKeySet *lpKeys) {
+    KEYHIER *lpMgr = calloc(1, sizeof(KEYHIER));
+    if (lpMgr == NULL) {
+        return NULL;
+    }
+    if (keyhier_sort_keys(lpKeys, &lpMgr->astSets[0].stKeys) != 0) {
+        free(lpMgr);
+        return NULL;
+    }
+    atomic_store(&lpMgr->astSets[0].eState, KEYHIER_SET_READY);
+    pthread_mutex_init(&lpMgr->hLock, NULL);
+    pthread_cond_init(&lpMgr->hWake, NULL);
+    if (pthread_create(&lpMgr->hThread, NULL, keyhier_thread, lpMgr) != 0) {
+        pthread_mutex_destroy(&lpMgr->hLock);
+        pthread_cond_destroy(&lpMgr->hWake);
+        free(lpMgr);
+        return NULL;
+    }
+    return lpMgr;
+}
+
+void keyhier_destroy(KEYHIER *lpMgr) {
+    pthread_mutex_lock(&lpMgr->hLock);
+    lpMgr->bShutdown = 1;
+    pthread_cond_signal(&lpMgr->hWake);
+    pthread_mutex_unlock(&lpMgr->hLock);
+    pthread_join(lpMgr->hThread, NULL);
+    pthread_mutex_destroy(&lpMgr->hLock);
+    pthread_cond_destroy(&lpMgr->hWake);
+    free(lpMgr);
+}
+
+int keyhier_add_cell(KEYHIER *lpMgr, const KeyhierCell *lpCell) {
+    // Ranges tb5 asserts on: 12-bit cn, 14-bit la, 6-bit cc
+    if (lpCell->dwTeaType < 1 || lpCell->dwTeaType > 3 || (lpCell->abCn[0] & 0xF0) || (lpCell->abLa[0] & 0xC0) || (lpCell->bCc & 0xC0)) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lpMgr->hLock);
+    uint32_t dwCell = atomic_load(&lpMgr->dwNumCells);
+    if (dwCell == KEYHIER_MAX_CELLS) {
+        pthread_mutex_unlock(&lpMgr->hLock);
+        return -1;
+    }
+    lpMgr->astCells[dwCell] = *lpCell;
+
+    // Nobody looks up the new cell before dwNumCells covers it, so no seqlock is needed
+    for (int i = 0; i < 2; i++) {
+        KeyhierSet *lpSet = &lpMgr->astSets[i];
+        if (atomic_load(&lpSet->eState) == KEYHIER_SET_READY) {
+            atomic_fetch_add(&lpMgr->qwDerived, keyhier_derive_cell(&lpSet->stKeys, lpCell, &lpSet->astCells[dwCell]));
+        }
+    }
+    atomic_store_explicit(&lpMgr->dwNumCells, dwCell + 1, memory_order_release);
+    pthread_mutex_unlock(&lpMgr->hLock);
+    return dwCell;
+}
+
+int keyhier_schedule(KEYHIER *lpMgr, const KeyhierKeySet *lpKeys, uint16_t wRolloverHn) {
+    KeyhierKeySet *lpSorted = malloc(sizeof(KeyhierKeySet));
+    if (lpSorted == NULL || keyhier_sort_keys(lpKeys, lpSorted) != 0) {
+        free(lpSorted);
+        return -1;
+    }
+
+    pthread_mutex_lock(&lpMgr->hLock);
+    KeyhierSet *lpSet = &lpMgr->astSets[1 - atomic_load(&lpMgr->dwCurrent)];
+    keyhier_set_begin_write(lpSet);
+    lpSet->stKeys = *lpSorted;
+    lpSet->wRolloverHn = wRolloverHn;
+    atomic_store(&lpSet->eState, KEYHIER_SET_DERIVING);
+    keyhier_set_end_write(lpSet);
+
+    lpMgr->dwSchedule++;
+    pthread_cond_signal(&lpMgr->hWake);
+    pthread_mutex_unlock(&lpMgr->hLock);
+    free(lpSorted);
+    return 0;
+}
+
+int keyhier_ready(KEYHIER *lpMgr) {
+    uint32_t dwNext = 1 - atomic_load(&lpMgr->dwCurrent);
+    return atomic_load(&lpMgr->astSets[dwNext].eState) != KEYHIER_SET_DERIVING;
+}
+
+void keyhier_advance(KEYHIER *lpMgr, uint16_t wHn) {
+    pthread_mutex_lock(&lpMgr->hLock);
+    uint32_t dwCurrent = atomic_load(&lpMgr->dwCurrent);
+    KeyhierSet *lpNext = &lpMgr->astSets[1 - dwCurrent];
+    if (atomic_load(&lpNext->eState) == KEYHIER_SET_READY && (int16_t)(wHn - lpNext->wRolloverHn) >= 1) {
+        KeyhierSet *lpOld = &lpMgr->astSets[dwCurrent];
+        atomic_store(&lpMgr->dwCurrent, 1 - dwCurrent);
+        keyhier_set_begin_write(lpOld);
+        atomic_store(&lpOld->eState, KEYHIER_SET_FREE);
+        keyhier_set_end_write(lpOld);
+        atomic_fetch_add(&lpMgr->qwRollovers, 1);
+    }
+    pthread_mutex_unlock(&lpMgr->hLock);
+}
+
+// The scheduled set is due but not derived yet: derive the one key asked for from a copy of it
+static int keyhier_lookup_stall(KEYHIER *lpMgr, KeyhierSet *lpSet, uint32_t dwCell, KeyhierKind eKind, uint32_t dwId, KeyhierTeaKey *lpKeyOut) {
+    KeyhierKeySet *lpKeys = malloc(sizeof(KeyhierKeySet));
+    if (lpKeys == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&lpMgr->hLock);
+    *lpKeys = lpSet->stKeys;
+    KeyhierCell stCell = lpMgr->astCells[dwCell];
+    pthread_mutex_unlock(&lpMgr->hLock);
+
+    int iIndex = keyhier_key_index(lpKeys, eKind, dwId);
+    if (iIndex >= 0) {
+        keyhier_derive(lpKeys, &stCell, eKind, iIndex, lpKeyOut);
+        atomic_fetch_add(&lpMgr->qwDerived, 1);
+    }
+    atomic_fetch_add(&lpMgr->qwStalls, 1);
+    free(lpKeys);
+    return iIndex >= 0 ? 0 : -1;
+}
+
+int keyhier_lookup(KEYHIER *lpMgr, uint32_t dwCell, KeyhierKind eKind, uint32_t dwId, uint16_t wHn, KeyhierTeaKey *lpKeyOut) {
+    if (dwCell >= atomic_load_explicit(&lpMgr->dwNumCells, memory_order_acquire)) {
+        return -1;
+    }
+
+    for (;;) {
+        uint32_t dwCurrent = atomic_load_explicit(&lpMgr->dwCurrent, memory_order_acquire);
+        KeyhierSet *lpSet = &lpMgr->astSets[dwCurrent];
+        KeyhierSet *lpNext = &lpMgr->astSets[1 - dwCurrent];
+
+        uint32_t dwNextSeq = atomic_load_explicit(&lpNext->dwSeq, memory_order_acquire);
+        uint32_t eNextState = atomic_load_explicit(&lpNext->eState, memory_order_relaxed);
+        if (!(dwNextSeq & 1) && eNextState != KEYHIER_SET_FREE && (int16_t)(wHn - lpNext->wRolloverHn) >= 0) {
+            if (eNextState == KEYHIER_SET_DERIVING) {
+                return keyhier_lookup_stall(lpMgr, lpNext, dwCell, eKind, dwId, lpKeyOut);
+            }
+            lpSet = lpNext;
+        }
+
+        uint32_t dwSeq = atomic_load_explicit(&lpSet->dwSeq, memory_order_acquire);
+        if ((dwSeq & 1) || atomic_load_explicit(&lpSet->eState, memory_order_relaxed) != KEYHIER_SET_READY) {
+            continue;
+        }
+        int iIndex = keyhier_key_index(&lpSet->stKeys, eKind, dwId);
+        const KeyhierCellKeys *lpCellKeys = &lpSet->astCells[dwCell];
+        if (iIndex >= 0) {
+            *lpKeyOut = eKind == KEYHIER_CCK ? lpCellKeys->stCck : eKind == KEYHIER_SCK ? lpCellKeys->astScks[iIndex] : lpCellKeys->astGcks[iIndex];
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&lpSet->dwSeq, memory_order_relaxed) == dwSeq) {
+            return iIndex >= 0 ? 0 : -1;
+        }
+    }
+}
+
+void keyhier_keystream(const KeyhierTeaKey *lpKey, uint32_t dwIv, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    uint8_t abEck[10];
+
+    switch (lpKey->dwTeaType) {
+        case 1:
+            tea1_inner(tea1_expand_iv(dwIv), lpKey->dwKeyReg, dwNumKsBytes, lpKsOut);
+            break;
+        case 2:
+            memcpy(abEck, lpKey->abEck, sizeof(abEck));
+            tea2(dwIv, abEck, dwNumKsBytes, lpKsOut);
+            break;
+        case 3:
+            memcpy(abEck, lpKey->abEck, sizeof(abEck));
+            tea3(dwIv, abEck, dwNumKsBytes, lpKsOut);
+            break;
+    }
+}
+
+void keyhier_get_stats(KEYHIER *lpMgr, KeyhierStats *lpStats) {
+    lpStats->qwDerived = atomic_load(&lpMgr->qwDerived);
+    lpStats->qwStalls = atomic_load(&lpMgr->qwStalls);
+    lpStats->qwRollovers = atomic_load(&lpMgr->qwRollovers);
+}
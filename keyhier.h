@@ -0,0 +1,86 @@
+#ifndef HAVE_KEYHIER_H
+#define HAVE_KEYHIER_H
+
+#include <inttypes.h>
+
+/*
+ * Class 3 key hierarchy. For every cell the manager keeps the TEA keys of all
+ * traffic it may have to decrypt, derived ahead of time from the current key
+ * set:
+ *
+ *   CCK traffic    ECK = tb5(cn, la, cc, CCK)
+ *   SCK traffic    ECK = tb6(SCK, cn, ssi)
+ *   group traffic  MGCK = ta71(GCK, CCK), ECK = tb5(cn, la, cc, MGCK)
+ *
+ * together with the TEA1 key register. A new key set is scheduled to take
+ * over at a given hyperframe; a background thread derives every key of every
+ * cell under it right away, so lookups for bursts after the rollover find
+ * them ready. Until then lookups for hyperframes past the rollover derive
+ * the single key they need, and count as a stall.
+ *
+ * Lookups may run on any number of threads and take no lock unless they
+ * stall: derived keys are published per set under a seqlock.
+ * keyhier_advance() retires the old set once the hyperframe after the
+ * rollover is reached, which leaves a grace hyperframe for late bursts.
+ */
+
+#define KEYHIER_MAX_CELLS   32
+#define KEYHIER_MAX_GROUPS  128
+#define KEYHIER_NUM_SCKS    32          // SCKN 1 .. 32
+
+typedef struct {
+    uint32_t dwTeaType;
+    uint8_t abCn[2];                    // big endian, as taken by tb5/tb6
+    uint8_t abLa[2];
+    uint8_t bCc;
+    uint8_t abSsi[3];                   // for tb6
+} KeyhierCell;
+
+typedef struct {
+    uint8_t abCck[10];
+    uint32_t dwSckMask;                 // bit n - 1 set if SCK n is present
+    uint8_t aabScks[KEYHIER_NUM_SCKS][10];
+    uint32_t dwNumGroups;
+    uint32_t adwGssis[KEYHIER_MAX_GROUPS];  // talkgroup of every GCK
+    uint8_t aabGcks[KEYHIER_MAX_GROUPS][10];
+} KeyhierKeySet;
+
+typedef enum {
+    KEYHIER_CCK,
+    KEYHIER_SCK,                        // dwId is the SCKN
+    KEYHIER_GCK,                        // dwId is the GSSI
+} KeyhierKind;
+
+typedef struct {
+    uint32_t dwTeaType;
+    uint32_t dwKeyReg;                  // TEA1 key register of abEck
+    uint8_t abEck[10];
+} KeyhierTeaKey;
+
+typedef struct {
+    uint64_t qwDerived;                 // ECKs derived, eagerly or not
+    uint64_t qwStalls;                  // lookups that had to derive their key
+    uint64_t qwRollovers;               // key sets retired by keyhier_advance
+} KeyhierStats;
+
+typedef struct KEYHIER KEYHIER;
+
+KEYHIER *keyhier_create(const KeyhierKeySet *lpKeys);
+void keyhier_destroy(KEYHIER *lpMgr);
+
+// Returns the cell id, or -1 if the TEA type or a field is out of range or there are too many cells
+int keyhier_add_cell(KEYHIER *lpMgr, const KeyhierCell *lpCell);
+
+// Replaces a set scheduled before that is not active yet. Returns 0, or -1 if the set is invalid.
+int keyhier_schedule(KEYHIER *lpMgr, const KeyhierKeySet *lpKeys, uint16_t wRolloverHn);
+// 1 once every key of the scheduled set is derived (or nothing is scheduled)
+int keyhier_ready(KEYHIER *lpMgr);
+void keyhier_advance(KEYHIER *lpMgr, uint16_t wHn);
+
+// Key for a burst in hyperframe wHn. Returns 0, or -1 if the cell or the key is unknown.
+int keyhier_lookup(KEYHIER *lpMgr, uint32_t dwCell, KeyhierKind eKind, uint32_t dwId, uint16_t wHn, KeyhierTeaKey *lpKeyOut);
+void keyhier_keystream(const KeyhierTeaKey *lpKey, uint32_t dwIv, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
+
+void keyhier_get_stats(KEYHIER *lpMgr, KeyhierStats *lpStats);
+
+#endif /* HAVE_KEYHIER_H */
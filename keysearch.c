@@ -0,0 +1,146 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "tea2.h"
+#include "tea3.h"
+#include "keysearch.h"
+
+#define KEYSEARCH_BATCH 256             // candidates generated per generator call
+#define KEYSEARCH_CHUNK (1 << 14)       // candidates per workpool chunk
+
+typedef void (*KeysearchStreamInitFn)(TeaKeyStream *lpStream, const uint8_t *lpKey);
+typedef int (*KeysearchMatchFn)(TeaKeyStream *lpStream, uint32_t dwFrameNumbers, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes);
+
+int keysearch_init(KEYSEARCH_CTX *lpCtx, uint32_t dwTeaType, const KeyGenerator *lpGen, const Tea1Filter *lpFilters, uint32_t dwNumFilters) {
+    memset(lpCtx, 0, sizeof(*lpCtx));
+    if ((dwTeaType != 2 && dwTeaType != 3) || dwNumFilters == 0 || dwNumFilters > KEYSEARCH_MAX_FILTERS) {
+        return -1;
+    }
+    // A TeaKeyStream records rounds for at most TEA_KEY_STREAM_MAX_KS_BYTES bytes
+    for (uint32_t i = 0; i < dwNumFilters; i++) {
+        if (lpFilters[i].dwNumKsBytes == 0 || lpFilters[i].dwNumKsBytes > TEA_KEY_STREAM_MAX_KS_BYTES) {
+            return -1;
+        }
+    }
+    lpCtx->dwTeaType = dwTeaType;
+    lpCtx->lpGen = lpGen;
+    memcpy(lpCtx->astFilters, lpFilters, dwNumFilters * sizeof(Tea1Filter));
+    lpCtx->dwNumFilters = dwNumFilters;
+    return 0;
+}
+
+void keysearch_free(KEYSEARCH_CTX *lpCtx) {
+    free(lpCtx->lpHits);
+    lpCtx->lpHits = NULL;
+    lpCtx->dwNumHits = 0;
+    lpCtx->dwHitsCapacity = 0;
+}
+
+int keysearch_done(const KEYSEARCH_CTX *lpCtx) {
+    return lpCtx->qwNextIndex >= lpCtx->lpGen->qwNumCandidates;
+}
+
+/*
+ * Generate and test candidates [qwBegin, qwEnd) in batches, appending hits.
+ * Returns the index of the first candidate not fully processed, which is
+ * qwEnd unless storing a hit failed.
+ */
+static uint64_t keysearch_scan(const KEYSEARCH_CTX *lpCtx, uint64_t qwBegin, uint64_t qwEnd,
+                               void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity) {
+    KeysearchStreamInitFn fnInit = lpCtx->dwTeaType == 2 ? tea2_key_stream_init : tea3_key_stream_init;
+    KeysearchMatchFn fnMatch = lpCtx->dwTeaType == 2 ? tea2_match_key_stream : tea3_match_key_stream;
+    uint8_t abKeys[KEYSEARCH_BATCH * KEYGEN_KEY_LEN];
+    TeaKeyStream stStream;
+
+    for (uint64_t qwBatch = qwBegin; qwBatch < qwEnd; qwBatch += KEYSEARCH_BATCH) {
+        uint32_t dwCount = qwEnd - qwBatch < KEYSEARCH_BATCH ? qwEnd - qwBatch : KEYSEARCH_BATCH;
+        lpCtx->lpGen->fnFill(lpCtx->lpGen->lpCtx, qwBatch, dwCount, abKeys);
+
+        for (uint32_t i = 0; i < dwCount; i++) {
+            const uint8_t *lpKey = &abKeys[i * KEYGEN_KEY_LEN];
+
+            // Key side of the rounds is generated once per candidate and shared by all filters
+            fnInit(&stStream, lpKey);
+            for (uint32_t f = 0; f < lpCtx->dwNumFilters; f++) {
+                const Tea1Filter *lpFilter = &lpCtx->astFilters[f];
+                if (!fnMatch(&stStream, lpFilter->dwIv, lpFilter->abKs, lpFilter->abMask, lpFilter->dwNumKsBytes)) {
+                    continue;
+                }
+                KeysearchHit stHit = { qwBatch + i, f, lpFilter->dwIv };
+                memcpy(stHit.abKey, lpKey, KEYGEN_KEY_LEN);
+                if (workpool_hits_append(lppHits, lpdwNum, lpdwCapacity, &stHit, sizeof(stHit))) {
+                    return qwBatch + i;
+                }
+            }
+        }
+    }
+    return qwEnd;
+}
+
+uint64_t keysearch_run(KEYSEARCH_CTX *lpCtx, uint64_t qwMaxCandidates) {
+    uint64_t qwBegin = lpCtx->qwNextIndex;
+    uint64_t qwEnd = lpCtx->lpGen->qwNumCandidates;
+    uint32_t dwFirstNew = lpCtx->dwNumHits;
+
+    if (qwEnd - qwBegin > qwMaxCandidates) {
+        qwEnd = qwBegin + qwMaxCandidates;
+    }
+
+    // Out of memory: drop the hits of the candidate that failed so a retry resumes on it
+    uint64_t qwStop = keysearch_scan(lpCtx, qwBegin, qwEnd, &lpCtx->lpHits, &lpCtx->dwNumHits, &lpCtx->dwHitsCapacity);
+    while (qwStop < qwEnd && lpCtx->dwNumHits > dwFirstNew && lpCtx->lpHits[lpCtx->dwNumHits - 1].qwIndex == qwStop) {
+        lpCtx->dwNumHits--;
+    }
+    lpCtx->qwNextIndex = qwStop;
+    return qwStop - qwBegin;
+}
+
+static int keysearch_collect(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd,
+                             void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity) {
+    return keysearch_scan(lpArg, qwBegin, qwEnd, lppHits, lpdwNum, lpdwCapacity) == qwEnd ? 0 : -1;
+}
+
+static int keysearch_cmp_hit(const void *a, const void *b) {
+    const KeysearchHit *x = a;
+    const KeysearchHit *y = b;
+    if (x->qwIndex != y->qwIndex) {
+        return (x->qwIndex > y->qwIndex) - (x->qwIndex < y->qwIndex);
+    }
+    return (x->dwFilter > y->dwFilter) - (x->dwFilter < y->dwFilter);
+}
+
+uint64_t keysearch_run_parallel(KEYSEARCH_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxCandidates) {
+    uint64_t qwBegin = lpCtx->qwNextIndex;
+    uint64_t qwEnd = lpCtx->lpGen->qwNumCandidates;
+
+    if (qwEnd - qwBegin > qwMaxCandidates) {
+        qwEnd = qwBegin + qwMaxCandidates;
+    }
+    if (qwBegin >= qwEnd) {
+        return 0;
+    }
+
+    // A stopped or failed pass is discarded and rescanned later
+    if (workpool_run_collect(lpPool, qwBegin, qwEnd, KEYSEARCH_CHUNK, keysearch_collect, lpCtx,
+                             &lpCtx->lpHits, &lpCtx->dwNumHits, &lpCtx->dwHitsCapacity, sizeof(KeysearchHit), keysearch_cmp_hit)) {
+        return 0;
+    }
+    lpCtx->qwNextIndex = qwEnd;
+    return qwEnd - qwBegin;
+}
@@ -0,0 +1,46 @@
+#ifndef HAVE_KEYSEARCH_H
+#define HAVE_KEYSEARCH_H
+
+#include <inttypes.h>
+
+#include "keygen.h"
+#include "tea1_search.h"
+#include "workpool.h"
+
+#define KEYSEARCH_MAX_FILTERS 64
+
+typedef struct {
+    uint64_t qwIndex;                   // candidate index in the generator
+    uint32_t dwFilter;                  // index of the filter the key reproduced
+    uint32_t dwIv;                      // and its IV
+    uint8_t abKey[KEYGEN_KEY_LEN];
+} KeysearchHit;
+
+/*
+ * Incremental TEA2/TEA3 candidate search over the keys of a generator. Every
+ * filter (same known keystream description as the TEA1 search) is an
+ * independent observation, possibly under a different key: a candidate is a
+ * hit for each filter it reproduces, and is rejected for a filter at its first
+ * mismatching keystream byte. Candidates [0, qwNextIndex) have been scanned.
+ */
+typedef struct {
+    uint32_t dwTeaType;
+    const KeyGenerator *lpGen;
+    Tea1Filter astFilters[KEYSEARCH_MAX_FILTERS];
+    uint32_t dwNumFilters;
+
+    uint64_t qwNextIndex;
+
+    KeysearchHit *lpHits;
+    uint32_t dwNumHits;
+    uint32_t dwHitsCapacity;
+} KEYSEARCH_CTX;
+
+// Returns -1 for an unknown TEA type, no or too many filters, or a filter of 0 or more than TEA_KEY_STREAM_MAX_KS_BYTES bytes
+int keysearch_init(KEYSEARCH_CTX *lpCtx, uint32_t dwTeaType, const KeyGenerator *lpGen, const Tea1Filter *lpFilters, uint32_t dwNumFilters);
+void keysearch_free(KEYSEARCH_CTX *lpCtx);
+uint64_t keysearch_run(KEYSEARCH_CTX *lpCtx, uint64_t qwMaxCandidates);
+uint64_t keysearch_run_parallel(KEYSEARCH_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxCandidates);
+int keysearch_done(const KEYSEARCH_CTX *lpCtx);
+
+#endif /* HAVE_KEYSEARCH_H */
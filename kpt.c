@@ -0,0 +1,201 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "common.h"
+#include "kpt.h"
+#include "tea1_search.h"
+
+
+void kpt_init(KPT_HARVESTER *lpHarvester, const KptTemplate *lpTemplates, uint32_t dwNumTemplates) {
+    memset(lpHarvester, 0, sizeof(*lpHarvester));
+    lpHarvester->lpTemplates = lpTemplates;
+    lpHarvester->dwNumTemplates = dwNumTemplates;
+}
+
+int kpt_derive(const KPT_HARVESTER *lpHarvester, const KptRecord *lpRecord, Tea1Filter *lpFilterOut) {
+    uint32_t dwLen = lpRecord->dwNumBytes;
+    if (dwLen > TEA1_SEARCH_MAX_KS_BYTES) {
+        dwLen = TEA1_SEARCH_MAX_KS_BYTES;
+    }
+
+    memset(lpFilterOut, 0, sizeof(*lpFilterOut));
+    lpFilterOut->dwIv = build_iv((FrameNumbers *)&lpRecord->stFn);
+
+    // Keystream = ciphertext ^ plaintext wherever the plaintext is predictable
+    for (int t = 0; t < lpHarvester->dwNumTemplates; t++) {
+        const KptTemplate *lpTemplate = &lpHarvester->lpTemplates[t];
+        for (int i = 0; i < lpTemplate->dwNumBytes; i++) {
+            uint32_t dwPos = lpTemplate->dwOffset + i;
+            if (dwPos >= dwLen) {
+                break;
+            }
+            uint8_t bMask = lpTemplate->lpMask[i];
+            lpFilterOut->abMask[dwPos] |= bMask;
+            lpFilterOut->abKs[dwPos] = (lpFilterOut->abKs[dwPos] & ~bMask) |
+                ((lpRecord->lpCiphertext[dwPos] ^ lpTemplate->lpPlaintext[i]) & bMask);
+        }
+    }
+
+    // Trim so candidates never generate keystream past the last known bit
+    for (int i = 0; i < dwLen; i++) {
+        lpFilterOut->abKs[i] &= lpFilterOut->abMask[i];
+        if (lpFilterOut->abMask[i]) {
+            lpFilterOut->dwNumKsBytes = i + 1;
+        }
+    }
+
+    return tea1_filter_known_bits(lpFilterOut);
+}
+
+static void kpt_swap(KPT_HARVESTER *lpHarvester, uint32_t a, uint32_t b) {
+    Tea1Filter stTmp = lpHarvester->astConstraints[a];
+    lpHarvester->astConstraints[a] = lpHarvester->astConstraints[b];
+    lpHarvester->astConstraints[b] = stTmp;
+
+    uint32_t dwTmp = lpHarvester->adwKnownBits[a];
+    lpHarvester->adwKnownBits[a] = lpHarvester->adwKnownBits[b];
+    lpHarvester->adwKnownBits[b] = dwTmp;
+}
+
+static void kpt_sift_up(KPT_HARVESTER *lpHarvester, uint32_t i) {
+    while (i > 0 && lpHarvester->adwKnownBits[(i - 1) / 2] > lpHarvester->adwKnownBits[i]) {
+        kpt_swap(lpHarvester, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void kpt_sift_down(KPT_HARVESTER *lpHarvester, uint32_t i) {
+    for (;;) {
+        uint32_t dwMin = i;
+        uint32_t l = 2 * i + 1;
+        uint32_t r = 2 * i + 2;
+        if (l < lpHarvester->dwNumConstraints && lpHarvester->adwKnownBits[l] < lpHarvester->adwKnownBits[dwMin]) {
+            dwMin = l;
+        }
+        if (r < lpHarvester->dwNumConstraints && lpHarvester->adwKnownBits[r] < lpHarvester->adwKnownBits[dwMin]) {
+            dwMin = r;
+        }
+        if (dwMin == i) {
+            return;
+        }
+        kpt_swap(lpHarvester, i, dwMin);
+        i = dwMin;
+    }
+}
+
+static int kpt_merge(KPT_HARVESTER *lpHarvester, uint32_t dwIndex, const Tea1Filter *lpFilter) {
+    Tea1Filter *lpExisting = &lpHarvester->astConstraints[dwIndex];
+
+    // Same IV means same keystream; disagreeing bits mean a bad template match
+    for (int i = 0; i < lpFilter->dwNumKsBytes; i++) {
+        if ((lpExisting->abKs[i] ^ lpFilter->abKs[i]) & lpExisting->abMask[i] & lpFilter->abMask[i]) {
+            return 0;
+        }
+    }
+
+    Tea1Filter stMerged = *lpExisting;
+    for (int i = 0; i < lpFilter->dwNumKsBytes; i++) {
+        stMerged.abKs[i] |= lpFilter->abKs[i];
+        stMerged.abMask[i] |= lpFilter->abMask[i];
+    }
+    if (lpFilter->dwNumKsBytes > stMerged.dwNumKsBytes) {
+        stMerged.dwNumKsBytes = lpFilter->dwNumKsBytes;
+    }
+
+    uint32_t dwBits = tea1_filter_known_bits(&stMerged);
+    if (dwBits == lpHarvester->adwKnownBits[dwIndex]) {
+        return 0;
+    }
+    *lpExisting = stMerged;
+    lpHarvester->adwKnownBits[dwIndex] = dwBits;
+    kpt_sift_down(lpHarvester, dwIndex);
+    return 1;
+}
+
+int kpt_push(KPT_HARVESTER *lpHarvester, const KptRecord *lpRecord) {
+    Tea1Filter stFilter;
+    uint32_t dwBits = kpt_derive(lpHarvester, lpRecord, &stFilter);
+    int bChanged = 0;
+
+    if (dwBits == 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < lpHarvester->dwNumConstraints; i++) {
+        if (lpHarvester->astConstraints[i].dwIv == stFilter.dwIv) {
+            bChanged = kpt_merge(lpHarvester, i, &stFilter);
+            lpHarvester->dwGeneration += bChanged;
+            return bChanged;
+        }
+    }
+
+    if (lpHarvester->dwNumConstraints < KPT_MAX_CONSTRAINTS) {
+        uint32_t i = lpHarvester->dwNumConstraints++;
+        lpHarvester->astConstraints[i] = stFilter;
+        lpHarvester->adwKnownBits[i] = dwBits;
+        kpt_sift_up(lpHarvester, i);
+        bChanged = 1;
+    } else if (dwBits > lpHarvester->adwKnownBits[0]) {
+        // Evict the weakest constraint
+        lpHarvester->astConstraints[0] = stFilter;
+        lpHarvester->adwKnownBits[0] = dwBits;
+        kpt_sift_down(lpHarvester, 0);
+        bChanged = 1;
+    }
+
+    lpHarvester->dwGeneration += bChanged;
+    return bChanged;
+}
+
+uint32_t kpt_get_filters(const KPT_HARVESTER *lpHarvester, Tea1Filter *lpFiltersOut, uint32_t dwMaxFilters) {
+    uint32_t adwOrder[KPT_MAX_CONSTRAINTS];
+    uint32_t dwNum = lpHarvester->dwNumConstraints;
+
+    // Strongest constraint first, so most candidates are rejected by the first filter
+    for (int i = 0; i < dwNum; i++) {
+        int j = i;
+        while (j > 0 && lpHarvester->adwKnownBits[adwOrder[j - 1]] < lpHarvester->adwKnownBits[i]) {
+            adwOrder[j] = adwOrder[j - 1];
+            j--;
+        }
+        adwOrder[j] = i;
+    }
+
+    if (dwNum > dwMaxFilters) {
+        dwNum = dwMaxFilters;
+    }
+    for (int i = 0; i < dwNum; i++) {
+        lpFiltersOut[i] = lpHarvester->astConstraints[adwOrder[i]];
+    }
+    return dwNum;
+}
+
+int kpt_feed_search(KPT_HARVESTER *lpHarvester, TEA1_SEARCH_CTX *lpSearch) {
+    Tea1Filter astFilters[KPT_MAX_CONSTRAINTS];
+
+    if (lpHarvester->dwGeneration == lpHarvester->dwPublished) {
+        return 0;
+    }
+
+    uint32_t dwNum = kpt_get_filters(lpHarvester, astFilters, KPT_MAX_CONSTRAINTS);
+    if (tea1_search_set_filters(lpSearch, astFilters, dwNum)) {
+        return 0;
+    }
+    lpHarvester->dwPublished = lpHarvester->dwGeneration;
+    return 1;
+}
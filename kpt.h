@@ -0,0 +1,48 @@
+#ifndef HAVE_KPT_H
+#define HAVE_KPT_H
+
+#include <inttypes.h>
+
+#include "common.h"
+#include "tea1_search.h"
+
+/*
+ * Known-plaintext harvester: turns encrypted bursts with predictable header
+ * fields into keystream constraints for the TEA1 reduced-key search.
+ */
+#define KPT_MAX_CONSTRAINTS TEA1_SEARCH_MAX_FILTERS
+
+typedef struct {
+    FrameNumbers stFn;
+    uint32_t dwNumBytes;
+    const uint8_t *lpCiphertext;
+} KptRecord;
+
+// Plaintext bits that are known for every burst fed to the harvester
+typedef struct {
+    uint32_t dwOffset;   // byte offset into the burst
+    uint32_t dwNumBytes;
+    const uint8_t *lpMask;
+    const uint8_t *lpPlaintext;
+} KptTemplate;
+
+typedef struct {
+    const KptTemplate *lpTemplates;
+    uint32_t dwNumTemplates;
+
+    // Min-heap on known bits, at most one constraint per IV
+    Tea1Filter astConstraints[KPT_MAX_CONSTRAINTS];
+    uint32_t adwKnownBits[KPT_MAX_CONSTRAINTS];
+    uint32_t dwNumConstraints;
+
+    uint32_t dwGeneration;  // bumped whenever the retained set changes
+    uint32_t dwPublished;   // generation last handed to a search
+} KPT_HARVESTER;
+
+void kpt_init(KPT_HARVESTER *lpHarvester, const KptTemplate *lpTemplates, uint32_t dwNumTemplates);
+int kpt_derive(const KPT_HARVESTER *lpHarvester, const KptRecord *lpRecord, Tea1Filter *lpFilterOut);
+int kpt_push(KPT_HARVESTER *lpHarvester, const KptRecord *lpRecord);
+uint32_t kpt_get_filters(const KPT_HARVESTER *lpHarvester, Tea1Filter *lpFiltersOut, uint32_t dwMaxFilters);
+int kpt_feed_search(KPT_HARVESTER *lpHarvester, TEA1_SEARCH_CTX *lpSearch);
+
+#endif /* HAVE_KPT_H */
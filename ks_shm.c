@@ -0,0 +1,778 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "ks_shm.h"
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+
+#define CACHE_LINE 64
+
+#define KS_SHM_MAGIC        0x4D48534B  // "KSHM"
+#define KS_SHM_VERSION      1
+#define KS_SHM_SPIN         1000        // idle rounds before a worker goes to sleep
+#define KS_SHM_SLEEP_NS     10000000
+#define KS_SHM_POLL_MS      100         // control thread shutdown latency
+#define KS_SHM_CLIENT_KEYS  64
+#define KS_SHM_CLIENT_SPIN  256         // busy polls of a request before yielding the cpu
+
+#define KS_SHM_CMD_LOAD     1
+#define KS_SHM_CMD_UNLOAD   2
+
+/*
+ * Request slot life cycle: a client moves it FREE -> CLAIMED by CAS, fills
+ * it in and publishes REQUEST. A worker takes it REQUEST -> BUSY by CAS and
+ * publishes DONE, after which the client reads the result and frees it. A
+ * client that times out takes its request back with REQUEST -> FREE, or, if
+ * a worker already has it, hands it over with BUSY -> ABANDONED; the worker
+ * then frees the slot instead of publishing DONE.
+ */
+enum {
+    KS_SLOT_FREE,
+    KS_SLOT_CLAIMED,
+    KS_SLOT_REQUEST,
+    KS_SLOT_BUSY,
+    KS_SLOT_DONE,
+    KS_SLOT_ABANDONED,
+};
+
+typedef struct {
+    _Atomic uint32_t dwState;
+    uint32_t dwKeyId;
+    uint32_t dwGen;
+    uint32_t dwIv;
+    uint32_t dwNumKsBytes;
+    int32_t iResult;
+    uint8_t abKs[KS_SHM_MAX_KS_BYTES];
+} __attribute__((aligned(CACHE_LINE))) KsShmSlot;
+
+// Seqlock protected, dwSeq is odd while a worker rewrites the entry
+typedef struct {
+    _Atomic uint32_t dwSeq;
+    uint32_t dwKeyId;
+    uint32_t dwGen;
+    uint32_t dwIv;
+    uint32_t dwNumKsBytes;
+    uint8_t abKs[KS_SHM_MAX_KS_BYTES];
+} __attribute__((aligned(CACHE_LINE))) KsShmCacheEntry;
+
+typedef struct {
+    uint32_t dwMagic;                   // written last by the daemon
+    uint32_t dwVersion;
+
+    _Atomic uint32_t dwSleepers __attribute__((aligned(CACHE_LINE)));
+    _Atomic uint32_t dwWakeSeq;         // futex word idle workers wait on
+
+    KsShmSlot astSlots[KS_SHM_NUM_SLOTS];
+    KsShmCacheEntry astCache[KS_SHM_CACHE_ENTRIES];
+} KsShmRegion;
+
+// Control messages, one per SOCK_SEQPACKET datagram
+typedef struct {
+    uint32_t dwCmd;
+    uint32_t dwTeaType;
+    uint32_t dwKeyId;
+    uint8_t abKey[10];
+} KsShmCtlRequest;
+
+typedef struct {
+    int32_t iResult;
+    uint32_t dwKeyId;
+    uint32_t dwGen;
+} KsShmCtlResponse;
+
+/*
+ * Daemon side key. dwGen is odd while the key is loaded and bumped on every
+ * load and unload; workers only use abKey when dwGen matches the request
+ * before and after copying it.
+ */
+typedef struct {
+    _Atomic uint32_t dwGen;
+    uint32_t dwTeaType;
+    uint32_t dwRefs;
+    uint8_t abKey[10];
+} KsShmKey;
+
+typedef struct {
+    pthread_t hThread;
+    uint32_t dwIndex;
+    struct KS_SHM_SERVER *lpServer;
+} __attribute__((aligned(CACHE_LINE))) KsShmWorker;
+
+struct KS_SHM_SERVER {
+    KsShmRegion *lpRegion;
+    char szShmName[256];
+    char szSocketPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int fdListen;
+
+    KsShmWorker *lpWorkers;
+    uint32_t dwNumWorkers;
+    pthread_t hControl;
+    int bControlStarted;
+    atomic_int bShutdown;
+    _Atomic uint32_t dwDelayUs;
+
+    // Only the control thread changes keys and connections
+    KsShmKey astKeys[KS_SHM_MAX_KEYS];
+    int afdClients[KS_SHM_MAX_CLIENTS];
+    uint16_t aawClientRefs[KS_SHM_MAX_CLIENTS][KS_SHM_MAX_KEYS];
+
+    _Atomic uint64_t qwRequests;
+    _Atomic uint64_t qwCacheHits;
+    _Atomic uint64_t qwRejected;
+    _Atomic uint64_t qwAbandoned;
+};
+
+typedef struct {
+    int bLoaded;
+    uint32_t dwTeaType;
+    uint8_t abKey[10];
+    int iKeyId;                         // daemon key id, -1 if the daemon doesn't know the key
+    uint32_t dwGen;
+} KsShmClientKey;
+
+struct KS_SHM_CLIENT {
+    KsShmRegion *lpRegion;
+    int fdControl;
+    int bConnected;
+    uint32_t dwNextSlot;
+    KsShmClientKey astKeys[KS_SHM_CLIENT_KEYS];
+    KsShmClientStats stStats;
+};
+
+static uint64_t ks_shm_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void ks_shm_generate(uint32_t dwTeaType, const uint8_t *lpKey, uint32_t dwIv, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    switch (dwTeaType) {
+        case 1: tea1(dwIv, (uint8_t *)lpKey, dwNumKsBytes, lpKsOut); break;
+        case 2: tea2(dwIv, (uint8_t *)lpKey, dwNumKsBytes, lpKsOut); break;
+        case 3: tea3(dwIv, (uint8_t *)lpKey, dwNumKsBytes, lpKsOut); break;
+    }
+}
+
+static KsShmCacheEntry *ks_shm_cache_entry(KsShmRegion *lpRegion, uint32_t dwKeyId, uint32_t dwIv) {
+    uint32_t dwHash = (dwIv ^ (dwKeyId * 0x9E3779B9)) * 0x85EBCA6B;
+    return &lpRegion->astCache[(dwHash >> 16) & (KS_SHM_CACHE_ENTRIES - 1)];
+}
+
+// Returns 1 and fills lpKsOut if the entry holds at least dwNumKsBytes of this keystream
+static int ks_shm_cache_read(KsShmRegion *lpRegion, uint32_t dwKeyId, uint32_t dwGen, uint32_t dwIv, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    KsShmCacheEntry *lpEntry = ks_shm_cache_entry(lpRegion, dwKeyId, dwIv);
+    uint32_t dwSeq = atomic_load_explicit(&lpEntry->dwSeq, memory_order_acquire);
+    if ((dwSeq & 1) || lpEntry->dwKeyId != dwKeyId || lpEntry->dwGen != dwGen ||
+            lpEntry->dwIv != dwIv || lpEntry->dwNumKsBytes < dwNumKsBytes) {
+        return 0;
+    }
+    memcpy(lpKsOut, lpEntry->abKs, dwNumKsBytes);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&lpEntry->dwSeq, memory_order_relaxed) == dwSeq;
+}
+
+// Writers race for the entry, a worker that loses just doesn't cache its result
+static void ks_shm_cache_write(KsShmRegion *lpRegion, uint32_t dwKeyId, uint32_t dwGen, uint32_t dwIv, uint32_t dwNumKsBytes, const uint8_t *lpKs) {
+    KsShmCacheEntry *lpEntry = ks_shm_cache_entry(lpRegion, dwKeyId, dwIv);
+    uint32_t dwSeq = atomic_load_explicit(&lpEntry->dwSeq, memory_order_relaxed);
+    if ((dwSeq & 1) || !atomic_compare_exchange_strong_explicit(&lpEntry->dwSeq, &dwSeq, dwSeq + 1, memory_order_acquire, memory_order_relaxed)) {
+        return;
+    }
+    atomic_thread_fence(memory_order_release);
+    lpEntry->dwKeyId = dwKeyId;
+    lpEntry->dwGen = dwGen;
+    lpEntry->dwIv = dwIv;
+    lpEntry->dwNumKsBytes = dwNumKsBytes;
+    memcpy(lpEntry->abKs, lpKs, dwNumKsBytes);
+    atomic_store_explicit(&lpEntry->dwSeq, dwSeq + 2, memory_order_release);
+}
+
+static long ks_shm_futex(_Atomic uint32_t *lpdwWord, int iOp, uint32_t dwVal, const struct timespec *lpTimeout) {
+    return syscall(SYS_futex, lpdwWord, iOp, dwVal, lpTimeout, NULL, 0);
+}
+
+static void ks_shm_server_process(KS_SHM_SERVER *lpServer, KsShmSlot *lpSlot) {
+    KsShmRegion *lpRegion = lpServer->lpRegion;
+    uint8_t abKey[10];
+
+    lpSlot->iResult = -1;
+    if (lpSlot->dwKeyId >= KS_SHM_MAX_KEYS || lpSlot->dwNumKsBytes > KS_SHM_MAX_KS_BYTES) {
+        atomic_fetch_add_explicit(&lpServer->qwRejected, 1, memory_order_relaxed);
+        return;
+    }
+
+    // The key may be unloaded and replaced while it is copied, the generation tells
+    KsShmKey *lpKey = &lpServer->astKeys[lpSlot->dwKeyId];
+    uint32_t dwGen = atomic_load_explicit(&lpKey->dwGen, memory_order_acquire);
+    uint32_t dwTeaType = lpKey->dwTeaType;
+    memcpy(abKey, lpKey->abKey, sizeof(abKey));
+    atomic_thread_fence(memory_order_acquire);
+    if (!(dwGen & 1) || dwGen != lpSlot->dwGen || atomic_load_explicit(&lpKey->dwGen, memory_order_relaxed) != dwGen) {
+        atomic_fetch_add_explicit(&lpServer->qwRejected, 1, memory_order_relaxed);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&lpServer->qwRequests, 1, memory_order_relaxed);
+    if (ks_shm_cache_read(lpRegion, lpSlot->dwKeyId, dwGen, lpSlot->dwIv, lpSlot->dwNumKsBytes, lpSlot->abKs)) {
+        atomic_fetch_add_explicit(&lpServer->qwCacheHits, 1, memory_order_relaxed);
+    } else {
+        ks_shm_generate(dwTeaType, abKey, lpSlot->dwIv, lpSlot->dwNumKsBytes, lpSlot->abKs);
+        ks_shm_cache_write(lpRegion, lpSlot->dwKeyId, dwGen, lpSlot->dwIv, lpSlot->dwNumKsBytes, lpSlot->abKs);
+    }
+    lpSlot->iResult = 0;
+}
+
+static int ks_shm_server_pending(KsShmRegion *lpRegion) {
+    for (uint32_t i = 0; i < KS_SHM_NUM_SLOTS; i++) {
+        if (atomic_load_explicit(&lpRegion->astSlots[i].dwState, memory_order_relaxed) == KS_SLOT_REQUEST) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *ks_shm_worker_thread(void *lpArg) {
+    KsShmWorker *lpWorker = lpArg;
+    KS_SHM_SERVER *lpServer = lpWorker->lpServer;
+    KsShmRegion *lpRegion = lpServer->lpRegion;
+    uint32_t dwIdle = 0;
+
+    for (;;) {
+        uint32_t dwServed = 0;
+
+        // Workers scan from different slots so they rarely contend for the same request
+        for (uint32_t n = 0; n < KS_SHM_NUM_SLOTS; n++) {
+            KsShmSlot *lpSlot = &lpRegion->astSlots[(n + lpWorker->dwIndex * 7) % KS_SHM_NUM_SLOTS];
+            uint32_t dwState = KS_SLOT_REQUEST;
+            if (atomic_load_explicit(&lpSlot->dwState, memory_order_relaxed) != KS_SLOT_REQUEST ||
+                    !atomic_compare_exchange_strong_explicit(&lpSlot->dwState, &dwState, KS_SLOT_BUSY, memory_order_acquire, memory_order_relaxed)) {
+                continue;
+            }
+            uint32_t dwDelayUs = atomic_load_explicit(&lpServer->dwDelayUs, memory_order_relaxed);
+            if (dwDelayUs) {
+                struct timespec ts = { dwDelayUs / 1000000, dwDelayUs % 1000000 * 1000 };
+                nanosleep(&ts, NULL);
+            }
+            ks_shm_server_process(lpServer, lpSlot);
+
+            // The client gave up waiting, so nobody will read the result and free the slot but us
+            dwState = KS_SLOT_BUSY;
+            if (!atomic_compare_exchange_strong_explicit(&lpSlot->dwState, &dwState, KS_SLOT_DONE, memory_order_release, memory_order_relaxed)) {
+                atomic_fetch_add_explicit(&lpServer->qwAbandoned, 1, memory_order_relaxed);
+                atomic_store_explicit(&lpSlot->dwState, KS_SLOT_FREE, memory_order_release);
+            }
+            dwServed++;
+        }
+        if (dwServed) {
+            dwIdle = 0;
+            continue;
+        }
+        if (atomic_load_explicit(&lpServer->bShutdown, memory_order_acquire)) {
+            break;
+        }
+        if (++dwIdle < KS_SHM_SPIN) {
+            sched_yield();
+            continue;
+        }
+
+        // Announce the sleep before the last look at the slots, clients check the count after posting
+        uint32_t dwWakeSeq = atomic_load(&lpRegion->dwWakeSeq);
+        atomic_fetch_add(&lpRegion->dwSleepers, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!ks_shm_server_pending(lpRegion) && !atomic_load(&lpServer->bShutdown)) {
+            struct timespec ts = { 0, KS_SHM_SLEEP_NS };
+            ks_shm_futex(&lpRegion->dwWakeSeq, FUTEX_WAIT, dwWakeSeq, &ts);
+        }
+        atomic_fetch_sub(&lpRegion->dwSleepers, 1);
+        dwIdle = 0;
+    }
+    return NULL;
+}
+
+static void ks_shm_server_unref(KS_SHM_SERVER *lpServer, uint32_t dwKeyId) {
+    KsShmKey *lpKey = &lpServer->astKeys[dwKeyId];
+    if (--lpKey->dwRefs == 0) {
+        atomic_store_explicit(&lpKey->dwGen, lpKey->dwGen + 1, memory_order_release);
+    }
+}
+
+static void ks_shm_server_command(KS_SHM_SERVER *lpServer, uint32_t dwClient, const KsShmCtlRequest *lpRequest, KsShmCtlResponse *lpResponse) {
+    lpResponse->iResult = -1;
+    lpResponse->dwKeyId = 0;
+    lpResponse->dwGen = 0;
+
+    if (lpRequest->dwCmd == KS_SHM_CMD_LOAD) {
+        if (lpRequest->dwTeaType < 1 || lpRequest->dwTeaType > 3) {
+            return;
+        }
+        // Reuse the id of an identical loaded key, otherwise take the first unused one
+        int iFree = -1, iKeyId = -1;
+        for (int i = 0; i < KS_SHM_MAX_KEYS && iKeyId < 0; i++) {
+            KsShmKey *lpKey = &lpServer->astKeys[i];
+            if (lpKey->dwRefs == 0) {
+                iFree = iFree < 0 ? i : iFree;
+            } else if (lpKey->dwTeaType == lpRequest->dwTeaType && !memcmp(lpKey->abKey, lpRequest->abKey, sizeof(lpKey->abKey))) {
+                iKeyId = i;
+            }
+        }
+        if (iKeyId < 0 && iFree >= 0) {
+            KsShmKey *lpKey = &lpServer->astKeys[iFree];
+            lpKey->dwTeaType = lpRequest->dwTeaType;
+            memcpy(lpKey->abKey, lpRequest->abKey, sizeof(lpKey->abKey));
+            atomic_store_explicit(&lpKey->dwGen, lpKey->dwGen + 1, memory_order_release);
+            iKeyId = iFree;
+        }
+        if (iKeyId < 0 || lpServer->aawClientRefs[dwClient][iKeyId] == UINT16_MAX) {
+            return;
+        }
+        lpServer->astKeys[iKeyId].dwRefs++;
+        lpServer->aawClientRefs[dwClient][iKeyId]++;
+        lpResponse->iResult = 0;
+        lpResponse->dwKeyId = iKeyId;
+        lpResponse->dwGen = atomic_load(&lpServer->astKeys[iKeyId].dwGen);
+    } else if (lpRequest->dwCmd == KS_SHM_CMD_UNLOAD) {
+        if (lpRequest->dwKeyId >= KS_SHM_MAX_KEYS || lpServer->aawClientRefs[dwClient][lpRequest->dwKeyId] == 0) {
+            return;
+        }
+        lpServer->aawClientRefs[dwClient][lpRequest->dwKeyId]--;
+        ks_shm_server_unref(lpServer, lpRequest->dwKeyId);
+        lpResponse->iResult = 0;
+    }
+}
+
+// A client that goes away drops every key it still holds
+static void ks_shm_server_disconnect(KS_SHM_SERVER *lpServer, uint32_t dwClient) {
+    for (uint32_t i = 0; i < KS_SHM_MAX_KEYS; i++) {
+        while (lpServer->aawClientRefs[dwClient][i]) {
+            lpServer->aawClientRefs[dwClient][i]--;
+            ks_shm_server_unref(lpServer, i);
+        }
+    }
+    close(lpServer->afdClients[dwClient]);
+    lpServer->afdClients[dwClient] = -1;
+}
+
+static void *ks_shm_control_thread(void *lpArg) {
+    KS_SHM_SERVER *lpServer = lpArg;
+    struct pollfd astPoll[KS_SHM_MAX_CLIENTS + 1];
+
+    while (!atomic_load(&lpServer->bShutdown)) {
+        astPoll[0].fd = lpServer->fdListen;
+        astPoll[0].events = POLLIN;
+        for (uint32_t i = 0; i < KS_SHM_MAX_CLIENTS; i++) {
+            astPoll[i + 1].fd = lpServer->afdClients[i];
+            astPoll[i + 1].events = POLLIN;
+        }
+        if (poll(astPoll, KS_SHM_MAX_CLIENTS + 1, KS_SHM_POLL_MS) <= 0) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < KS_SHM_MAX_CLIENTS; i++) {
+            if (lpServer->afdClients[i] < 0 || !astPoll[i + 1].revents) {
+                continue;
+            }
+            KsShmCtlRequest stRequest;
+            KsShmCtlResponse stResponse;
+            ssize_t iLen = recv(lpServer->afdClients[i], &stRequest, sizeof(stRequest), MSG_DONTWAIT);
+            if (iLen < 0 && (errno == EAGAIN || errno == EINTR)) {
+                continue;
+            }
+            if (iLen != sizeof(stRequest)) {
+                ks_shm_server_disconnect(lpServer, i);
+                continue;
+            }
+            ks_shm_server_command(lpServer, i, &stRequest, &stResponse);
+            if (send(lpServer->afdClients[i], &stResponse, sizeof(stResponse), MSG_NOSIGNAL) != sizeof(stResponse)) {
+                ks_shm_server_disconnect(lpServer, i);
+            }
+        }
+
+        if (astPoll[0].revents & POLLIN) {
+            int fdClient = accept4(lpServer->fdListen, NULL, NULL, SOCK_CLOEXEC);
+            if (fdClient < 0) {
+                continue;
+            }
+            uint32_t i = 0;
+            while (i < KS_SHM_MAX_CLIENTS && lpServer->afdClients[i] >= 0) {
+                i++;
+            }
+            if (i == KS_SHM_MAX_CLIENTS) {
+                close(fdClient);
+                continue;
+            }
+            lpServer->afdClients[i] = fdClient;
+            memset(lpServer->aawClientRefs[i], 0, sizeof(lpServer->aawClientRefs[i]));
+        }
+    }
+    return NULL;
+}
+
+KS_SHM_SERVER *ks_shm_server_create(const char *lpszShmName, const char *lpszSocketPath, uint32_t dwNumWorkers) {
+    struct sockaddr_un stAddr;
+
+    if (strlen(lpszShmName) >= sizeof(((KS_SHM_SERVER *)0)->szShmName) || strlen(lpszSocketPath) >= sizeof(stAddr.sun_path)) {
+        return NULL;
+    }
+    if (dwNumWorkers == 0) {
+        dwNumWorkers = 1;
+    }
+
+    KS_SHM_SERVER *lpServer = calloc(1, sizeof(KS_SHM_SERVER));
+    if (lpServer == NULL) {
+        return NULL;
+    }
+    strcpy(lpServer->szShmName, lpszShmName);
+    strcpy(lpServer->szSocketPath, lpszSocketPath);
+    lpServer->fdListen = -1;
+    lpServer->lpRegion = MAP_FAILED;
+    for (uint32_t i = 0; i < KS_SHM_MAX_CLIENTS; i++) {
+        lpServer->afdClients[i] = -1;
+    }
+
+    // A segment left behind by a daemon that died is replaced, clients still mapping it time out
+    shm_unlink(lpszShmName);
+    int fdShm = shm_open(lpszShmName, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fdShm < 0) {
+        free(lpServer);
+        return NULL;
+    }
+    if (ftruncate(fdShm, sizeof(KsShmRegion)) == 0) {
+        lpServer->lpRegion = mmap(NULL, sizeof(KsShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fdShm, 0);
+    }
+    close(fdShm);
+    if (lpServer->lpRegion == MAP_FAILED) {
+        shm_unlink(lpszShmName);
+        free(lpServer);
+        return NULL;
+    }
+    lpServer->lpRegion->dwVersion = KS_SHM_VERSION;
+
+    memset(&stAddr, 0, sizeof(stAddr));
+    stAddr.sun_family = AF_UNIX;
+    strcpy(stAddr.sun_path, lpszSocketPath);
+    unlink(lpszSocketPath);
+    lpServer->fdListen = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (lpServer->fdListen < 0 || bind(lpServer->fdListen, (struct sockaddr *)&stAddr, sizeof(stAddr)) != 0 ||
+            listen(lpServer->fdListen, 16) != 0) {
+        ks_shm_server_destroy(lpServer);
+        return NULL;
+    }
+
+    lpServer->lpWorkers = aligned_alloc(CACHE_LINE, dwNumWorkers * sizeof(KsShmWorker));
+    if (lpServer->lpWorkers == NULL) {
+        ks_shm_server_destroy(lpServer);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < dwNumWorkers; i++) {
+        KsShmWorker *lpWorker = &lpServer->lpWorkers[i];
+        lpWorker->dwIndex = i;
+        lpWorker->lpServer = lpServer;
+        if (pthread_create(&lpWorker->hThread, NULL, ks_shm_worker_thread, lpWorker) != 0) {
+            ks_shm_server_destroy(lpServer);
+            return NULL;
+        }
+        lpServer->dwNumWorkers = i + 1;
+    }
+    if (pthread_create(&lpServer->hControl, NULL, ks_shm_control_thread, lpServer) != 0) {
+        ks_shm_server_destroy(lpServer);
+        return NULL;
+    }
+    lpServer->bControlStarted = 1;
+
+    // Clients ignore the segment until the magic is there
+    __atomic_store_n(&lpServer->lpRegion->dwMagic, KS_SHM_MAGIC, __ATOMIC_RELEASE);
+    return lpServer;
+}
+
+void ks_shm_server_destroy(KS_SHM_SERVER *lpServer) {
+    atomic_store(&lpServer->bShutdown, 1);
+    if (lpServer->lpRegion != MAP_FAILED) {
+        atomic_fetch_add(&lpServer->lpRegion->dwWakeSeq, 1);
+        ks_shm_futex(&lpServer->lpRegion->dwWakeSeq, FUTEX_WAKE, INT32_MAX, NULL);
+    }
+    for (uint32_t i = 0; i < lpServer->dwNumWorkers; i++) {
+        pthread_join(lpServer->lpWorkers[i].hThread, NULL);
+    }
+    if (lpServer->bControlStarted) {
+        pthread_join(lpServer->hControl, NULL);
+    }
+    for (uint32_t i = 0; i < KS_SHM_MAX_CLIENTS; i++) {
+        if (lpServer->afdClients[i] >= 0) {
+            close(lpServer->afdClients[i]);
+        }
+    }
+    if (lpServer->fdListen >= 0) {
+        close(lpServer->fdListen);
+        unlink(lpServer->szSocketPath);
+    }
+    if (lpServer->lpRegion != MAP_FAILED) {
+        munmap(lpServer->lpRegion, sizeof(KsShmRegion));
+        shm_unlink(lpServer->szShmName);
+    }
+    free(lpServer->lpWorkers);
+    free(lpServer);
+}
+
+void ks_shm_server_get_stats(KS_SHM_SERVER *lpServer, KsShmServerStats *lpStats) {
+    lpStats->qwRequests = atomic_load(&lpServer->qwRequests);
+    lpStats->qwCacheHits = atomic_load(&lpServer->qwCacheHits);
+    lpStats->qwRejected = atomic_load(&lpServer->qwRejected);
+    lpStats->qwAbandoned = atomic_load(&lpServer->qwAbandoned);
+}
+
+void ks_shm_server_set_delay(KS_SHM_SERVER *lpServer, uint32_t dwDelayUs) {
+    atomic_store_explicit(&lpServer->dwDelayUs, dwDelayUs, memory_order_relaxed);
+}
+
+static void ks_shm_client_disconnect(KS_SHM_CLIENT *lpClient) {
+    lpClient->bConnected = 0;
+    if (lpClient->fdControl >= 0) {
+        close(lpClient->fdControl);
+        lpClient->fdControl = -1;
+    }
+    for (uint32_t i = 0; i < KS_SHM_CLIENT_KEYS; i++) {
+        lpClient->astKeys[i].iKeyId = -1;
+    }
+}
+
+static int ks_shm_client_call(KS_SHM_CLIENT *lpClient, const KsShmCtlRequest *lpRequest, KsShmCtlResponse *lpResponse) {
+    if (!lpClient->bConnected) {
+        return -1;
+    }
+    if (send(lpClient->fdControl, lpRequest, sizeof(*lpRequest), MSG_NOSIGNAL) != sizeof(*lpRequest) ||
+            recv(lpClient->fdControl, lpResponse, sizeof(*lpResponse), 0) != sizeof(*lpResponse)) {
+        ks_shm_client_disconnect(lpClient);
+        return -1;
+    }
+    return lpResponse->iResult;
+}
+
+KS_SHM_CLIENT *ks_shm_client_open(const char *lpszShmName, const char *lpszSocketPath) {
+    struct sockaddr_un stAddr;
+    struct stat st;
+
+    KS_SHM_CLIENT *lpClient = calloc(1, sizeof(KS_SHM_CLIENT));
+    if (lpClient == NULL) {
+        return NULL;
+    }
+    lpClient->fdControl = -1;
+    for (uint32_t i = 0; i < KS_SHM_CLIENT_KEYS; i++) {
+        lpClient->astKeys[i].iKeyId = -1;
+    }
+
+    // Anything missing or mismatched leaves the client generating keystream in process
+    int fdShm = shm_open(lpszShmName, O_RDWR, 0);
+    if (fdShm < 0) {
+        return lpClient;
+    }
+    if (fstat(fdShm, &st) == 0 && st.st_size == sizeof(KsShmRegion)) {
+        void *lpMap = mmap(NULL, sizeof(KsShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fdShm, 0);
+        lpClient->lpRegion = lpMap == MAP_FAILED ? NULL : lpMap;
+    }
+    close(fdShm);
+    if (lpClient->lpRegion == NULL) {
+        return lpClient;
+    }
+    if (__atomic_load_n(&lpClient->lpRegion->dwMagic, __ATOMIC_ACQUIRE) != KS_SHM_MAGIC ||
+            lpClient->lpRegion->dwVersion != KS_SHM_VERSION || strlen(lpszSocketPath) >= sizeof(stAddr.sun_path)) {
+        return lpClient;
+    }
+
+    memset(&stAddr, 0, sizeof(stAddr));
+    stAddr.sun_family = AF_UNIX;
+    strcpy(stAddr.sun_path, lpszSocketPath);
+    lpClient->fdControl = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (lpClient->fdControl < 0 || connect(lpClient->fdControl, (struct sockaddr *)&stAddr, sizeof(stAddr)) != 0) {
+        ks_shm_client_disconnect(lpClient);
+        return lpClient;
+    }
+    lpClient->bConnected = 1;
+    return lpClient;
+}
+
+void ks_shm_client_close(KS_SHM_CLIENT *lpClient) {
+    // Closing the control socket drops the client's keys in the daemon
+    ks_shm_client_disconnect(lpClient);
+    if (lpClient->lpRegion) {
+        munmap(lpClient->lpRegion, sizeof(KsShmRegion));
+    }
+    free(lpClient);
+}
+
+int ks_shm_client_connected(const KS_SHM_CLIENT *lpClient) {
+    return lpClient->bConnected;
+}
+
+int ks_shm_client_load_key(KS_SHM_CLIENT *lpClient, uint32_t dwTeaType, const uint8_t *lpKey) {
+    if (dwTeaType < 1 || dwTeaType > 3) {
+        return -1;
+    }
+    int iHandle = 0;
+    while (iHandle < KS_SHM_CLIENT_KEYS && lpClient->astKeys[iHandle].bLoaded) {
+        iHandle++;
+    }
+    if (iHandle == KS_SHM_CLIENT_KEYS) {
+        return -1;
+    }
+
+    KsShmClientKey *lpClientKey = &lpClient->astKeys[iHandle];
+    lpClientKey->bLoaded = 1;
+    lpClientKey->dwTeaType = dwTeaType;
+    memcpy(lpClientKey->abKey, lpKey, sizeof(lpClientKey->abKey));
+    lpClientKey->iKeyId = -1;
+
+    // A daemon that can't take the key (e.g. all ids in use) only costs the sharing
+    KsShmCtlRequest stRequest = { KS_SHM_CMD_LOAD, dwTeaType, 0 };
+    KsShmCtlResponse stResponse;
+    memcpy(stRequest.abKey, lpKey, sizeof(stRequest.abKey));
+    if (ks_shm_client_call(lpClient, &stRequest, &stResponse) == 0) {
+        lpClientKey->iKeyId = stResponse.dwKeyId;
+        lpClientKey->dwGen = stResponse.dwGen;
+    }
+    return iHandle;
+}
+
+int ks_shm_client_unload_key(KS_SHM_CLIENT *lpClient, int iHandle) {
+    if (iHandle < 0 || iHandle >= KS_SHM_CLIENT_KEYS || !lpClient->astKeys[iHandle].bLoaded) {
+        return -1;
+    }
+    KsShmClientKey *lpClientKey = &lpClient->astKeys[iHandle];
+    if (lpClientKey->iKeyId >= 0) {
+        KsShmCtlRequest stRequest = { KS_SHM_CMD_UNLOAD, 0, lpClientKey->iKeyId };
+        KsShmCtlResponse stResponse;
+        ks_shm_client_call(lpClient, &stRequest, &stResponse);
+    }
+    memset(lpClientKey, 0, sizeof(*lpClientKey));
+    lpClientKey->iKeyId = -1;
+    return 0;
+}
+
+// Returns 0 if the daemon answered, -1 to fall back to local generation
+static int ks_shm_client_request(KS_SHM_CLIENT *lpClient, const KsShmClientKey *lpClientKey, uint32_t dwIv, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    KsShmRegion *lpRegion = lpClient->lpRegion;
+    KsShmSlot *lpSlot = NULL;
+
+    for (uint32_t n = 0; n < KS_SHM_NUM_SLOTS && lpSlot == NULL; n++) {
+        KsShmSlot *lpCandidate = &lpRegion->astSlots[lpClient->dwNextSlot++ % KS_SHM_NUM_SLOTS];
+        uint32_t dwState = KS_SLOT_FREE;
+        if (atomic_compare_exchange_strong_explicit(&lpCandidate->dwState, &dwState, KS_SLOT_CLAIMED, memory_order_acquire, memory_order_relaxed)) {
+            lpSlot = lpCandidate;
+        }
+    }
+    if (lpSlot == NULL) {
+        return -1;
+    }
+    lpSlot->dwKeyId = lpClientKey->iKeyId;
+    lpSlot->dwGen = lpClientKey->dwGen;
+    lpSlot->dwIv = dwIv;
+    lpSlot->dwNumKsBytes = dwNumKsBytes;
+    atomic_store_explicit(&lpSlot->dwState, KS_SLOT_REQUEST, memory_order_release);
+
+    // Only an idle daemon costs a syscall
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&lpRegion->dwSleepers, memory_order_relaxed)) {
+        atomic_fetch_add(&lpRegion->dwWakeSeq, 1);
+        ks_shm_futex(&lpRegion->dwWakeSeq, FUTEX_WAKE, 1, NULL);
+    }
+
+    /*
+     * A busy daemon answers within microseconds, so poll without giving up
+     * the cpu first. Yield after that, the daemon may need this very cpu.
+     */
+    uint64_t qwDeadline = 0;
+    for (uint32_t dwSpin = 0; atomic_load_explicit(&lpSlot->dwState, memory_order_acquire) != KS_SLOT_DONE; dwSpin++) {
+        if (dwSpin < KS_SHM_CLIENT_SPIN) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            continue;
+        }
+        sched_yield();
+        if ((dwSpin & 255) != 0) {
+            continue;
+        }
+        uint64_t qwNow = ks_shm_now_ns();
+        if (qwDeadline == 0) {
+            qwDeadline = qwNow + KS_SHM_TIMEOUT_NS;
+            continue;
+        }
+        if (qwNow < qwDeadline) {
+            continue;
+        }
+        // Nobody took the request: the daemon is gone or wedged, stop talking to it
+        uint32_t dwState = KS_SLOT_REQUEST;
+        if (atomic_compare_exchange_strong(&lpSlot->dwState, &dwState, KS_SLOT_FREE)) {
+            ks_shm_client_disconnect(lpClient);
+            return -1;
+        }
+        // A worker is on it but slow: leave the slot for it to free and generate this one locally
+        if (dwState == KS_SLOT_BUSY && atomic_compare_exchange_strong(&lpSlot->dwState, &dwState, KS_SLOT_ABANDONED)) {
+            return -1;
+        }
+    }
+
+    int iResult = lpSlot->iResult;
+    if (iResult == 0) {
+        memcpy(lpKsOut, lpSlot->abKs, dwNumKsBytes);
+    }
+    atomic_store_explicit(&lpSlot->dwState, KS_SLOT_FREE, memory_order_release);
+    return iResult;
+}
+
+int ks_shm_client_keystream(KS_SHM_CLIENT *lpClient, int iHandle, uint32_t dwIv, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    if (iHandle < 0 || iHandle >= KS_SHM_CLIENT_KEYS || !lpClient->astKeys[iHandle].bLoaded || dwNumKsBytes > KS_SHM_MAX_KS_BYTES) {
+        return -1;
+    }
+    KsShmClientKey *lpClientKey = &lpClient->astKeys[iHandle];
+
+    if (lpClient->bConnected && lpClientKey->iKeyId >= 0) {
+        if (ks_shm_cache_read(lpClient->lpRegion, lpClientKey->iKeyId, lpClientKey->dwGen, dwIv, dwNumKsBytes, lpKsOut)) {
+            lpClient->stStats.qwCacheHits++;
+            return 0;
+        }
+        if (ks_shm_client_request(lpClient, lpClientKey, dwIv, dwNumKsBytes, lpKsOut) == 0) {
+            lpClient->stStats.qwRequests++;
+            return 0;
+        }
+    }
+
+    ks_shm_generate(lpClientKey->dwTeaType, lpClientKey->abKey, dwIv, dwNumKsBytes, lpKsOut);
+    lpClient->stStats.qwLocal++;
+    return 0;
+}
+
+void ks_shm_client_get_stats(const KS_SHM_CLIENT *lpClient, KsShmClientStats *lpStats) {
+    *lpStats = lpClient->stStats;
+}
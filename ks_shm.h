@@ -0,0 +1,70 @@
+#ifndef HAVE_KS_SHM_H
+#define HAVE_KS_SHM_H
+
+#include <inttypes.h>
+
+/*
+ * Keystream daemon shared by several decoder processes on one host. The
+ * daemon owns the loaded keys and publishes keystream through a POSIX shared
+ * memory segment holding two things: a cache of recently generated keystreams
+ * that clients read under a seqlock, and request slots that a client claims,
+ * fills in and spins on while a daemon worker generates into them. Neither
+ * path takes a syscall on the client side, except to wake an idle daemon.
+ *
+ * Keys are loaded and unloaded over a Unix socket. Loading a key that is
+ * already loaded returns the same key id, so every client using it shares the
+ * cached keystream. A client falls back to generating keystream in process
+ * when no daemon is running, or when the daemon stops answering.
+ */
+
+#define KS_SHM_MAX_KEYS         256
+#define KS_SHM_MAX_CLIENTS      64      // concurrent control connections
+#define KS_SHM_NUM_SLOTS        64
+#define KS_SHM_CACHE_ENTRIES    4096    // power of 2
+#define KS_SHM_MAX_KS_BYTES     64      // enough for a 432-bit burst plus offset
+#define KS_SHM_TIMEOUT_NS       100000000
+
+typedef struct KS_SHM_SERVER KS_SHM_SERVER;
+typedef struct KS_SHM_CLIENT KS_SHM_CLIENT;
+
+typedef struct {
+    uint64_t qwRequests;                // request slots served
+    uint64_t qwCacheHits;               // of those, answered from the cache
+    uint64_t qwRejected;                // stale or unknown key
+    uint64_t qwAbandoned;               // finished after the client had stopped waiting
+} KsShmServerStats;
+
+typedef struct {
+    uint64_t qwCacheHits;               // read straight from the shared cache
+    uint64_t qwRequests;                // answered through a request slot
+    uint64_t qwLocal;                   // generated in process
+} KsShmClientStats;
+
+/*
+ * lpszShmName is a shm_open name ("/name"), lpszSocketPath the control socket.
+ * Both are replaced if they exist. 0 workers means 1.
+ */
+KS_SHM_SERVER *ks_shm_server_create(const char *lpszShmName, const char *lpszSocketPath, uint32_t dwNumWorkers);
+void ks_shm_server_destroy(KS_SHM_SERVER *lpServer);
+void ks_shm_server_get_stats(KS_SHM_SERVER *lpServer, KsShmServerStats *lpStats);
+
+// Hold every request this long before serving it, to rehearse clients against an overloaded daemon
+void ks_shm_server_set_delay(KS_SHM_SERVER *lpServer, uint32_t dwDelayUs);
+
+/*
+ * Only returns NULL when out of memory: without a daemon the client generates
+ * everything itself. A client must only be used by one thread at a time.
+ */
+KS_SHM_CLIENT *ks_shm_client_open(const char *lpszShmName, const char *lpszSocketPath);
+void ks_shm_client_close(KS_SHM_CLIENT *lpClient);
+int ks_shm_client_connected(const KS_SHM_CLIENT *lpClient);
+
+// Returns a key handle >= 0, or -1 if the TEA type is invalid or the client has too many keys
+int ks_shm_client_load_key(KS_SHM_CLIENT *lpClient, uint32_t dwTeaType, const uint8_t *lpKey);
+int ks_shm_client_unload_key(KS_SHM_CLIENT *lpClient, int iHandle);
+
+// Returns 0, or -1 if the handle is invalid or dwNumKsBytes exceeds KS_SHM_MAX_KS_BYTES
+int ks_shm_client_keystream(KS_SHM_CLIENT *lpClient, int iHandle, uint32_t dwIv, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
+void ks_shm_client_get_stats(const KS_SHM_CLIENT *lpClient, KsShmClientStats *lpStats);
+
+#endif /* HAVE_KS_SHM_H */
@@ -0,0 +1,272 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "lathist.h"
+
+#define LATHIST_NAME(id, name) name,
+const char *g_aszLathistStageNames[LATHIST_NUM_STAGES] = {
+    LATHIST_STAGES(LATHIST_NAME)
+};
+#undef LATHIST_NAME
+
+typedef struct LathistBlock {
+    LathistHistogram astStages[LATHIST_NUM_STAGES];
+    struct LathistBlock *lpNext;
+} LathistBlock;
+
+__thread LathistHistogram *g_lpLathistThread;
+int g_bLathistEnabled;
+
+// Blocks outlive their threads so totals never go backwards
+static pthread_mutex_t g_hLathistLock = PTHREAD_MUTEX_INITIALIZER;
+static LathistBlock *g_lpLathistBlocks;
+static LathistSnapshot g_stLathistBaseline;
+static int g_bLathistReset;
+
+// Running totals at the last LATHIST_WINDOW_TICKS ticks, only allocated once ticking starts
+static LathistSnapshot *g_lpLathistRing;
+static uint64_t g_qwLathistTicks;
+
+static const struct {
+    const char *lpszLabel;
+    double dPercentile;
+} g_astLathistQuantiles[] = {
+    { "0.5",   50.0 },
+    { "0.99",  99.0 },
+    { "0.999", 99.9 },
+};
+
+__attribute__((constructor))
+static void lathist_init_from_env(void) {
+    const char *lpszEnabled = getenv("TETRA_LATHIST");
+    if (lpszEnabled && atoi(lpszEnabled)) {
+        lathist_set_enabled(1);
+    }
+}
+
+void lathist_set_enabled(int bEnabled) {
+    __atomic_store_n(&g_bLathistEnabled, bEnabled != 0, __ATOMIC_RELAXED);
+}
+
+LathistHistogram *lathist_register_thread(void) {
+    LathistBlock *lpBlock = aligned_alloc(64, sizeof(LathistBlock));
+    if (lpBlock == NULL) {
+        // Recording is best effort; abort() would be worse than a missing sample
+        static LathistHistogram s_astDiscard[LATHIST_NUM_STAGES];
+        return s_astDiscard;
+    }
+    memset(lpBlock, 0, sizeof(*lpBlock));
+
+    pthread_mutex_lock(&g_hLathistLock);
+    lpBlock->lpNext = g_lpLathistBlocks;
+    g_lpLathistBlocks = lpBlock;
+    pthread_mutex_unlock(&g_hLathistLock);
+
+    g_lpLathistThread = lpBlock->astStages;
+    return g_lpLathistThread;
+}
+
+uint64_t lathist_bucket_high(uint32_t dwBucket) {
+    uint32_t dwGroup = dwBucket / LATHIST_SUB_BUCKETS;
+    uint64_t qwSub = dwBucket % LATHIST_SUB_BUCKETS;
+    if (dwGroup == 0) {
+        return qwSub;
+    }
+    uint32_t dwShift = dwGroup - 1;
+    return ((LATHIST_SUB_BUCKETS + qwSub + 1) << dwShift) - 1;
+}
+
+static uint64_t lathist_bucket_max(const LathistHistogram *lpHist) {
+    for (int i = LATHIST_NUM_BUCKETS - 1; i >= 0; i--) {
+        if (lpHist->aqwBuckets[i]) {
+            return lathist_bucket_high(i);
+        }
+    }
+    return 0;
+}
+
+void lathist_merge(LathistHistogram *lpDst, const LathistHistogram *lpSrc) {
+    lpDst->qwCount += lpSrc->qwCount;
+    lpDst->qwSumNs += lpSrc->qwSumNs;
+    lpDst->qwMaxNs = lpSrc->qwMaxNs > lpDst->qwMaxNs ? lpSrc->qwMaxNs : lpDst->qwMaxNs;
+    for (int i = 0; i < LATHIST_NUM_BUCKETS; i++) {
+        lpDst->aqwBuckets[i] += lpSrc->aqwBuckets[i];
+    }
+}
+
+// lpDst -= lpBase, for totals taken at two points in time
+static void lathist_subtract(LathistSnapshot *lpDst, const LathistSnapshot *lpBase) {
+    for (int s = 0; s < LATHIST_NUM_STAGES; s++) {
+        LathistHistogram *lpHist = &lpDst->astStages[s];
+        const LathistHistogram *lpSub = &lpBase->astStages[s];
+        lpHist->qwCount -= lpSub->qwCount;
+        lpHist->qwSumNs -= lpSub->qwSumNs;
+        for (int i = 0; i < LATHIST_NUM_BUCKETS; i++) {
+            lpHist->aqwBuckets[i] -= lpSub->aqwBuckets[i];
+        }
+        lpHist->qwMaxNs = lathist_bucket_max(lpHist);
+    }
+}
+
+static void lathist_sum(LathistSnapshot *lpSnapshotOut) {
+    memset(lpSnapshotOut, 0, sizeof(*lpSnapshotOut));
+    for (LathistBlock *lpBlock = g_lpLathistBlocks; lpBlock; lpBlock = lpBlock->lpNext) {
+        for (int s = 0; s < LATHIST_NUM_STAGES; s++) {
+            LathistHistogram *lpIn = &lpBlock->astStages[s];
+            LathistHistogram *lpOut = &lpSnapshotOut->astStages[s];
+            uint64_t qwMax = __atomic_load_n(&lpIn->qwMaxNs, __ATOMIC_RELAXED);
+            lpOut->qwCount += __atomic_load_n(&lpIn->qwCount, __ATOMIC_RELAXED);
+            lpOut->qwSumNs += __atomic_load_n(&lpIn->qwSumNs, __ATOMIC_RELAXED);
+            lpOut->qwMaxNs = qwMax > lpOut->qwMaxNs ? qwMax : lpOut->qwMaxNs;
+            for (int i = 0; i < LATHIST_NUM_BUCKETS; i++) {
+                lpOut->aqwBuckets[i] += __atomic_load_n(&lpIn->aqwBuckets[i], __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+void lathist_snapshot(LathistSnapshot *lpSnapshotOut) {
+    pthread_mutex_lock(&g_hLathistLock);
+    lathist_sum(lpSnapshotOut);
+    if (g_bLathistReset) {
+        lathist_subtract(lpSnapshotOut, &g_stLathistBaseline);
+    }
+    pthread_mutex_unlock(&g_hLathistLock);
+}
+
+void lathist_reset(void) {
+    // Histograms are owned by their threads, so a reset moves the baseline instead
+    pthread_mutex_lock(&g_hLathistLock);
+    lathist_sum(&g_stLathistBaseline);
+    g_bLathistReset = 1;
+    pthread_mutex_unlock(&g_hLathistLock);
+}
+
+void lathist_tick(void) {
+    pthread_mutex_lock(&g_hLathistLock);
+    if (g_lpLathistRing == NULL) {
+        g_lpLathistRing = calloc(LATHIST_WINDOW_TICKS, sizeof(LathistSnapshot));
+    }
+    if (g_lpLathistRing) {
+        lathist_sum(&g_lpLathistRing[g_qwLathistTicks % LATHIST_WINDOW_TICKS]);
+        g_qwLathistTicks++;
+    }
+    pthread_mutex_unlock(&g_hLathistLock);
+}
+
+void lathist_window(LathistSnapshot *lpSnapshotOut) {
+    pthread_mutex_lock(&g_hLathistLock);
+    lathist_sum(lpSnapshotOut);
+    if (g_qwLathistTicks >= LATHIST_WINDOW_TICKS) {
+        // The oldest entry of a full ring is LATHIST_WINDOW_TICKS ticks back
+        lathist_subtract(lpSnapshotOut, &g_lpLathistRing[g_qwLathistTicks % LATHIST_WINDOW_TICKS]);
+    } else if (g_qwLathistTicks) {
+        lathist_subtract(lpSnapshotOut, &g_lpLathistRing[0]);
+    } else {
+        // No tick yet: the window is everything recorded so far
+        for (int s = 0; s < LATHIST_NUM_STAGES; s++) {
+            lpSnapshotOut->astStages[s].qwMaxNs = lathist_bucket_max(&lpSnapshotOut->astStages[s]);
+        }
+    }
+    pthread_mutex_unlock(&g_hLathistLock);
+}
+
+uint64_t lathist_percentile(const LathistHistogram *lpHist, double dPercentile) {
+    if (lpHist->qwCount == 0) {
+        return 0;
+    }
+    uint64_t qwRank = (uint64_t)(dPercentile / 100.0 * lpHist->qwCount + 0.5);
+    qwRank = qwRank < 1 ? 1 : qwRank;
+    uint64_t qwSeen = 0;
+    for (int i = 0; i < LATHIST_NUM_BUCKETS; i++) {
+        qwSeen += lpHist->aqwBuckets[i];
+        if (qwSeen >= qwRank) {
+            uint64_t qwHigh = lathist_bucket_high(i);
+            return qwHigh < lpHist->qwMaxNs ? qwHigh : lpHist->qwMaxNs;
+        }
+    }
+    return lpHist->qwMaxNs;
+}
+
+static void lathist_get(LathistSnapshot *lpSnapshotOut, int bWindow) {
+    if (bWindow) {
+        lathist_window(lpSnapshotOut);
+    } else {
+        lathist_snapshot(lpSnapshotOut);
+    }
+}
+
+int lathist_export_prometheus(const char *lpszPath, int bWindow) {
+    LathistSnapshot *lpSnapshot = malloc(sizeof(LathistSnapshot));
+    if (lpSnapshot == NULL) {
+        return -1;
+    }
+    FILE *fp = fopen(lpszPath, "w");
+    if (fp == NULL) {
+        free(lpSnapshot);
+        return -1;
+    }
+    lathist_get(lpSnapshot, bWindow);
+
+    fprintf(fp, "# HELP tetracrypto_latency_ns Decrypt path stage latency in nanoseconds\n");
+    fprintf(fp, "# TYPE tetracrypto_latency_ns summary\n");
+    for (int s = 0; s < LATHIST_NUM_STAGES; s++) {
+        const LathistHistogram *lpHist = &lpSnapshot->astStages[s];
+        for (int q = 0; q < sizeof(g_astLathistQuantiles) / sizeof(g_astLathistQuantiles[0]); q++) {
+            fprintf(fp, "tetracrypto_latency_ns{stage=\"%s\",quantile=\"%s\"} %" PRIu64 "\n", g_aszLathistStageNames[s],
+                    g_astLathistQuantiles[q].lpszLabel, lathist_percentile(lpHist, g_astLathistQuantiles[q].dPercentile));
+        }
+        fprintf(fp, "tetracrypto_latency_ns_sum{stage=\"%s\"} %" PRIu64 "\n", g_aszLathistStageNames[s], lpHist->qwSumNs);
+        fprintf(fp, "tetracrypto_latency_ns_count{stage=\"%s\"} %" PRIu64 "\n", g_aszLathistStageNames[s], lpHist->qwCount);
+    }
+    fprintf(fp, "# HELP tetracrypto_latency_max_ns Largest stage latency in nanoseconds\n");
+    fprintf(fp, "# TYPE tetracrypto_latency_max_ns gauge\n");
+    for (int s = 0; s < LATHIST_NUM_STAGES; s++) {
+        fprintf(fp, "tetracrypto_latency_max_ns{stage=\"%s\"} %" PRIu64 "\n", g_aszLathistStageNames[s], lpSnapshot->astStages[s].qwMaxNs);
+    }
+    free(lpSnapshot);
+    return fclose(fp) ? -1 : 0;
+}
+
+int lathist_export_json(const char *lpszPath, int bWindow) {
+    LathistSnapshot *lpSnapshot = malloc(sizeof(LathistSnapshot));
+    if (lpSnapshot == NULL) {
+        return -1;
+    }
+    FILE *fp = fopen(lpszPath, "w");
+    if (fp == NULL) {
+        free(lpSnapshot);
+        return -1;
+    }
+    lathist_get(lpSnapshot, bWindow);
+
+    fprintf(fp, "{\n");
+    for (int s = 0; s < LATHIST_NUM_STAGES; s++) {
+        const LathistHistogram *lpHist = &lpSnapshot->astStages[s];
+        fprintf(fp, "  \"%s\": {\"count\": %" PRIu64 ", \"sum_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+                ", \"p999_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 "}%s\n",
+                g_aszLathistStageNames[s], lpHist->qwCount, lpHist->qwSumNs, lathist_percentile(lpHist, 50.0),
+                lathist_percentile(lpHist, 99.0), lathist_percentile(lpHist, 99.9), lpHist->qwMaxNs,
+                s + 1 < LATHIST_NUM_STAGES ? "," : "");
+    }
+    fprintf(fp, "}\n");
+    free(lpSnapshot);
+    return fclose(fp) ? -1 : 0;
+}
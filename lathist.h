@@ -0,0 +1,123 @@
+#ifndef HAVE_LATHIST_H
+#define HAVE_LATHIST_H
+
+#include <inttypes.h>
+#include <time.h>
+
+/*
+ * Latency histograms for the stages of the burst decrypt path. Unlike the
+ * STATS_* counters these are always compiled in and switched on at runtime,
+ * with lathist_set_enabled() or by starting the process with TETRA_LATHIST=1
+ * in the environment; while off, a probe costs one relaxed load.
+ *
+ * Buckets are log-linear as in HdrHistogram: values below LATHIST_SUB_BUCKETS
+ * ns are exact, above that every power of two is split into
+ * LATHIST_SUB_BUCKETS buckets, so a bucket is at most 1/16 (6%) wide relative
+ * to its values. Every thread records into histograms only it writes, and
+ * histograms merge by adding their buckets.
+ *
+ * The rolling window is kept by the reader: lathist_tick() stores a snapshot
+ * of the running totals in a ring, and a window is the difference between the
+ * current totals and the snapshot LATHIST_WINDOW_TICKS ticks back. Call it
+ * at a fixed interval (e.g. every second) to get a window of that many
+ * intervals.
+ */
+
+#define LATHIST_STAGES(X) \
+    X(QUEUE,     "queue")      /* submit until a worker picks the burst up */ \
+    X(IV,        "iv")         /* frame number tracking and build_iv */ \
+    X(KEY,       "key")        /* ECK derivation when a carrier is set up */ \
+    X(KEYSTREAM, "keystream")  /* key register load and keystream generation */ \
+    X(XOR,       "xor") \
+    X(OUTPUT,    "output")     /* the output callback, i.e. handing the burst on */ \
+    X(TOTAL,     "total")      /* submit until the output callback returns */
+
+#define LATHIST_ENUM(id, name) LATHIST_##id,
+enum {
+    LATHIST_STAGES(LATHIST_ENUM)
+    LATHIST_NUM_STAGES
+};
+#undef LATHIST_ENUM
+
+#define LATHIST_SUB_BITS        4
+#define LATHIST_SUB_BUCKETS     (1 << LATHIST_SUB_BITS)
+#define LATHIST_MAX_BITS        40      // values from 2^40 ns (18 minutes) up land in the last bucket
+#define LATHIST_NUM_BUCKETS     ((LATHIST_MAX_BITS - LATHIST_SUB_BITS + 1) * LATHIST_SUB_BUCKETS)
+#define LATHIST_WINDOW_TICKS    10
+
+typedef struct {
+    uint64_t qwCount;
+    uint64_t qwSumNs;
+    uint64_t qwMaxNs;                   // exact for totals before any reset, else the top of its bucket
+    uint64_t aqwBuckets[LATHIST_NUM_BUCKETS];
+} __attribute__((aligned(64))) LathistHistogram;
+
+typedef struct {
+    LathistHistogram astStages[LATHIST_NUM_STAGES];
+} LathistSnapshot;
+
+extern const char *g_aszLathistStageNames[LATHIST_NUM_STAGES];
+
+void lathist_set_enabled(int bEnabled);
+
+// Totals since the start or the last lathist_reset(), and the rolling window
+void lathist_snapshot(LathistSnapshot *lpSnapshotOut);
+void lathist_window(LathistSnapshot *lpSnapshotOut);
+void lathist_tick(void);
+void lathist_reset(void);
+
+void lathist_merge(LathistHistogram *lpDst, const LathistHistogram *lpSrc);
+// Smallest recorded bucket bound below which dPercentile percent of the values lie, 0 if empty
+uint64_t lathist_percentile(const LathistHistogram *lpHist, double dPercentile);
+// Largest value that falls into a bucket
+uint64_t lathist_bucket_high(uint32_t dwBucket);
+
+// p50, p99, p99.9 and max per stage, of the totals or of the rolling window
+int lathist_export_prometheus(const char *lpszPath, int bWindow);
+int lathist_export_json(const char *lpszPath, int bWindow);
+
+// Internal
+LathistHistogram *lathist_register_thread(void);
+extern __thread LathistHistogram *g_lpLathistThread;
+extern int g_bLathistEnabled;
+
+static inline int lathist_enabled(void) {
+    return __builtin_expect(__atomic_load_n(&g_bLathistEnabled, __ATOMIC_RELAXED), 0);
+}
+
+static inline uint64_t lathist_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint32_t lathist_bucket(uint64_t qwNs) {
+    if (qwNs < LATHIST_SUB_BUCKETS) {
+        return qwNs;
+    }
+    uint32_t dwExp = 63 - __builtin_clzll(qwNs);
+    if (dwExp >= LATHIST_MAX_BITS) {
+        return LATHIST_NUM_BUCKETS - 1;
+    }
+    uint32_t dwShift = dwExp - LATHIST_SUB_BITS;
+    return (dwShift + 1) * LATHIST_SUB_BUCKETS + ((qwNs >> dwShift) & (LATHIST_SUB_BUCKETS - 1));
+}
+
+// Only the owning thread writes, relaxed stores keep concurrent snapshots well-defined
+#define LATHIST_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+static inline void lathist_record(uint32_t dwStage, uint64_t qwNs) {
+    LathistHistogram *lpBlock = g_lpLathistThread;
+    if (__builtin_expect(lpBlock == NULL, 0)) {
+        lpBlock = lathist_register_thread();
+    }
+    LathistHistogram *lpHist = &lpBlock[dwStage];
+    LATHIST_ADD(lpHist->aqwBuckets[lathist_bucket(qwNs)], 1);
+    LATHIST_ADD(lpHist->qwCount, 1);
+    LATHIST_ADD(lpHist->qwSumNs, qwNs);
+    if (qwNs > lpHist->qwMaxNs) {
+        __atomic_store_n(&lpHist->qwMaxNs, qwNs, __ATOMIC_RELAXED);
+    }
+}
+
+#endif /* HAVE_LATHIST_H */
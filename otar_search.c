@@ -0,0 +1,180 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sealsearch.h"
+#include "workpool.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_hex(const char *lpszHex, uint8_t *lpOut, uint32_t dwLen) {
+    if (strlen(lpszHex) != 2 * dwLen) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < dwLen; i++) {
+        unsigned int dwByte;
+        if (sscanf(&lpszHex[2 * i], "%2x", &dwByte) != 1) {
+            return -1;
+        }
+        lpOut[i] = dwByte;
+    }
+    return 0;
+}
+
+static void print_hex(const uint8_t *lpData, uint32_t dwLen) {
+    for (uint32_t i = 0; i < dwLen; i++) {
+        printf("%02x", lpData[i]);
+    }
+}
+
+// One hex key per line, '#' starts a comment; returns a malloc'd array or NULL with the failing line in *lpdwLine
+static uint8_t *load_keys(const char *lpszPath, uint32_t dwKeyLen, uint32_t *lpdwNumKeys, uint32_t *lpdwLine) {
+    FILE *lpFile = fopen(lpszPath, "r");
+    uint8_t *lpKeys = NULL;
+    uint32_t dwNumKeys = 0, dwCapacity = 0;
+    char szLine[256], szKey[64];
+
+    *lpdwLine = 0;
+    if (lpFile == NULL) {
+        return NULL;
+    }
+    while (fgets(szLine, sizeof(szLine), lpFile)) {
+        (*lpdwLine)++;
+        char *lpszComment = strchr(szLine, '#');
+        if (lpszComment) {
+            *lpszComment = 0;
+        }
+        if (sscanf(szLine, "%63s", szKey) != 1) {
+            continue;
+        }
+        if (dwNumKeys == dwCapacity) {
+            dwCapacity = dwCapacity ? dwCapacity * 2 : 64;
+            uint8_t *lpGrown = realloc(lpKeys, dwCapacity * dwKeyLen);
+            if (lpGrown == NULL) {
+                break;
+            }
+            lpKeys = lpGrown;
+        }
+        if (parse_hex(szKey, &lpKeys[dwNumKeys * dwKeyLen], dwKeyLen) != 0) {
+            break;
+        }
+        dwNumKeys++;
+    }
+    int bComplete = feof(lpFile) && dwNumKeys > 0;
+    fclose(lpFile);
+    if (!bComplete) {
+        free(lpKeys);
+        return NULL;
+    }
+    *lpdwNumKeys = dwNumKeys;
+    return lpKeys;
+}
+
+static void usage(const char *lpszName) {
+    fprintf(stderr, "Usage: %s [-t threads] [-v first vn[:count]] ta82|ta32 <key file> <sealed hex> [<sealed hex> ...]\n", lpszName);
+    fprintf(stderr, "       tries every VN (GCK-VN for ta82, CCK-id for ta32) with every key of the file, one hex key\n");
+    fprintf(stderr, "       per line (16 bytes CCK/KEK for ta82, 10 bytes DCK for ta32), on the 15-byte sealed blocks\n");
+    fprintf(stderr, "       and prints the candidates whose modification flag is clear; threads 0 = all cpus\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t dwNumThreads = 0, dwVnFirst = 0, dwNumVns = SEALSEARCH_NUM_VNS;
+    uint8_t abSealed[SEALSEARCH_MAX_BLOCKS * SEALSEARCH_SEALED_LEN];
+    int iOpt;
+
+    while ((iOpt = getopt(argc, argv, "t:v:")) != -1) {
+        switch (iOpt) {
+        case 't':
+            dwNumThreads = atoi(optarg);
+            break;
+        case 'v': {
+            char *lpszCount = strchr(optarg, ':');
+            dwVnFirst = strtoul(optarg, NULL, 0);
+            dwNumVns = lpszCount ? strtoul(lpszCount + 1, NULL, 0) : 1;
+            break;
+        }
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind < 3 || argc - optind - 2 > SEALSEARCH_MAX_BLOCKS || (strcmp(argv[optind], "ta82") && strcmp(argv[optind], "ta32"))) {
+        usage(argv[0]);
+    }
+    SealsearchMode eMode = strcmp(argv[optind], "ta82") ? SEALSEARCH_TA32 : SEALSEARCH_TA82;
+    uint32_t dwKeyLen = eMode == SEALSEARCH_TA82 ? 16 : 10;
+    uint32_t dwNumBlocks = argc - optind - 2;
+    for (uint32_t i = 0; i < dwNumBlocks; i++) {
+        if (parse_hex(argv[optind + 2 + i], &abSealed[i * SEALSEARCH_SEALED_LEN], SEALSEARCH_SEALED_LEN) != 0) {
+            fprintf(stderr, "Bad sealed block %s\n", argv[optind + 2 + i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint32_t dwNumKeys, dwLine;
+    uint8_t *lpKeys = load_keys(argv[optind + 1], dwKeyLen, &dwNumKeys, &dwLine);
+    if (lpKeys == NULL) {
+        fprintf(stderr, "Can't load keys from %s (line %u)\n", argv[optind + 1], dwLine);
+        exit(EXIT_FAILURE);
+    }
+
+    SEALSEARCH_CTX stCtx;
+    if (sealsearch_init(&stCtx, eMode, abSealed, dwNumBlocks, lpKeys, dwNumKeys, dwVnFirst, dwNumVns) != 0) {
+        fprintf(stderr, "Bad VN range\n");
+        exit(EXIT_FAILURE);
+    }
+    WORKPOOL *lpPool = workpool_create(dwNumThreads, WORKPOOL_FLAG_PIN);
+    if (lpPool == NULL) {
+        perror("workpool_create failed");
+        exit(EXIT_FAILURE);
+    }
+
+    double dStart = now();
+    uint64_t qwScanned = sealsearch_run(&stCtx, lpPool, stCtx.qwNumCandidates);
+    double dElapsed = now() - dStart;
+    if (qwScanned != stCtx.qwNumCandidates) {
+        fprintf(stderr, "Search failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < stCtx.dwNumHits; i++) {
+        const SealsearchHit *lpHit = &stCtx.lpHits[i];
+        printf("key %u ", lpHit->dwKey);
+        print_hex(&lpKeys[lpHit->dwKey * dwKeyLen], dwKeyLen);
+        printf(" vn %02x%02x block %u unsealed ", lpHit->abVn[0], lpHit->abVn[1], lpHit->dwBlock);
+        print_hex(lpHit->abUnsealed, 10);
+        if (eMode == SEALSEARCH_TA82) {
+            printf(" gck-n ");
+            print_hex(lpHit->abKeyN, 2);
+        }
+        printf("\n");
+    }
+    fprintf(stderr, "%llu candidates x %u blocks, %u survivors, %.3f s, %.1f ms per key sweep\n",
+            (unsigned long long)qwScanned, dwNumBlocks, stCtx.dwNumHits, dElapsed, dElapsed * 1e3 / dwNumKeys);
+
+    sealsearch_free(&stCtx);
+    workpool_destroy(lpPool);
+    free(lpKeys);
+    return 0;
+}
@@ -0,0 +1,482 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * CPython bindings for libtetracrypto, built with `make python`.
+ *
+ * Every array argument is taken through the buffer protocol (bytes, bytearray,
+ * memoryview, array.array, numpy arrays, ...) and used in place; results are
+ * written into a caller supplied writable buffer (out=) or a new bytearray,
+ * which numpy.frombuffer wraps without copying. The GIL is released while the
+ * library runs, so Python threads keep going and a Pool spreads the work over
+ * native worker threads.
+ *
+ *   import tetracrypto
+ *   pool = tetracrypto.Pool()                       # all cpus
+ *   ks = tetracrypto.keystream(1, ivs, keys, 54, pool=pool)
+ *   hits = tetracrypto.tea1_search([(iv, ks, mask)], pool=pool,
+ *                                  progress=lambda done, total: print(done, total))
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hurdle.h"
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+#include "tea1_search.h"
+#include "workpool.h"
+#include "batch.h"
+
+#define SEARCH_KEYS_PER_PASS (1ULL << 24)
+
+typedef struct {
+    PyObject_HEAD
+    WORKPOOL *lpPool;
+    pthread_mutex_t hLock;      // a workpool runs one job at a time, Python threads queue up here
+} PoolObject;
+
+static PyTypeObject PoolType;
+
+static PyObject *Pool_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+    PoolObject *self = (PoolObject *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+        pthread_mutex_init(&self->hLock, NULL);
+    }
+    return (PyObject *)self;
+}
+
+static int Pool_init(PoolObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "threads", "pin", NULL };
+    unsigned int dwNumThreads = 0;
+    int bPin = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Ip", kwlist, &dwNumThreads, &bPin)) {
+        return -1;
+    }
+    if (self->lpPool) {
+        PyErr_SetString(PyExc_RuntimeError, "Pool is already initialized");
+        return -1;
+    }
+    self->lpPool = workpool_create(dwNumThreads, bPin ? WORKPOOL_FLAG_PIN : 0);
+    if (self->lpPool == NULL) {
+        PyErr_SetString(PyExc_OSError, "workpool_create failed");
+        return -1;
+    }
+    return 0;
+}
+
+static void Pool_dealloc(PoolObject *self) {
+    if (self->lpPool) {
+        workpool_destroy(self->lpPool);
+    }
+    pthread_mutex_destroy(&self->hLock);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Pool_get_threads(PoolObject *self, void *closure) {
+    return PyLong_FromUnsignedLong(workpool_num_workers(self->lpPool));
+}
+
+static PyGetSetDef Pool_getset[] = {
+    { "threads", (getter)Pool_get_threads, NULL, "number of worker threads", NULL },
+    { NULL }
+};
+
+static PyTypeObject PoolType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "tetracrypto.Pool",
+    .tp_doc = "Pool(threads=0, pin=False)\n\nNative worker threads, 0 means one per allowed cpu.",
+    .tp_basicsize = sizeof(PoolObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = Pool_new,
+    .tp_init = (initproc)Pool_init,
+    .tp_dealloc = (destructor)Pool_dealloc,
+    .tp_getset = Pool_getset,
+};
+
+static int get_pool(PyObject *lpObj, PoolObject **lppPoolOut) {
+    if (lpObj == NULL || lpObj == Py_None) {
+        *lppPoolOut = NULL;
+        return 0;
+    }
+    if (!PyObject_TypeCheck(lpObj, &PoolType) || ((PoolObject *)lpObj)->lpPool == NULL) {
+        PyErr_SetString(PyExc_TypeError, "pool must be an initialized tetracrypto.Pool or None");
+        return -1;
+    }
+    *lppPoolOut = (PoolObject *)lpObj;
+    return 0;
+}
+
+// Called with the GIL released; a NULL pool runs on the calling thread
+static WORKPOOL *pool_acquire(PoolObject *lpPool) {
+    if (lpPool == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&lpPool->hLock);
+    return lpPool->lpPool;
+}
+
+static void pool_release(PoolObject *lpPool) {
+    if (lpPool != NULL) {
+        pthread_mutex_unlock(&lpPool->hLock);
+    }
+}
+
+static int get_buffer(PyObject *lpObj, Py_buffer *lpView, int bWritable, Py_ssize_t qwExpected, const char *lpszName) {
+    if (PyObject_GetBuffer(lpObj, lpView, PyBUF_C_CONTIGUOUS | (bWritable ? PyBUF_WRITABLE : 0)) < 0) {
+        return -1;
+    }
+    if (qwExpected >= 0 && lpView->len != qwExpected) {
+        PyErr_Format(PyExc_ValueError, "%s must be %zd bytes, got %zd", lpszName, qwExpected, lpView->len);
+        PyBuffer_Release(lpView);
+        return -1;
+    }
+    return 0;
+}
+
+// Wrap out= if given, otherwise allocate a bytearray of the right size
+static PyObject *get_output(PyObject *lpOut, Py_buffer *lpView, Py_ssize_t qwLen) {
+    if (lpOut == NULL || lpOut == Py_None) {
+        lpOut = PyByteArray_FromStringAndSize(NULL, qwLen);
+        if (lpOut == NULL) {
+            return NULL;
+        }
+    } else {
+        Py_INCREF(lpOut);
+    }
+    if (get_buffer(lpOut, lpView, 1, qwLen, "out") < 0) {
+        Py_DECREF(lpOut);
+        return NULL;
+    }
+    return lpOut;
+}
+
+PyDoc_STRVAR(keystream_doc,
+"keystream(tea_type, ivs, keys, ks_len, out=None, pool=None)\n\n"
+"Keystream for many (iv, key) lanes. ivs holds n native uint32 IVs, keys n\n"
+"10 byte keys; returns n * ks_len bytes, lane after lane.");
+
+static PyObject *py_keystream(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "tea_type", "ivs", "keys", "ks_len", "out", "pool", NULL };
+    unsigned int dwTeaType, dwNumKsBytes;
+    PyObject *lpIvs, *lpKeys, *lpOut = NULL, *lpPoolObj = NULL;
+    Py_buffer stIvs, stKeys, stOut;
+    PoolObject *lpPool;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "IOOI|OO", kwlist, &dwTeaType, &lpIvs, &lpKeys, &dwNumKsBytes, &lpOut, &lpPoolObj)) {
+        return NULL;
+    }
+    if (dwTeaType < 1 || dwTeaType > 3) {
+        PyErr_SetString(PyExc_ValueError, "tea_type must be 1, 2 or 3");
+        return NULL;
+    }
+    if (get_pool(lpPoolObj, &lpPool) < 0 || get_buffer(lpIvs, &stIvs, 0, -1, "ivs") < 0) {
+        return NULL;
+    }
+    if (stIvs.len % sizeof(uint32_t) || stIvs.len / sizeof(uint32_t) > UINT32_MAX) {
+        PyErr_SetString(PyExc_ValueError, "ivs must hold whole uint32 values");
+        PyBuffer_Release(&stIvs);
+        return NULL;
+    }
+    uint32_t dwNumLanes = stIvs.len / sizeof(uint32_t);
+    if (get_buffer(lpKeys, &stKeys, 0, (Py_ssize_t)dwNumLanes * 10, "keys") < 0) {
+        PyBuffer_Release(&stIvs);
+        return NULL;
+    }
+    lpOut = get_output(lpOut, &stOut, (Py_ssize_t)dwNumLanes * dwNumKsBytes);
+    if (lpOut != NULL) {
+        Py_BEGIN_ALLOW_THREADS
+        batch_keystream(pool_acquire(lpPool), dwTeaType, dwNumLanes, stIvs.buf, stKeys.buf, dwNumKsBytes, stOut.buf);
+        pool_release(lpPool);
+        Py_END_ALLOW_THREADS
+        PyBuffer_Release(&stOut);
+    }
+    PyBuffer_Release(&stKeys);
+    PyBuffer_Release(&stIvs);
+    return lpOut;
+}
+
+PyDoc_STRVAR(hurdle_doc,
+"hurdle(keys, data, decrypt=False, out=None, pool=None)\n\n"
+"HURDLE ECB over n 8 byte blocks, block i with the i-th 16 byte key.");
+
+static PyObject *py_hurdle(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "keys", "data", "decrypt", "out", "pool", NULL };
+    PyObject *lpKeys, *lpData, *lpOut = NULL, *lpPoolObj = NULL;
+    int bDecrypt = 0;
+    Py_buffer stKeys, stData, stOut;
+    PoolObject *lpPool;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|pOO", kwlist, &lpKeys, &lpData, &bDecrypt, &lpOut, &lpPoolObj)) {
+        return NULL;
+    }
+    if (get_pool(lpPoolObj, &lpPool) < 0 || get_buffer(lpData, &stData, 0, -1, "data") < 0) {
+        return NULL;
+    }
+    if (stData.len % 8 || stData.len / 8 > UINT32_MAX) {
+        PyErr_SetString(PyExc_ValueError, "data must hold whole 8 byte blocks");
+        PyBuffer_Release(&stData);
+        return NULL;
+    }
+    uint32_t dwNumLanes = stData.len / 8;
+    if (get_buffer(lpKeys, &stKeys, 0, (Py_ssize_t)dwNumLanes * 16, "keys") < 0) {
+        PyBuffer_Release(&stData);
+        return NULL;
+    }
+    lpOut = get_output(lpOut, &stOut, stData.len);
+    if (lpOut != NULL) {
+        Py_BEGIN_ALLOW_THREADS
+        batch_hurdle(pool_acquire(lpPool), dwNumLanes, stKeys.buf, stData.buf, stOut.buf, bDecrypt ? HURDLE_DECRYPT : HURDLE_ENCRYPT);
+        pool_release(lpPool);
+        Py_END_ALLOW_THREADS
+        PyBuffer_Release(&stOut);
+    }
+    PyBuffer_Release(&stKeys);
+    PyBuffer_Release(&stData);
+    return lpOut;
+}
+
+PyDoc_STRVAR(xor_doc,
+"xor(tea_type, iv, key, buf, bit_offset=0, bit_len=None)\n\n"
+"Xor keystream into the writable buffer buf in place, starting at bit\n"
+"bit_offset (MSB first). bit_len defaults to the rest of the buffer.");
+
+static PyObject *py_xor(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "tea_type", "iv", "key", "buf", "bit_offset", "bit_len", NULL };
+    unsigned int dwTeaType, dwIv, dwBitOffset = 0;
+    PyObject *lpKeyObj, *lpBufObj, *lpBitLen = Py_None;
+    Py_buffer stKey, stBuf;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "IIOO|IO", kwlist, &dwTeaType, &dwIv, &lpKeyObj, &lpBufObj, &dwBitOffset, &lpBitLen)) {
+        return NULL;
+    }
+    if (dwTeaType < 1 || dwTeaType > 3) {
+        PyErr_SetString(PyExc_ValueError, "tea_type must be 1, 2 or 3");
+        return NULL;
+    }
+    if (get_buffer(lpKeyObj, &stKey, 0, 10, "key") < 0) {
+        return NULL;
+    }
+    if (get_buffer(lpBufObj, &stBuf, 1, -1, "buf") < 0) {
+        PyBuffer_Release(&stKey);
+        return NULL;
+    }
+
+    uint64_t qwBufBits = (uint64_t)stBuf.len * 8;
+    uint64_t qwBitLen = qwBufBits > dwBitOffset ? qwBufBits - dwBitOffset : 0;
+    if (lpBitLen != Py_None) {
+        qwBitLen = PyLong_AsUnsignedLongLong(lpBitLen);
+        if (PyErr_Occurred()) {
+            goto fail;
+        }
+    }
+    if (dwBitOffset + qwBitLen > qwBufBits || qwBitLen > UINT32_MAX) {
+        PyErr_SetString(PyExc_ValueError, "bit range exceeds buf");
+        goto fail;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    if (dwTeaType == 1) tea1_xor(dwIv, stKey.buf, dwBitOffset, qwBitLen, stBuf.buf);
+    if (dwTeaType == 2) tea2_xor(dwIv, stKey.buf, dwBitOffset, qwBitLen, stBuf.buf);
+    if (dwTeaType == 3) tea3_xor(dwIv, stKey.buf, dwBitOffset, qwBitLen, stBuf.buf);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&stBuf);
+    PyBuffer_Release(&stKey);
+    Py_RETURN_NONE;
+
+fail:
+    PyBuffer_Release(&stBuf);
+    PyBuffer_Release(&stKey);
+    return NULL;
+}
+
+static int parse_filter(PyObject *lpItem, Tea1Filter *lpFilter) {
+    unsigned int dwIv;
+    PyObject *lpKsObj, *lpMaskObj = Py_None;
+    Py_buffer stKs, stMask;
+
+    if (!PyArg_ParseTuple(lpItem, "IO|O", &dwIv, &lpKsObj, &lpMaskObj)) {
+        return -1;
+    }
+    if (get_buffer(lpKsObj, &stKs, 0, -1, "filter keystream") < 0) {
+        return -1;
+    }
+    if (stKs.len == 0 || stKs.len > TEA1_SEARCH_MAX_KS_BYTES) {
+        PyErr_Format(PyExc_ValueError, "filter keystream must be 1 to %d bytes", TEA1_SEARCH_MAX_KS_BYTES);
+        PyBuffer_Release(&stKs);
+        return -1;
+    }
+
+    memset(lpFilter, 0, sizeof(*lpFilter));
+    lpFilter->dwIv = dwIv;
+    lpFilter->dwNumKsBytes = stKs.len;
+    memcpy(lpFilter->abKs, stKs.buf, stKs.len);
+    memset(lpFilter->abMask, 0xFF, stKs.len);
+    if (lpMaskObj != Py_None) {
+        if (get_buffer(lpMaskObj, &stMask, 0, stKs.len, "filter mask") < 0) {
+            PyBuffer_Release(&stKs);
+            return -1;
+        }
+        memcpy(lpFilter->abMask, stMask.buf, stKs.len);
+        PyBuffer_Release(&stMask);
+    }
+    for (int i = 0; i < stKs.len; i++) {
+        lpFilter->abKs[i] &= lpFilter->abMask[i];
+    }
+    PyBuffer_Release(&stKs);
+    return 0;
+}
+
+PyDoc_STRVAR(tea1_search_doc,
+"tea1_search(filters, start=0, end=2**32, pool=None, progress=None)\n\n"
+"Reduced TEA1 key register search. filters is a list of (iv, keystream[, mask])\n"
+"tuples, mask bits set where the keystream bit is known. progress(done, total)\n"
+"is called between passes; returning False stops the search early. Returns the\n"
+"sorted list of matching 32-bit key registers found so far.");
+
+static PyObject *py_tea1_search(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "filters", "start", "end", "pool", "progress", NULL };
+    PyObject *lpFiltersObj, *lpPoolObj = NULL, *lpProgress = Py_None, *lpResult = NULL;
+    unsigned long long qwStart = 0, qwEnd = TEA1_SEARCH_KEYSPACE;
+    Tea1Filter astFilters[TEA1_SEARCH_MAX_FILTERS];
+    TEA1_SEARCH_CTX stSearch;
+    PoolObject *lpPool;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|KKOO", kwlist, &lpFiltersObj, &qwStart, &qwEnd, &lpPoolObj, &lpProgress)) {
+        return NULL;
+    }
+    if (get_pool(lpPoolObj, &lpPool) < 0) {
+        return NULL;
+    }
+    if (qwStart > qwEnd || qwEnd > TEA1_SEARCH_KEYSPACE) {
+        PyErr_SetString(PyExc_ValueError, "need start <= end <= 2**32");
+        return NULL;
+    }
+    if (lpProgress != Py_None && !PyCallable_Check(lpProgress)) {
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+        return NULL;
+    }
+
+    PyObject *lpSeq = PySequence_Fast(lpFiltersObj, "filters must be a sequence");
+    if (lpSeq == NULL) {
+        return NULL;
+    }
+    Py_ssize_t qwNumFilters = PySequence_Fast_GET_SIZE(lpSeq);
+    if (qwNumFilters < 1 || qwNumFilters > TEA1_SEARCH_MAX_FILTERS) {
+        PyErr_Format(PyExc_ValueError, "need 1 to %d filters", TEA1_SEARCH_MAX_FILTERS);
+        Py_DECREF(lpSeq);
+        return NULL;
+    }
+    for (Py_ssize_t i = 0; i < qwNumFilters; i++) {
+        if (parse_filter(PySequence_Fast_GET_ITEM(lpSeq, i), &astFilters[i]) < 0) {
+            Py_DECREF(lpSeq);
+            return NULL;
+        }
+    }
+    Py_DECREF(lpSeq);
+
+    tea1_search_init_range(&stSearch, qwStart, qwEnd);
+    tea1_search_set_filters(&stSearch, astFilters, qwNumFilters);
+
+    while (!tea1_search_done(&stSearch)) {
+        uint64_t qwScanned;
+        int bStopped;
+        Py_BEGIN_ALLOW_THREADS
+        WORKPOOL *lpWorkpool = pool_acquire(lpPool);
+        qwScanned = tea1_search_run_parallel(&stSearch, lpWorkpool, SEARCH_KEYS_PER_PASS);
+        bStopped = lpWorkpool && workpool_stopped(lpWorkpool);
+        pool_release(lpPool);
+        Py_END_ALLOW_THREADS
+
+        // Nothing scanned means the pass was stopped or out of memory; retrying would spin with the GIL released
+        if (qwScanned == 0) {
+            if (bStopped) {
+                PyErr_SetString(PyExc_RuntimeError, "pool was stopped");
+            } else {
+                PyErr_NoMemory();
+            }
+            goto out;
+        }
+
+        if (PyErr_CheckSignals() < 0) {
+            goto out;
+        }
+        if (lpProgress != Py_None) {
+            PyObject *lpRet = PyObject_CallFunction(lpProgress, "KK", (unsigned long long)(stSearch.qwNextKey - qwStart),
+                                                    (unsigned long long)(qwEnd - qwStart));
+            if (lpRet == NULL) {
+                goto out;
+            }
+            int bStop = (lpRet == Py_False);
+            Py_DECREF(lpRet);
+            if (bStop) {
+                break;
+            }
+        }
+    }
+
+    lpResult = PyList_New(stSearch.dwNumHits);
+    for (uint32_t i = 0; lpResult && i < stSearch.dwNumHits; i++) {
+        PyObject *lpHit = PyLong_FromUnsignedLong(stSearch.lpdwHits[i]);
+        if (lpHit == NULL) {
+            Py_CLEAR(lpResult);
+            break;
+        }
+        PyList_SET_ITEM(lpResult, i, lpHit);
+    }
+
+out:
+    tea1_search_free(&stSearch);
+    return lpResult;
+}
+
+static PyMethodDef tetracrypto_methods[] = {
+    { "keystream",   (PyCFunction)(void (*)(void))py_keystream,   METH_VARARGS | METH_KEYWORDS, keystream_doc },
+    { "hurdle",      (PyCFunction)(void (*)(void))py_hurdle,      METH_VARARGS | METH_KEYWORDS, hurdle_doc },
+    { "xor",         (PyCFunction)(void (*)(void))py_xor,         METH_VARARGS | METH_KEYWORDS, xor_doc },
+    { "tea1_search", (PyCFunction)(void (*)(void))py_tea1_search, METH_VARARGS | METH_KEYWORDS, tea1_search_doc },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef tetracrypto_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "tetracrypto",
+    .m_doc = "Native bindings for libtetracrypto (TEA1/2/3, HURDLE, TEA1 key search).",
+    .m_size = -1,
+    .m_methods = tetracrypto_methods,
+};
+
+PyMODINIT_FUNC PyInit_tetracrypto(void) {
+    if (PyType_Ready(&PoolType) < 0) {
+        return NULL;
+    }
+    PyObject *lpModule = PyModule_Create(&tetracrypto_module);
+    if (lpModule == NULL) {
+        return NULL;
+    }
+    Py_INCREF(&PoolType);
+    if (PyModule_AddObject(lpModule, "Pool", (PyObject *)&PoolType) < 0) {
+        Py_DECREF(&PoolType);
+        Py_DECREF(lpModule);
+        return NULL;
+    }
+    return lpModule;
+}
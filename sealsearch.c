@@ -0,0 +1,186 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "hurdle.h"
+#include "taa1.h"
+#include "tune.h"
+#include "sealsearch.h"
+
+#define SEALSEARCH_CHUNK 4096           // candidates per workpool chunk
+
+typedef struct {
+    uint32_t eImpl;                     // TuneHurdleImpl
+    uint8_t abKey[16];
+    HURDLE_CTX stCtx;
+    HURDLE_COMPACT_CTX stCompact;
+} SealsearchCipher;
+
+int sealsearch_init(SEALSEARCH_CTX *lpCtx, SealsearchMode eMode, const uint8_t *lpSealed, uint32_t dwNumBlocks,
+                    const uint8_t *lpKeys, uint32_t dwNumKeys, uint32_t dwVnFirst, uint32_t dwNumVns) {
+    memset(lpCtx, 0, sizeof(*lpCtx));
+    if ((eMode != SEALSEARCH_TA82 && eMode != SEALSEARCH_TA32) || dwNumBlocks == 0 || dwNumBlocks > SEALSEARCH_MAX_BLOCKS ||
+            dwNumKeys == 0 || dwNumVns == 0 || dwVnFirst >= SEALSEARCH_NUM_VNS || dwNumVns > SEALSEARCH_NUM_VNS - dwVnFirst) {
+        return -1;
+    }
+    lpCtx->eMode = eMode;
+    lpCtx->lpKeys = lpKeys;
+    lpCtx->dwNumKeys = dwNumKeys;
+    lpCtx->dwVnFirst = dwVnFirst;
+    lpCtx->dwNumVns = dwNumVns;
+    memcpy(lpCtx->aabSealed, lpSealed, dwNumBlocks * SEALSEARCH_SEALED_LEN);
+    lpCtx->dwNumBlocks = dwNumBlocks;
+    lpCtx->qwNumCandidates = (uint64_t)dwNumKeys * dwNumVns;
+    return 0;
+}
+
+void sealsearch_free(SEALSEARCH_CTX *lpCtx) {
+    free(lpCtx->lpHits);
+    lpCtx->lpHits = NULL;
+    lpCtx->dwNumHits = 0;
+    lpCtx->dwHitsCapacity = 0;
+}
+
+int sealsearch_done(const SEALSEARCH_CTX *lpCtx) {
+    return lpCtx->qwNextIndex >= lpCtx->qwNumCandidates;
+}
+
+static void sealsearch_set_key(SealsearchCipher *lpCipher) {
+    switch (lpCipher->eImpl) {
+    case TUNE_HURDLE_SCHEDULE: HURDLE_set_key(lpCipher->abKey, &lpCipher->stCtx); break;
+    case TUNE_HURDLE_COMPACT:  HURDLE_set_key_compact(lpCipher->abKey, &lpCipher->stCompact); break;
+    }
+}
+
+static void sealsearch_decrypt(SealsearchCipher *lpCipher, uint8_t abOutput[8], const uint8_t abInput[8]) {
+    switch (lpCipher->eImpl) {
+    case TUNE_HURDLE_SCHEDULE: HURDLE_encrypt(abOutput, abInput, &lpCipher->stCtx, HURDLE_DECRYPT); break;
+    case TUNE_HURDLE_COMPACT:  HURDLE_encrypt_compact(abOutput, abInput, &lpCipher->stCompact, HURDLE_DECRYPT); break;
+    default:                   HURDLE_encrypt_otf(abOutput, abInput, lpCipher->abKey, HURDLE_DECRYPT); break;
+    }
+}
+
+/*
+ * The last ciphertext block decrypts, xored with the first 7 ciphertext bytes,
+ * to plaintext bytes 8..14 (see HURDLE_dec_cts). Whether those hold the
+ * redundancy the modification flag checks is known after one decryption.
+ */
+static int sealsearch_prefilter(uint32_t eMode, const uint8_t *lpSealed, const uint8_t *lpLastBlock) {
+    uint8_t abTail[7];
+    for (int i = 0; i < 7; i++) {
+        abTail[i] = lpLastBlock[i] ^ lpSealed[i];
+    }
+    if (eMode == SEALSEARCH_TA82) {
+        return abTail[6] == (abTail[2] ^ abTail[3] ^ abTail[4] ^ abTail[5]);
+    }
+    return (abTail[1] ^ abTail[2]) == abTail[3] && (abTail[4] ^ abTail[5]) == abTail[6];
+}
+
+typedef struct {
+    const SEALSEARCH_CTX *lpCtx;
+    uint32_t eImpl;
+} SealsearchJob;
+
+// Test candidates [qwBegin, qwEnd), appending hits
+static int sealsearch_scan(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd,
+                           void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity) {
+    const SealsearchJob *lpJob = lpArg;
+    const SEALSEARCH_CTX *lpCtx = lpJob->lpCtx;
+    SealsearchCipher stCipher = { lpJob->eImpl };
+    uint8_t abLastBlock[8];
+
+    for (uint64_t n = qwBegin; n < qwEnd; n++) {
+        uint32_t dwKey = n / lpCtx->dwNumVns;
+        uint32_t dwVn = lpCtx->dwVnFirst + n % lpCtx->dwNumVns;
+        uint8_t abVn[2] = { dwVn >> 8, dwVn };
+
+        // The HURDLE key ta82/ta32 would derive, expanded once for all blocks
+        if (lpCtx->eMode == SEALSEARCH_TA82) {
+            const uint8_t *lpKey = &lpCtx->lpKeys[dwKey * 16];
+            for (int i = 0; i < 16; i++) {
+                stCipher.abKey[i] = lpKey[i] ^ abVn[i & 1];
+            }
+        } else {
+            const uint8_t *lpDck = &lpCtx->lpKeys[dwKey * 10];
+            uint8_t abAdjustedDck[10];
+            for (int i = 0; i < 10; i++) {
+                abAdjustedDck[i] = lpDck[i] ^ abVn[i & 1];
+            }
+            transform_80_to_128(abAdjustedDck, stCipher.abKey);
+        }
+        sealsearch_set_key(&stCipher);
+
+        for (uint32_t b = 0; b < lpCtx->dwNumBlocks; b++) {
+            const uint8_t *lpSealed = lpCtx->aabSealed[b];
+            sealsearch_decrypt(&stCipher, abLastBlock, &lpSealed[7]);
+            if (!sealsearch_prefilter(lpCtx->eMode, lpSealed, abLastBlock)) {
+                continue;
+            }
+
+            SealsearchHit stHit = { n, dwKey, b, { abVn[0], abVn[1] } };
+            uint8_t bMf;
+            if (lpCtx->eMode == SEALSEARCH_TA82) {
+                ta82((uint8_t *)lpSealed, abVn, (uint8_t *)&lpCtx->lpKeys[dwKey * 16], stHit.abUnsealed, &bMf, stHit.abKeyN);
+            } else {
+                ta32((uint8_t *)lpSealed, abVn, (uint8_t *)&lpCtx->lpKeys[dwKey * 10], stHit.abUnsealed, &bMf);
+            }
+            if (!bMf && workpool_hits_append(lppHits, lpdwNum, lpdwCapacity, &stHit, sizeof(stHit))) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int sealsearch_cmp_hit(const void *a, const void *b) {
+    const SealsearchHit *x = a;
+    const SealsearchHit *y = b;
+    if (x->qwIndex != y->qwIndex) {
+        return (x->qwIndex > y->qwIndex) - (x->qwIndex < y->qwIndex);
+    }
+    return (x->dwBlock > y->dwBlock) - (x->dwBlock < y->dwBlock);
+}
+
+uint64_t sealsearch_run(SEALSEARCH_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxCandidates) {
+    uint64_t qwBegin = lpCtx->qwNextIndex;
+    uint64_t qwEnd = lpCtx->qwNumCandidates;
+
+    if (qwEnd - qwBegin > qwMaxCandidates) {
+        qwEnd = qwBegin + qwMaxCandidates;
+    }
+    if (qwBegin >= qwEnd) {
+        return 0;
+    }
+
+    // With one block per key schedule nothing is shared, so the tuned path applies; with more the schedule is expanded once
+    TuneProfile stTune;
+    tune_get(&stTune);
+    uint32_t eImpl = stTune.eHurdleImpl;
+    if (eImpl == TUNE_HURDLE_OTF && lpCtx->dwNumBlocks > 1) {
+        eImpl = TUNE_HURDLE_COMPACT;
+    }
+
+    // A stopped or failed pass is discarded and rescanned later
+    SealsearchJob stJob = { lpCtx, eImpl };
+    if (workpool_run_collect(lpPool, qwBegin, qwEnd, SEALSEARCH_CHUNK, sealsearch_scan, &stJob,
+                             &lpCtx->lpHits, &lpCtx->dwNumHits, &lpCtx->dwHitsCapacity, sizeof(SealsearchHit), sealsearch_cmp_hit)) {
+        return 0;
+    }
+    lpCtx->qwNextIndex = qwEnd;
+    return qwEnd - qwBegin;
+}
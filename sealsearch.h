@@ -0,0 +1,72 @@
+#ifndef HAVE_SEALSEARCH_H
+#define HAVE_SEALSEARCH_H
+
+#include <inttypes.h>
+
+#include "workpool.h"
+
+#define SEALSEARCH_MAX_BLOCKS   64
+#define SEALSEARCH_NUM_VNS      65536
+#define SEALSEARCH_SEALED_LEN   15
+
+/*
+ * Sealing parameter recovery for captured OTAR key blocks. The redundancy
+ * that ta82 and ta32 check for the modification flag makes the flag a cheap
+ * oracle: every candidate (key, VN) unseals each block with HURDLE_dec_cts
+ * and survives for the blocks whose flag comes out clear.
+ *
+ *   SEALSEARCH_TA82  GCK/GSKO sealed under a 16-byte CCK/KEK, VN = GCK-VN
+ *   SEALSEARCH_TA32  CCK sealed under a 10-byte DCK, VN = CCK-id
+ *
+ * Candidate n is key n / dwNumVns with VN dwVnFirst + n % dwNumVns, so a full
+ * sweep is 65536 VNs per key and a known VN is a range of one. A candidate's
+ * HURDLE key is expanded once and used for all blocks, and the second block
+ * decryption is only done for the 1 in 256 (ta82) or 65536 (ta32) candidates
+ * that pass the redundancy held in the second half of the plaintext.
+ * Survivors are confirmed with ta82/ta32 themselves. Without the right key a
+ * ta82 block passes with probability 2^-24, so a full VN sweep over many keys
+ * leaves a few false survivors; more blocks under the same parameters weed
+ * them out. Candidates [0, qwNextIndex) have been scanned.
+ */
+
+typedef enum {
+    SEALSEARCH_TA82,
+    SEALSEARCH_TA32,
+} SealsearchMode;
+
+typedef struct {
+    uint64_t qwIndex;                   // candidate index
+    uint32_t dwKey;                     // index into the candidate keys
+    uint32_t dwBlock;                   // index of the block it unsealed
+    uint8_t abVn[2];                    // GCK-VN or CCK-id, big endian
+    uint8_t abUnsealed[10];
+    uint8_t abKeyN[2];                  // GCK-N (ta82), zero for ta32
+} SealsearchHit;
+
+typedef struct {
+    uint32_t eMode;                     // SealsearchMode
+    const uint8_t *lpKeys;              // 16 (ta82) or 10 (ta32) bytes per key, kept by the caller
+    uint32_t dwNumKeys;
+    uint32_t dwVnFirst;
+    uint32_t dwNumVns;
+    uint8_t aabSealed[SEALSEARCH_MAX_BLOCKS][SEALSEARCH_SEALED_LEN];
+    uint32_t dwNumBlocks;
+
+    uint64_t qwNumCandidates;
+    uint64_t qwNextIndex;
+
+    SealsearchHit *lpHits;
+    uint32_t dwNumHits;
+    uint32_t dwHitsCapacity;
+} SEALSEARCH_CTX;
+
+// Returns -1 for an unknown mode, no keys or blocks, too many blocks or a VN range past 0xFFFF
+int sealsearch_init(SEALSEARCH_CTX *lpCtx, SealsearchMode eMode, const uint8_t *lpSealed, uint32_t dwNumBlocks,
+                    const uint8_t *lpKeys, uint32_t dwNumKeys, uint32_t dwVnFirst, uint32_t dwNumVns);
+void sealsearch_free(SEALSEARCH_CTX *lpCtx);
+
+// Scans up to qwMaxCandidates more on lpPool (NULL = calling thread); returns the number scanned, 0 if stopped or out of memory
+uint64_t sealsearch_run(SEALSEARCH_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxCandidates);
+int sealsearch_done(const SEALSEARCH_CTX *lpCtx);
+
+#endif /* HAVE_SEALSEARCH_H */
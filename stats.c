@@ -0,0 +1,160 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "stats.h"
+
+#define STATS_NAME(id, name) name,
+const char *g_aszStatsProbeNames[STATS_NUM_PROBES] = {
+    STATS_PROBES(STATS_NAME)
+};
+#undef STATS_NAME
+
+typedef struct StatsBlock {
+    StatsCounters astProbes[STATS_NUM_PROBES];
+    struct StatsBlock *lpNext;
+} StatsBlock;
+
+__thread StatsCounters *g_lpStatsThread;
+
+// Blocks outlive their threads so totals never go backwards
+static pthread_mutex_t g_hStatsLock = PTHREAD_MUTEX_INITIALIZER;
+static StatsBlock *g_lpStatsBlocks;
+static StatsSnapshot g_stStatsBaseline;
+
+#if !defined(__x86_64__) && !defined(__i386__)
+uint64_t stats_cycles(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+StatsCounters *stats_register_thread(void) {
+    StatsBlock *lpBlock = aligned_alloc(64, sizeof(StatsBlock));
+    if (lpBlock == NULL) {
+        // Counting is best effort; abort() would be worse than a missing sample
+        static StatsCounters s_astDiscard[STATS_NUM_PROBES];
+        return s_astDiscard;
+    }
+    memset(lpBlock, 0, sizeof(*lpBlock));
+
+    pthread_mutex_lock(&g_hStatsLock);
+    lpBlock->lpNext = g_lpStatsBlocks;
+    g_lpStatsBlocks = lpBlock;
+    pthread_mutex_unlock(&g_hStatsLock);
+
+    g_lpStatsThread = lpBlock->astProbes;
+    return g_lpStatsThread;
+}
+
+static void stats_sum(StatsSnapshot *lpSnapshotOut) {
+    memset(lpSnapshotOut, 0, sizeof(*lpSnapshotOut));
+    for (StatsBlock *lpBlock = g_lpStatsBlocks; lpBlock; lpBlock = lpBlock->lpNext) {
+        for (int i = 0; i < STATS_NUM_PROBES; i++) {
+            StatsCounters *lpIn = &lpBlock->astProbes[i];
+            StatsCounters *lpOut = &lpSnapshotOut->astProbes[i];
+            lpOut->qwCalls        += __atomic_load_n(&lpIn->qwCalls, __ATOMIC_RELAXED);
+            lpOut->qwKsBytes      += __atomic_load_n(&lpIn->qwKsBytes, __ATOMIC_RELAXED);
+            lpOut->qwRounds       += __atomic_load_n(&lpIn->qwRounds, __ATOMIC_RELAXED);
+            lpOut->qwBlocks       += __atomic_load_n(&lpIn->qwBlocks, __ATOMIC_RELAXED);
+            lpOut->qwKeySchedules += __atomic_load_n(&lpIn->qwKeySchedules, __ATOMIC_RELAXED);
+            lpOut->qwCycles       += __atomic_load_n(&lpIn->qwCycles, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void stats_snapshot(StatsSnapshot *lpSnapshotOut) {
+    pthread_mutex_lock(&g_hStatsLock);
+    stats_sum(lpSnapshotOut);
+    for (int i = 0; i < STATS_NUM_PROBES; i++) {
+        StatsCounters *lpOut = &lpSnapshotOut->astProbes[i];
+        StatsCounters *lpBase = &g_stStatsBaseline.astProbes[i];
+        lpOut->qwCalls        -= lpBase->qwCalls;
+        lpOut->qwKsBytes      -= lpBase->qwKsBytes;
+        lpOut->qwRounds       -= lpBase->qwRounds;
+        lpOut->qwBlocks       -= lpBase->qwBlocks;
+        lpOut->qwKeySchedules -= lpBase->qwKeySchedules;
+        lpOut->qwCycles       -= lpBase->qwCycles;
+    }
+    pthread_mutex_unlock(&g_hStatsLock);
+}
+
+void stats_reset(void) {
+    // Counters are owned by their threads, so a reset moves the baseline instead
+    pthread_mutex_lock(&g_hStatsLock);
+    stats_sum(&g_stStatsBaseline);
+    pthread_mutex_unlock(&g_hStatsLock);
+}
+
+int stats_export_prometheus(const char *lpszPath) {
+    static const struct {
+        const char *lpszMetric;
+        const char *lpszHelp;
+        size_t dwOffset;
+    } astMetrics[] = {
+        { "tetracrypto_calls_total",         "Number of calls",                        offsetof(StatsCounters, qwCalls) },
+        { "tetracrypto_keystream_bytes_total","Keystream bytes produced",              offsetof(StatsCounters, qwKsBytes) },
+        { "tetracrypto_rounds_total",        "Cipher rounds executed",                 offsetof(StatsCounters, qwRounds) },
+        { "tetracrypto_hurdle_blocks_total", "HURDLE blocks processed",                offsetof(StatsCounters, qwBlocks) },
+        { "tetracrypto_key_schedules_total", "Key schedule invocations",               offsetof(StatsCounters, qwKeySchedules) },
+        { "tetracrypto_cycles_total",        "Cycles spent, inclusive of nested calls", offsetof(StatsCounters, qwCycles) },
+    };
+    StatsSnapshot stSnapshot;
+
+    FILE *fp = fopen(lpszPath, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    stats_snapshot(&stSnapshot);
+
+    for (int m = 0; m < sizeof(astMetrics) / sizeof(astMetrics[0]); m++) {
+        fprintf(fp, "# HELP %s %s\n", astMetrics[m].lpszMetric, astMetrics[m].lpszHelp);
+        fprintf(fp, "# TYPE %s counter\n", astMetrics[m].lpszMetric);
+        for (int i = 0; i < STATS_NUM_PROBES; i++) {
+            uint64_t qwValue = *(uint64_t *)((uint8_t *)&stSnapshot.astProbes[i] + astMetrics[m].dwOffset);
+            fprintf(fp, "%s{function=\"%s\"} %" PRIu64 "\n", astMetrics[m].lpszMetric, g_aszStatsProbeNames[i], qwValue);
+        }
+    }
+    return fclose(fp) ? -1 : 0;
+}
+
+int stats_export_json(const char *lpszPath) {
+    StatsSnapshot stSnapshot;
+
+    FILE *fp = fopen(lpszPath, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    stats_snapshot(&stSnapshot);
+
+    fprintf(fp, "{\n");
+    for (int i = 0; i < STATS_NUM_PROBES; i++) {
+        StatsCounters *lpCounters = &stSnapshot.astProbes[i];
+        fprintf(fp, "  \"%s\": {\"calls\": %" PRIu64 ", \"keystream_bytes\": %" PRIu64 ", \"rounds\": %" PRIu64
+                ", \"hurdle_blocks\": %" PRIu64 ", \"key_schedules\": %" PRIu64 ", \"cycles\": %" PRIu64 "}%s\n",
+                g_aszStatsProbeNames[i], lpCounters->qwCalls, lpCounters->qwKsBytes, lpCounters->qwRounds,
+                lpCounters->qwBlocks, lpCounters->qwKeySchedules, lpCounters->qwCycles,
+                i + 1 < STATS_NUM_PROBES ? "," : "");
+    }
+    fprintf(fp, "}\n");
+    return fclose(fp) ? -1 : 0;
+}
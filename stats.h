@@ -0,0 +1,134 @@
+#ifndef HAVE_STATS_H
+#define HAVE_STATS_H
+
+#include <inttypes.h>
+
+/*
+ * Hot-path instrumentation. Counting is compiled in only when the library is
+ * built with -DTETRA_STATS (make STATS=1); otherwise the STATS_* macros expand
+ * to nothing and the snapshot/export API reports zeros.
+ *
+ * Every thread owns a cache-line aligned block of counters that only it writes;
+ * snapshots sum the blocks of all threads that ever recorded anything. Cycle
+ * counts are inclusive of nested primitives (e.g. HURDLE_enc_cbc includes its
+ * HURDLE_set_key and HURDLE_encrypt calls). The match probes count calls only,
+ * since how many keystream bytes a match generates depends on where it fails.
+ */
+
+#define STATS_PROBES(X) \
+    X(TEA1,                  "tea1") \
+    X(TEA1_INIT_KEY_REGISTER,"tea1_init_key_register") \
+    X(TEA1_CLOCK,            "tea1_clock") \
+    X(TEA1_INNER,            "tea1_inner") \
+    X(TEA1_EXPAND_IV,        "tea1_expand_iv") \
+    X(TEA1_MATCH_KEY_STREAM, "tea1_match_key_stream") \
+    X(TEA2,                  "tea2") \
+    X(TEA2_MATCH,            "tea2_match") \
+    X(TEA2_MATCH_KEY_STREAM, "tea2_match_key_stream") \
+    X(TEA3,                  "tea3") \
+    X(TEA3_MATCH,            "tea3_match") \
+    X(TEA3_MATCH_KEY_STREAM, "tea3_match_key_stream") \
+    X(HURDLE_SET_KEY,        "HURDLE_set_key") \
+    X(HURDLE_SET_KEY_FW,     "HURDLE_set_key_fw") \
+    X(HURDLE_F,              "HURDLE_f") \
+    X(HURDLE_ENCRYPT,        "HURDLE_encrypt") \
+    X(HURDLE_SET_KEY_COMPACT,"HURDLE_set_key_compact") \
+    X(HURDLE_ENCRYPT_COMPACT,"HURDLE_encrypt_compact") \
+    X(HURDLE_ENCRYPT_OTF,    "HURDLE_encrypt_otf") \
+    X(HURDLE_ENC_CBC,        "HURDLE_enc_cbc") \
+    X(HURDLE_DEC_CTS,        "HURDLE_dec_cts") \
+    X(TA11_TA41,             "ta11_ta41") \
+    X(TA12_TA22,             "ta12_ta22") \
+    X(TA21,                  "ta21") \
+    X(TA31,                  "ta31") \
+    X(TA32,                  "ta32") \
+    X(TA51,                  "ta51") \
+    X(TA52,                  "ta52") \
+    X(TA71,                  "ta71") \
+    X(TA81,                  "ta81") \
+    X(TA82,                  "ta82") \
+    X(TA91,                  "ta91") \
+    X(TA92,                  "ta92") \
+    X(TB4,                   "tb4") \
+    X(TB5,                   "tb5") \
+    X(TB6,                   "tb6") \
+    X(TB7,                   "tb7")
+
+#define STATS_ENUM(id, name) STATS_##id,
+enum {
+    STATS_PROBES(STATS_ENUM)
+    STATS_NUM_PROBES
+};
+#undef STATS_ENUM
+
+typedef struct {
+    uint64_t qwCalls;
+    uint64_t qwKsBytes;
+    uint64_t qwRounds;
+    uint64_t qwBlocks;
+    uint64_t qwKeySchedules;
+    uint64_t qwCycles;
+} __attribute__((aligned(64))) StatsCounters;
+
+typedef struct {
+    StatsCounters astProbes[STATS_NUM_PROBES];
+} StatsSnapshot;
+
+extern const char *g_aszStatsProbeNames[STATS_NUM_PROBES];
+
+void stats_snapshot(StatsSnapshot *lpSnapshotOut);
+void stats_reset(void);
+int stats_export_prometheus(const char *lpszPath);
+int stats_export_json(const char *lpszPath);
+
+// Internal
+StatsCounters *stats_register_thread(void);
+extern __thread StatsCounters *g_lpStatsThread;
+
+#ifdef TETRA_STATS
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define stats_cycles() __rdtsc()
+#else
+uint64_t stats_cycles(void);
+#endif
+
+static inline StatsCounters *stats_counters(uint32_t dwProbe) {
+    StatsCounters *lpBlock = g_lpStatsThread;
+    if (__builtin_expect(lpBlock == NULL, 0)) {
+        lpBlock = stats_register_thread();
+    }
+    return &lpBlock[dwProbe];
+}
+
+// Only the owning thread writes, relaxed stores keep concurrent snapshots well-defined
+#define STATS_ADD(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+static inline void stats_record(uint32_t dwProbe, uint64_t qwStart, uint64_t qwKsBytes, uint64_t qwRounds, uint64_t qwBlocks, uint64_t qwKeySchedules) {
+    StatsCounters *lpCounters = stats_counters(dwProbe);
+    STATS_ADD(lpCounters->qwCalls, 1);
+    STATS_ADD(lpCounters->qwKsBytes, qwKsBytes);
+    STATS_ADD(lpCounters->qwRounds, qwRounds);
+    STATS_ADD(lpCounters->qwBlocks, qwBlocks);
+    STATS_ADD(lpCounters->qwKeySchedules, qwKeySchedules);
+    if (qwStart) {
+        STATS_ADD(lpCounters->qwCycles, stats_cycles() - qwStart);
+    }
+}
+
+#define STATS_BEGIN()                                uint64_t qwStatsStart = stats_cycles()
+#define STATS_END(probe, ks, rounds, blocks, keysch) stats_record(STATS_##probe, qwStatsStart, ks, rounds, blocks, keysch)
+#define STATS_COUNT(probe, ks, rounds, blocks, keysch) stats_record(STATS_##probe, 0, ks, rounds, blocks, keysch)
+
+#else
+
+// The arguments are referenced but never evaluated, so values computed only for stats don't warn
+#define STATS_UNUSED(ks, rounds, blocks, keysch)       do { (void)sizeof(ks); (void)sizeof(rounds); (void)sizeof(blocks); (void)sizeof(keysch); } while (0)
+#define STATS_BEGIN()                                  do { } while (0)
+#define STATS_END(probe, ks, rounds, blocks, keysch)   STATS_UNUSED(ks, rounds, blocks, keysch)
+#define STATS_COUNT(probe, ks, rounds, blocks, keysch) STATS_UNUSED(ks, rounds, blocks, keysch)
+
+#endif /* TETRA_STATS */
+
+#endif /* HAVE_STATS_H */
@@ -20,6 +20,7 @@
 #include "taa1.h"
 #include "hurdle.h"
 #include "common.h"
+#include "stats.h"
 
 void transform_80_to_120(const uint8_t *lpBuffer, uint8_t *lpBufferOut) {
     lpBufferOut[ 0] = lpBuffer[0] + lpBuffer[9];
@@ -114,13 +115,18 @@ void transform_120_to_80_alt(const uint8_t *lpBuffer, uint8_t *lpBufferOut) {
 
 void ta11_ta41(uint8_t *lpKeyK, uint8_t *lpChallengeRs, uint8_t *lpKsOut) {
     uint8_t abChallengeExpanded[16];
+    STATS_BEGIN();
+
     transform_80_to_128_alt(lpChallengeRs, abChallengeExpanded);
     HURDLE_enc_cbc(lpKsOut, abChallengeExpanded, lpKeyK);
+    STATS_END(TA11_TA41, 0, 0, 0, 0);
 }
 
 void ta12_ta22(uint8_t *lpKeyKs, uint8_t *lpRand, uint8_t *lpResOut, uint8_t *lpDckOut) {
     uint8_t abRandExpanded[16];
     uint8_t abCiphertext[16];
+    STATS_BEGIN();
+
     transform_80_to_128_alt(lpRand, abRandExpanded);
     HURDLE_enc_cbc(abCiphertext, abRandExpanded, lpKeyKs);
 
@@ -139,12 +145,14 @@ void ta12_ta22(uint8_t *lpKeyKs, uint8_t *lpRand, uint8_t *lpResOut, uint8_t *lp
     lpDckOut[7] = abCiphertext[11];
     lpDckOut[8] = abCiphertext[13];
     lpDckOut[9] = abCiphertext[14];
+    STATS_END(TA12_TA22, 0, 0, 0, 0);
 }
 
 void ta21(uint8_t *lpKeyK, uint8_t *lpChallengeRs, uint8_t *lpKspOut) {
     uint8_t abChallengeExpanded[16];
     uint8_t abChallengeReversed[10];
     int i;
+    STATS_BEGIN();
 
     for (i = 0; i < 10; i++) {
         abChallengeReversed[i] = lpChallengeRs[9-i];
@@ -152,6 +160,7 @@ void ta21(uint8_t *lpKeyK, uint8_t *lpChallengeRs, uint8_t *lpKspOut) {
 
     transform_80_to_128_alt(abChallengeReversed, abChallengeExpanded);
     HURDLE_enc_cbc(lpKspOut, abChallengeExpanded, lpKeyK);
+    STATS_END(TA21, 0, 0, 0, 0);
 }
 
 void ta31(uint8_t *lpUnsealedCck, uint8_t *lpCckId, uint8_t *lpDck, uint8_t *lpSealedCckOut) {
@@ -160,6 +169,7 @@ void ta31(uint8_t *lpUnsealedCck, uint8_t *lpCckId, uint8_t *lpDck, uint8_t *lpS
     uint8_t abAdjustedDck[10];
     uint8_t abSealed[16];
     int i;
+    STATS_BEGIN();
 
     transform_80_to_120_alt(lpUnsealedCck, abUnsealedPadded);
     abUnsealedPadded[15] = '\0';
@@ -173,6 +183,7 @@ void ta31(uint8_t *lpUnsealedCck, uint8_t *lpCckId, uint8_t *lpDck, uint8_t *lpS
     /* ciphertext stealing */
     memcpy(lpSealedCckOut, abSealed, 7);
     memcpy(lpSealedCckOut + 7, abSealed + 8, 8);
+    STATS_END(TA31, 0, 0, 0, 0);
 }
 
 void ta32(uint8_t *lpSealedCck, uint8_t *lpCckId, uint8_t *lpDck, uint8_t *lpUnsealedCckOut, uint8_t *lpMfOut) {
@@ -180,7 +191,8 @@ void ta32(uint8_t *lpSealedCck, uint8_t *lpCckId, uint8_t *lpDck, uint8_t *lpUns
     uint8_t abAdjustedDck[10];
     uint8_t abUnsealedPadded[16];
     int i;
-    
+    STATS_BEGIN();
+
     for (i = 0; i < 10; i++) {
         abAdjustedDck[i] = lpDck[i] ^ lpCckId[i & 1];
     }
@@ -196,6 +208,7 @@ void ta32(uint8_t *lpSealedCck, uint8_t *lpCckId, uint8_t *lpDck, uint8_t *lpUns
         ((abUnsealedPadded[ 6] ^ abUnsealedPadded[ 7]) != abUnsealedPadded[ 8]) ||
         ((abUnsealedPadded[ 9] ^ abUnsealedPadded[10]) != abUnsealedPadded[11]) ||
         ((abUnsealedPadded[12] ^ abUnsealedPadded[13]) != abUnsealedPadded[14]);
+    STATS_END(TA32, 0, 0, 0, 0);
 }
 
 void ta51(uint8_t *lpUnsealed, uint8_t *lpVn, uint8_t *lpKey, uint8_t *lpKeyN, uint8_t *lpSealedOut) {
@@ -204,6 +217,7 @@ void ta51(uint8_t *lpUnsealed, uint8_t *lpVn, uint8_t *lpKey, uint8_t *lpKeyN, u
     uint8_t abSealed[16];
     uint8_t abAdjustedKey[16];
     int i;
+    STATS_BEGIN();
 
     assert((*lpKeyN & 0xe0) == 0);
 
@@ -219,6 +233,7 @@ void ta51(uint8_t *lpUnsealed, uint8_t *lpVn, uint8_t *lpKey, uint8_t *lpKeyN, u
     /* ciphertext stealing */
     memcpy(lpSealedOut, abSealed, 7);
     memcpy(lpSealedOut + 7, abSealed + 8, 8);
+    STATS_END(TA51, 0, 0, 0, 0);
 }
 
 void ta52(uint8_t *lpSealed, uint8_t *lpKey, uint8_t *lpVn, uint8_t *lpUnsealedOut, uint8_t *lpMfOut, uint8_t *lpKeyNOut) {
@@ -226,6 +241,7 @@ void ta52(uint8_t *lpSealed, uint8_t *lpKey, uint8_t *lpVn, uint8_t *lpUnsealedO
     uint8_t abUnsealedPadded[15];
     uint8_t abUnsealed[11];
     int i;
+    STATS_BEGIN();
 
     for (i = 0; i < 16; i++) {
         abAdjustedKey[i] = lpKey[i] ^ lpVn[i & 1];
@@ -241,6 +257,7 @@ void ta52(uint8_t *lpSealed, uint8_t *lpKey, uint8_t *lpVn, uint8_t *lpUnsealedO
         ((abUnsealedPadded[ 7] ^ abUnsealedPadded[ 8] ^ abUnsealedPadded[ 9]) != abUnsealedPadded[10]) ||
         ((abUnsealedPadded[11] ^ abUnsealedPadded[12] ^ abUnsealedPadded[13]) != abUnsealedPadded[14]) ||
         abUnsealed[10] & 0xe0;
+    STATS_END(TA52, 0, 0, 0, 0);
 }
 
 void ta71(uint8_t *lpGck, uint8_t *lpCck, uint8_t *lpMgckOut) {
@@ -249,6 +266,7 @@ void ta71(uint8_t *lpGck, uint8_t *lpCck, uint8_t *lpMgckOut) {
     uint8_t abPlaintextExpanded[16];
     uint8_t abPlaintext[10];
     int i;
+    STATS_BEGIN();
 
     for (i = 0; i < 10; i++) {
         abPlaintext[i] = lpGck[i] ^ lpCck[i];
@@ -276,6 +294,7 @@ void ta71(uint8_t *lpGck, uint8_t *lpCck, uint8_t *lpMgckOut) {
     HURDLE_enc_cbc(abCiphertext, abPlaintextExpanded, abHurdleKey);
 
     memcpy(lpMgckOut, &abCiphertext[3], 10);
+    STATS_END(TA71, 0, 0, 0, 0);
 }
 
 void ta81(uint8_t *lpUnsealedGck, uint8_t *lpGckVn, uint8_t *lpGckN, uint8_t *lpKey, uint8_t *lpSealedGckOut) {
@@ -283,6 +302,7 @@ void ta81(uint8_t *lpUnsealedGck, uint8_t *lpGckVn, uint8_t *lpGckN, uint8_t *lp
     uint8_t abSealed[16];
     uint8_t abAdjustedKey[16];
     int i;
+    STATS_BEGIN();
 
     abUnsealedPadded[ 0] = lpUnsealedGck[0];
     abUnsealedPadded[ 1] = lpUnsealedGck[1];
@@ -308,12 +328,14 @@ void ta81(uint8_t *lpUnsealedGck, uint8_t *lpGckVn, uint8_t *lpGckN, uint8_t *lp
     /* ciphertext stealing */
     memcpy(lpSealedGckOut, abSealed, 7);
     memcpy(lpSealedGckOut + 7, abSealed + 8, 8);
+    STATS_END(TA81, 0, 0, 0, 0);
 }
 
 void ta82(uint8_t *lpSealedGck, uint8_t *lpGckVn, uint8_t *lpKey, uint8_t *lpUnsealedGckOut, uint8_t *lpMfOut, uint8_t *lpGckNOut) {
     uint8_t abAdjustedKey[16];
     uint8_t abUnsealedPadded[15];
     int i;
+    STATS_BEGIN();
 
     for (i = 0; i < 16; i++) {
         abAdjustedKey[i] = lpKey[i] ^ lpGckVn[i & 1];
@@ -339,19 +361,26 @@ void ta82(uint8_t *lpSealedGck, uint8_t *lpGckVn, uint8_t *lpKey, uint8_t *lpUns
         (abUnsealedPadded[14] != (abUnsealedPadded[10] ^ abUnsealedPadded[11] ^ abUnsealedPadded[12] ^ abUnsealedPadded[13])) ||
         (abUnsealedPadded[ 9] != (abUnsealedPadded[ 5] ^ abUnsealedPadded[ 6] ^ abUnsealedPadded[ 7] ^ abUnsealedPadded[ 8])) ||
         (abUnsealedPadded[ 4] != (abUnsealedPadded[ 0] ^ abUnsealedPadded[ 1] ^ abUnsealedPadded[ 2] ^ abUnsealedPadded[ 3]));
+    STATS_END(TA82, 0, 0, 0, 0);
 }
 
 void ta91(uint8_t *lpUnsealedGsko, uint8_t *lpGskoVn, uint8_t *lpKey, uint8_t *lpSealedGskoOut) {
-    return ta81(lpUnsealedGsko, lpGskoVn, lpUnsealedGsko + 10, lpKey, lpSealedGskoOut);
+    STATS_BEGIN();
+    ta81(lpUnsealedGsko, lpGskoVn, lpUnsealedGsko + 10, lpKey, lpSealedGskoOut);
+    STATS_END(TA91, 0, 0, 0, 0);
 }
 
 void ta92(uint8_t *lpSealedGsko, uint8_t *lpGskoVn, uint8_t *lpKey, uint8_t *lpUnsealedGskoOut, uint8_t *lpMfOut) {
-    return ta82(lpSealedGsko, lpGskoVn, lpKey, lpUnsealedGskoOut, lpMfOut, lpUnsealedGskoOut + 10);
+    STATS_BEGIN();
+    ta82(lpSealedGsko, lpGskoVn, lpKey, lpUnsealedGskoOut, lpMfOut, lpUnsealedGskoOut + 10);
+    STATS_END(TA92, 0, 0, 0, 0);
 }
 
 
 void tb4(uint8_t *lpDck1, uint8_t *lpDck2, uint8_t *lpDckOut) {
     int i;
+    STATS_COUNT(TB4, 0, 0, 0, 0);
+
     for (i = 0; i < 10; i++) {
         lpDckOut[i] = lpDck1[i] ^ lpDck2[i];
     }
@@ -360,6 +389,7 @@ void tb4(uint8_t *lpDck1, uint8_t *lpDck2, uint8_t *lpDckOut) {
 void tb5(uint8_t *lpCn, uint8_t *lpLa, uint8_t *lpCc, uint8_t *lpCk, uint8_t *lpEckOut) {
     uint32_t adwComputedEck[3];
     uint32_t adwInputCk[3];
+    STATS_COUNT(TB5, 0, 0, 0, 0);
 
     adwInputCk[0] = be16(*(uint16_t *)&lpCk[0]);
     adwInputCk[1] = be32(*(uint32_t *)&lpCk[2]);
@@ -398,6 +428,7 @@ void tb5(uint8_t *lpCn, uint8_t *lpLa, uint8_t *lpCc, uint8_t *lpCk, uint8_t *lp
 void tb6(uint8_t *lpSck, uint8_t *lpCn, uint8_t *lpSsi, uint8_t *lpEckOut) {
     uint32_t adwComputedEck[3];
     uint32_t adwInputSck[3];
+    STATS_COUNT(TB6, 0, 0, 0, 0);
 
     adwInputSck[0] = be16(*(uint16_t *)&lpSck[0]);
     adwInputSck[1] = be32(*(uint32_t *)&lpSck[2]);
@@ -424,6 +455,7 @@ void tb6(uint8_t *lpSck, uint8_t *lpCn, uint8_t *lpSsi, uint8_t *lpEckOut) {
 }
 
 void tb7(uint8_t *lpGsko, uint8_t *lpEgskoOut) {
+    STATS_COUNT(TB7, 0, 0, 0, 0);
     lpEgskoOut[ 0] = lpGsko[ 0];
     lpEgskoOut[ 1] = lpGsko[ 1];
     lpEgskoOut[ 2] = lpGsko[ 2];
@@ -0,0 +1,185 @@
+/*
+ * TEA1/TEA2/TEA3 batch keystream generation and TEA1 reduced-key search.
+ *
+ * This file is not compiled on its own. tea_cl.c builds one program per
+ * variant and prepends the TEA_* parameters and the g_abSbox/g_awLutSliced
+ * tables taken from that variant's TeaVariant descriptor, so the constants
+ * have a single source in tea1.c/tea2.c/tea3.c. The round function mirrors
+ * tea_core.h; see there for the key register layout.
+ */
+
+#define ror8x2(x, n) ((ushort)((((x) >> (n)) & ((0xFF >> (n)) * 0x0101)) | (((x) << (8 - (n))) & ((0xFF & (0xFF << (8 - (n)))) * 0x0101))))
+#define mux16(a, b, s) ((ushort)((a) ^ (((a) ^ (b)) & (s))))
+
+static inline ushort tea_filter_sliced(ushort x0, ushort x1, ushort x2, ushort x3) {
+    ushort m0 = mux16(g_awLutSliced[ 0], g_awLutSliced[ 1], x0);
+    ushort m1 = mux16(g_awLutSliced[ 2], g_awLutSliced[ 3], x0);
+    ushort m2 = mux16(g_awLutSliced[ 4], g_awLutSliced[ 5], x0);
+    ushort m3 = mux16(g_awLutSliced[ 6], g_awLutSliced[ 7], x0);
+    ushort m4 = mux16(g_awLutSliced[ 8], g_awLutSliced[ 9], x0);
+    ushort m5 = mux16(g_awLutSliced[10], g_awLutSliced[11], x0);
+    ushort m6 = mux16(g_awLutSliced[12], g_awLutSliced[13], x0);
+    ushort m7 = mux16(g_awLutSliced[14], g_awLutSliced[15], x0);
+    m0 = mux16(m0, m1, x1);
+    m2 = mux16(m2, m3, x1);
+    m4 = mux16(m4, m5, x1);
+    m6 = mux16(m6, m7, x1);
+    m0 = mux16(m0, m2, x2);
+    m4 = mux16(m4, m6, x2);
+    return mux16(m0, m4, x3);
+}
+
+static inline ulong tea_expand_iv(uint dwFrameNumbers) {
+    uint dwXorred = dwFrameNumbers ^ TEA_IV_XOR;
+    dwXorred = (dwXorred << 8) | (dwXorred >> 24);
+    ulong qwIv = ((ulong)dwFrameNumbers << 32) | dwXorred;
+    return (qwIv >> 8) | (qwIv << 56);
+}
+
+static inline uchar tea_key_byte(ulong qwKeyHi, ushort wKeyLo, uint dwIndex) {
+#if TEA_KEY_LEN <= 8
+    return (uchar)(qwKeyHi >> (8 * (TEA_KEY_LEN - 1 - dwIndex)));
+#else
+    return dwIndex < 8 ? (uchar)(qwKeyHi >> (56 - 8 * dwIndex)) : (uchar)(wKeyLo >> (8 * (9 - dwIndex)));
+#endif
+}
+
+// Key register from the 80-bit key; TEA1 compresses it into its 32-bit register
+static inline void tea_load_key(__global const uchar *lpKey, ulong *lpqwKeyHi, ushort *lpwKeyLo) {
+    ulong qwKeyHi = 0;
+    ushort wKeyLo = 0;
+#if TEA_TYPE == 1
+    uint dwReg = 0;
+    for (int i = 0; i < 10; i++) {
+        dwReg = (dwReg << 8) | g_abSbox[((dwReg >> 24) ^ lpKey[i] ^ dwReg) & 0xff];
+    }
+    qwKeyHi = dwReg;
+#else
+    for (int i = 0; i < 8; i++) {
+        qwKeyHi |= (ulong)lpKey[i] << (56 - 8 * i);
+    }
+    wKeyLo = (ushort)((lpKey[8] << 8) | lpKey[9]);
+#endif
+    *lpqwKeyHi = qwKeyHi;
+    *lpwKeyLo = wKeyLo;
+}
+
+static inline uchar tea_reorder(uchar bStByte) {
+    return (uchar)((((bStByte >> 0) & 1) << TEA_PERM_0) | (((bStByte >> 1) & 1) << TEA_PERM_1) |
+                   (((bStByte >> 2) & 1) << TEA_PERM_2) | (((bStByte >> 3) & 1) << TEA_PERM_3) |
+                   (((bStByte >> 4) & 1) << TEA_PERM_4) | (((bStByte >> 5) & 1) << TEA_PERM_5) |
+                   (((bStByte >> 6) & 1) << TEA_PERM_6) | (((bStByte >> 7) & 1) << TEA_PERM_7));
+}
+
+static inline void tea_clock(ulong *lpqwIvReg, ulong *lpqwKeyHi, ushort *lpwKeyLo, uint dwNumRounds) {
+    ulong qwIvReg = *lpqwIvReg;
+    ulong qwKeyHi = *lpqwKeyHi;
+    ushort wKeyLo = *lpwKeyLo;
+
+    for (uint j = 0; j < dwNumRounds; j++) {
+        uchar bSboxOut = g_abSbox[tea_key_byte(qwKeyHi, wKeyLo, TEA_SBOX_TAP_A) ^ tea_key_byte(qwKeyHi, wKeyLo, TEA_SBOX_TAP_B)];
+#if TEA_SBOX_XOR_TAP >= 0
+        bSboxOut ^= tea_key_byte(qwKeyHi, wKeyLo, TEA_SBOX_XOR_TAP);
+#endif
+#if TEA_KEY_LEN <= 8
+        qwKeyHi = (qwKeyHi << 8) | bSboxOut;
+#if TEA_KEY_LEN < 8
+        qwKeyHi &= (1UL << (8 * TEA_KEY_LEN)) - 1;
+#endif
+#else
+        qwKeyHi = (qwKeyHi << 8) | (wKeyLo >> 8);
+        wKeyLo = (ushort)((wKeyLo << 8) | bSboxOut);
+#endif
+
+        ushort wStA = (ushort)(qwIvReg >> TEA_FILTER_SHIFT_A);
+        ushort wStB = (ushort)(qwIvReg >> TEA_FILTER_SHIFT_B);
+        ushort wSt0 = (wStA & 0xff) | (wStB << 8);
+        ushort wSt1 = (wStA >> 8) | (wStB & 0xff00);
+        ushort wDerived = tea_filter_sliced(ror8x2(wSt0, TEA_FILTER_ROT_0), ror8x2(wSt0, TEA_FILTER_ROT_1),
+                                            ror8x2(wSt1, TEA_FILTER_ROT_2), ror8x2(wSt1, TEA_FILTER_ROT_3));
+        uchar bReordByte = tea_reorder((uchar)(qwIvReg >> TEA_REORDER_SHIFT));
+
+#if TEA_NEW_FROM_LUT_B
+        uchar bNewByte = (uchar)(qwIvReg >> 56) ^ bReordByte ^ bSboxOut ^ (uchar)(wDerived >> 8);
+        uchar bMixByte = (uchar)wDerived;
+#else
+        uchar bNewByte = (uchar)(qwIvReg >> 56) ^ bReordByte ^ bSboxOut ^ (uchar)wDerived;
+        uchar bMixByte = (uchar)(wDerived >> 8);
+#endif
+#if TEA_EXTRA_TAP_SHIFT >= 0
+        bNewByte ^= (uchar)(qwIvReg >> TEA_EXTRA_TAP_SHIFT);
+#endif
+        qwIvReg = ((qwIvReg << 8) ^ ((ulong)bMixByte << TEA_MIX_SHIFT)) | bNewByte;
+    }
+
+    *lpqwIvReg = qwIvReg;
+    *lpqwKeyHi = qwKeyHi;
+    *lpwKeyLo = wKeyLo;
+}
+
+/*
+ * One keystream per work item: lane i uses adwIvs[i] and the 10 byte key at
+ * lpKeys + 10 * i, and writes dwNumKsBytes bytes to lpKsOut + dwNumKsBytes * i.
+ */
+__kernel void tea_keystream(__global const uint *adwIvs, __global const uchar *lpKeys, uint dwNumLanes,
+                            uint dwNumKsBytes, __global uchar *lpKsOut) {
+    uint dwLane = get_global_id(0);
+    if (dwLane >= dwNumLanes) {
+        return;
+    }
+
+    ulong qwKeyHi;
+    ushort wKeyLo;
+    ulong qwIvReg = tea_expand_iv(adwIvs[dwLane]);
+    tea_load_key(lpKeys + 10 * dwLane, &qwKeyHi, &wKeyLo);
+
+    __global uchar *lpOut = lpKsOut + (ulong)dwNumKsBytes * dwLane;
+    for (uint i = 0; i < dwNumKsBytes; i++) {
+        tea_clock(&qwIvReg, &qwKeyHi, &wKeyLo, i ? TEA_BYTE_ROUNDS : TEA_INIT_ROUNDS);
+        lpOut[i] = (uchar)(qwIvReg >> 56);
+    }
+}
+
+#if TEA_TYPE == 1
+
+// Same layout as Tea1Filter in tea1_search.h
+typedef struct {
+    uint dwIv;
+    uint dwNumKsBytes;
+    uchar abKs[TEA1_SEARCH_MAX_KS_BYTES];
+    uchar abMask[TEA1_SEARCH_MAX_KS_BYTES];
+} Tea1Filter;
+
+/*
+ * Test key registers qwStartKey .. qwStartKey + dwCount - 1 against every
+ * filter, stopping at the first mismatching keystream byte like
+ * tea1_filter_match. Only passing registers are written back: the hit counter
+ * is always incremented, the register is stored if it still fits.
+ */
+__kernel void tea1_search(ulong qwStartKey, uint dwCount, __constant Tea1Filter *astFilters, uint dwNumFilters,
+                          __global uint *lpdwHits, uint dwMaxHits, volatile __global uint *lpdwNumHits) {
+    uint dwIndex = get_global_id(0);
+    if (dwIndex >= dwCount) {
+        return;
+    }
+    uint dwKeyReg = (uint)(qwStartKey + dwIndex);
+
+    for (uint f = 0; f < dwNumFilters; f++) {
+        ulong qwIvReg = tea_expand_iv(astFilters[f].dwIv);
+        ulong qwKeyHi = dwKeyReg;
+        ushort wKeyLo = 0;
+        for (uint i = 0; i < astFilters[f].dwNumKsBytes; i++) {
+            tea_clock(&qwIvReg, &qwKeyHi, &wKeyLo, i ? TEA_BYTE_ROUNDS : TEA_INIT_ROUNDS);
+            if (((uchar)(qwIvReg >> 56) ^ astFilters[f].abKs[i]) & astFilters[f].abMask[i]) {
+                return;
+            }
+        }
+    }
+
+    uint dwSlot = atomic_inc(lpdwNumHits);
+    if (dwSlot < dwMaxHits) {
+        lpdwHits[dwSlot] = dwKeyReg;
+    }
+}
+
+#endif
@@ -16,11 +16,18 @@
 #include <inttypes.h>
 #include <string.h>
 
+#include "common.h"
 #include "tea1.h"
+#include "tea_core.h"
+#include "tea_simd.h"
+#include "stats.h"
 
 
-const uint16_t g_awTea1LutA[8] = { 0xDA86, 0x85E9, 0x29B5, 0x2BC6, 0x8C6B, 0x974C, 0xC671, 0x93E2 };
-const uint16_t g_awTea1LutB[8] = { 0x85D6, 0x791A, 0xE985, 0xC671, 0x2B9C, 0xEC92, 0xC62B, 0x9C47 };
+#define TEA1_LUT_A 0xDA86, 0x85E9, 0x29B5, 0x2BC6, 0x8C6B, 0x974C, 0xC671, 0x93E2
+#define TEA1_LUT_B 0x85D6, 0x791A, 0xE985, 0xC671, 0x2B9C, 0xEC92, 0xC62B, 0x9C47
+
+const uint16_t g_awTea1LutA[8] = { TEA1_LUT_A };
+const uint16_t g_awTea1LutB[8] = { TEA1_LUT_B };
 const uint8_t g_abTea1Sbox[256] = {
     0x9B, 0xF8, 0x3B, 0x72, 0x75, 0x62, 0x88, 0x22, 0xFF, 0xA6, 0x10, 0x4D, 0xA9, 0x97, 0xC3, 0x7B,
     0x9F, 0x78, 0xF3, 0xB6, 0xA0, 0xCC, 0x17, 0xAB, 0x4A, 0x41, 0x8D, 0x89, 0x25, 0x87, 0xD3, 0xE3,
@@ -39,12 +46,36 @@ const uint8_t g_abTea1Sbox[256] = {
     0x7C, 0xE9, 0x8C, 0xFE, 0xDC, 0x0F, 0x2D, 0x3C, 0x2E, 0xF6, 0x15, 0x2F, 0xAF, 0xE1, 0xEB, 0x3F,
     0x99, 0x43, 0x13, 0x0B, 0xE0, 0xA5, 0x12, 0x77, 0x5D, 0xB3, 0x38, 0xD9, 0xEF, 0x5A, 0x01, 0x70};
 
+static const uint16_t g_awTea1LutSliced[16] = TEA_LUT_SLICED(TEA1_LUT_A, TEA1_LUT_B);
+
+static const TeaVariant g_stTea1Variant = {
+    .abSbox = g_abTea1Sbox,
+    .awLutSliced = g_awTea1LutSliced,
+    .dwIvXor = 0x96724FA1,
+    .dwKeyLen = 4,
+    .dwSboxTapA = 0,
+    .dwSboxTapB = 3,
+    .dwSboxXorTap = -1,
+    .dwFilterShiftA = 8,
+    .dwFilterShiftB = 40,
+    .abFilterRot = { 7, 0, 1, 2 },    // taps on bit 7,0 for bSt0 and bit 1,2 for bSt1
+    .dwReorderShift = 32,
+    .abReorderPerm = { 6, 3, 0, 7, 5, 2, 1, 4 },
+    .bNewFromLutB = 1,
+    .dwExtraTapShift = -1,
+    .dwMixShift = 32,
+    .dwInitRounds = TEA1_NUM_INIT_ROUNDS,
+    .dwByteRounds = TEA1_NUM_BYTE_ROUNDS,
+};
+
+const TeaVariant *tea1_variant(void) {
+    return &g_stTea1Variant;
+}
+
 
 uint64_t tea1_expand_iv(uint32_t dwShortIv) {
-    uint32_t dwXorred = dwShortIv ^ 0x96724FA1;
-    dwXorred = (dwXorred << 8) | (dwXorred >> 24); // rotate left -> translated to single rol instruction
-    uint64_t qwIv = ((uint64_t)dwShortIv << 32) | dwXorred;
-    return (qwIv >> 8) | (qwIv << 56); // rotate right
+    STATS_COUNT(TEA1_EXPAND_IV, 0, 0, 0, 0);
+    return tea_core_expand_iv(&g_stTea1Variant, dwShortIv);
 }
 
 uint8_t tea1_state_word_to_newbyte(uint16_t wSt, const uint16_t *awLut) {
@@ -56,9 +87,7 @@ uint8_t tea1_state_word_to_newbyte(uint16_t wSt, const uint16_t *awLut) {
     for (int i = 0; i < 8; i++) {
         // taps on bit 7,0 for bSt0 and bit 1,2 for bSt1
         bDist = ((bSt0 >> 7) & 1) | ((bSt0 << 1) & 2) | ((bSt1 << 1) & 12);
-        if (awLut[i] & (1 << bDist)) {
-            bOut |= 1 << i;
-        }
+        bOut |= ((awLut[i] >> bDist) & 1) << i;
 
         // rotate one position
         bSt0 = ((bSt0 >> 1) | (bSt0 << 7));
@@ -69,60 +98,101 @@ uint8_t tea1_state_word_to_newbyte(uint16_t wSt, const uint16_t *awLut) {
 }
 
 uint8_t tea1_reorder_state_byte(uint8_t bStByte) {
-    // simple re-ordering of bits
-    uint8_t bOut = 0;
-    bOut |= ((bStByte << 6) & 0x40);
-    bOut |= ((bStByte << 1) & 0x20);
-    bOut |= ((bStByte << 2) & 0x08);
-    bOut |= ((bStByte >> 3) & 0x14);
-    bOut |= ((bStByte >> 2) & 0x01);
-    bOut |= ((bStByte >> 5) & 0x02);
-    bOut |= ((bStByte << 4) & 0x80);
-    return bOut;
+    return tea_core_reorder(&g_stTea1Variant, bStByte);
 }
 
 int32_t tea1_init_key_register(const uint8_t *lpKey) {
     int32_t dwResult = 0;
+    STATS_COUNT(TEA1_INIT_KEY_REGISTER, 0, 0, 0, 1);
     for (int i = 0; i < 10; i++) {
         dwResult = (dwResult << 8) | g_abTea1Sbox[((dwResult >> 24) ^ lpKey[i] ^ dwResult) & 0xff];
     }
     return dwResult;
 }
 
+void tea1_clock(uint64_t *lpqwIvReg, uint32_t *lpdwKeyReg, uint32_t dwNumRounds) {
+    uint64_t qwKeyHi = *lpdwKeyReg;
+    uint16_t wKeyLo = 0;
+    STATS_COUNT(TEA1_CLOCK, 0, dwNumRounds, 0, 0);
+
+    tea_core_clock(&g_stTea1Variant, lpqwIvReg, &qwKeyHi, &wKeyLo, dwNumRounds);
+    *lpdwKeyReg = qwKeyHi;
+}
+
 void tea1_inner(uint64_t qwIvReg, uint32_t dwKeyReg, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
-    
-    uint32_t dwNumSkipRounds = 54;
-
-    for (int i = 0; i < dwNumKsBytes; i++) {
-        for (int j = 0; j < dwNumSkipRounds; j++) {
-            // Step 1: Derive a non-linear feedback byte through sbox and feed back into key register
-            uint8_t bSboxOut = g_abTea1Sbox[((dwKeyReg >> 24) ^ dwKeyReg) & 0xff];
-            dwKeyReg = (dwKeyReg << 8) | bSboxOut;
-
-            // Step 2: Compute 3 bytes derived from current state
-            uint8_t bDerivByte12 = tea1_state_word_to_newbyte((qwIvReg >>  8) & 0xffff, g_awTea1LutA);
-            uint8_t bDerivByte56 = tea1_state_word_to_newbyte((qwIvReg >> 40) & 0xffff, g_awTea1LutB);
-            uint8_t bReordByte4  = tea1_reorder_state_byte((qwIvReg >> 32) & 0xff);
-
-            // Step 3: Combine current state with state derived values, and xor in key derived sbox output
-            uint8_t bNewByte = (bDerivByte56 ^ (qwIvReg >> 56) ^ bReordByte4 ^ bSboxOut) & 0xff;
-            uint8_t bMixByte = bDerivByte12;
-
-            // Step 4: Update lfsr: leftshift 8, feed/mix in previously generated bytes
-            qwIvReg = ((qwIvReg << 8) ^ ((uint64_t)bMixByte << 32)) | bNewByte;
-        }
-
-        lpKsOut[i] = (qwIvReg >> 56);
-        dwNumSkipRounds = 19;
-    }
+    STATS_BEGIN();
+    STATS_COUNT(TEA1_CLOCK, 0, dwNumKsBytes ? TEA1_NUM_INIT_ROUNDS + TEA1_NUM_BYTE_ROUNDS * (dwNumKsBytes - 1) : 0, 0, 0);
+
+    tea_core_keystream(&g_stTea1Variant, qwIvReg, dwKeyReg, 0, dwNumKsBytes, lpKsOut);
+    STATS_END(TEA1_INNER, dwNumKsBytes, 0, 0, 0);
 }
 
 void tea1(uint32_t dwFrameNumbers, const uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
-    
+    STATS_BEGIN();
+
     // Initialize IV and key register
     uint64_t qwIvReg = tea1_expand_iv(dwFrameNumbers);
     uint32_t dwKeyReg = tea1_init_key_register(lpKey);
 
     // Invoke actual TEA1 core function
     tea1_inner(qwIvReg, dwKeyReg, dwNumKsBytes, lpKsOut);
+    STATS_END(TEA1, dwNumKsBytes, 0, 0, 1);
+}
+
+void tea1_xor_scatter(uint32_t dwFrameNumbers, const uint8_t *lpKey, const TeaXorSegment *lpSegments, uint32_t dwNumSegments) {
+    STATS_BEGIN();
+    uint64_t qwIvReg = tea1_expand_iv(dwFrameNumbers);
+    uint32_t dwKeyReg = tea1_init_key_register(lpKey);
+
+    uint32_t dwNumKsBytes = tea_core_xor_scatter(&g_stTea1Variant, qwIvReg, dwKeyReg, 0, lpSegments, dwNumSegments);
+    STATS_COUNT(TEA1_CLOCK, 0, dwNumKsBytes ? TEA1_NUM_INIT_ROUNDS + TEA1_NUM_BYTE_ROUNDS * (dwNumKsBytes - 1) : 0, 0, 0);
+    STATS_END(TEA1, dwNumKsBytes, 0, 0, 1);
+}
+
+void tea1_xor(uint32_t dwFrameNumbers, const uint8_t *lpKey, uint32_t dwBitOffset, uint32_t dwBitLen, uint8_t *lpInOut) {
+    TeaXorSegment stSegment = { 0, dwBitOffset, dwBitLen, lpInOut };
+    tea1_xor_scatter(dwFrameNumbers, lpKey, &stSegment, 1);
+}
+
+void tea1_key_stream_init(TeaKeyStream *lpStream, uint32_t dwKeyReg) {
+    tea_core_key_stream_init(&g_stTea1Variant, lpStream, dwKeyReg, 0);
+}
+
+int tea1_match_key_stream(TeaKeyStream *lpStream, uint32_t dwFrameNumbers, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes) {
+    STATS_COUNT(TEA1_MATCH_KEY_STREAM, 0, 0, 0, 0);
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea1Variant, dwFrameNumbers);
+    return tea_core_match_key_stream(&g_stTea1Variant, lpStream, qwIvReg, lpKs, lpMask, dwNumKsBytes);
+}
+
+uint32_t tea1_key_stream_slide(TeaKeyStream *lpStream, uint32_t dwKeyReg) {
+    return (dwKeyReg << 8) | tea_core_key_stream_slide(&g_stTea1Variant, lpStream);
+}
+
+static void tea1_simd_load_key(const uint8_t *lpKey, uint8_t *lpKeyRegOut) {
+    uint32_t dwKeyReg = tea1_init_key_register(lpKey);
+    for (int i = 0; i < 4; i++) {
+        lpKeyRegOut[i] = dwKeyReg >> (24 - 8 * i);
+    }
+}
+
+static void tea1_simd_scalar(uint32_t dwFrameNumbers, const uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    tea_core_keystream(&g_stTea1Variant, tea1_expand_iv(dwFrameNumbers), (uint32_t)tea1_init_key_register(lpKey), 0, dwNumKsBytes, lpKsOut);
+}
+
+TEA_SIMD_TARGET_AVX512 static void tea1_simd_avx512(const TeaSimdLanes *lpLanes) {
+    tea_simd_keystream_avx512(&g_stTea1Variant, lpLanes);
+}
+
+TEA_SIMD_TARGET_AVX2 static void tea1_simd_avx2(const TeaSimdLanes *lpLanes) {
+    tea_simd_keystream_avx2(&g_stTea1Variant, lpLanes);
+}
+
+static const TeaSimdKernels g_stTea1SimdKernels = { 1, tea1_simd_avx512, tea1_simd_avx2, tea1_simd_load_key, tea1_simd_scalar };
+
+void tea1_keystream_lanes(uint32_t dwNumLanes, const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    STATS_BEGIN();
+    STATS_COUNT(TEA1_CLOCK, 0, dwNumKsBytes ? (uint64_t)dwNumLanes * (TEA1_NUM_INIT_ROUNDS + TEA1_NUM_BYTE_ROUNDS * (dwNumKsBytes - 1)) : 0, 0, 0);
+
+    tea_simd_keystream(&g_stTea1Variant, &g_stTea1SimdKernels, dwNumLanes, adwIvs, lpKeys, dwNumKsBytes, lpKsOut);
+    STATS_END(TEA1, (uint64_t)dwNumLanes * dwNumKsBytes, 0, 0, dwNumLanes);
 }
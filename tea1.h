@@ -3,9 +3,28 @@
 
 #include <inttypes.h>
 
+#include "common.h"
+
+// Rounds before the first keystream byte, and between subsequent ones
+#define TEA1_NUM_INIT_ROUNDS 54
+#define TEA1_NUM_BYTE_ROUNDS 19
 
 void tea1(uint32_t dwFrameNumbers, const uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
 
+// Keystream for dwNumLanes (IV, key) pairs at once on the byte-lane vector kernels, see tea_simd.h.
+// Keys are 10 bytes and the keystream dwNumKsBytes bytes per lane.
+void tea1_keystream_lanes(uint32_t dwNumLanes, const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
+
+// Xor keystream into a buffer at bit granularity, dwBitLen bits starting at bit dwBitOffset (MSB first)
+void tea1_xor(uint32_t dwFrameNumbers, const uint8_t *lpKey, uint32_t dwBitOffset, uint32_t dwBitLen, uint8_t *lpInOut);
+void tea1_xor_scatter(uint32_t dwFrameNumbers, const uint8_t *lpKey, const TeaXorSegment *lpSegments, uint32_t dwNumSegments);
+
+// Candidate key register test for several IVs, the key side of the rounds is shared through lpStream
+void tea1_key_stream_init(TeaKeyStream *lpStream, uint32_t dwKeyReg);
+int tea1_match_key_stream(TeaKeyStream *lpStream, uint32_t dwFrameNumbers, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes);
+// Move the stream on to the successor of dwKeyReg and return that register
+uint32_t tea1_key_stream_slide(TeaKeyStream *lpStream, uint32_t dwKeyReg);
+
 // Constants
 extern const uint16_t g_awTea1LutA[8];
 extern const uint16_t g_awTea1LutB[8];
@@ -16,6 +35,7 @@ uint64_t tea1_expand_iv(uint32_t dwShortIv);
 int32_t tea1_init_key_register(const uint8_t *lpKey);
 uint8_t tea1_state_word_to_newbyte(uint16_t wSt, const uint16_t *awLut);
 uint8_t tea1_reorder_state_byte(uint8_t bStByte);
+void tea1_clock(uint64_t *lpqwIvReg, uint32_t *lpdwKeyReg, uint32_t dwNumRounds);
 void tea1_inner(uint64_t qwIvReg, uint32_t dwKeyReg, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
 
 #endif /* HAVE_TEA1_H */
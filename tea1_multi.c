@@ -1,141 +1,187 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <string.h>
-#include <pthread.h>
-
-#define NUM_THREADS 16
-#define COMMAND_BUFFER_SIZE 256
-#define LINE_BUFFER_SIZE 128
-#define OUTPUT_SIZE 11
-
-// Function to generate the next hexadecimal value as a string
-char *hex_inc(int num) {
-    char *hex_value = malloc(11); // Allocate memory for 10 characters + null terminator
-    if (hex_value == NULL) {
-        perror("malloc failed");
-        exit(EXIT_FAILURE);
+#include <inttypes.h>
+
+#include "common.h"
+#include "tea1.h"
+#include "tea1_search.h"
+#include "tea1_targets.h"
+#include "workpool.h"
+
+#define KEYS_PER_PASS (1ULL << 28)
+#define MAX_TARGETS   (1 << 20)
+
+static int parse_target(FrameNumbers *f, const char *hex, Tea1Filter *filter) {
+    memset(filter, 0, sizeof(*filter));
+    filter->dwIv = build_iv(f);
+    int len = strlen(hex);
+    if (len == 0 || len > 2 * TEA1_SEARCH_MAX_KS_BYTES) {
+        fprintf(stderr, "Target must be 1 to %d hex digits\n", 2 * TEA1_SEARCH_MAX_KS_BYTES);
+        return -1;
+    }
+    for (int i = 0; i < len; i++) {
+        unsigned int nibble;
+        if (sscanf(&hex[i], "%1x", &nibble) != 1) {
+            fprintf(stderr, "Can't parse target digit %d\n", i);
+            return -1;
+        }
+        int shift = (i & 1) ? 0 : 4;
+        filter->abKs[i / 2] |= nibble << shift;
+        filter->abMask[i / 2] |= 0xf << shift;
     }
-    sprintf(hex_value, "%08x", num + 1); // Increment and format
-    return hex_value;
+    filter->dwNumKsBytes = (len + 1) / 2;
+    return 0;
 }
 
-// Struct to pass arguments to threads
-typedef struct {
-    int start;
-    int end;
-    char *target;
-    int *found;
-    pthread_mutex_t *mutex;
-} thread_args;
-
-// Thread function
-void *thread_func(void *arg) {
-    thread_args *args = (thread_args *)arg;
-    char command[COMMAND_BUFFER_SIZE];
-    char line[LINE_BUFFER_SIZE];
-    char output[OUTPUT_SIZE];
-    char *to_increment;
-    FILE *fp;
-
-    for (int i = args->start; i <= args->end; i++) {
-        // Generate the next hex value
-        to_increment = hex_inc(i);
-
-        // Construct the command string
-        snprintf(command, sizeof(command),
-                 "/home/nirvana/TETRA_crypto/gen_ks 1 110 30 06 1 0 %s", to_increment);
-
-        // Execute the command
-        fp = popen(command, "r");
-        if (fp == NULL) {
-            perror("popen failed");
-            free(to_increment);
-            continue;
-        }
+// build_iv asserts on these, so out of range values are refused up front
+static int set_frame_numbers(FrameNumbers *f, unsigned int hn, unsigned int mn, unsigned int fn, unsigned int tn, unsigned int dir) {
+    if (hn > 0xFFFF || mn < 1 || mn > 60 || fn < 1 || fn > 18 || tn < 1 || tn > 4 || dir > 1) {
+        return -1;
+    }
+    f->hn = hn;
+    f->mn = mn;
+    f->fn = fn;
+    f->tn = tn;
+    f->dir = dir;
+    return 0;
+}
 
-        // Read the output
-        if (fgets(line, sizeof(line), fp) == NULL) {
-            pclose(fp);
-            free(to_increment);
+/*
+ * Targets file: one intercept per line as "hn mn fn tn dir <keystream hex>",
+ * blank lines and lines starting with # are skipped. All targets are
+ * searched together, one sweep per IV and set of known prefix bits, see
+ * tea1_targets.h.
+ */
+static int run_targets(const char *path, int threads) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror("Can't open targets file");
+        return EXIT_FAILURE;
+    }
+
+    Tea1Filter *targets = malloc(MAX_TARGETS * sizeof(Tea1Filter));
+    uint32_t num_targets = 0;
+    char line[512], hex[2 * TEA1_SEARCH_MAX_KS_BYTES + 3];
+    int line_no = 0;
+    while (targets && fgets(line, sizeof(line), fp)) {
+        FrameNumbers f;
+        unsigned int hn, mn, fn, tn, dir;
+        line_no++;
+        if (line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\r\n")] == 0) {
             continue;
         }
-
-        // Read the second line (expected key)
-        if (fgets(line, sizeof(line), fp) != NULL) {
-            strncpy(output, line, OUTPUT_SIZE - 1);
-            output[OUTPUT_SIZE - 1] = '\0'; // Ensure null termination
+        int fields = sscanf(line, "%u %u %u %u %u %110s", &hn, &mn, &fn, &tn, &dir, hex);
+        if (fields >= 5 && set_frame_numbers(&f, hn, mn, fn, tn, dir) != 0) {
+            fprintf(stderr, "Frame numbers out of range on line %d (tn 1-4, fn 1-18, mn 1-60, hn 0-65535, dir 0-1)\n", line_no);
+            fclose(fp);
+            free(targets);
+            return EXIT_FAILURE;
         }
-        pclose(fp);
-
-        // Check if the output matches the target
-        pthread_mutex_lock(args->mutex);
-        if (*(args->found)) {
-            pthread_mutex_unlock(args->mutex);
-            free(to_increment);
-            return NULL;
+        if (fields != 6 || num_targets == MAX_TARGETS || parse_target(&f, hex, &targets[num_targets]) != 0) {
+            fprintf(stderr, "Bad target on line %d\n", line_no);
+            fclose(fp);
+            free(targets);
+            return EXIT_FAILURE;
         }
-        if (strcmp(output, args->target) == 0) {
-            *(args->found) = 1;
-            printf("Found key: %s\n", to_increment);
-            pthread_mutex_unlock(args->mutex);
-            free(to_increment);
-            exit(EXIT_SUCCESS);
+        num_targets++;
+    }
+    fclose(fp);
+
+    TEA1_TARGETS_CTX search;
+    WORKPOOL *pool = workpool_create(threads, WORKPOOL_FLAG_PIN);
+    if (targets == NULL || pool == NULL || tea1_targets_init(&search, targets, num_targets) != 0) {
+        fprintf(stderr, "Can't set up the search over %u targets\n", num_targets);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "%u targets in %u sweeps\n", num_targets, search.dwNumGroups);
+
+    while (!tea1_targets_done(&search)) {
+        // A pass that scans nothing failed to store its hits, retrying would only spin
+        if (tea1_targets_run_parallel(&search, pool, KEYS_PER_PASS) == 0) {
+            fprintf(stderr, "\nSearch failed at %llu\n", (unsigned long long)search.qwNextIndex);
+            exit(EXIT_FAILURE);
         }
-        pthread_mutex_unlock(args->mutex);
+        fprintf(stderr, "searched %llu / %llu\r", (unsigned long long)search.qwNextIndex, (unsigned long long)search.qwNumCandidates);
+    }
+    fprintf(stderr, "\n");
 
-        // Free allocated memory
-        free(to_increment);
+    // Hits are sorted by target, so every target lists its keys in one run
+    uint32_t h = 0;
+    for (uint32_t t = 0; t < num_targets; t++) {
+        if (h == search.dwNumHits || search.lpHits[h].dwTarget != t) {
+            printf("Target %u: key not found.\n", t);
+        }
+        for (; h < search.dwNumHits && search.lpHits[h].dwTarget == t; h++) {
+            printf("Target %u: found key %08x\n", t, search.lpHits[h].dwKeyReg);
+        }
     }
-    return NULL;
+
+    tea1_targets_free(&search);
+    workpool_destroy(pool);
+    free(targets);
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <target>\n", argv[0]);
+    if ((argc == 3 || argc == 4) && !strcmp(argv[1], "-t")) {
+        return run_targets(argv[2], argc == 4 ? atoi(argv[3]) : 0);
+    }
+    if (argc != 2 && argc != 3 && argc != 8) {
+        fprintf(stderr, "Usage: %s <target keystream hex> [threads] [hn mn fn tn dir]\n", argv[0]);
+        fprintf(stderr, "       %s -t <targets file> [threads]\n", argv[0]);
+        fprintf(stderr, "       default frame numbers are 110 30 06 1 0, threads 0 = all cpus\n");
         exit(EXIT_FAILURE);
     }
-    char result[11]; // Un tampon pour stocker les 10 premiers caractères + '\0'
-
-    // Copier les 10 premiers caractères dans `result`
-    strncpy(result, argv[1], 10);
-    result[10] = '\0'; // S'assurer que la chaîne est terminée par '\0'
-
-    char *target = result; // Target value to match
-    long total_values = 4294967296; // Total number of values
-    int values_per_thread = total_values / NUM_THREADS;
-    pthread_t threads[NUM_THREADS];
-    thread_args args[NUM_THREADS];
-    int found = 0;
-    pthread_mutex_t mutex;
-
-    pthread_mutex_init(&mutex, NULL);
-
-    // Create threads
-    for (int i = 0; i < NUM_THREADS; i++) {
-        args[i].start = i * values_per_thread;
-        args[i].end = (i + 1) * values_per_thread - 1;
-        args[i].target = target;
-        args[i].found = &found;
-        args[i].mutex = &mutex;
-
-        if (pthread_create(&threads[i], NULL, thread_func, &args[i]) != 0) {
-            perror("pthread_create failed");
-            pthread_mutex_destroy(&mutex);
+
+    FrameNumbers f = { 1, 6, 30, 110, 0 };
+    if (argc == 8) {
+        unsigned int hn, mn, fn, tn, dir;
+        if (    sscanf(argv[3], "%u", &hn) != 1 ||
+                sscanf(argv[4], "%u", &mn) != 1 ||
+                sscanf(argv[5], "%u", &fn) != 1 ||
+                sscanf(argv[6], "%u", &tn) != 1 ||
+                sscanf(argv[7], "%u", &dir) != 1 ||
+                set_frame_numbers(&f, hn, mn, fn, tn, dir) != 0) {
+            fprintf(stderr, "Can't parse hn/mn/fn/tn/dir (tn 1-4, fn 1-18, mn 1-60, hn 0-65535, dir 0-1)\n");
             exit(EXIT_FAILURE);
         }
     }
 
-    // Wait for all threads to finish
-    for (int i = 0; i < NUM_THREADS; i++) {
-        pthread_join(threads[i], NULL);
+    // Every hex digit of the target is a known keystream nibble
+    Tea1Filter filter;
+    if (parse_target(&f, argv[1], &filter) != 0) {
+        exit(EXIT_FAILURE);
     }
 
-    pthread_mutex_destroy(&mutex);
+    WORKPOOL *pool = workpool_create(argc >= 3 ? atoi(argv[2]) : 0, WORKPOOL_FLAG_PIN);
+    if (pool == NULL) {
+        perror("workpool_create failed");
+        exit(EXIT_FAILURE);
+    }
+
+    TEA1_SEARCH_CTX search;
+    tea1_search_init(&search);
+    tea1_search_set_filters(&search, &filter, 1);
+
+    // Search in passes and stop after the first pass that produced a hit
+    while (!tea1_search_done(&search) && search.dwNumHits == 0) {
+        if (tea1_search_run_parallel(&search, pool, KEYS_PER_PASS) == 0) {
+            fprintf(stderr, "\nSearch failed at %llu\n", (unsigned long long)search.qwNextKey);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "searched %llu / %llu\r", (unsigned long long)search.qwNextKey, TEA1_SEARCH_KEYSPACE);
+    }
+    fprintf(stderr, "\n");
 
-    if (!found) {
+    for (int i = 0; i < search.dwNumHits; i++) {
+        printf("Found key: %08x\n", search.lpdwHits[i]);
+    }
+    if (search.dwNumHits == 0) {
         printf("Key not found.\n");
     }
 
+    tea1_search_free(&search);
+    workpool_destroy(pool);
     return 0;
 }
@@ -0,0 +1,205 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "hugemem.h"
+#include "tea1.h"
+#include "tea1_orbit.h"
+
+#define TEA1_ORBIT_CHUNK (1 << 12)      // starts per workpool chunk
+#define TEA1_ORBIT_PREFETCH 16          // registers ahead whose bitmap word is prefetched
+
+int tea1_orbit_init(TEA1_ORBIT_CTX *lpCtx, const Tea1Filter *lpFilters, uint32_t dwNumFilters) {
+    memset(lpCtx, 0, sizeof(*lpCtx));
+    if (dwNumFilters == 0 || dwNumFilters > TEA1_SEARCH_MAX_FILTERS) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < dwNumFilters; i++) {
+        if (lpFilters[i].dwNumKsBytes > TEA_KEY_STREAM_MAX_KS_BYTES) {
+            return -1;
+        }
+    }
+
+    // Walks hit the bitmap at random, so it wants huge pages
+    if (hugemem_alloc(&lpCtx->stVisitedMem, TEA1_ORBIT_BITMAP_BYTES, HUGEMEM_FLAG_HUGETLB, -1) != 0) {
+        return -1;
+    }
+    lpCtx->lpqwVisited = lpCtx->stVisitedMem.lpBase;
+    memcpy(lpCtx->astFilters, lpFilters, dwNumFilters * sizeof(Tea1Filter));
+    lpCtx->dwNumFilters = dwNumFilters;
+    return 0;
+}
+
+void tea1_orbit_free(TEA1_ORBIT_CTX *lpCtx) {
+    hugemem_free(&lpCtx->stVisitedMem);
+    free(lpCtx->lpdwHits);
+    memset(lpCtx, 0, sizeof(*lpCtx));
+}
+
+int tea1_orbit_done(const TEA1_ORBIT_CTX *lpCtx) {
+    return lpCtx->qwNextStart >= TEA1_SEARCH_KEYSPACE;
+}
+
+// Mark a register visited, returns 1 if this call was the first to do so
+static int tea1_orbit_claim(uint64_t *lpqwVisited, uint32_t dwKeyReg) {
+    uint64_t *lpqwWord = &lpqwVisited[dwKeyReg >> 6];
+    uint64_t qwBit = 1ULL << (dwKeyReg & 63);
+    if (__atomic_load_n(lpqwWord, __ATOMIC_RELAXED) & qwBit) {
+        return 0;
+    }
+    return !(__atomic_fetch_or(lpqwWord, qwBit, __ATOMIC_RELAXED) & qwBit);
+}
+
+static void tea1_orbit_release(uint64_t *lpqwVisited, uint32_t dwKeyReg) {
+    __atomic_fetch_and(&lpqwVisited[dwKeyReg >> 6], ~(1ULL << (dwKeyReg & 63)), __ATOMIC_RELAXED);
+}
+
+// Per-worker hit buffer and visit count, padded so workers never share a cache line
+typedef struct {
+    uint32_t *lpdwHits;
+    uint32_t dwNumHits;
+    uint32_t dwCapacity;
+    uint64_t qwVisited;
+    int bFailed;
+} __attribute__((aligned(64))) Tea1OrbitWorker;
+
+typedef struct {
+    const TEA1_ORBIT_CTX *lpCtx;
+    Tea1OrbitWorker *lpWorkers;
+} Tea1OrbitJob;
+
+static int tea1_orbit_match_all(const TEA1_ORBIT_CTX *lpCtx, TeaKeyStream *lpStream) {
+    for (uint32_t i = 0; i < lpCtx->dwNumFilters; i++) {
+        const Tea1Filter *lpFilter = &lpCtx->astFilters[i];
+        if (!tea1_match_key_stream(lpStream, lpFilter->dwIv, lpFilter->abKs, lpFilter->abMask, lpFilter->dwNumKsBytes)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void tea1_orbit_walk(const TEA1_ORBIT_CTX *lpCtx, uint32_t dwStart, Tea1OrbitWorker *lpWorker) {
+    TeaKeyStream stStream;
+    uint32_t dwKeyReg = dwStart;
+    uint32_t dwAhead = dwStart;
+
+    // The walk order is known in advance, so the bitmap misses can be overlapped
+    for (int i = 0; i < TEA1_ORBIT_PREFETCH; i++) {
+        dwAhead = tea1_orbit_next(dwAhead);
+        __builtin_prefetch(&lpCtx->lpqwVisited[dwAhead >> 6], 1);
+    }
+
+    tea1_key_stream_init(&stStream, dwKeyReg);
+    for (uint32_t n = 0; n < TEA1_ORBIT_MAX_WALK && tea1_orbit_claim(lpCtx->lpqwVisited, dwKeyReg); n++) {
+        dwAhead = tea1_orbit_next(dwAhead);
+        __builtin_prefetch(&lpCtx->lpqwVisited[dwAhead >> 6], 1);
+        if (tea1_orbit_match_all(lpCtx, &stStream) &&
+                workpool_hits_append(&lpWorker->lpdwHits, &lpWorker->dwNumHits, &lpWorker->dwCapacity, &dwKeyReg, sizeof(dwKeyReg))) {
+            // Leave the register to a later walk rather than lose the hit
+            tea1_orbit_release(lpCtx->lpqwVisited, dwKeyReg);
+            lpWorker->bFailed = 1;
+            return;
+        }
+        lpWorker->qwVisited++;
+        dwKeyReg = tea1_key_stream_slide(&stStream, dwKeyReg);
+    }
+}
+
+static void tea1_orbit_chunk(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd) {
+    Tea1OrbitJob *lpJob = lpArg;
+    Tea1OrbitWorker *lpWorker = &lpJob->lpWorkers[dwWorker];
+    const uint64_t *lpqwVisited = lpJob->lpCtx->lpqwVisited;
+
+    for (uint64_t qwStart = qwBegin; qwStart < qwEnd && !lpWorker->bFailed; qwStart++) {
+        // Once the search is under way most starts are visited, skip them a bitmap word at a time
+        if ((qwStart & 63) == 0 && qwEnd - qwStart >= 64 && __atomic_load_n(&lpqwVisited[qwStart >> 6], __ATOMIC_RELAXED) == ~0ULL) {
+            qwStart += 63;
+            continue;
+        }
+        tea1_orbit_walk(lpJob->lpCtx, (uint32_t)qwStart, lpWorker);
+    }
+}
+
+static int tea1_cmp_key(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t tea1_orbit_pass(TEA1_ORBIT_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxStarts) {
+    uint64_t qwBegin = lpCtx->qwNextStart;
+    uint64_t qwEnd = TEA1_SEARCH_KEYSPACE;
+    uint32_t dwNumWorkers = lpPool ? workpool_num_workers(lpPool) : 1;
+    uint32_t dwFirstNew = lpCtx->dwNumHits;
+    int bFailed = 0;
+
+    if (qwEnd - qwBegin > qwMaxStarts) {
+        qwEnd = qwBegin + qwMaxStarts;
+    }
+    if (qwBegin >= qwEnd) {
+        return 0;
+    }
+
+    Tea1OrbitWorker *lpWorkers = aligned_alloc(64, dwNumWorkers * sizeof(Tea1OrbitWorker));
+    if (lpWorkers == NULL) {
+        return 0;
+    }
+    memset(lpWorkers, 0, dwNumWorkers * sizeof(Tea1OrbitWorker));
+
+    Tea1OrbitJob stJob = { lpCtx, lpWorkers };
+    int bStopped = workpool_run(lpPool, qwBegin, qwEnd, TEA1_ORBIT_CHUNK, tea1_orbit_chunk, &stJob);
+
+    /*
+     * Every hit found is kept even if the pass stopped or failed, since its
+     * register is marked visited and won't be tested again. A hit that can't
+     * be stored is released back to the bitmap instead.
+     */
+    for (uint32_t i = 0; i < dwNumWorkers; i++) {
+        bFailed |= lpWorkers[i].bFailed;
+        for (uint32_t j = 0; j < lpWorkers[i].dwNumHits; j++) {
+            if (workpool_hits_append(&lpCtx->lpdwHits, &lpCtx->dwNumHits, &lpCtx->dwHitsCapacity, &lpWorkers[i].lpdwHits[j], sizeof(uint32_t))) {
+                tea1_orbit_release(lpCtx->lpqwVisited, lpWorkers[i].lpdwHits[j]);
+                lpWorkers[i].qwVisited--;
+                bFailed = 1;
+            }
+        }
+        lpCtx->qwNumVisited += lpWorkers[i].qwVisited;
+        free(lpWorkers[i].lpdwHits);
+    }
+    free(lpWorkers);
+    qsort(lpCtx->lpdwHits + dwFirstNew, lpCtx->dwNumHits - dwFirstNew, sizeof(uint32_t), tea1_cmp_key);
+
+    // Released registers may lie behind the cursor, so a failed pass rescans from the start
+    if (bFailed) {
+        lpCtx->qwNextStart = 0;
+        return 0;
+    }
+    if (bStopped) {
+        return 0;
+    }
+    lpCtx->qwNextStart = qwEnd;
+    return qwEnd - qwBegin;
+}
+
+uint64_t tea1_orbit_run(TEA1_ORBIT_CTX *lpCtx, uint64_t qwMaxStarts) {
+    return tea1_orbit_pass(lpCtx, NULL, qwMaxStarts);
+}
+
+uint64_t tea1_orbit_run_parallel(TEA1_ORBIT_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxStarts) {
+    return tea1_orbit_pass(lpCtx, lpPool, qwMaxStarts);
+}
@@ -0,0 +1,61 @@
+#ifndef HAVE_TEA1_ORBIT_H
+#define HAVE_TEA1_ORBIT_H
+
+#include <inttypes.h>
+
+#include "hugemem.h"
+#include "tea1.h"
+#include "tea1_search.h"
+#include "workpool.h"
+
+/*
+ * Orbit ordered reduced-key search. The TEA1 key register update
+ * K -> (K << 8) | S[(K >> 24 ^ K) & 0xff] is a permutation of the 2^32
+ * registers, and the sbox bytes of a register's rounds are those of its
+ * successor shifted by one. Walking along the cycles of the permutation, every
+ * candidate therefore reuses the key side stream of the previous one and only
+ * adds one round to it.
+ *
+ * Walks start at every register in order and stop at the first register some
+ * walk already visited, or after TEA1_ORBIT_MAX_WALK registers. A visited
+ * bitmap of TEA1_ORBIT_BITMAP_BYTES makes sure every register is tested
+ * exactly once, so rerunning a range of starts never tests a key twice.
+ * Starts [0, qwNextStart) are done; the search is complete when all are.
+ */
+
+#define TEA1_ORBIT_BITMAP_BYTES (TEA1_SEARCH_KEYSPACE / 8)
+#define TEA1_ORBIT_MAX_WALK     (1 << 16)
+
+// Key register after one round
+static inline uint32_t tea1_orbit_next(uint32_t dwKeyReg) {
+    return (dwKeyReg << 8) | g_abTea1Sbox[((dwKeyReg >> 24) ^ dwKeyReg) & 0xff];
+}
+
+typedef struct {
+    Tea1Filter astFilters[TEA1_SEARCH_MAX_FILTERS];
+    uint32_t dwNumFilters;
+
+    HugememBlock stVisitedMem;
+    uint64_t *lpqwVisited;
+    uint64_t qwNextStart;
+    uint64_t qwNumVisited;              // registers tested so far
+
+    uint32_t *lpdwHits;
+    uint32_t dwNumHits;
+    uint32_t dwHitsCapacity;
+} TEA1_ORBIT_CTX;
+
+// Returns 0, or -1 if the filters are invalid or the bitmap can't be allocated
+int tea1_orbit_init(TEA1_ORBIT_CTX *lpCtx, const Tea1Filter *lpFilters, uint32_t dwNumFilters);
+void tea1_orbit_free(TEA1_ORBIT_CTX *lpCtx);
+
+/*
+ * Walk from the next qwMaxStarts start registers, returns the number of
+ * starts done. A failed pass rewinds the cursor to 0: the bitmap keeps the
+ * rescan from testing anything twice.
+ */
+uint64_t tea1_orbit_run(TEA1_ORBIT_CTX *lpCtx, uint64_t qwMaxStarts);
+uint64_t tea1_orbit_run_parallel(TEA1_ORBIT_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxStarts);
+int tea1_orbit_done(const TEA1_ORBIT_CTX *lpCtx);
+
+#endif /* HAVE_TEA1_ORBIT_H */
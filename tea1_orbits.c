@@ -0,0 +1,167 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "common.h"
+#include "hugemem.h"
+#include "tea1.h"
+#include "tea1_orbit.h"
+#include "tea1_search.h"
+#include "workpool.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *lpszName) {
+    fprintf(stderr, "Usage: %s cycles\n", lpszName);
+    fprintf(stderr, "       %s search <target keystream hex> [threads] [hn mn fn tn dir]\n", lpszName);
+    fprintf(stderr, "       cycles lists the cycles of the TEA1 key register permutation,\n");
+    fprintf(stderr, "       search is tea1_multi with orbit ordered enumeration\n");
+    exit(EXIT_FAILURE);
+}
+
+// Walk the whole permutation once and report its cycle structure
+static void cycles(void) {
+    HugememBlock stVisitedMem;
+    uint64_t aqwHist[33] = { 0 };
+    uint64_t qwNumCycles = 0, qwLongest = 0;
+
+    if (hugemem_alloc(&stVisitedMem, TEA1_ORBIT_BITMAP_BYTES, HUGEMEM_FLAG_HUGETLB, -1) != 0) {
+        perror("Can't allocate bitmap");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t *lpqwVisited = stVisitedMem.lpBase;
+
+    double dStart = now();
+    for (uint64_t qwStart = 0; qwStart < TEA1_SEARCH_KEYSPACE; qwStart++) {
+        if (lpqwVisited[qwStart >> 6] & (1ULL << (qwStart & 63))) {
+            continue;
+        }
+        uint32_t dwKeyReg = qwStart;
+        uint64_t qwLen = 0;
+        do {
+            lpqwVisited[dwKeyReg >> 6] |= 1ULL << (dwKeyReg & 63);
+            dwKeyReg = tea1_orbit_next(dwKeyReg);
+            qwLen++;
+        } while (dwKeyReg != (uint32_t)qwStart);
+
+        printf("cycle %3llu: start %08x length %10llu (%5.2f%%)\n", (unsigned long long)qwNumCycles, (uint32_t)qwStart,
+               (unsigned long long)qwLen, 100.0 * qwLen / TEA1_SEARCH_KEYSPACE);
+        aqwHist[63 - __builtin_clzll(qwLen)]++;
+        qwLongest = qwLen > qwLongest ? qwLen : qwLongest;
+        qwNumCycles++;
+    }
+
+    printf("%llu cycles, longest %llu, %.1f s\n", (unsigned long long)qwNumCycles, (unsigned long long)qwLongest, now() - dStart);
+    for (int i = 0; i <= 32; i++) {
+        if (aqwHist[i]) {
+            printf("length [2^%d, 2^%d): %llu cycles\n", i, i + 1, (unsigned long long)aqwHist[i]);
+        }
+    }
+    hugemem_free(&stVisitedMem);
+}
+
+static void search(int argc, char *argv[]) {
+    FrameNumbers f = { 1, 6, 30, 110, 0 };
+    if (argc == 9) {
+        if (    !sscanf(argv[4], "%hd", &f.hn) ||
+                !sscanf(argv[5], "%hhd", &f.mn) ||
+                !sscanf(argv[6], "%hhd", &f.fn) ||
+                !sscanf(argv[7], "%hhd", &f.tn) ||
+                !sscanf(argv[8], "%hhd", &f.dir)) {
+            fprintf(stderr, "Can't parse hn/mn/fn/tn/dir\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Every hex digit of the target is a known keystream nibble
+    Tea1Filter filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.dwIv = build_iv(&f);
+    int len = strlen(argv[2]);
+    if (len == 0 || len > 2 * TEA1_SEARCH_MAX_KS_BYTES) {
+        fprintf(stderr, "Target must be 1 to %d hex digits\n", 2 * TEA1_SEARCH_MAX_KS_BYTES);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < len; i++) {
+        unsigned int nibble;
+        if (sscanf(&argv[2][i], "%1x", &nibble) != 1) {
+            fprintf(stderr, "Can't parse target digit %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+        int shift = (i & 1) ? 0 : 4;
+        filter.abKs[i / 2] |= nibble << shift;
+        filter.abMask[i / 2] |= 0xf << shift;
+    }
+    filter.dwNumKsBytes = (len + 1) / 2;
+
+    WORKPOOL *pool = workpool_create(argc >= 4 ? atoi(argv[3]) : 0, WORKPOOL_FLAG_PIN);
+    if (pool == NULL) {
+        perror("workpool_create failed");
+        exit(EXIT_FAILURE);
+    }
+
+    TEA1_ORBIT_CTX orbit;
+    if (tea1_orbit_init(&orbit, &filter, 1) != 0) {
+        perror("tea1_orbit_init failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /*
+     * Search in passes and stop after the first pass that produced a hit. Early
+     * starts walk up to TEA1_ORBIT_MAX_WALK keys each and later ones are mostly
+     * visited already, so the pass size grows while passes stay short.
+     */
+    double dStart = now();
+    uint64_t qwStarts = 64;
+    while (!tea1_orbit_done(&orbit) && orbit.dwNumHits == 0) {
+        double dPass = now();
+        tea1_orbit_run_parallel(&orbit, pool, qwStarts);
+        if (now() - dPass < 0.5) {
+            qwStarts *= 2;
+        }
+        fprintf(stderr, "searched %llu / %llu keys, %.2f Mkeys/s\r", (unsigned long long)orbit.qwNumVisited,
+                TEA1_SEARCH_KEYSPACE, orbit.qwNumVisited / (now() - dStart) / 1e6);
+    }
+    fprintf(stderr, "\n");
+
+    for (int i = 0; i < orbit.dwNumHits; i++) {
+        printf("Found key: %08x\n", orbit.lpdwHits[i]);
+    }
+    if (orbit.dwNumHits == 0) {
+        printf("Key not found.\n");
+    }
+
+    tea1_orbit_free(&orbit);
+    workpool_destroy(pool);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "cycles") == 0) {
+        cycles();
+    } else if (argc >= 3 && argc != 5 && argc != 6 && argc != 7 && argc <= 9 && strcmp(argv[1], "search") == 0) {
+        search(argc, argv);
+    } else {
+        usage(argv[0]);
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "tea1.h"
+#include "workpool.h"
+#include "tea1_search.h"
+
+
+int tea1_filter_match(const Tea1Filter *lpFilter, uint32_t dwKeyReg) {
+    uint64_t qwIvReg = tea1_expand_iv(lpFilter->dwIv);
+    uint32_t dwNumRounds = TEA1_NUM_INIT_ROUNDS;
+
+    // Generate keystream byte by byte and bail out on the first mismatch
+    for (int i = 0; i < lpFilter->dwNumKsBytes; i++) {
+        tea1_clock(&qwIvReg, &dwKeyReg, dwNumRounds);
+        if (((qwIvReg >> 56) ^ lpFilter->abKs[i]) & lpFilter->abMask[i]) {
+            return 0;
+        }
+        dwNumRounds = TEA1_NUM_BYTE_ROUNDS;
+    }
+    return 1;
+}
+
+uint32_t tea1_filter_known_bits(const Tea1Filter *lpFilter) {
+    uint32_t dwBits = 0;
+    for (int i = 0; i < lpFilter->dwNumKsBytes; i++) {
+        dwBits += __builtin_popcount(lpFilter->abMask[i]);
+    }
+    return dwBits;
+}
+
+void tea1_search_init_range(TEA1_SEARCH_CTX *lpCtx, uint64_t qwStartKey, uint64_t qwEndKey) {
+    memset(lpCtx, 0, sizeof(*lpCtx));
+    lpCtx->qwEndKey = qwEndKey > TEA1_SEARCH_KEYSPACE ? TEA1_SEARCH_KEYSPACE : qwEndKey;
+
+    // An inverted range is empty, and starts out done instead of underflowing the key count
+    lpCtx->qwStartKey = qwStartKey < lpCtx->qwEndKey ? qwStartKey : lpCtx->qwEndKey;
+    lpCtx->qwNextKey = lpCtx->qwStartKey;
+}
+
+void tea1_search_init(TEA1_SEARCH_CTX *lpCtx) {
+    tea1_search_init_range(lpCtx, 0, TEA1_SEARCH_KEYSPACE);
+}
+
+void tea1_search_free(TEA1_SEARCH_CTX *lpCtx) {
+    free(lpCtx->lpdwHits);
+    lpCtx->lpdwHits = NULL;
+    lpCtx->dwNumHits = 0;
+    lpCtx->dwHitsCapacity = 0;
+}
+
+static int tea1_search_match_all(const TEA1_SEARCH_CTX *lpCtx, uint32_t dwKeyReg) {
+    TeaKeyStream stStream;
+
+    if (lpCtx->dwNumFilters == 1) {
+        return tea1_filter_match(&lpCtx->astFilters[0], dwKeyReg);
+    }
+
+    // The key register evolves the same way under every IV, so its side of the rounds is only run once
+    tea1_key_stream_init(&stStream, dwKeyReg);
+    for (int i = 0; i < lpCtx->dwNumFilters; i++) {
+        const Tea1Filter *lpFilter = &lpCtx->astFilters[i];
+        if (!tea1_match_key_stream(&stStream, lpFilter->dwIv, lpFilter->abKs, lpFilter->abMask, lpFilter->dwNumKsBytes)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int tea1_search_set_filters(TEA1_SEARCH_CTX *lpCtx, const Tea1Filter *lpFilters, uint32_t dwNumFilters) {
+    if (dwNumFilters == 0 || dwNumFilters > TEA1_SEARCH_MAX_FILTERS) {
+        return -1;
+    }
+
+    memcpy(lpCtx->astFilters, lpFilters, dwNumFilters * sizeof(Tea1Filter));
+    lpCtx->dwNumFilters = dwNumFilters;
+
+    /*
+     * Every filter describes the real key, so a key rejected by an earlier
+     * filter set stays rejected. Only the survivors of the already scanned
+     * range need to be checked against the new set.
+     */
+    uint32_t dwKept = 0;
+    for (int i = 0; i < lpCtx->dwNumHits; i++) {
+        if (tea1_search_match_all(lpCtx, lpCtx->lpdwHits[i])) {
+            lpCtx->lpdwHits[dwKept++] = lpCtx->lpdwHits[i];
+        }
+    }
+    lpCtx->dwNumHits = dwKept;
+    return 0;
+}
+
+static int tea1_search_add_hit(TEA1_SEARCH_CTX *lpCtx, uint32_t dwKeyReg) {
+    return workpool_hits_append(&lpCtx->lpdwHits, &lpCtx->dwNumHits, &lpCtx->dwHitsCapacity, &dwKeyReg, sizeof(dwKeyReg));
+}
+
+uint64_t tea1_search_run(TEA1_SEARCH_CTX *lpCtx, uint64_t qwMaxKeys) {
+    uint64_t qwKey = lpCtx->qwNextKey;
+    uint64_t qwEnd = lpCtx->qwEndKey;
+
+    if (lpCtx->dwNumFilters == 0) {
+        return 0;
+    }
+    if (qwEnd - qwKey > qwMaxKeys) {
+        qwEnd = qwKey + qwMaxKeys;
+    }
+
+    for (; qwKey < qwEnd; qwKey++) {
+        if (tea1_search_match_all(lpCtx, (uint32_t)qwKey) && tea1_search_add_hit(lpCtx, (uint32_t)qwKey)) {
+            // Out of memory; leave the cursor on this key so a retry resumes here
+            break;
+        }
+    }
+
+    uint64_t qwScanned = qwKey - lpCtx->qwNextKey;
+    lpCtx->qwNextKey = qwKey;
+    return qwScanned;
+}
+
+int tea1_search_done(const TEA1_SEARCH_CTX *lpCtx) {
+    return lpCtx->qwNextKey >= lpCtx->qwEndKey;
+}
+
+#define TEA1_SEARCH_CHUNK (1 << 16)
+
+static int tea1_search_collect(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd,
+                               void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity) {
+    for (uint64_t qwKey = qwBegin; qwKey < qwEnd; qwKey++) {
+        uint32_t dwKeyReg = (uint32_t)qwKey;
+        if (tea1_search_match_all(lpArg, dwKeyReg) && workpool_hits_append(lppHits, lpdwNum, lpdwCapacity, &dwKeyReg, sizeof(dwKeyReg))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int tea1_cmp_key(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+uint64_t tea1_search_run_parallel(TEA1_SEARCH_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxKeys) {
+    uint64_t qwBegin = lpCtx->qwNextKey;
+    uint64_t qwEnd = lpCtx->qwEndKey;
+
+    if (lpCtx->dwNumFilters == 0) {
+        return 0;
+    }
+    if (qwEnd - qwBegin > qwMaxKeys) {
+        qwEnd = qwBegin + qwMaxKeys;
+    }
+
+    // A stopped or failed pass is discarded and rescanned later
+    if (workpool_run_collect(lpPool, qwBegin, qwEnd, TEA1_SEARCH_CHUNK, tea1_search_collect, lpCtx,
+                             &lpCtx->lpdwHits, &lpCtx->dwNumHits, &lpCtx->dwHitsCapacity, sizeof(uint32_t), tea1_cmp_key)) {
+        return 0;
+    }
+    lpCtx->qwNextKey = qwEnd;
+    return qwEnd - qwBegin;
+}
@@ -0,0 +1,54 @@
+#ifndef HAVE_TEA1_SEARCH_H
+#define HAVE_TEA1_SEARCH_H
+
+#include <inttypes.h>
+
+#include "workpool.h"
+
+#define TEA1_SEARCH_MAX_KS_BYTES 54
+#define TEA1_SEARCH_MAX_FILTERS  8
+#define TEA1_SEARCH_KEYSPACE     (1ULL << 32)
+
+/*
+ * Known keystream bits for a single IV. Bit n of abMask[i] set means bit n of
+ * keystream byte i is known and equals the same bit in abKs[i]. Only the first
+ * dwNumKsBytes bytes are generated when testing a candidate.
+ */
+typedef struct {
+    uint32_t dwIv;
+    uint32_t dwNumKsBytes;
+    uint8_t  abKs[TEA1_SEARCH_MAX_KS_BYTES];
+    uint8_t  abMask[TEA1_SEARCH_MAX_KS_BYTES];
+} Tea1Filter;
+
+/*
+ * Incremental reduced-key (32-bit key register) search. Keys in
+ * [qwStartKey, qwNextKey) have been scanned, and the ones that passed every
+ * filter active at the time are kept in lpdwHits. Replacing the filter set
+ * only re-checks those hits; the scanned range is never visited again.
+ */
+typedef struct {
+    Tea1Filter astFilters[TEA1_SEARCH_MAX_FILTERS];
+    uint32_t dwNumFilters;
+
+    uint64_t qwStartKey;
+    uint64_t qwNextKey;
+    uint64_t qwEndKey;
+
+    uint32_t *lpdwHits;
+    uint32_t dwNumHits;
+    uint32_t dwHitsCapacity;
+} TEA1_SEARCH_CTX;
+
+int tea1_filter_match(const Tea1Filter *lpFilter, uint32_t dwKeyReg);
+uint32_t tea1_filter_known_bits(const Tea1Filter *lpFilter);
+
+void tea1_search_init(TEA1_SEARCH_CTX *lpCtx);
+void tea1_search_init_range(TEA1_SEARCH_CTX *lpCtx, uint64_t qwStartKey, uint64_t qwEndKey);
+void tea1_search_free(TEA1_SEARCH_CTX *lpCtx);
+int tea1_search_set_filters(TEA1_SEARCH_CTX *lpCtx, const Tea1Filter *lpFilters, uint32_t dwNumFilters);
+uint64_t tea1_search_run(TEA1_SEARCH_CTX *lpCtx, uint64_t qwMaxKeys);
+uint64_t tea1_search_run_parallel(TEA1_SEARCH_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxKeys);
+int tea1_search_done(const TEA1_SEARCH_CTX *lpCtx);
+
+#endif /* HAVE_TEA1_SEARCH_H */
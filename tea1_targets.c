@@ -0,0 +1,269 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "tea1.h"
+#include "tea1_search.h"
+#include "tea1_targets.h"
+#include "workpool.h"
+
+#define TEA1_TARGETS_CHUNK  (1 << 16)   // candidates per workpool chunk
+#define TEA1_TARGETS_BITMAP (1 << 16)   // bits, one per masked value of the first two keystream bytes
+
+typedef struct {
+    uint32_t dwIv;
+    uint32_t dwPrefixMask;
+    uint32_t dwTarget;
+} Tea1TargetKey;
+
+static uint32_t tea1_targets_prefix(const uint8_t *abBytes, uint32_t dwNumKsBytes) {
+    uint32_t dwPrefix = 0;
+    for (uint32_t i = 0; i < TEA1_TARGETS_PREFIX_BYTES; i++) {
+        dwPrefix = (dwPrefix << 8) | (i < dwNumKsBytes ? abBytes[i] : 0);
+    }
+    return dwPrefix;
+}
+
+static uint32_t tea1_targets_slot(uint32_t dwPrefix, uint32_t dwTableMask) {
+    uint32_t dwHash = dwPrefix * 0x9E3779B1u;
+    return (dwHash ^ (dwHash >> 16)) & dwTableMask;
+}
+
+static int tea1_targets_cmp_key(const void *a, const void *b) {
+    const Tea1TargetKey *x = a;
+    const Tea1TargetKey *y = b;
+    if (x->dwIv != y->dwIv) {
+        return (x->dwIv > y->dwIv) - (x->dwIv < y->dwIv);
+    }
+    if (x->dwPrefixMask != y->dwPrefixMask) {
+        return (x->dwPrefixMask > y->dwPrefixMask) - (x->dwPrefixMask < y->dwPrefixMask);
+    }
+    return (x->dwTarget > y->dwTarget) - (x->dwTarget < y->dwTarget);
+}
+
+// Bitmap and prefix table of the dwNum targets listed in lpKeys
+static int tea1_targets_build_group(TEA1_TARGETS_CTX *lpCtx, Tea1TargetGroup *lpGroup, const Tea1TargetKey *lpKeys, uint32_t dwNum) {
+    uint32_t dwSlots = 16;
+    while (dwSlots < 2 * dwNum) {
+        dwSlots *= 2;
+    }
+
+    lpGroup->dwIv = lpKeys[0].dwIv;
+    lpGroup->dwPrefixMask = lpKeys[0].dwPrefixMask;
+    lpGroup->dwTableMask = dwSlots - 1;
+    lpGroup->lpqwBitmap = calloc(TEA1_TARGETS_BITMAP / 64, sizeof(uint64_t));
+    lpGroup->lpdwPrefixes = calloc(dwSlots, sizeof(uint32_t));
+    lpGroup->lpdwTargets = calloc(dwSlots, sizeof(uint32_t));
+    if (lpGroup->lpqwBitmap == NULL || lpGroup->lpdwPrefixes == NULL || lpGroup->lpdwTargets == NULL) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < dwNum; i++) {
+        const Tea1Filter *lpTarget = &lpCtx->lpTargets[lpKeys[i].dwTarget];
+        uint32_t dwPrefix = tea1_targets_prefix(lpTarget->abKs, lpTarget->dwNumKsBytes) & lpGroup->dwPrefixMask;
+        uint32_t dwHi = dwPrefix >> 16;
+        lpGroup->lpqwBitmap[dwHi / 64] |= 1ULL << (dwHi % 64);
+
+        // Equal prefixes take consecutive slots, a probe walks them all
+        uint32_t dwSlot = tea1_targets_slot(dwPrefix, lpGroup->dwTableMask);
+        while (lpGroup->lpdwTargets[dwSlot]) {
+            dwSlot = (dwSlot + 1) & lpGroup->dwTableMask;
+        }
+        lpGroup->lpdwPrefixes[dwSlot] = dwPrefix;
+        lpGroup->lpdwTargets[dwSlot] = lpKeys[i].dwTarget + 1;
+    }
+    return 0;
+}
+
+int tea1_targets_init_range(TEA1_TARGETS_CTX *lpCtx, const Tea1Filter *lpTargets, uint32_t dwNumTargets,
+                            uint64_t qwStartKey, uint64_t qwEndKey) {
+    memset(lpCtx, 0, sizeof(*lpCtx));
+    if (qwEndKey > TEA1_SEARCH_KEYSPACE) {
+        qwEndKey = TEA1_SEARCH_KEYSPACE;
+    }
+    if (dwNumTargets == 0 || qwStartKey >= qwEndKey) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < dwNumTargets; i++) {
+        if (lpTargets[i].dwNumKsBytes == 0 || lpTargets[i].dwNumKsBytes > TEA1_SEARCH_MAX_KS_BYTES) {
+            return -1;
+        }
+    }
+
+    lpCtx->lpTargets = malloc(dwNumTargets * sizeof(Tea1Filter));
+    Tea1TargetKey *lpKeys = malloc(dwNumTargets * sizeof(Tea1TargetKey));
+    lpCtx->lpGroups = calloc(dwNumTargets, sizeof(Tea1TargetGroup));
+    if (lpCtx->lpTargets == NULL || lpKeys == NULL || lpCtx->lpGroups == NULL) {
+        free(lpKeys);
+        tea1_targets_free(lpCtx);
+        return -1;
+    }
+    memcpy(lpCtx->lpTargets, lpTargets, dwNumTargets * sizeof(Tea1Filter));
+    lpCtx->dwNumTargets = dwNumTargets;
+
+    // A group shares the IV and the known prefix bits, so one masked prefix probe serves all its targets
+    for (uint32_t i = 0; i < dwNumTargets; i++) {
+        lpKeys[i].dwIv = lpTargets[i].dwIv;
+        lpKeys[i].dwPrefixMask = tea1_targets_prefix(lpTargets[i].abMask, lpTargets[i].dwNumKsBytes);
+        lpKeys[i].dwTarget = i;
+    }
+    qsort(lpKeys, dwNumTargets, sizeof(Tea1TargetKey), tea1_targets_cmp_key);
+
+    int dwResult = 0;
+    for (uint32_t i = 0, j; i < dwNumTargets && dwResult == 0; i = j) {
+        for (j = i + 1; j < dwNumTargets && lpKeys[j].dwIv == lpKeys[i].dwIv && lpKeys[j].dwPrefixMask == lpKeys[i].dwPrefixMask; j++) {
+        }
+        dwResult = tea1_targets_build_group(lpCtx, &lpCtx->lpGroups[lpCtx->dwNumGroups++], &lpKeys[i], j - i);
+    }
+    free(lpKeys);
+    if (dwResult != 0) {
+        tea1_targets_free(lpCtx);
+        return -1;
+    }
+
+    lpCtx->qwStartKey = qwStartKey;
+    lpCtx->qwEndKey = qwEndKey;
+    lpCtx->qwNumCandidates = lpCtx->dwNumGroups * (qwEndKey - qwStartKey);
+    return 0;
+}
+
+int tea1_targets_init(TEA1_TARGETS_CTX *lpCtx, const Tea1Filter *lpTargets, uint32_t dwNumTargets) {
+    return tea1_targets_init_range(lpCtx, lpTargets, dwNumTargets, 0, TEA1_SEARCH_KEYSPACE);
+}
+
+void tea1_targets_free(TEA1_TARGETS_CTX *lpCtx) {
+    for (uint32_t i = 0; lpCtx->lpGroups && i < lpCtx->dwNumGroups; i++) {
+        free(lpCtx->lpGroups[i].lpqwBitmap);
+        free(lpCtx->lpGroups[i].lpdwPrefixes);
+        free(lpCtx->lpGroups[i].lpdwTargets);
+    }
+    free(lpCtx->lpGroups);
+    free(lpCtx->lpTargets);
+    free(lpCtx->lpHits);
+    memset(lpCtx, 0, sizeof(*lpCtx));
+}
+
+int tea1_targets_done(const TEA1_TARGETS_CTX *lpCtx) {
+    return lpCtx->qwNextIndex >= lpCtx->qwNumCandidates;
+}
+
+/*
+ * Test candidates [qwBegin, qwEnd), appending hits. Returns the index of the
+ * first candidate not fully processed, which is qwEnd unless storing a hit
+ * failed; the hits of that candidate are dropped again.
+ */
+static uint64_t tea1_targets_scan(const TEA1_TARGETS_CTX *lpCtx, uint64_t qwBegin, uint64_t qwEnd,
+                                  void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity) {
+    uint64_t qwSpan = lpCtx->qwEndKey - lpCtx->qwStartKey;
+
+    for (uint64_t qwIndex = qwBegin; qwIndex < qwEnd; ) {
+        const Tea1TargetGroup *lpGroup = &lpCtx->lpGroups[qwIndex / qwSpan];
+        uint64_t qwIvReg = tea1_expand_iv(lpGroup->dwIv);
+        uint64_t qwKey = lpCtx->qwStartKey + qwIndex % qwSpan;
+        uint64_t qwKeyEnd = qwKey + (qwEnd - qwIndex) < lpCtx->qwEndKey ? qwKey + (qwEnd - qwIndex) : lpCtx->qwEndKey;
+
+        for (; qwKey < qwKeyEnd; qwKey++, qwIndex++) {
+            uint64_t qwReg = qwIvReg;
+            uint32_t dwKeyReg = (uint32_t)qwKey;
+
+            // Two bytes against the bitmap stop nearly every candidate
+            tea1_clock(&qwReg, &dwKeyReg, TEA1_NUM_INIT_ROUNDS);
+            uint32_t dwPrefix = qwReg >> 56;
+            tea1_clock(&qwReg, &dwKeyReg, TEA1_NUM_BYTE_ROUNDS);
+            dwPrefix = ((dwPrefix << 8) | (qwReg >> 56)) & (lpGroup->dwPrefixMask >> 16);
+            if (!(lpGroup->lpqwBitmap[dwPrefix / 64] & (1ULL << (dwPrefix % 64)))) {
+                continue;
+            }
+            for (int i = 2; i < TEA1_TARGETS_PREFIX_BYTES; i++) {
+                tea1_clock(&qwReg, &dwKeyReg, TEA1_NUM_BYTE_ROUNDS);
+                dwPrefix = (dwPrefix << 8) | (qwReg >> 56);
+            }
+            dwPrefix &= lpGroup->dwPrefixMask;
+
+            uint32_t dwFirstHit = *lpdwNum;
+            for (uint32_t dwSlot = tea1_targets_slot(dwPrefix, lpGroup->dwTableMask); lpGroup->lpdwTargets[dwSlot];
+                    dwSlot = (dwSlot + 1) & lpGroup->dwTableMask) {
+                uint32_t dwTarget = lpGroup->lpdwTargets[dwSlot] - 1;
+                if (lpGroup->lpdwPrefixes[dwSlot] != dwPrefix || !tea1_filter_match(&lpCtx->lpTargets[dwTarget], (uint32_t)qwKey)) {
+                    continue;
+                }
+                Tea1TargetHit stHit = { dwTarget, (uint32_t)qwKey };
+                if (workpool_hits_append(lppHits, lpdwNum, lpdwCapacity, &stHit, sizeof(stHit))) {
+                    *lpdwNum = dwFirstHit;
+                    return qwIndex;
+                }
+            }
+        }
+    }
+    return qwEnd;
+}
+
+static int tea1_targets_cmp_hit(const void *a, const void *b) {
+    const Tea1TargetHit *x = a;
+    const Tea1TargetHit *y = b;
+    if (x->dwTarget != y->dwTarget) {
+        return (x->dwTarget > y->dwTarget) - (x->dwTarget < y->dwTarget);
+    }
+    return (x->dwKeyReg > y->dwKeyReg) - (x->dwKeyReg < y->dwKeyReg);
+}
+
+uint64_t tea1_targets_run(TEA1_TARGETS_CTX *lpCtx, uint64_t qwMaxCandidates) {
+    uint64_t qwBegin = lpCtx->qwNextIndex;
+    uint64_t qwEnd = lpCtx->qwNumCandidates;
+    uint32_t dwFirstNew = lpCtx->dwNumHits;
+
+    if (qwEnd - qwBegin > qwMaxCandidates) {
+        qwEnd = qwBegin + qwMaxCandidates;
+    }
+
+    uint64_t qwStop = tea1_targets_scan(lpCtx, qwBegin, qwEnd, &lpCtx->lpHits, &lpCtx->dwNumHits, &lpCtx->dwHitsCapacity);
+    if (lpCtx->dwNumHits != dwFirstNew) {
+        qsort(lpCtx->lpHits, lpCtx->dwNumHits, sizeof(Tea1TargetHit), tea1_targets_cmp_hit);
+    }
+    lpCtx->qwNextIndex = qwStop;
+    return qwStop - qwBegin;
+}
+
+static int tea1_targets_collect(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd,
+                                void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity) {
+    return tea1_targets_scan(lpArg, qwBegin, qwEnd, lppHits, lpdwNum, lpdwCapacity) == qwEnd ? 0 : -1;
+}
+
+uint64_t tea1_targets_run_parallel(TEA1_TARGETS_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxCandidates) {
+    uint64_t qwBegin = lpCtx->qwNextIndex;
+    uint64_t qwEnd = lpCtx->qwNumCandidates;
+    uint32_t dwFirstNew = lpCtx->dwNumHits;
+
+    if (qwEnd - qwBegin > qwMaxCandidates) {
+        qwEnd = qwBegin + qwMaxCandidates;
+    }
+    if (qwBegin >= qwEnd) {
+        return 0;
+    }
+
+    // A stopped or failed pass is discarded and rescanned later; the whole list stays sorted by target
+    if (workpool_run_collect(lpPool, qwBegin, qwEnd, TEA1_TARGETS_CHUNK, tea1_targets_collect, lpCtx,
+                             &lpCtx->lpHits, &lpCtx->dwNumHits, &lpCtx->dwHitsCapacity, sizeof(Tea1TargetHit), NULL)) {
+        return 0;
+    }
+    if (lpCtx->dwNumHits != dwFirstNew) {
+        qsort(lpCtx->lpHits, lpCtx->dwNumHits, sizeof(Tea1TargetHit), tea1_targets_cmp_hit);
+    }
+    lpCtx->qwNextIndex = qwEnd;
+    return qwEnd - qwBegin;
+}
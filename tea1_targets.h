@@ -0,0 +1,70 @@
+#ifndef HAVE_TEA1_TARGETS_H
+#define HAVE_TEA1_TARGETS_H
+
+#include <inttypes.h>
+
+#include "tea1_search.h"
+#include "workpool.h"
+
+/*
+ * Multi-target reduced-key search: recover the 32-bit key registers of many
+ * intercepts at once. Targets are grouped by IV and by the known bits of their
+ * first TEA1_TARGETS_PREFIX_BYTES keystream bytes, and each group is swept
+ * once over the key range, whatever the number of targets in it.
+ *
+ * A candidate first generates two keystream bytes and looks them up in a
+ * 2^16 bit bitmap of the targets' first two bytes; most candidates stop
+ * there. The rest generate the whole prefix and probe an open addressing
+ * table of target prefixes, and a prefix match is confirmed against all of
+ * the target's known bits with tea1_filter_match. The cost of a candidate
+ * thus does not depend on the number of targets, as long as the bitmap stays
+ * sparse (a few thousand targets per group).
+ */
+
+#define TEA1_TARGETS_PREFIX_BYTES 4
+
+typedef struct {
+    uint32_t dwTarget;                  // index into the targets passed to tea1_targets_init
+    uint32_t dwKeyReg;
+} Tea1TargetHit;
+
+typedef struct {
+    uint32_t dwIv;
+    uint32_t dwPrefixMask;              // known bits of keystream bytes 0..3, byte 0 on top
+    uint64_t *lpqwBitmap;               // bit set for the masked first two bytes of every target
+    uint32_t dwTableMask;               // slots - 1
+    uint32_t *lpdwPrefixes;             // masked prefix per slot
+    uint32_t *lpdwTargets;              // target index + 1 per slot, 0 if the slot is empty
+} Tea1TargetGroup;
+
+/*
+ * Candidates [0, qwNumCandidates) are the keys of the range for every group
+ * in turn, group g covering [g * span, (g + 1) * span); [0, qwNextIndex) have
+ * been tested. Hits are kept sorted by target, then key.
+ */
+typedef struct {
+    Tea1Filter *lpTargets;
+    uint32_t dwNumTargets;
+    Tea1TargetGroup *lpGroups;
+    uint32_t dwNumGroups;
+
+    uint64_t qwStartKey;
+    uint64_t qwEndKey;
+    uint64_t qwNumCandidates;
+    uint64_t qwNextIndex;
+
+    Tea1TargetHit *lpHits;
+    uint32_t dwNumHits;
+    uint32_t dwHitsCapacity;
+} TEA1_TARGETS_CTX;
+
+// Returns 0, or -1 if there are no targets, a target has no keystream or memory runs out
+int tea1_targets_init(TEA1_TARGETS_CTX *lpCtx, const Tea1Filter *lpTargets, uint32_t dwNumTargets);
+int tea1_targets_init_range(TEA1_TARGETS_CTX *lpCtx, const Tea1Filter *lpTargets, uint32_t dwNumTargets,
+                            uint64_t qwStartKey, uint64_t qwEndKey);
+void tea1_targets_free(TEA1_TARGETS_CTX *lpCtx);
+uint64_t tea1_targets_run(TEA1_TARGETS_CTX *lpCtx, uint64_t qwMaxCandidates);
+uint64_t tea1_targets_run_parallel(TEA1_TARGETS_CTX *lpCtx, WORKPOOL *lpPool, uint64_t qwMaxCandidates);
+int tea1_targets_done(const TEA1_TARGETS_CTX *lpCtx);
+
+#endif /* HAVE_TEA1_TARGETS_H */
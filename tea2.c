@@ -16,11 +16,18 @@
 #include <inttypes.h>
 #include <string.h>
 
+#include "common.h"
 #include "tea2.h"
+#include "tea_core.h"
+#include "tea_simd.h"
+#include "stats.h"
 
 
-const uint16_t g_abTea2LutA[8] = { 0x2579, 0x86E5, 0xB6C8, 0x31D6, 0x7394, 0x934D, 0x638E, 0xC68B };
-const uint16_t g_abTea2LutB[8] = { 0xD68A, 0x97A1, 0xB2C9, 0x239E, 0x9C71, 0x36E8, 0xC9B2, 0x6CD1 };
+#define TEA2_LUT_A 0x2579, 0x86E5, 0xB6C8, 0x31D6, 0x7394, 0x934D, 0x638E, 0xC68B
+#define TEA2_LUT_B 0xD68A, 0x97A1, 0xB2C9, 0x239E, 0x9C71, 0x36E8, 0xC9B2, 0x6CD1
+
+const uint16_t g_abTea2LutA[8] = { TEA2_LUT_A };
+const uint16_t g_abTea2LutB[8] = { TEA2_LUT_B };
 const uint8_t g_abTea2Sbox[256] = {
     0x62, 0xDA, 0xFD, 0xB6, 0xBB, 0x9C, 0xD8, 0x2A, 0xAB, 0x28, 0x6E, 0x42, 0xE7, 0x1C, 0x78, 0x9E, 
     0xFC, 0xCA, 0x81, 0x8E, 0x32, 0x3B, 0xB4, 0xEF, 0x9F, 0x8B, 0xDB, 0x94, 0x0F, 0x9A, 0xA2, 0x96, 
@@ -40,79 +47,112 @@ const uint8_t g_abTea2Sbox[256] = {
     0x0A, 0x88, 0xA9, 0x1A, 0x6C, 0x43, 0xEA, 0xAD, 0x30, 0x86, 0x36, 0x59, 0x08, 0x55, 0x01, 0x02
 };
 
+static const uint16_t g_awTea2LutSliced[16] = TEA_LUT_SLICED(TEA2_LUT_A, TEA2_LUT_B);
+
+static const TeaVariant g_stTea2Variant = {
+    .abSbox = g_abTea2Sbox,
+    .awLutSliced = g_awTea2LutSliced,
+    .dwIvXor = 0x5A6E3278,
+    .dwKeyLen = 10,
+    .dwSboxTapA = 0,
+    .dwSboxTapB = 7,
+    .dwSboxXorTap = -1,
+    .dwFilterShiftA = 0,
+    .dwFilterShiftB = 24,
+    .abFilterRot = { 1, 2, 7, 0 },    // taps on bit 0,2 for bSt0 and bit 0,7 for bSt1
+    .dwReorderShift = 40,
+    .abReorderPerm = { 6, 4, 0, 5, 7, 1, 3, 2 },
+    .bNewFromLutB = 0,
+    .dwExtraTapShift = 16,
+    .dwMixShift = 24,
+    .dwInitRounds = 51,
+    .dwByteRounds = 19,
+};
 
-static uint64_t tea2_expand_iv(uint32_t dwFrameNumbers) {
-    uint32_t dwXorred = dwFrameNumbers ^ 0x5A6E3278;
-    dwXorred = (dwXorred << 8) | (dwXorred >> 24); // rotate left -> translated to single rol instruction
-    uint64_t qwIv = ((uint64_t)dwFrameNumbers << 32) | dwXorred;
-    return (qwIv >> 8) | (qwIv << 56); // rotate right
+const TeaVariant *tea2_variant(void) {
+    return &g_stTea2Variant;
 }
 
-static uint8_t tea2_state_word_to_newbyte(uint16_t wSt, const uint16_t *awLut) {
-    
-    uint8_t bSt0 = wSt;
-    uint8_t bSt1 = wSt >> 8;
-    uint8_t bDist;
-    uint8_t bOut = 0;
-
-    for (int i = 0; i < 8; i++) {
-        // taps on bit 0,2 for bSt0 and bit 0,7 for bSt1
-        bDist = ((bSt0 >> 1) & 0x1) | ((bSt0 >> 1) & 0x2) | ((bSt1 >> 5) & 0x4) | ((bSt1 << 3) & 0x8);
-        if (awLut[i] & (1 << bDist)) {
-            bOut |= 1 << i;
-        }
-
-        // rotate one position
-        bSt0 = ((bSt0 >> 1) | (bSt0 << 7));
-        bSt1 = ((bSt1 >> 1) | (bSt1 << 7));
-    }
-
-    return bOut;
+
+void tea2(uint32_t dwFrameNumbers, uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+    STATS_BEGIN();
+
+    // init registers
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea2Variant, dwFrameNumbers);
+    tea_core_load_key(&g_stTea2Variant, lpKey, &qwKeyHi, &wKeyLo);
+
+    tea_core_keystream(&g_stTea2Variant, qwIvReg, qwKeyHi, wKeyLo, dwNumKsBytes, lpKsOut);
+    STATS_END(TEA2, dwNumKsBytes, dwNumKsBytes ? 51 + 19 * (dwNumKsBytes - 1) : 0, 0, 1);
 }
 
-static uint8_t tea2_reorder_state_byte(uint8_t bStByte) {
-    // simple re-ordering of bits
-    uint8_t bOut = 0;
-    bOut |= ((bStByte << 6) & 0x40);
-    bOut |= ((bStByte << 3) & 0x10);
-    bOut |= ((bStByte >> 2) & 0x01);
-    bOut |= ((bStByte << 2) & 0x20);
-    bOut |= ((bStByte << 3) & 0x80);
-    bOut |= ((bStByte >> 4) & 0x02);
-    bOut |= ((bStByte >> 3) & 0x08);
-    bOut |= ((bStByte >> 5) & 0x04);
-    return bOut;
+void tea2_xor_scatter(uint32_t dwFrameNumbers, const uint8_t *lpKey, const TeaXorSegment *lpSegments, uint32_t dwNumSegments) {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+    STATS_BEGIN();
+
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea2Variant, dwFrameNumbers);
+    tea_core_load_key(&g_stTea2Variant, lpKey, &qwKeyHi, &wKeyLo);
+
+    uint32_t dwNumKsBytes = tea_core_xor_scatter(&g_stTea2Variant, qwIvReg, qwKeyHi, wKeyLo, lpSegments, dwNumSegments);
+    STATS_END(TEA2, dwNumKsBytes, dwNumKsBytes ? 51 + 19 * (dwNumKsBytes - 1) : 0, 0, 1);
 }
 
-void tea2(uint32_t dwFrameNumbers, uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
-    uint8_t abKeyReg[10];
-    uint32_t dwNumSkipRounds = 51;
+void tea2_xor(uint32_t dwFrameNumbers, const uint8_t *lpKey, uint32_t dwBitOffset, uint32_t dwBitLen, uint8_t *lpInOut) {
+    TeaXorSegment stSegment = { 0, dwBitOffset, dwBitLen, lpInOut };
+    tea2_xor_scatter(dwFrameNumbers, lpKey, &stSegment, 1);
+}
 
-    // init registers
-    uint64_t qwIvReg = tea2_expand_iv(dwFrameNumbers);
-    memcpy(abKeyReg, lpKey, 10);
-
-    for (int i = 0; i < dwNumKsBytes; i++) {
-        for (int j = 0; j < dwNumSkipRounds; j++) {
-            // Step 1: Derive a non-linear feedback byte through sbox and feed back into key register
-            uint8_t bSboxOut = g_abTea2Sbox[abKeyReg[0] ^ abKeyReg[7]];
-            memmove(abKeyReg, abKeyReg + 1, 9);
-            abKeyReg[9] = bSboxOut;
-
-            // Step 2: Compute 3 bytes derived from current state
-            uint8_t bDerivByte01 = tea2_state_word_to_newbyte((qwIvReg >>  0) & 0xffff, g_abTea2LutA);
-            uint8_t bDerivByte34 = tea2_state_word_to_newbyte((qwIvReg >> 24) & 0xffff, g_abTea2LutB);
-            uint8_t bReordByte5  = tea2_reorder_state_byte((qwIvReg >> 40) & 0xff);
-
-            // Step 3: Combine current state with state derived values, and xor in key derived sbox output
-            uint8_t bNewByte = ((qwIvReg >> 56) ^ (qwIvReg >> 16) ^ bReordByte5 ^ bDerivByte01 ^ bSboxOut) & 0xff;
-            uint8_t bMixByte = bDerivByte34;
-
-            // Step 4: Update lfsr: leftshift 8, feed/mix in previously generated bytes
-            qwIvReg = ((qwIvReg << 8) ^ ((uint64_t)bMixByte << 24)) | bNewByte;
-        }
-
-        lpKsOut[i] = qwIvReg >> 56;
-        dwNumSkipRounds = 19;
-    }
+int tea2_match(uint32_t dwFrameNumbers, const uint8_t *lpKey, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes) {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+    STATS_COUNT(TEA2_MATCH, 0, 0, 0, 1);
+
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea2Variant, dwFrameNumbers);
+    tea_core_load_key(&g_stTea2Variant, lpKey, &qwKeyHi, &wKeyLo);
+    return tea_core_match(&g_stTea2Variant, qwIvReg, qwKeyHi, wKeyLo, lpKs, lpMask, dwNumKsBytes);
+}
+
+void tea2_key_stream_init(TeaKeyStream *lpStream, const uint8_t *lpKey) {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+
+    tea_core_load_key(&g_stTea2Variant, lpKey, &qwKeyHi, &wKeyLo);
+    tea_core_key_stream_init(&g_stTea2Variant, lpStream, qwKeyHi, wKeyLo);
+}
+
+int tea2_match_key_stream(TeaKeyStream *lpStream, uint32_t dwFrameNumbers, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes) {
+    STATS_COUNT(TEA2_MATCH_KEY_STREAM, 0, 0, 0, 0);
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea2Variant, dwFrameNumbers);
+    return tea_core_match_key_stream(&g_stTea2Variant, lpStream, qwIvReg, lpKs, lpMask, dwNumKsBytes);
+}
+
+static void tea2_simd_load_key(const uint8_t *lpKey, uint8_t *lpKeyRegOut) {
+    memcpy(lpKeyRegOut, lpKey, 10);
+}
+
+static void tea2_simd_scalar(uint32_t dwFrameNumbers, const uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea2Variant, dwFrameNumbers);
+    tea_core_load_key(&g_stTea2Variant, lpKey, &qwKeyHi, &wKeyLo);
+    tea_core_keystream(&g_stTea2Variant, qwIvReg, qwKeyHi, wKeyLo, dwNumKsBytes, lpKsOut);
+}
+
+TEA_SIMD_TARGET_AVX512 static void tea2_simd_avx512(const TeaSimdLanes *lpLanes) {
+    tea_simd_keystream_avx512(&g_stTea2Variant, lpLanes);
+}
+
+TEA_SIMD_TARGET_AVX2 static void tea2_simd_avx2(const TeaSimdLanes *lpLanes) {
+    tea_simd_keystream_avx2(&g_stTea2Variant, lpLanes);
+}
+
+static const TeaSimdKernels g_stTea2SimdKernels = { 2, tea2_simd_avx512, tea2_simd_avx2, tea2_simd_load_key, tea2_simd_scalar };
+
+void tea2_keystream_lanes(uint32_t dwNumLanes, const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    STATS_BEGIN();
+    tea_simd_keystream(&g_stTea2Variant, &g_stTea2SimdKernels, dwNumLanes, adwIvs, lpKeys, dwNumKsBytes, lpKsOut);
+    STATS_END(TEA2, (uint64_t)dwNumLanes * dwNumKsBytes, dwNumKsBytes ? (uint64_t)dwNumLanes * (51 + 19 * (dwNumKsBytes - 1)) : 0, 0, dwNumLanes);
 }
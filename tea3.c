@@ -16,11 +16,18 @@
 #include <inttypes.h>
 #include <string.h>
 
+#include "common.h"
 #include "tea3.h"
+#include "tea_core.h"
+#include "tea_simd.h"
+#include "stats.h"
 
 
-const uint16_t g_awTea3LutA[8] = { 0x92A7, 0xA761, 0x974C, 0x6B8C, 0x29CE, 0x176C, 0x39D4, 0x7463 };
-const uint16_t g_awTea3LutB[8] = { 0x9D58, 0xA46D, 0x176C, 0x79C4, 0xC62B, 0xB2C9, 0x4D93, 0x2E93 };
+#define TEA3_LUT_A 0x92A7, 0xA761, 0x974C, 0x6B8C, 0x29CE, 0x176C, 0x39D4, 0x7463
+#define TEA3_LUT_B 0x9D58, 0xA46D, 0x176C, 0x79C4, 0xC62B, 0xB2C9, 0x4D93, 0x2E93
+
+const uint16_t g_awTea3LutA[8] = { TEA3_LUT_A };
+const uint16_t g_awTea3LutB[8] = { TEA3_LUT_B };
 const uint8_t g_abTea3Sbox[256] = {
     0x7D, 0xBF, 0x7B, 0x92, 0xAE, 0x7C, 0xF2, 0x10, 0x5A, 0x0F, 0x61, 0x7A, 0x98, 0x76, 0x07, 0x64,
     0xEE, 0x89, 0xF7, 0xBA, 0xC2, 0x02, 0x0D, 0xE8, 0x56, 0x2E, 0xCA, 0x58, 0xC0, 0xFA, 0x2A, 0x01,
@@ -40,76 +47,112 @@ const uint8_t g_abTea3Sbox[256] = {
     0x52, 0x8C, 0x5D, 0x29, 0x6D, 0x04, 0xBC, 0x25, 0x15, 0x8B, 0x12, 0x9B, 0xD6, 0x75, 0xA3, 0x97
 };
 
+static const uint16_t g_awTea3LutSliced[16] = TEA_LUT_SLICED(TEA3_LUT_A, TEA3_LUT_B);
+
+static const TeaVariant g_stTea3Variant = {
+    .abSbox = g_abTea3Sbox,
+    .awLutSliced = g_awTea3LutSliced,
+    .dwIvXor = 0xC43A7D51,
+    .dwKeyLen = 10,
+    .dwSboxTapA = 7,
+    .dwSboxTapB = 2,
+    .dwSboxXorTap = 0,
+    .dwFilterShiftA = 8,
+    .dwFilterShiftB = 40,
+    .abFilterRot = { 5, 6, 5, 6 },    // taps on bit 5,6 for bSt0 and bit 5,6 for bSt1
+    .dwReorderShift = 32,
+    .abReorderPerm = { 6, 3, 4, 0, 5, 7, 2, 1 },
+    .bNewFromLutB = 0,
+    .dwExtraTapShift = -1,
+    .dwMixShift = 40,
+    .dwInitRounds = 51,
+    .dwByteRounds = 19,
+};
 
-static uint64_t tea3_compute_iv(uint32_t dwFrameNumbers) {
-    uint32_t dwXorred = dwFrameNumbers ^ 0xC43A7D51;
-    dwXorred = (dwXorred << 8) | (dwXorred >> 24); // rotate left -> translated to single rol instruction
-    uint64_t qwIv = ((uint64_t)dwFrameNumbers << 32) | dwXorred;
-    return (qwIv >> 8) | (qwIv << 56); // rotate right
+const TeaVariant *tea3_variant(void) {
+    return &g_stTea3Variant;
 }
 
-static uint8_t tea3_state_word_to_newbyte(uint16_t wSt, const uint16_t *awLut) {
-    uint8_t bSt0 = wSt;
-    uint8_t bSt1 = wSt >> 8;
 
-    uint8_t bDist;
-    uint8_t bOut = 0;
+void tea3(uint32_t dwFrameNumbers, uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+    STATS_BEGIN();
+
+    // init registers
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea3Variant, dwFrameNumbers);
+    tea_core_load_key(&g_stTea3Variant, lpKey, &qwKeyHi, &wKeyLo);
+
+    tea_core_keystream(&g_stTea3Variant, qwIvReg, qwKeyHi, wKeyLo, dwNumKsBytes, lpKsOut);
+    STATS_END(TEA3, dwNumKsBytes, dwNumKsBytes ? 51 + 19 * (dwNumKsBytes - 1) : 0, 0, 1);
+}
 
-    for (int i = 0; i < 8; i++) {
-        // taps on bit 5,6 for bSt0 and bit 5,6 for bSt1
-        bDist = ((bSt0 >> 5) & 3) | ((bSt1 >> 3) & 12);
-        if (awLut[i] & (1 << bDist)) {
-            bOut |= 1 << i;
-        }
+void tea3_xor_scatter(uint32_t dwFrameNumbers, const uint8_t *lpKey, const TeaXorSegment *lpSegments, uint32_t dwNumSegments) {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+    STATS_BEGIN();
 
-        // rotate one position
-        bSt0 = ((bSt0 >> 1) | (bSt0 << 7));
-        bSt1 = ((bSt1 >> 1) | (bSt1 << 7));
-    }
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea3Variant, dwFrameNumbers);
+    tea_core_load_key(&g_stTea3Variant, lpKey, &qwKeyHi, &wKeyLo);
 
-    return bOut;
+    uint32_t dwNumKsBytes = tea_core_xor_scatter(&g_stTea3Variant, qwIvReg, qwKeyHi, wKeyLo, lpSegments, dwNumSegments);
+    STATS_END(TEA3, dwNumKsBytes, dwNumKsBytes ? 51 + 19 * (dwNumKsBytes - 1) : 0, 0, 1);
 }
 
-static uint8_t tea3_reorder_state_byte(uint8_t bStByte) {
-    // simple re-ordering of bits
-    uint8_t bOut = 0;
-    bOut |= ((bStByte << 6) & 0x40);
-    bOut |= ((bStByte << 1) & 0x20);
-    bOut |= ((bStByte << 2) & 0x98);
-    bOut |= ((bStByte >> 4) & 0x04);
-    bOut |= ((bStByte >> 3) & 0x01);
-    bOut |= ((bStByte >> 6) & 0x02);
-    return bOut;
+void tea3_xor(uint32_t dwFrameNumbers, const uint8_t *lpKey, uint32_t dwBitOffset, uint32_t dwBitLen, uint8_t *lpInOut) {
+    TeaXorSegment stSegment = { 0, dwBitOffset, dwBitLen, lpInOut };
+    tea3_xor_scatter(dwFrameNumbers, lpKey, &stSegment, 1);
 }
 
-void tea3(uint32_t dwFrameNumbers, uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
-    uint8_t abKeyReg[10];
-    uint32_t dwNumSkipRounds = 51;
+int tea3_match(uint32_t dwFrameNumbers, const uint8_t *lpKey, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes) {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+    STATS_COUNT(TEA3_MATCH, 0, 0, 0, 1);
 
-    // init registers
-    uint64_t qwIvReg = tea3_compute_iv(dwFrameNumbers);
-    memcpy(abKeyReg, lpKey, 10);
-
-    for (int i = 0; i < dwNumKsBytes; i++) {
-        for (int j = 0; j < dwNumSkipRounds; j++) {
-            // Step 1: Derive a non-linear feedback byte through sbox and feed back into key register
-            uint8_t bSboxOut = g_abTea3Sbox[abKeyReg[7] ^ abKeyReg[2]] ^ abKeyReg[0];
-            memmove(abKeyReg, abKeyReg + 1, 9);
-            abKeyReg[9] = bSboxOut;
-
-            // Step 2: Compute 3 bytes derived from current state
-            uint8_t bDerivByte12 = tea3_state_word_to_newbyte((qwIvReg >>  8) & 0xffff, g_awTea3LutA);
-            uint8_t bDerivByte56 = tea3_state_word_to_newbyte((qwIvReg >> 40) & 0xffff, g_awTea3LutB);
-            uint8_t bReordByte4  = tea3_reorder_state_byte((qwIvReg >> 32) & 0xff);
-
-            // Step 3: Combine current state with state derived values, and xor in key derived sbox output
-            uint8_t bNewByte = ((qwIvReg >> 56) ^ bReordByte4 ^ bDerivByte12 ^ bSboxOut) & 0xff;
-            uint8_t bMixByte = bDerivByte56;
-
-            // Step 4: Update lfsr: leftshift 8, feed/mix in previously generated bytes
-            qwIvReg = ((qwIvReg << 8) ^ ((uint64_t)bMixByte << 40)) | bNewByte;
-        }
-        lpKsOut[i] = (qwIvReg >> 56);
-        dwNumSkipRounds = 19;
-    }
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea3Variant, dwFrameNumbers);
+    tea_core_load_key(&g_stTea3Variant, lpKey, &qwKeyHi, &wKeyLo);
+    return tea_core_match(&g_stTea3Variant, qwIvReg, qwKeyHi, wKeyLo, lpKs, lpMask, dwNumKsBytes);
+}
+
+void tea3_key_stream_init(TeaKeyStream *lpStream, const uint8_t *lpKey) {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+
+    tea_core_load_key(&g_stTea3Variant, lpKey, &qwKeyHi, &wKeyLo);
+    tea_core_key_stream_init(&g_stTea3Variant, lpStream, qwKeyHi, wKeyLo);
+}
+
+int tea3_match_key_stream(TeaKeyStream *lpStream, uint32_t dwFrameNumbers, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes) {
+    STATS_COUNT(TEA3_MATCH_KEY_STREAM, 0, 0, 0, 0);
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea3Variant, dwFrameNumbers);
+    return tea_core_match_key_stream(&g_stTea3Variant, lpStream, qwIvReg, lpKs, lpMask, dwNumKsBytes);
+}
+
+static void tea3_simd_load_key(const uint8_t *lpKey, uint8_t *lpKeyRegOut) {
+    memcpy(lpKeyRegOut, lpKey, 10);
+}
+
+static void tea3_simd_scalar(uint32_t dwFrameNumbers, const uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    uint64_t qwKeyHi;
+    uint16_t wKeyLo;
+
+    uint64_t qwIvReg = tea_core_expand_iv(&g_stTea3Variant, dwFrameNumbers);
+    tea_core_load_key(&g_stTea3Variant, lpKey, &qwKeyHi, &wKeyLo);
+    tea_core_keystream(&g_stTea3Variant, qwIvReg, qwKeyHi, wKeyLo, dwNumKsBytes, lpKsOut);
+}
+
+TEA_SIMD_TARGET_AVX512 static void tea3_simd_avx512(const TeaSimdLanes *lpLanes) {
+    tea_simd_keystream_avx512(&g_stTea3Variant, lpLanes);
+}
+
+TEA_SIMD_TARGET_AVX2 static void tea3_simd_avx2(const TeaSimdLanes *lpLanes) {
+    tea_simd_keystream_avx2(&g_stTea3Variant, lpLanes);
+}
+
+static const TeaSimdKernels g_stTea3SimdKernels = { 3, tea3_simd_avx512, tea3_simd_avx2, tea3_simd_load_key, tea3_simd_scalar };
+
+void tea3_keystream_lanes(uint32_t dwNumLanes, const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    STATS_BEGIN();
+    tea_simd_keystream(&g_stTea3Variant, &g_stTea3SimdKernels, dwNumLanes, adwIvs, lpKeys, dwNumKsBytes, lpKsOut);
+    STATS_END(TEA3, (uint64_t)dwNumLanes * dwNumKsBytes, dwNumKsBytes ? (uint64_t)dwNumLanes * (51 + 19 * (dwNumKsBytes - 1)) : 0, 0, dwNumLanes);
 }
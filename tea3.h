@@ -3,6 +3,23 @@
 
 #include <inttypes.h>
 
+#include "common.h"
+
 void tea3(uint32_t dwFrameNumbers, uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
 
+// Keystream for dwNumLanes (IV, key) pairs at once on the byte-lane vector kernels, see tea_simd.h.
+// Keys are 10 bytes and the keystream dwNumKsBytes bytes per lane.
+void tea3_keystream_lanes(uint32_t dwNumLanes, const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
+
+// Xor keystream into a buffer at bit granularity, dwBitLen bits starting at bit dwBitOffset (MSB first)
+void tea3_xor(uint32_t dwFrameNumbers, const uint8_t *lpKey, uint32_t dwBitOffset, uint32_t dwBitLen, uint8_t *lpInOut);
+void tea3_xor_scatter(uint32_t dwFrameNumbers, const uint8_t *lpKey, const TeaXorSegment *lpSegments, uint32_t dwNumSegments);
+
+// Candidate key test: keystream bits under lpMask equal lpKs, bails out at the first mismatching byte
+int tea3_match(uint32_t dwFrameNumbers, const uint8_t *lpKey, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes);
+
+// Same test for several IVs under one key, the key side of the rounds is shared through lpStream
+void tea3_key_stream_init(TeaKeyStream *lpStream, const uint8_t *lpKey);
+int tea3_match_key_stream(TeaKeyStream *lpStream, uint32_t dwFrameNumbers, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes);
+
 #endif /* HAVE_TEA3_H */
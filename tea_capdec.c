@@ -0,0 +1,124 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "workpool.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    CaptureKeyChange *lpSchedule;
+    uint32_t dwNumChanges, dwLine;
+    CaptureSummary stSummary;
+    struct stat st;
+
+    if (argc != 5) {
+        fprintf(stderr, "Usage: %s <threads> <key schedule> <capture in> <capture out>\n", argv[0]);
+        fprintf(stderr, "       threads 0 = all cpus, see capture.h for the file formats\n");
+        exit(EXIT_FAILURE);
+    }
+    if (capture_load_schedule(argv[2], &lpSchedule, &dwNumChanges, &dwLine) != 0) {
+        fprintf(stderr, "Can't load key schedule %s (line %u)\n", argv[2], dwLine);
+        exit(EXIT_FAILURE);
+    }
+
+    int fdIn = open(argv[3], O_RDONLY);
+    if (fdIn < 0 || fstat(fdIn, &st) != 0) {
+        perror("Can't open capture");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t qwLen = st.st_size;
+
+    // Nothing to map, an empty capture decrypts to an empty output
+    if (qwLen == 0) {
+        int fdOut = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fdOut < 0) {
+            perror("Can't create output");
+            exit(EXIT_FAILURE);
+        }
+        close(fdOut);
+        close(fdIn);
+        free(lpSchedule);
+        printf("0 records, 0 keystreams\n");
+        return 0;
+    }
+
+    // Mapped lazily, so the disk reads happen during, and are timed with, the decryption
+    uint8_t *lpIn = mmap(NULL, qwLen, PROT_READ, MAP_PRIVATE, fdIn, 0);
+    if (lpIn == MAP_FAILED) {
+        perror("Can't map capture");
+        exit(EXIT_FAILURE);
+    }
+    madvise(lpIn, qwLen, MADV_SEQUENTIAL);
+
+    // Preallocate the output so workers write straight into the page cache out of order
+    int fdOut = open(argv[4], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fdOut < 0 || posix_fallocate(fdOut, 0, qwLen) != 0) {
+        perror("Can't create output");
+        exit(EXIT_FAILURE);
+    }
+    uint8_t *lpOut = mmap(NULL, qwLen, PROT_READ | PROT_WRITE, MAP_SHARED, fdOut, 0);
+    if (lpOut == MAP_FAILED) {
+        perror("Can't map output");
+        exit(EXIT_FAILURE);
+    }
+
+    WORKPOOL *pool = workpool_create(atoi(argv[1]), WORKPOOL_FLAG_PIN);
+    if (pool == NULL) {
+        perror("workpool_create failed");
+        exit(EXIT_FAILURE);
+    }
+
+    double dStart = now();
+    int iResult = capture_decrypt(pool, lpIn, lpOut, qwLen, lpSchedule, dwNumChanges, 0, &stSummary);
+    if (iResult == 0 && msync(lpOut, qwLen, MS_SYNC) != 0) {
+        perror("msync failed");
+        iResult = -1;
+    }
+    double dElapsed = now() - dStart;
+
+    if (iResult != 0) {
+        fprintf(stderr, "Decryption failed");
+        if (stSummary.qwErrorOffset) {
+            fprintf(stderr, ", malformed record at offset %llu", (unsigned long long)stSummary.qwErrorOffset);
+        }
+        fprintf(stderr, "\n");
+    } else {
+        printf("%llu records, %llu keystreams, %.3f s, %.1f MB/s, %.0f records/s\n",
+               (unsigned long long)stSummary.qwRecords, (unsigned long long)stSummary.qwKeystreams, dElapsed,
+               qwLen / dElapsed / 1e6, stSummary.qwRecords / dElapsed);
+    }
+
+    workpool_destroy(pool);
+    munmap(lpOut, qwLen);
+    munmap(lpIn, qwLen);
+    close(fdOut);
+    close(fdIn);
+    free(lpSchedule);
+    return iResult == 0 ? 0 : EXIT_FAILURE;
+}
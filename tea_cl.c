@@ -0,0 +1,346 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define CL_TARGET_OPENCL_VERSION 120
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "tea_core.h"
+#include "tea1_search.h"
+#include "tea_cl.h"
+
+#define TEA_CL_NUM_TYPES   3
+#define TEA_CL_LOCAL_SIZE  64
+#define TEA_CL_SEARCH_PASS (1 << 24)    // keys per search kernel launch
+#define TEA_CL_PREFIX_SIZE 8192
+
+struct TEA_CL {
+    cl_context hContext;
+    cl_device_id hDevice;
+    cl_command_queue hQueue;
+    cl_program ahPrograms[TEA_CL_NUM_TYPES];
+    cl_kernel ahKeystream[TEA_CL_NUM_TYPES];
+    cl_kernel hSearch;
+};
+
+/*
+ * Emit the parameters and tables of one variant in front of tea.cl, so the
+ * device code is generated from the same TeaVariant as the C implementation.
+ */
+static int tea_cl_variant_prefix(uint32_t dwTeaType, char *lpszOut, size_t qwSize) {
+    const TeaVariant *lpVariant = dwTeaType == 1 ? tea1_variant() : dwTeaType == 2 ? tea2_variant() : tea3_variant();
+    size_t qwLen = 0;
+
+    qwLen += snprintf(lpszOut + qwLen, qwSize - qwLen,
+        "#define TEA_TYPE %u\n#define TEA_IV_XOR 0x%08Xu\n#define TEA_KEY_LEN %u\n"
+        "#define TEA_SBOX_TAP_A %u\n#define TEA_SBOX_TAP_B %u\n#define TEA_SBOX_XOR_TAP %d\n"
+        "#define TEA_FILTER_SHIFT_A %u\n#define TEA_FILTER_SHIFT_B %u\n"
+        "#define TEA_FILTER_ROT_0 %u\n#define TEA_FILTER_ROT_1 %u\n#define TEA_FILTER_ROT_2 %u\n#define TEA_FILTER_ROT_3 %u\n"
+        "#define TEA_REORDER_SHIFT %u\n",
+        dwTeaType, lpVariant->dwIvXor, lpVariant->dwKeyLen,
+        lpVariant->dwSboxTapA, lpVariant->dwSboxTapB, lpVariant->dwSboxXorTap,
+        lpVariant->dwFilterShiftA, lpVariant->dwFilterShiftB,
+        lpVariant->abFilterRot[0], lpVariant->abFilterRot[1], lpVariant->abFilterRot[2], lpVariant->abFilterRot[3],
+        lpVariant->dwReorderShift);
+    for (int i = 0; i < 8 && qwLen < qwSize; i++) {
+        qwLen += snprintf(lpszOut + qwLen, qwSize - qwLen, "#define TEA_PERM_%d %u\n", i, lpVariant->abReorderPerm[i]);
+    }
+    if (qwLen < qwSize) {
+        qwLen += snprintf(lpszOut + qwLen, qwSize - qwLen,
+            "#define TEA_NEW_FROM_LUT_B %u\n#define TEA_EXTRA_TAP_SHIFT %d\n#define TEA_MIX_SHIFT %u\n"
+            "#define TEA_INIT_ROUNDS %u\n#define TEA_BYTE_ROUNDS %u\n#define TEA1_SEARCH_MAX_KS_BYTES %d\n"
+            "__constant uchar g_abSbox[256] = {",
+            lpVariant->bNewFromLutB, lpVariant->dwExtraTapShift, lpVariant->dwMixShift,
+            lpVariant->dwInitRounds, lpVariant->dwByteRounds, TEA1_SEARCH_MAX_KS_BYTES);
+    }
+    for (int i = 0; i < 256 && qwLen < qwSize; i++) {
+        qwLen += snprintf(lpszOut + qwLen, qwSize - qwLen, "%s0x%02X", i == 0 ? "\n    " : i % 16 ? ", " : ",\n    ", lpVariant->abSbox[i]);
+    }
+    if (qwLen < qwSize) {
+        qwLen += snprintf(lpszOut + qwLen, qwSize - qwLen, "\n};\n__constant ushort g_awLutSliced[16] = {");
+    }
+    for (int i = 0; i < 16 && qwLen < qwSize; i++) {
+        qwLen += snprintf(lpszOut + qwLen, qwSize - qwLen, "%s0x%04X", i ? ", " : " ", lpVariant->awLutSliced[i]);
+    }
+    if (qwLen < qwSize) {
+        qwLen += snprintf(lpszOut + qwLen, qwSize - qwLen, " };\n\n");
+    }
+    return qwLen < qwSize ? 0 : -1;
+}
+
+static char *tea_cl_read_file(const char *lpszPath) {
+    FILE *lpFile = fopen(lpszPath, "rb");
+    if (lpFile == NULL) {
+        return NULL;
+    }
+    fseek(lpFile, 0, SEEK_END);
+    long qwSize = ftell(lpFile);
+    fseek(lpFile, 0, SEEK_SET);
+
+    char *lpszSource = qwSize >= 0 ? malloc(qwSize + 1) : NULL;
+    if (lpszSource != NULL) {
+        if (fread(lpszSource, 1, qwSize, lpFile) != (size_t)qwSize) {
+            free(lpszSource);
+            lpszSource = NULL;
+        } else {
+            lpszSource[qwSize] = 0;
+        }
+    }
+    fclose(lpFile);
+    return lpszSource;
+}
+
+static cl_int tea_cl_build(TEA_CL *lpCl, uint32_t dwTeaType, const char *lpszSource) {
+    char szPrefix[TEA_CL_PREFIX_SIZE];
+    cl_int iErr;
+
+    if (tea_cl_variant_prefix(dwTeaType, szPrefix, sizeof(szPrefix)) != 0) {
+        return CL_OUT_OF_HOST_MEMORY;
+    }
+    const char *alpszSources[2] = { szPrefix, lpszSource };
+    cl_program hProgram = clCreateProgramWithSource(lpCl->hContext, 2, alpszSources, NULL, &iErr);
+    if (iErr != CL_SUCCESS) {
+        return iErr;
+    }
+    lpCl->ahPrograms[dwTeaType - 1] = hProgram;
+
+    iErr = clBuildProgram(hProgram, 1, &lpCl->hDevice, "", NULL, NULL);
+    if (iErr != CL_SUCCESS) {
+        size_t qwLogSize = 0;
+        clGetProgramBuildInfo(hProgram, lpCl->hDevice, CL_PROGRAM_BUILD_LOG, 0, NULL, &qwLogSize);
+        char *lpszLog = malloc(qwLogSize + 1);
+        if (lpszLog != NULL) {
+            clGetProgramBuildInfo(hProgram, lpCl->hDevice, CL_PROGRAM_BUILD_LOG, qwLogSize, lpszLog, NULL);
+            lpszLog[qwLogSize] = 0;
+            fprintf(stderr, "TEA%u kernel build failed:\n%s\n", dwTeaType, lpszLog);
+            free(lpszLog);
+        }
+        return iErr;
+    }
+
+    lpCl->ahKeystream[dwTeaType - 1] = clCreateKernel(hProgram, "tea_keystream", &iErr);
+    if (iErr == CL_SUCCESS && dwTeaType == 1) {
+        lpCl->hSearch = clCreateKernel(hProgram, "tea1_search", &iErr);
+    }
+    return iErr;
+}
+
+TEA_CL *tea_cl_create(const char *lpszKernelPath, uint32_t dwPlatform, uint32_t dwDevice) {
+    cl_platform_id ahPlatforms[16];
+    cl_device_id ahDevices[16];
+    cl_uint dwNumPlatforms = 0, dwNumDevices = 0;
+    cl_int iErr;
+
+    if (clGetPlatformIDs(16, ahPlatforms, &dwNumPlatforms) != CL_SUCCESS || dwPlatform >= dwNumPlatforms || dwPlatform >= 16) {
+        return NULL;
+    }
+    if (clGetDeviceIDs(ahPlatforms[dwPlatform], CL_DEVICE_TYPE_ALL, 16, ahDevices, &dwNumDevices) != CL_SUCCESS ||
+        dwDevice >= dwNumDevices || dwDevice >= 16) {
+        return NULL;
+    }
+
+    char *lpszSource = tea_cl_read_file(lpszKernelPath);
+    if (lpszSource == NULL) {
+        return NULL;
+    }
+    TEA_CL *lpCl = calloc(1, sizeof(TEA_CL));
+    if (lpCl == NULL) {
+        free(lpszSource);
+        return NULL;
+    }
+    lpCl->hDevice = ahDevices[dwDevice];
+
+    lpCl->hContext = clCreateContext(NULL, 1, &lpCl->hDevice, NULL, NULL, &iErr);
+    if (iErr == CL_SUCCESS) {
+        lpCl->hQueue = clCreateCommandQueue(lpCl->hContext, lpCl->hDevice, 0, &iErr);
+    }
+    for (uint32_t dwTeaType = 1; dwTeaType <= TEA_CL_NUM_TYPES && iErr == CL_SUCCESS; dwTeaType++) {
+        iErr = tea_cl_build(lpCl, dwTeaType, lpszSource);
+    }
+    free(lpszSource);
+
+    if (iErr != CL_SUCCESS) {
+        tea_cl_destroy(lpCl);
+        return NULL;
+    }
+    return lpCl;
+}
+
+void tea_cl_destroy(TEA_CL *lpCl) {
+    if (lpCl == NULL) {
+        return;
+    }
+    if (lpCl->hSearch) {
+        clReleaseKernel(lpCl->hSearch);
+    }
+    for (int i = 0; i < TEA_CL_NUM_TYPES; i++) {
+        if (lpCl->ahKeystream[i]) {
+            clReleaseKernel(lpCl->ahKeystream[i]);
+        }
+        if (lpCl->ahPrograms[i]) {
+            clReleaseProgram(lpCl->ahPrograms[i]);
+        }
+    }
+    if (lpCl->hQueue) {
+        clReleaseCommandQueue(lpCl->hQueue);
+    }
+    if (lpCl->hContext) {
+        clReleaseContext(lpCl->hContext);
+    }
+    free(lpCl);
+}
+
+static size_t tea_cl_global_size(uint64_t qwNumItems) {
+    return (qwNumItems + TEA_CL_LOCAL_SIZE - 1) / TEA_CL_LOCAL_SIZE * TEA_CL_LOCAL_SIZE;
+}
+
+int tea_cl_keystream(TEA_CL *lpCl, uint32_t dwTeaType, uint32_t dwNumLanes, const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    cl_mem hIvs = NULL, hKeys = NULL, hKs = NULL;
+    cl_int iErr;
+
+    if (dwTeaType < 1 || dwTeaType > TEA_CL_NUM_TYPES) {
+        return CL_INVALID_VALUE;
+    }
+    if (dwNumLanes == 0 || dwNumKsBytes == 0) {
+        return CL_SUCCESS;
+    }
+    cl_kernel hKernel = lpCl->ahKeystream[dwTeaType - 1];
+
+    hIvs = clCreateBuffer(lpCl->hContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t) * dwNumLanes, (void *)adwIvs, &iErr);
+    if (iErr == CL_SUCCESS) {
+        hKeys = clCreateBuffer(lpCl->hContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 10 * (size_t)dwNumLanes, (void *)lpKeys, &iErr);
+    }
+    if (iErr == CL_SUCCESS) {
+        hKs = clCreateBuffer(lpCl->hContext, CL_MEM_WRITE_ONLY, (size_t)dwNumKsBytes * dwNumLanes, NULL, &iErr);
+    }
+    if (iErr != CL_SUCCESS) {
+        goto out;
+    }
+
+    iErr  = clSetKernelArg(hKernel, 0, sizeof(cl_mem), &hIvs);
+    iErr |= clSetKernelArg(hKernel, 1, sizeof(cl_mem), &hKeys);
+    iErr |= clSetKernelArg(hKernel, 2, sizeof(cl_uint), &dwNumLanes);
+    iErr |= clSetKernelArg(hKernel, 3, sizeof(cl_uint), &dwNumKsBytes);
+    iErr |= clSetKernelArg(hKernel, 4, sizeof(cl_mem), &hKs);
+    if (iErr != CL_SUCCESS) {
+        iErr = CL_INVALID_KERNEL_ARGS;
+        goto out;
+    }
+
+    size_t qwGlobal = tea_cl_global_size(dwNumLanes);
+    size_t qwLocal = TEA_CL_LOCAL_SIZE;
+    iErr = clEnqueueNDRangeKernel(lpCl->hQueue, hKernel, 1, NULL, &qwGlobal, &qwLocal, 0, NULL, NULL);
+    if (iErr == CL_SUCCESS) {
+        iErr = clEnqueueReadBuffer(lpCl->hQueue, hKs, CL_TRUE, 0, (size_t)dwNumKsBytes * dwNumLanes, lpKsOut, 0, NULL, NULL);
+    }
+
+out:
+    if (hKs) {
+        clReleaseMemObject(hKs);
+    }
+    if (hKeys) {
+        clReleaseMemObject(hKeys);
+    }
+    if (hIvs) {
+        clReleaseMemObject(hIvs);
+    }
+    return iErr;
+}
+
+static int tea_cl_cmp_u32(const void *lpA, const void *lpB) {
+    uint32_t a = *(const uint32_t *)lpA, b = *(const uint32_t *)lpB;
+    return (a > b) - (a < b);
+}
+
+int tea_cl_search(TEA_CL *lpCl, const Tea1Filter *lpFilters, uint32_t dwNumFilters, uint64_t qwStartKey, uint64_t qwEndKey, uint32_t *lpdwHits, uint32_t dwMaxHits, uint64_t *lpqwNumHits) {
+    cl_mem hFilters = NULL, hHits = NULL, hNumHits = NULL;
+    uint64_t qwNumHits = 0;
+    uint32_t dwStored = 0;
+    cl_int iErr;
+
+    if (dwNumFilters == 0 || dwNumFilters > TEA1_SEARCH_MAX_FILTERS || qwEndKey > TEA1_SEARCH_KEYSPACE) {
+        return CL_INVALID_VALUE;
+    }
+
+    // The hit buffer is never empty so the kernel always gets a valid pointer
+    hFilters = clCreateBuffer(lpCl->hContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Tea1Filter) * dwNumFilters, (void *)lpFilters, &iErr);
+    if (iErr == CL_SUCCESS) {
+        hHits = clCreateBuffer(lpCl->hContext, CL_MEM_WRITE_ONLY, sizeof(uint32_t) * (dwMaxHits ? dwMaxHits : 1), NULL, &iErr);
+    }
+    if (iErr == CL_SUCCESS) {
+        hNumHits = clCreateBuffer(lpCl->hContext, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &iErr);
+    }
+    if (iErr != CL_SUCCESS) {
+        goto out;
+    }
+
+    for (uint64_t qwKey = qwStartKey; qwKey < qwEndKey; qwKey += TEA_CL_SEARCH_PASS) {
+        cl_ulong qwPassStart = qwKey;
+        cl_uint dwCount = qwEndKey - qwKey < TEA_CL_SEARCH_PASS ? qwEndKey - qwKey : TEA_CL_SEARCH_PASS;
+        cl_uint dwRoom = dwMaxHits - dwStored;
+        cl_uint dwPassHits = 0;
+
+        // Each pass fills the hit buffer from the start, then the new hits are appended on the host
+        iErr  = clSetKernelArg(lpCl->hSearch, 0, sizeof(cl_ulong), &qwPassStart);
+        iErr |= clSetKernelArg(lpCl->hSearch, 1, sizeof(cl_uint), &dwCount);
+        iErr |= clSetKernelArg(lpCl->hSearch, 2, sizeof(cl_mem), &hFilters);
+        iErr |= clSetKernelArg(lpCl->hSearch, 3, sizeof(cl_uint), &dwNumFilters);
+        iErr |= clSetKernelArg(lpCl->hSearch, 4, sizeof(cl_mem), &hHits);
+        iErr |= clSetKernelArg(lpCl->hSearch, 5, sizeof(cl_uint), &dwRoom);
+        iErr |= clSetKernelArg(lpCl->hSearch, 6, sizeof(cl_mem), &hNumHits);
+        if (iErr != CL_SUCCESS) {
+            iErr = CL_INVALID_KERNEL_ARGS;
+            goto out;
+        }
+
+        size_t qwGlobal = tea_cl_global_size(dwCount);
+        size_t qwLocal = TEA_CL_LOCAL_SIZE;
+        iErr = clEnqueueWriteBuffer(lpCl->hQueue, hNumHits, CL_FALSE, 0, sizeof(cl_uint), &dwPassHits, 0, NULL, NULL);
+        if (iErr == CL_SUCCESS) {
+            iErr = clEnqueueNDRangeKernel(lpCl->hQueue, lpCl->hSearch, 1, NULL, &qwGlobal, &qwLocal, 0, NULL, NULL);
+        }
+        if (iErr == CL_SUCCESS) {
+            iErr = clEnqueueReadBuffer(lpCl->hQueue, hNumHits, CL_TRUE, 0, sizeof(cl_uint), &dwPassHits, 0, NULL, NULL);
+        }
+        if (iErr == CL_SUCCESS && dwPassHits && dwRoom) {
+            uint32_t dwNew = dwPassHits < dwRoom ? dwPassHits : dwRoom;
+            iErr = clEnqueueReadBuffer(lpCl->hQueue, hHits, CL_TRUE, 0, sizeof(uint32_t) * dwNew, lpdwHits + dwStored, 0, NULL, NULL);
+            dwStored += dwNew;
+        }
+        if (iErr != CL_SUCCESS) {
+            goto out;
+        }
+        qwNumHits += dwPassHits;
+    }
+
+    // Work items finish in any order
+    qsort(lpdwHits, dwStored, sizeof(uint32_t), tea_cl_cmp_u32);
+    *lpqwNumHits = qwNumHits;
+
+out:
+    if (hNumHits) {
+        clReleaseMemObject(hNumHits);
+    }
+    if (hHits) {
+        clReleaseMemObject(hHits);
+    }
+    if (hFilters) {
+        clReleaseMemObject(hFilters);
+    }
+    return iErr;
+}
@@ -0,0 +1,31 @@
+#ifndef HAVE_TEA_CL_H
+#define HAVE_TEA_CL_H
+
+#include <inttypes.h>
+
+#include "tea1_search.h"
+
+/*
+ * OpenCL driver for tea.cl: batch keystream generation for TEA1/TEA2/TEA3 and
+ * the TEA1 reduced-key search with on-device filtering. Functions returning
+ * int give 0 on success, an OpenCL error code (< 0) otherwise.
+ */
+
+typedef struct TEA_CL TEA_CL;
+
+// Build the kernels from lpszKernelPath on the given platform and device index, NULL on failure
+TEA_CL *tea_cl_create(const char *lpszKernelPath, uint32_t dwPlatform, uint32_t dwDevice);
+void tea_cl_destroy(TEA_CL *lpCl);
+
+// Same contract as batch_keystream, dwTeaType is 1..3 and every key is 10 bytes
+int tea_cl_keystream(TEA_CL *lpCl, uint32_t dwTeaType, uint32_t dwNumLanes, const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
+
+/*
+ * Test key registers [qwStartKey, qwEndKey) against all filters. Up to
+ * dwMaxHits passing registers are stored sorted to lpdwHits and *lpqwNumHits
+ * receives the total number found. If that exceeds dwMaxHits, which of the
+ * hits were kept is unspecified.
+ */
+int tea_cl_search(TEA_CL *lpCl, const Tea1Filter *lpFilters, uint32_t dwNumFilters, uint64_t qwStartKey, uint64_t qwEndKey, uint32_t *lpdwHits, uint32_t dwMaxHits, uint64_t *lpqwNumHits);
+
+#endif /* HAVE_TEA_CL_H */
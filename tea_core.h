@@ -0,0 +1,343 @@
+#ifndef HAVE_TEA_CORE_H
+#define HAVE_TEA_CORE_H
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "common.h"
+
+/*
+ * Shared TEA1/TEA2/TEA3 keystream generator. The three variants only differ in
+ * the parameters collected in TeaVariant; each teaN.c declares one as a static
+ * const and calls the always-inlined functions below with it, so the compiler
+ * folds every parameter and emits a specialized generator per variant.
+ *
+ * The key register holds dwKeyLen bytes, byte 0 being the oldest one. Up to 8
+ * bytes it lives right-aligned in qwKeyHi (TEA1's 32-bit register maps to the
+ * low word); a 10 byte register keeps bytes 0..7 in qwKeyHi, byte 0 on top,
+ * and bytes 8..9 in wKeyLo.
+ */
+
+#define TEA_CORE_INLINE static inline __attribute__((always_inline))
+
+typedef struct {
+    const uint8_t *abSbox;
+    const uint16_t *awLutSliced;        // see TEA_LUT_SLICED
+    uint32_t dwIvXor;                   // constant mixed into the expanded IV
+
+    uint32_t dwKeyLen;                  // key register length in bytes
+    uint32_t dwSboxTapA;                // key register bytes xored into the S-box index
+    uint32_t dwSboxTapB;
+    int32_t  dwSboxXorTap;              // key register byte xored into the S-box output, or -1
+
+    uint32_t dwFilterShiftA;            // state words fed to the LutA and LutB filters
+    uint32_t dwFilterShiftB;
+    uint8_t  abFilterRot[4];            // rotation per filter tap, taps 0,1 from the low and 2,3 from the high state byte
+    uint32_t dwReorderShift;            // state byte fed to the bit permutation
+    uint8_t  abReorderPerm[8];          // output position of every input bit
+    uint32_t bNewFromLutB;              // filter output xored into the new byte, the other one is mixed in
+    int32_t  dwExtraTapShift;           // additional state byte xored into the new byte, or -1
+    uint32_t dwMixShift;                // where the mix byte enters the state register
+
+    uint32_t dwInitRounds;              // rounds before the first keystream byte
+    uint32_t dwByteRounds;              // rounds between subsequent keystream bytes
+} TeaVariant;
+
+// Parameters of the library's variants, for code generated outside of C (tea.cl)
+const TeaVariant *tea1_variant(void);
+const TeaVariant *tea2_variant(void);
+const TeaVariant *tea3_variant(void);
+
+// Rotate both bytes of a 16-bit word right by n (0..7) independently
+#define ror8x2(x, n) ((uint16_t)((((x) >> (n)) & ((0xFF >> (n)) * 0x0101)) | (((x) << (8 - (n))) & ((0xFF & (0xFF << (8 - (n)))) * 0x0101))))
+
+/*
+ * Transpose the LutA/LutB filter tables for tea_filter_sliced: bit i of entry d
+ * is bit d of Lut[i], LutA in the low byte and LutB in the high byte. The
+ * arguments are the 8 + 8 table constants, so the result is a constant
+ * initializer derived from the same literals as the plain tables.
+ */
+#define TEA_SLICE_LANE(l, i, d) ((((l) >> (d)) & 1) << (i))
+#define TEA_SLICE_BIT(a0, a1, a2, a3, a4, a5, a6, a7, b0, b1, b2, b3, b4, b5, b6, b7, d) (uint16_t)( \
+    TEA_SLICE_LANE(a0, 0, d) | TEA_SLICE_LANE(a1, 1, d) | TEA_SLICE_LANE(a2, 2, d) | TEA_SLICE_LANE(a3, 3, d) | \
+    TEA_SLICE_LANE(a4, 4, d) | TEA_SLICE_LANE(a5, 5, d) | TEA_SLICE_LANE(a6, 6, d) | TEA_SLICE_LANE(a7, 7, d) | \
+    TEA_SLICE_LANE(b0, 8, d) | TEA_SLICE_LANE(b1, 9, d) | TEA_SLICE_LANE(b2, 10, d) | TEA_SLICE_LANE(b3, 11, d) | \
+    TEA_SLICE_LANE(b4, 12, d) | TEA_SLICE_LANE(b5, 13, d) | TEA_SLICE_LANE(b6, 14, d) | TEA_SLICE_LANE(b7, 15, d))
+#define TEA_SLICE_TABLE(...) { \
+    TEA_SLICE_BIT(__VA_ARGS__, 0),  TEA_SLICE_BIT(__VA_ARGS__, 1),  TEA_SLICE_BIT(__VA_ARGS__, 2),  TEA_SLICE_BIT(__VA_ARGS__, 3),  \
+    TEA_SLICE_BIT(__VA_ARGS__, 4),  TEA_SLICE_BIT(__VA_ARGS__, 5),  TEA_SLICE_BIT(__VA_ARGS__, 6),  TEA_SLICE_BIT(__VA_ARGS__, 7),  \
+    TEA_SLICE_BIT(__VA_ARGS__, 8),  TEA_SLICE_BIT(__VA_ARGS__, 9),  TEA_SLICE_BIT(__VA_ARGS__, 10), TEA_SLICE_BIT(__VA_ARGS__, 11), \
+    TEA_SLICE_BIT(__VA_ARGS__, 12), TEA_SLICE_BIT(__VA_ARGS__, 13), TEA_SLICE_BIT(__VA_ARGS__, 14), TEA_SLICE_BIT(__VA_ARGS__, 15) }
+#define TEA_LUT_SLICED(lutA, lutB) TEA_SLICE_TABLE(lutA, lutB)
+
+/*
+ * Evaluate the TEA state filter for 8 output bits of two LUTs at once without
+ * branches. x0..x3 hold the four tap bits of every output bit, the result is a
+ * 4-level multiplexer tree selecting awSliced[x0 | x1<<1 | x2<<2 | x3<<3].
+ */
+#define mux16(a, b, s) ((uint16_t)((a) ^ (((a) ^ (b)) & (s))))
+
+TEA_CORE_INLINE uint16_t tea_filter_sliced(const uint16_t *awSliced, uint16_t x0, uint16_t x1, uint16_t x2, uint16_t x3) {
+    uint16_t m0 = mux16(awSliced[ 0], awSliced[ 1], x0);
+    uint16_t m1 = mux16(awSliced[ 2], awSliced[ 3], x0);
+    uint16_t m2 = mux16(awSliced[ 4], awSliced[ 5], x0);
+    uint16_t m3 = mux16(awSliced[ 6], awSliced[ 7], x0);
+    uint16_t m4 = mux16(awSliced[ 8], awSliced[ 9], x0);
+    uint16_t m5 = mux16(awSliced[10], awSliced[11], x0);
+    uint16_t m6 = mux16(awSliced[12], awSliced[13], x0);
+    uint16_t m7 = mux16(awSliced[14], awSliced[15], x0);
+    m0 = mux16(m0, m1, x1);
+    m2 = mux16(m2, m3, x1);
+    m4 = mux16(m4, m5, x1);
+    m6 = mux16(m6, m7, x1);
+    m0 = mux16(m0, m2, x2);
+    m4 = mux16(m4, m6, x2);
+    return mux16(m0, m4, x3);
+}
+
+TEA_CORE_INLINE uint64_t tea_core_expand_iv(const TeaVariant *lpVariant, uint32_t dwFrameNumbers) {
+    uint32_t dwXorred = dwFrameNumbers ^ lpVariant->dwIvXor;
+    dwXorred = (dwXorred << 8) | (dwXorred >> 24); // rotate left -> translated to single rol instruction
+    uint64_t qwIv = ((uint64_t)dwFrameNumbers << 32) | dwXorred;
+    return (qwIv >> 8) | (qwIv << 56); // rotate right
+}
+
+TEA_CORE_INLINE uint8_t tea_core_key_byte(const TeaVariant *lpVariant, uint64_t qwKeyHi, uint16_t wKeyLo, uint32_t dwIndex) {
+    if (lpVariant->dwKeyLen <= 8) {
+        return qwKeyHi >> (8 * (lpVariant->dwKeyLen - 1 - dwIndex));
+    }
+    return dwIndex < 8 ? qwKeyHi >> (56 - 8 * dwIndex) : wKeyLo >> (8 * (9 - dwIndex));
+}
+
+TEA_CORE_INLINE void tea_core_load_key(const TeaVariant *lpVariant, const uint8_t *lpKey, uint64_t *lpqwKeyHi, uint16_t *lpwKeyLo) {
+    uint64_t qwKeyHi = 0;
+    uint16_t wKeyLo = 0;
+    for (int i = 0; i < lpVariant->dwKeyLen; i++) {
+        if (lpVariant->dwKeyLen <= 8) {
+            qwKeyHi = (qwKeyHi << 8) | lpKey[i];
+        } else if (i < 8) {
+            qwKeyHi |= (uint64_t)lpKey[i] << (56 - 8 * i);
+        } else {
+            wKeyLo |= lpKey[i] << (8 * (9 - i));
+        }
+    }
+    *lpqwKeyHi = qwKeyHi;
+    *lpwKeyLo = wKeyLo;
+}
+
+TEA_CORE_INLINE uint8_t tea_core_reorder(const TeaVariant *lpVariant, uint8_t bStByte) {
+    // simple re-ordering of bits, the permutation folds to shifts and masks
+    uint8_t bOut = 0;
+    for (int i = 0; i < 8; i++) {
+        bOut |= ((bStByte >> i) & 1) << lpVariant->abReorderPerm[i];
+    }
+    return bOut;
+}
+
+TEA_CORE_INLINE uint16_t tea_core_filter_pair(const TeaVariant *lpVariant, uint16_t wStA, uint16_t wStB) {
+    // Both state words at once, LutA lanes in the low byte and LutB lanes in the high byte
+    uint16_t wSt0 = (wStA & 0xff) | (wStB << 8);
+    uint16_t wSt1 = (wStA >> 8) | (wStB & 0xff00);
+    const uint8_t *abRot = lpVariant->abFilterRot;
+    return tea_filter_sliced(lpVariant->awLutSliced, ror8x2(wSt0, abRot[0]), ror8x2(wSt0, abRot[1]),
+                             ror8x2(wSt1, abRot[2]), ror8x2(wSt1, abRot[3]));
+}
+
+// Step 1 of a round: derive a non-linear feedback byte through the sbox and feed it back into the key register
+TEA_CORE_INLINE uint8_t tea_core_key_step(const TeaVariant *lpVariant, uint64_t *lpqwKeyHi, uint16_t *lpwKeyLo) {
+    uint64_t qwKeyHi = *lpqwKeyHi;
+    uint16_t wKeyLo = *lpwKeyLo;
+
+    uint8_t bSboxOut = lpVariant->abSbox[tea_core_key_byte(lpVariant, qwKeyHi, wKeyLo, lpVariant->dwSboxTapA) ^
+                                         tea_core_key_byte(lpVariant, qwKeyHi, wKeyLo, lpVariant->dwSboxTapB)];
+    if (lpVariant->dwSboxXorTap >= 0) {
+        bSboxOut ^= tea_core_key_byte(lpVariant, qwKeyHi, wKeyLo, lpVariant->dwSboxXorTap);
+    }
+    if (lpVariant->dwKeyLen <= 8) {
+        qwKeyHi = (qwKeyHi << 8) | bSboxOut;
+        if (lpVariant->dwKeyLen < 8) {
+            qwKeyHi &= (1ULL << (8 * lpVariant->dwKeyLen)) - 1;
+        }
+    } else {
+        qwKeyHi = (qwKeyHi << 8) | (wKeyLo >> 8);
+        wKeyLo = (wKeyLo << 8) | bSboxOut;
+    }
+
+    *lpqwKeyHi = qwKeyHi;
+    *lpwKeyLo = wKeyLo;
+    return bSboxOut;
+}
+
+// Steps 2 to 4 of a round, which only read the key register through bSboxOut
+TEA_CORE_INLINE uint64_t tea_core_iv_step(const TeaVariant *lpVariant, uint64_t qwIvReg, uint8_t bSboxOut) {
+    // Step 2: Compute 3 bytes derived from current state
+    uint16_t wDerived = tea_core_filter_pair(lpVariant, (qwIvReg >> lpVariant->dwFilterShiftA) & 0xffff,
+                                             (qwIvReg >> lpVariant->dwFilterShiftB) & 0xffff);
+    uint8_t bDerivA = wDerived;
+    uint8_t bDerivB = wDerived >> 8;
+    uint8_t bReordByte = tea_core_reorder(lpVariant, (qwIvReg >> lpVariant->dwReorderShift) & 0xff);
+
+    // Step 3: Combine current state with state derived values, and xor in key derived sbox output
+    uint8_t bNewByte = (qwIvReg >> 56) ^ bReordByte ^ bSboxOut ^ (lpVariant->bNewFromLutB ? bDerivB : bDerivA);
+    if (lpVariant->dwExtraTapShift >= 0) {
+        bNewByte ^= qwIvReg >> lpVariant->dwExtraTapShift;
+    }
+    uint8_t bMixByte = lpVariant->bNewFromLutB ? bDerivA : bDerivB;
+
+    // Step 4: Update lfsr: leftshift 8, feed/mix in previously generated bytes
+    return ((qwIvReg << 8) ^ ((uint64_t)bMixByte << lpVariant->dwMixShift)) | bNewByte;
+}
+
+TEA_CORE_INLINE void tea_core_clock(const TeaVariant *lpVariant, uint64_t *lpqwIvReg, uint64_t *lpqwKeyHi, uint16_t *lpwKeyLo, uint32_t dwNumRounds) {
+    uint64_t qwIvReg = *lpqwIvReg;
+    uint64_t qwKeyHi = *lpqwKeyHi;
+    uint16_t wKeyLo = *lpwKeyLo;
+
+    for (int j = 0; j < dwNumRounds; j++) {
+        uint8_t bSboxOut = tea_core_key_step(lpVariant, &qwKeyHi, &wKeyLo);
+        qwIvReg = tea_core_iv_step(lpVariant, qwIvReg, bSboxOut);
+    }
+
+    *lpqwIvReg = qwIvReg;
+    *lpqwKeyHi = qwKeyHi;
+    *lpwKeyLo = wKeyLo;
+}
+
+TEA_CORE_INLINE void tea_core_keystream(const TeaVariant *lpVariant, uint64_t qwIvReg, uint64_t qwKeyHi, uint16_t wKeyLo, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    if (dwNumKsBytes == 0) {
+        return;
+    }
+    tea_core_clock(lpVariant, &qwIvReg, &qwKeyHi, &wKeyLo, lpVariant->dwInitRounds);
+    lpKsOut[0] = qwIvReg >> 56;
+    for (int i = 1; i < dwNumKsBytes; i++) {
+        tea_core_clock(lpVariant, &qwIvReg, &qwKeyHi, &wKeyLo, lpVariant->dwByteRounds);
+        lpKsOut[i] = qwIvReg >> 56;
+    }
+}
+
+/*
+ * Compare generated keystream against lpKs under lpMask, stopping at the first
+ * mismatching byte. Returns 1 if all dwNumKsBytes bytes match.
+ */
+TEA_CORE_INLINE int tea_core_match(const TeaVariant *lpVariant, uint64_t qwIvReg, uint64_t qwKeyHi, uint16_t wKeyLo, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes) {
+    for (uint32_t i = 0; i < dwNumKsBytes; i++) {
+        tea_core_clock(lpVariant, &qwIvReg, &qwKeyHi, &wKeyLo, i ? lpVariant->dwByteRounds : lpVariant->dwInitRounds);
+        if (((qwIvReg >> 56) ^ lpKs[i]) & lpMask[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * The key register never reads the IV register, so one key produces the same
+ * sbox output bytes whatever the IV. A TeaKeyStream records them lazily, up to
+ * the furthest round any IV asked for so far, and tea_core_match_key_stream
+ * then only runs the IV half of every round. Checking one key against several
+ * IVs this way does the key schedule work once instead of once per IV.
+ */
+TEA_CORE_INLINE void tea_core_key_stream_init(const TeaVariant *lpVariant, TeaKeyStream *lpStream, uint64_t qwKeyHi, uint16_t wKeyLo) {
+    lpStream->qwKeyHi = qwKeyHi;
+    lpStream->wKeyLo = wKeyLo;
+    lpStream->dwFirst = 0;
+    lpStream->dwNumRounds = 0;
+}
+
+// Record rounds up to dwNumRounds of the current key
+TEA_CORE_INLINE void tea_core_key_stream_extend(const TeaVariant *lpVariant, TeaKeyStream *lpStream, uint32_t dwNumRounds) {
+    while (lpStream->dwNumRounds < lpStream->dwFirst + dwNumRounds) {
+        lpStream->abSboxOut[lpStream->dwNumRounds++] = tea_core_key_step(lpVariant, &lpStream->qwKeyHi, &lpStream->wKeyLo);
+    }
+}
+
+/*
+ * Drop round 0, making the stream that of the key register after one round.
+ * Returns the dropped sbox output byte. The buffer is compacted once the
+ * dropped rounds fill half of it, so this is amortized constant time.
+ */
+TEA_CORE_INLINE uint8_t tea_core_key_stream_slide(const TeaVariant *lpVariant, TeaKeyStream *lpStream) {
+    tea_core_key_stream_extend(lpVariant, lpStream, 1);
+    uint8_t bSboxOut = lpStream->abSboxOut[lpStream->dwFirst++];
+    if (lpStream->dwFirst == TEA_KEY_STREAM_MAX_ROUNDS) {
+        memmove(lpStream->abSboxOut, &lpStream->abSboxOut[lpStream->dwFirst], lpStream->dwNumRounds - lpStream->dwFirst);
+        lpStream->dwNumRounds -= lpStream->dwFirst;
+        lpStream->dwFirst = 0;
+    }
+    return bSboxOut;
+}
+
+// Same as tea_core_match, with the key side taken from (and recorded into) lpStream
+TEA_CORE_INLINE int tea_core_match_key_stream(const TeaVariant *lpVariant, TeaKeyStream *lpStream, uint64_t qwIvReg, const uint8_t *lpKs, const uint8_t *lpMask, uint32_t dwNumKsBytes) {
+    uint32_t dwRound = 0;
+    assert(dwNumKsBytes <= TEA_KEY_STREAM_MAX_KS_BYTES);  // past that abSboxOut overflows
+    for (uint32_t i = 0; i < dwNumKsBytes; i++) {
+        uint32_t dwEnd = dwRound + (i ? lpVariant->dwByteRounds : lpVariant->dwInitRounds);
+        tea_core_key_stream_extend(lpVariant, lpStream, dwEnd);
+        const uint8_t *lpSboxOut = &lpStream->abSboxOut[lpStream->dwFirst];
+        for (; dwRound < dwEnd; dwRound++) {
+            qwIvReg = tea_core_iv_step(lpVariant, qwIvReg, lpSboxOut[dwRound]);
+        }
+        if (((qwIvReg >> 56) ^ lpKs[i]) & lpMask[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Xor keystream byte dwKsByte (keystream bits 8*dwKsByte..8*dwKsByte+7) into
+ * the part of a segment it overlaps. Only buffer bytes holding segment bits
+ * are touched.
+ */
+TEA_CORE_INLINE void tea_core_xor_segment(const TeaXorSegment *lpSegment, uint32_t dwKsByte, uint8_t bKs) {
+    int64_t qwKsBit = 8 * (int64_t)dwKsByte;
+    int64_t qwLo = qwKsBit > lpSegment->dwKsBitOffset ? qwKsBit : lpSegment->dwKsBitOffset;
+    int64_t qwHi = (int64_t)lpSegment->dwKsBitOffset + lpSegment->dwBitLen;
+    if (qwHi > qwKsBit + 8) {
+        qwHi = qwKsBit + 8;
+    }
+    if (qwLo >= qwHi) {
+        return;
+    }
+
+    // Keep the overlapping keystream bits, then line them up with the buffer
+    uint16_t wBits = (uint8_t)(bKs & (0xFF >> (qwLo - qwKsBit)) & (0xFF << (qwKsBit + 8 - qwHi))) << 8;
+    int64_t qwPos = lpSegment->dwBitOffset + (qwKsBit - (int64_t)lpSegment->dwKsBitOffset);
+    if (qwPos < 0) {
+        wBits <<= -qwPos;
+        qwPos = 0;
+    }
+    wBits >>= qwPos & 7;
+
+    uint8_t *lpOut = lpSegment->lpBuf + (qwPos >> 3);
+    lpOut[0] ^= wBits >> 8;
+    if (wBits & 0xFF) {
+        lpOut[1] ^= wBits;
+    }
+}
+
+/*
+ * Generate keystream and xor it straight into every segment, without a
+ * keystream buffer. Returns the number of keystream bytes generated.
+ */
+TEA_CORE_INLINE uint32_t tea_core_xor_scatter(const TeaVariant *lpVariant, uint64_t qwIvReg, uint64_t qwKeyHi, uint16_t wKeyLo, const TeaXorSegment *lpSegments, uint32_t dwNumSegments) {
+    uint64_t qwKsBits = 0;
+    for (int i = 0; i < dwNumSegments; i++) {
+        if (lpSegments[i].dwBitLen && (uint64_t)lpSegments[i].dwKsBitOffset + lpSegments[i].dwBitLen > qwKsBits) {
+            qwKsBits = (uint64_t)lpSegments[i].dwKsBitOffset + lpSegments[i].dwBitLen;
+        }
+    }
+
+    uint32_t dwNumKsBytes = (qwKsBits + 7) / 8;
+    for (uint32_t dwKsByte = 0; dwKsByte < dwNumKsBytes; dwKsByte++) {
+        tea_core_clock(lpVariant, &qwIvReg, &qwKeyHi, &wKeyLo, dwKsByte ? lpVariant->dwByteRounds : lpVariant->dwInitRounds);
+        uint8_t bKs = qwIvReg >> 56;
+        for (int i = 0; i < dwNumSegments; i++) {
+            tea_core_xor_segment(&lpSegments[i], dwKsByte, bKs);
+        }
+    }
+    return dwNumKsBytes;
+}
+
+#endif /* HAVE_TEA_CORE_H */
@@ -0,0 +1,134 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "keygen.h"
+#include "keysearch.h"
+#include "workpool.h"
+
+#define CANDIDATES_PER_PASS (1ULL << 24)
+
+static void usage(const char *lpszName) {
+    fprintf(stderr, "Usage: %s <2|3> <threads> <generator> <iv hex>:<keystream hex> [...]\n", lpszName);
+    fprintf(stderr, "       generator is one of mask:<mask>, hex:<wordlist>, ascii:<wordlist>,\n");
+    fprintf(stderr, "       glibc:<first seed>:<num seeds>, msvc:<first seed>:<num seeds>; threads 0 = all cpus\n");
+    exit(EXIT_FAILURE);
+}
+
+static int open_generator(KeyGenerator *lpGen, const char *lpszSpec) {
+    unsigned int dwFirst;
+    unsigned long long qwCount;
+
+    if (strncmp(lpszSpec, "mask:", 5) == 0) {
+        return keygen_mask_init(lpGen, lpszSpec + 5);
+    }
+    if (strncmp(lpszSpec, "hex:", 4) == 0) {
+        return keygen_wordlist_open(lpGen, lpszSpec + 4, KEYGEN_WORDLIST_HEX);
+    }
+    if (strncmp(lpszSpec, "ascii:", 6) == 0) {
+        return keygen_wordlist_open(lpGen, lpszSpec + 6, KEYGEN_WORDLIST_ASCII);
+    }
+    if (sscanf(lpszSpec, "glibc:%u:%llu", &dwFirst, &qwCount) == 2) {
+        return keygen_prng_init(lpGen, KEYGEN_PRNG_GLIBC, dwFirst, qwCount);
+    }
+    if (sscanf(lpszSpec, "msvc:%u:%llu", &dwFirst, &qwCount) == 2) {
+        return keygen_prng_init(lpGen, KEYGEN_PRNG_MSVC, dwFirst, qwCount);
+    }
+    return -1;
+}
+
+// Every hex digit of the keystream is a known nibble
+static int parse_filter(Tea1Filter *lpFilter, const char *lpszSpec) {
+    int iPos = 0;
+
+    memset(lpFilter, 0, sizeof(*lpFilter));
+    if (sscanf(lpszSpec, "%x:%n", &lpFilter->dwIv, &iPos) != 1 || iPos == 0) {
+        return -1;
+    }
+    const char *lpszKs = lpszSpec + iPos;
+    int len = strlen(lpszKs);
+    if (len == 0 || len > 2 * TEA1_SEARCH_MAX_KS_BYTES) {
+        return -1;
+    }
+    for (int i = 0; i < len; i++) {
+        unsigned int nibble;
+        if (sscanf(&lpszKs[i], "%1x", &nibble) != 1) {
+            return -1;
+        }
+        int shift = (i & 1) ? 0 : 4;
+        lpFilter->abKs[i / 2] |= nibble << shift;
+        lpFilter->abMask[i / 2] |= 0xf << shift;
+    }
+    lpFilter->dwNumKsBytes = (len + 1) / 2;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static Tea1Filter astFilters[KEYSEARCH_MAX_FILTERS];
+    KeyGenerator stGen;
+    KEYSEARCH_CTX search;
+
+    if (argc < 5 || argc - 4 > KEYSEARCH_MAX_FILTERS || (strcmp(argv[1], "2") && strcmp(argv[1], "3"))) {
+        usage(argv[0]);
+    }
+    for (int i = 4; i < argc; i++) {
+        if (parse_filter(&astFilters[i - 4], argv[i]) != 0) {
+            fprintf(stderr, "Can't parse observation %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (open_generator(&stGen, argv[3]) != 0) {
+        fprintf(stderr, "Can't set up generator %s\n", argv[3]);
+        exit(EXIT_FAILURE);
+    }
+
+    WORKPOOL *pool = workpool_create(atoi(argv[2]), WORKPOOL_FLAG_PIN);
+    if (pool == NULL) {
+        perror("workpool_create failed");
+        exit(EXIT_FAILURE);
+    }
+    keysearch_init(&search, atoi(argv[1]), &stGen, astFilters, argc - 4);
+
+    // Report hits after every pass so a long run shows results early
+    uint32_t dwReported = 0;
+    while (!keysearch_done(&search)) {
+        if (keysearch_run_parallel(&search, pool, CANDIDATES_PER_PASS) == 0) {
+            fprintf(stderr, "\nSearch pass failed\n");
+            break;
+        }
+        for (; dwReported < search.dwNumHits; dwReported++) {
+            KeysearchHit *lpHit = &search.lpHits[dwReported];
+            fprintf(stderr, "\n");
+            printf("Found key: ");
+            for (int j = 0; j < KEYGEN_KEY_LEN; j++) {
+                printf("%02x", lpHit->abKey[j]);
+            }
+            printf(" candidate %llu iv %08x\n", (unsigned long long)lpHit->qwIndex, lpHit->dwIv);
+        }
+        fprintf(stderr, "searched %llu / %llu\r", (unsigned long long)search.qwNextIndex, (unsigned long long)stGen.qwNumCandidates);
+    }
+    fprintf(stderr, "\n");
+    if (search.dwNumHits == 0) {
+        printf("Key not found.\n");
+    }
+
+    keysearch_free(&search);
+    keygen_free(&stGen);
+    workpool_destroy(pool);
+    return 0;
+}
@@ -0,0 +1,193 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "jobsrv.h"
+#include "workpool.h"
+
+static void usage(const char *lpszName) {
+    fprintf(stderr, "Usage: %s serve <address> [lease ms] [lease timeout ms]\n", lpszName);
+    fprintf(stderr, "       %s work <address> [threads] [output dir]\n", lpszName);
+    fprintf(stderr, "       %s search <address> <priority> <hn> <mn> <fn> <tn> <dir> <keystream hex>\n", lpszName);
+    fprintf(stderr, "       %s precompute <address> <priority> <hn> <mn> <fn> <tn> <dir> <bytes> <path> [first key] [keys]\n", lpszName);
+    fprintf(stderr, "       address is a Unix socket path or host:port, e.g. %s serve /tmp/tetra_jobs.sock;\n", lpszName);
+    fprintf(stderr, "       the server only listens on loopback hosts. A precompute path is relative to each\n");
+    fprintf(stderr, "       worker's output dir (default: its current directory), without \"..\"\n");
+    exit(EXIT_FAILURE);
+}
+
+static void parse_fn(char *argv[], FrameNumbers *lpFn) {
+    lpFn->hn = atoi(argv[0]);
+    lpFn->mn = atoi(argv[1]);
+    lpFn->fn = atoi(argv[2]);
+    lpFn->tn = atoi(argv[3]);
+    lpFn->dir = atoi(argv[4]);
+}
+
+static int serve(const char *lpszAddress, uint32_t dwLeaseMs, uint32_t dwLeaseTimeoutMs) {
+    sigset_t stSignals;
+    int iSignal;
+
+    // Block the signals before any thread exists so only sigwait sees them
+    sigemptyset(&stSignals);
+    sigaddset(&stSignals, SIGINT);
+    sigaddset(&stSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stSignals, NULL);
+
+    JobsrvConfig stConfig = { dwLeaseMs, dwLeaseTimeoutMs, 0, 0 };
+    JOBSRV_SERVER *lpServer = jobsrv_server_create(lpszAddress, &stConfig);
+    if (lpServer == NULL) {
+        perror("jobsrv_server_create failed");
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "Serving jobs on %s\n", lpszAddress);
+    sigwait(&stSignals, &iSignal);
+
+    JobsrvStats stStats;
+    jobsrv_server_get_stats(lpServer, &stStats);
+    jobsrv_server_destroy(lpServer);
+    printf("%llu leases, %llu expired, %llu late reports, %llu units done\n", (unsigned long long)stStats.qwLeases,
+           (unsigned long long)stStats.qwExpired, (unsigned long long)stStats.qwLateReports, (unsigned long long)stStats.qwUnitsDone);
+    return 0;
+}
+
+static int work(const char *lpszAddress, uint32_t dwThreads, const char *lpszOutputDir) {
+    JOBSRV_CLIENT *lpClient = jobsrv_client_connect(lpszAddress);
+    WORKPOOL *lpPool = workpool_create(dwThreads, WORKPOOL_FLAG_PIN);
+    if (lpClient == NULL || lpPool == NULL) {
+        fprintf(stderr, "Can't connect to %s\n", lpszAddress);
+        return EXIT_FAILURE;
+    }
+    if (lpszOutputDir && jobsrv_client_set_output_dir(lpClient, lpszOutputDir) != 0) {
+        fprintf(stderr, "Output dir too long\n");
+        return EXIT_FAILURE;
+    }
+    uint64_t qwLeases = jobsrv_client_work(lpClient, lpPool, 0);
+    fprintf(stderr, "Server went away after %llu leases\n", (unsigned long long)qwLeases);
+    jobsrv_client_close(lpClient);
+    workpool_destroy(lpPool);
+    return 0;
+}
+
+// Submits the job, follows it to the end and prints its hits
+static int submit(const char *lpszAddress, const JobsrvJob *lpJob) {
+    JOBSRV_CLIENT *lpClient = jobsrv_client_connect(lpszAddress);
+    if (lpClient == NULL) {
+        fprintf(stderr, "Can't connect to %s\n", lpszAddress);
+        return EXIT_FAILURE;
+    }
+    int iJob = jobsrv_client_submit(lpClient, lpJob);
+    if (iJob < 0) {
+        fprintf(stderr, "Job rejected\n");
+        jobsrv_client_close(lpClient);
+        return EXIT_FAILURE;
+    }
+
+    JobsrvJobStatus stStatus;
+    memset(&stStatus, 0, sizeof(stStatus));
+    stStatus.eState = JOBSRV_RUNNING;
+    while (jobsrv_client_status(lpClient, iJob, &stStatus) == 0) {
+        fprintf(stderr, "job %d: %llu / %llu, %u leases, %llu units/s, %llu hits\r", iJob, (unsigned long long)stStatus.qwUnitsDone,
+                (unsigned long long)stStatus.qwNumUnits, stStatus.dwActiveLeases, (unsigned long long)stStatus.qwUnitsPerSec,
+                (unsigned long long)stStatus.qwNumHits);
+        if (stStatus.eState != JOBSRV_RUNNING) {
+            break;
+        }
+        sleep(1);
+    }
+    fprintf(stderr, "\n");
+    if (stStatus.eState == JOBSRV_RUNNING) {
+        fprintf(stderr, "Lost the connection to the server\n");
+        jobsrv_client_close(lpClient);
+        return EXIT_FAILURE;
+    }
+
+    if (stStatus.eState == JOBSRV_FAILED) {
+        fprintf(stderr, "A lease found more than %u hits, the filters are too weak; the hits so far follow\n", JOBSRV_MAX_REPORT_HITS);
+    }
+
+    JobsrvHit astHits[256];
+    uint64_t qwFirst = 0;
+    int iNum;
+    while ((iNum = jobsrv_client_hits(lpClient, iJob, qwFirst, astHits, 256)) > 0) {
+        for (int i = 0; i < iNum; i++) {
+            printf("%08x\n", astHits[i].dwValue);
+        }
+        qwFirst += iNum;
+    }
+    jobsrv_client_remove(lpClient, iJob);
+    jobsrv_client_close(lpClient);
+    return stStatus.eState == JOBSRV_DONE ? 0 : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) {
+    JobsrvJob stJob;
+    FrameNumbers stFn;
+
+    if (argc < 3) {
+        usage(argv[0]);
+    }
+    memset(&stJob, 0, sizeof(stJob));
+
+    if (!strcmp(argv[1], "serve") && argc <= 5) {
+        return serve(argv[2], argc > 3 ? atoi(argv[3]) : 0, argc > 4 ? atoi(argv[4]) : 0);
+    } else if (!strcmp(argv[1], "work") && argc <= 5) {
+        return work(argv[2], argc > 3 ? atoi(argv[3]) : 1, argc > 4 ? argv[4] : NULL);
+    } else if (!strcmp(argv[1], "search") && argc == 10) {
+        Tea1Filter *lpFilter = &stJob.stSearch.astFilters[0];
+        const char *lpszHex = argv[9];
+        int iLen = strlen(lpszHex);
+        if (iLen == 0 || iLen > 2 * TEA1_SEARCH_MAX_KS_BYTES) {
+            fprintf(stderr, "Keystream must be 1 to %d hex digits\n", 2 * TEA1_SEARCH_MAX_KS_BYTES);
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < iLen; i++) {
+            unsigned int dwNibble;
+            if (sscanf(&lpszHex[i], "%1x", &dwNibble) != 1) {
+                fprintf(stderr, "Can't parse keystream digit %d\n", i);
+                return EXIT_FAILURE;
+            }
+            lpFilter->abKs[i / 2] |= dwNibble << ((i & 1) ? 0 : 4);
+            lpFilter->abMask[i / 2] |= 0xf << ((i & 1) ? 0 : 4);
+        }
+        parse_fn(&argv[4], &stFn);
+        lpFilter->dwIv = build_iv(&stFn);
+        lpFilter->dwNumKsBytes = (iLen + 1) / 2;
+        stJob.stSearch.dwNumFilters = 1;
+        stJob.eType = JOBSRV_TEA1_SEARCH;
+        stJob.dwPriority = atoi(argv[3]);
+        stJob.qwNumUnits = TEA1_SEARCH_KEYSPACE;
+        return submit(argv[2], &stJob);
+    } else if (!strcmp(argv[1], "precompute") && (argc == 11 || argc == 13)) {
+        parse_fn(&argv[4], &stFn);
+        stJob.eType = JOBSRV_PRECOMPUTE;
+        stJob.dwPriority = atoi(argv[3]);
+        stJob.stPrecompute.dwIv = build_iv(&stFn);
+        stJob.stPrecompute.dwNumKsBytes = atoi(argv[9]);
+        snprintf(stJob.stPrecompute.szPath, sizeof(stJob.stPrecompute.szPath), "%s", argv[10]);
+        stJob.qwStartKey = argc == 13 ? strtoull(argv[11], NULL, 0) : 0;
+        stJob.qwNumUnits = argc == 13 ? strtoull(argv[12], NULL, 0) : TEA1_SEARCH_KEYSPACE;
+        return submit(argv[2], &stJob);
+    }
+    usage(argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,54 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "ks_shm.h"
+
+int main(int argc, char *argv[]) {
+    sigset_t stSignals;
+    int iSignal;
+
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s <shm name> <control socket> [workers]\n", argv[0]);
+        fprintf(stderr, "       serves keystream to ks_shm clients until SIGINT or SIGTERM\n");
+        fprintf(stderr, "       e.g. %s /tetra_ks /tmp/tetra_ks.sock 2\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Block the signals before any thread exists so only sigwait sees them
+    sigemptyset(&stSignals);
+    sigaddset(&stSignals, SIGINT);
+    sigaddset(&stSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stSignals, NULL);
+
+    KS_SHM_SERVER *lpServer = ks_shm_server_create(argv[1], argv[2], argc == 4 ? atoi(argv[3]) : 1);
+    if (lpServer == NULL) {
+        perror("ks_shm_server_create failed");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "Serving %s, control socket %s\n", argv[1], argv[2]);
+    sigwait(&stSignals, &iSignal);
+
+    KsShmServerStats stStats;
+    ks_shm_server_get_stats(lpServer, &stStats);
+    ks_shm_server_destroy(lpServer);
+    printf("%llu requests, %llu answered from the cache, %llu rejected, %llu abandoned by the client\n", (unsigned long long)stStats.qwRequests,
+           (unsigned long long)stStats.qwCacheHits, (unsigned long long)stStats.qwRejected, (unsigned long long)stStats.qwAbandoned);
+    return 0;
+}
@@ -0,0 +1,111 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "tea_core.h"
+#include "tea_simd.h"
+#include "tune.h"
+
+static TeaSimdLevel g_eTeaSimdCpu = TEA_SIMD_SCALAR;
+static TeaSimdLevel g_eTeaSimdLevel = TEA_SIMD_SCALAR;
+
+// The build has no -march, so the kernels are compiled per target and picked here
+__attribute__((constructor))
+static void tea_simd_detect(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi")) {
+        g_eTeaSimdCpu = TEA_SIMD_AVX512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        g_eTeaSimdCpu = TEA_SIMD_AVX2;
+    }
+    g_eTeaSimdLevel = g_eTeaSimdCpu;
+
+    // TETRA_SIMD=scalar|avx2|avx512 caps the level, e.g. to compare against the scalar code
+    const char *lpszLevel = getenv("TETRA_SIMD");
+    if (lpszLevel) {
+        for (int i = TEA_SIMD_SCALAR; i <= TEA_SIMD_AVX512; i++) {
+            if (!strcmp(lpszLevel, tea_simd_level_name(i))) {
+                tea_simd_set_level(i);
+            }
+        }
+    }
+}
+
+TeaSimdLevel tea_simd_level(void) {
+    return __atomic_load_n(&g_eTeaSimdLevel, __ATOMIC_RELAXED);
+}
+
+void tea_simd_set_level(TeaSimdLevel eLevel) {
+    __atomic_store_n(&g_eTeaSimdLevel, eLevel < g_eTeaSimdCpu ? eLevel : g_eTeaSimdCpu, __ATOMIC_RELAXED);
+}
+
+const char *tea_simd_level_name(TeaSimdLevel eLevel) {
+    switch (eLevel) {
+    case TEA_SIMD_AVX2:   return "avx2";
+    case TEA_SIMD_AVX512: return "avx512";
+    default:              return "scalar";
+    }
+}
+
+void tea_simd_keystream(const TeaVariant *lpVariant, const TeaSimdKernels *lpKernels, uint32_t dwNumLanes,
+                        const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut) {
+    TeaSimdLevel eLevel = tea_simd_level();
+    TeaSimdLanes stLanes;
+    TuneProfile stTune;
+    uint8_t abKeyReg[10];
+
+    // The profile picks the kernel and crossover measured for this variant on this machine
+    tune_get(&stTune);
+    uint32_t dwMinLanes = stTune.adwTeaMinLanes[lpKernels->dwTeaType - 1];
+    eLevel = stTune.aeTeaLevel[lpKernels->dwTeaType - 1] < eLevel ? stTune.aeTeaLevel[lpKernels->dwTeaType - 1] : eLevel;
+
+    for (uint32_t dwFirst = 0; dwFirst < dwNumLanes; dwFirst += TEA_SIMD_MAX_LANES) {
+        uint32_t dwNum = dwNumLanes - dwFirst < TEA_SIMD_MAX_LANES ? dwNumLanes - dwFirst : TEA_SIMD_MAX_LANES;
+        if (eLevel == TEA_SIMD_SCALAR || dwNum < dwMinLanes) {
+            for (uint32_t i = dwFirst; i < dwFirst + dwNum; i++) {
+                lpKernels->fnScalar(adwIvs[i], &lpKeys[i * 10], dwNumKsBytes, &lpKsOut[(uint64_t)i * dwNumKsBytes]);
+            }
+            continue;
+        }
+
+        // Lanes past dwNum are run as well, on zeroes, and never written out
+        if (dwNum < TEA_SIMD_MAX_LANES) {
+            memset(stLanes.aabKey, 0, sizeof(stLanes.aabKey));
+            memset(stLanes.aabIv, 0, sizeof(stLanes.aabIv));
+        }
+        for (uint32_t i = 0; i < dwNum; i++) {
+            lpKernels->fnLoadKey(&lpKeys[(dwFirst + i) * 10], abKeyReg);
+            for (uint32_t j = 0; j < lpVariant->dwKeyLen; j++) {
+                stLanes.aabKey[j][i] = abKeyReg[j];
+            }
+            uint64_t qwIvReg = tea_core_expand_iv(lpVariant, adwIvs[dwFirst + i]);
+            for (uint32_t j = 0; j < 8; j++) {
+                stLanes.aabIv[j][i] = qwIvReg >> (8 * j);
+            }
+        }
+        stLanes.dwNumLanes = dwNum;
+        stLanes.dwNumKsBytes = dwNumKsBytes;
+        stLanes.lpKsOut = &lpKsOut[(uint64_t)dwFirst * dwNumKsBytes];
+
+        if (eLevel == TEA_SIMD_AVX512) {
+            lpKernels->fnAvx512(&stLanes);
+        } else {
+            lpKernels->fnAvx2(&stLanes);
+        }
+    }
+}
@@ -0,0 +1,278 @@
+#ifndef HAVE_TEA_SIMD_H
+#define HAVE_TEA_SIMD_H
+
+#include <inttypes.h>
+#include <immintrin.h>
+
+#include "tea_core.h"
+
+/*
+ * Byte-lane vector TEA: every byte lane of a vector register runs its own
+ * (key, IV) instance, and the registers are kept as byte planes, vector j
+ * holding byte j of every lane's IV or key register. Shifting a register by
+ * a byte is then just renaming planes, so no bit transposition is needed and
+ * a batch of 16 to 64 bursts fills the vectors already.
+ *
+ * The S-box lookup is done in registers: two VPERMI2B over the 4 x 64 table
+ * bytes on AVX-512 VBMI, or a VPSHUFB per table row of 16 on AVX2. The state
+ * filters run the tea_filter_sliced multiplexer tree on whole vectors (one
+ * VPTERNLOG per step on AVX-512), and the bit reorder is two nibble shuffles.
+ *
+ * Like tea_core.h the kernels are always-inlined templates over a TeaVariant:
+ * teaN.c instantiates them with its variant and passes them on to
+ * tea_simd_keystream, which picks the widest one the cpu runs.
+ */
+
+#define TEA_SIMD_MAX_LANES      64
+#define TEA_SIMD_MIN_LANES      4       // default crossover, below it a vector pass costs more than the lanes one by one
+
+#define TEA_SIMD_TARGET_AVX512  __attribute__((target("avx512f,avx512bw,avx512vbmi")))
+#define TEA_SIMD_TARGET_AVX2    __attribute__((target("avx2")))
+
+typedef enum {
+    TEA_SIMD_SCALAR,
+    TEA_SIMD_AVX2,
+    TEA_SIMD_AVX512,
+} TeaSimdLevel;
+
+// Up to TEA_SIMD_MAX_LANES instances as byte planes; lane n writes lpKsOut[n * dwNumKsBytes ...]
+typedef struct {
+    uint8_t aabKey[10][TEA_SIMD_MAX_LANES] __attribute__((aligned(64)));
+    uint8_t aabIv[8][TEA_SIMD_MAX_LANES] __attribute__((aligned(64)));
+    uint32_t dwNumLanes;
+    uint32_t dwNumKsBytes;
+    uint8_t *lpKsOut;
+} TeaSimdLanes;
+
+typedef struct {
+    uint32_t dwTeaType;                 // 1 to 3, selects the tuning profile entry (see tune.h)
+    void (*fnAvx512)(const TeaSimdLanes *lpLanes);
+    void (*fnAvx2)(const TeaSimdLanes *lpLanes);
+    void (*fnLoadKey)(const uint8_t *lpKey, uint8_t *lpKeyRegOut);  // key register bytes, oldest first
+    void (*fnScalar)(uint32_t dwIv, const uint8_t *lpKey, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
+} TeaSimdKernels;
+
+// Widest kernel the cpu runs, or the one set with tea_simd_set_level if that is narrower; the tuning profile may narrow it per variant
+TeaSimdLevel tea_simd_level(void);
+void tea_simd_set_level(TeaSimdLevel eLevel);
+const char *tea_simd_level_name(TeaSimdLevel eLevel);
+
+// Keystream for dwNumLanes (key, IV) pairs, same layout as batch_keystream
+void tea_simd_keystream(const TeaVariant *lpVariant, const TeaSimdKernels *lpKernels, uint32_t dwNumLanes,
+                        const uint32_t *adwIvs, const uint8_t *lpKeys, uint32_t dwNumKsBytes, uint8_t *lpKsOut);
+
+// Reorder permutation split in nibbles: reorder(b) = abLo[b & 15] | abHi[b >> 4]
+TEA_CORE_INLINE void tea_simd_reorder_tables(const TeaVariant *lpVariant, uint8_t *abLo, uint8_t *abHi) {
+    for (int i = 0; i < 16; i++) {
+        abLo[i] = tea_core_reorder(lpVariant, i);
+        abHi[i] = tea_core_reorder(lpVariant, i << 4);
+    }
+}
+
+// Write the keystream byte plane of one output byte to the lanes
+TEA_CORE_INLINE void tea_simd_scatter(const TeaSimdLanes *lpLanes, uint32_t dwFirstLane, uint32_t dwNumLanes, uint32_t dwKsByte, const uint8_t *abPlane) {
+    uint8_t *lpOut = lpLanes->lpKsOut + (uint64_t)dwFirstLane * lpLanes->dwNumKsBytes + dwKsByte;
+    for (uint32_t i = 0; i < dwNumLanes; i++) {
+        lpOut[(uint64_t)i * lpLanes->dwNumKsBytes] = abPlane[i];
+    }
+}
+
+/*
+ * AVX-512 VBMI, 64 lanes
+ */
+
+// Rotate every byte right by n: shifted word halves merged under a per-byte mask
+#define TEA_SIMD_SEL512(s, t, f) _mm512_ternarylogic_epi64((s), (t), (f), 0xCA)    // s ? t : f, bitwise
+#define TEA_SIMD_ROR512(x, n) ((n) ? TEA_SIMD_SEL512(_mm512_set1_epi8(0xFF >> (n)), _mm512_srli_epi16((x), (n)), _mm512_slli_epi16((x), 8 - (n))) : (x))
+
+TEA_CORE_INLINE TEA_SIMD_TARGET_AVX512 __m512i tea_simd_filter512(const __m512i *avLut, __m512i vLo, __m512i vHi, const uint8_t *abRot) {
+    __m512i x0 = TEA_SIMD_ROR512(vLo, abRot[0]);
+    __m512i x1 = TEA_SIMD_ROR512(vLo, abRot[1]);
+    __m512i x2 = TEA_SIMD_ROR512(vHi, abRot[2]);
+    __m512i x3 = TEA_SIMD_ROR512(vHi, abRot[3]);
+    __m512i m[8];
+    for (int i = 0; i < 8; i++) {
+        m[i] = TEA_SIMD_SEL512(x0, avLut[2 * i + 1], avLut[2 * i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        m[i] = TEA_SIMD_SEL512(x1, m[2 * i + 1], m[2 * i]);
+    }
+    m[0] = TEA_SIMD_SEL512(x2, m[1], m[0]);
+    m[1] = TEA_SIMD_SEL512(x2, m[3], m[2]);
+    return TEA_SIMD_SEL512(x3, m[1], m[0]);
+}
+
+TEA_CORE_INLINE TEA_SIMD_TARGET_AVX512 void tea_simd_keystream_avx512(const TeaVariant *lpVariant, const TeaSimdLanes *lpLanes) {
+    const uint32_t dwKeyLen = lpVariant->dwKeyLen;
+    uint8_t abReorderLo[16], abReorderHi[16];
+    uint8_t abPlane[64] __attribute__((aligned(64)));
+    __m512i avLutA[16], avLutB[16];
+    __m512i K[10], R[8];
+
+    __m512i vSbox0 = _mm512_loadu_si512(lpVariant->abSbox);
+    __m512i vSbox1 = _mm512_loadu_si512(lpVariant->abSbox + 64);
+    __m512i vSbox2 = _mm512_loadu_si512(lpVariant->abSbox + 128);
+    __m512i vSbox3 = _mm512_loadu_si512(lpVariant->abSbox + 192);
+    for (int i = 0; i < 16; i++) {
+        avLutA[i] = _mm512_set1_epi8(lpVariant->awLutSliced[i] & 0xFF);
+        avLutB[i] = _mm512_set1_epi8(lpVariant->awLutSliced[i] >> 8);
+    }
+    tea_simd_reorder_tables(lpVariant, abReorderLo, abReorderHi);
+    __m512i vReorderLo = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)abReorderLo));
+    __m512i vReorderHi = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)abReorderHi));
+    __m512i vNibble = _mm512_set1_epi8(0x0F);
+
+    for (int i = 0; i < dwKeyLen; i++) {
+        K[i] = _mm512_load_si512(lpLanes->aabKey[i]);
+    }
+    for (int i = 0; i < 8; i++) {
+        R[i] = _mm512_load_si512(lpLanes->aabIv[i]);
+    }
+
+    for (uint32_t dwKsByte = 0; dwKsByte < lpLanes->dwNumKsBytes; dwKsByte++) {
+        uint32_t dwRounds = dwKsByte ? lpVariant->dwByteRounds : lpVariant->dwInitRounds;
+        for (uint32_t r = 0; r < dwRounds; r++) {
+            // Key step: S-box over the 256 table bytes, bit 7 of the index picks the half
+            __m512i vIdx = _mm512_xor_si512(K[lpVariant->dwSboxTapA], K[lpVariant->dwSboxTapB]);
+            __m512i vSboxOut = _mm512_mask_blend_epi8(_mm512_movepi8_mask(vIdx), _mm512_permutex2var_epi8(vSbox0, vIdx, vSbox1),
+                                                      _mm512_permutex2var_epi8(vSbox2, vIdx, vSbox3));
+            if (lpVariant->dwSboxXorTap >= 0) {
+                vSboxOut = _mm512_xor_si512(vSboxOut, K[lpVariant->dwSboxXorTap]);
+            }
+            for (int i = 0; i + 1 < dwKeyLen; i++) {
+                K[i] = K[i + 1];
+            }
+            K[dwKeyLen - 1] = vSboxOut;
+
+            // IV step
+            uint32_t a = lpVariant->dwFilterShiftA / 8, b = lpVariant->dwFilterShiftB / 8;
+            __m512i vDerivA = tea_simd_filter512(avLutA, R[a], R[a + 1], lpVariant->abFilterRot);
+            __m512i vDerivB = tea_simd_filter512(avLutB, R[b], R[b + 1], lpVariant->abFilterRot);
+            __m512i vSt = R[lpVariant->dwReorderShift / 8];
+            __m512i vReord = _mm512_or_si512(_mm512_shuffle_epi8(vReorderLo, _mm512_and_si512(vSt, vNibble)),
+                                             _mm512_shuffle_epi8(vReorderHi, _mm512_and_si512(_mm512_srli_epi16(vSt, 4), vNibble)));
+            __m512i vNew = _mm512_ternarylogic_epi64(R[7], vReord, vSboxOut, 0x96);
+            vNew = _mm512_xor_si512(vNew, lpVariant->bNewFromLutB ? vDerivB : vDerivA);
+            if (lpVariant->dwExtraTapShift >= 0) {
+                vNew = _mm512_xor_si512(vNew, R[lpVariant->dwExtraTapShift / 8]);
+            }
+            for (int i = 7; i > 0; i--) {
+                R[i] = R[i - 1];
+            }
+            R[0] = vNew;
+            R[lpVariant->dwMixShift / 8] = _mm512_xor_si512(R[lpVariant->dwMixShift / 8], lpVariant->bNewFromLutB ? vDerivA : vDerivB);
+        }
+        _mm512_store_si512(abPlane, R[7]);
+        tea_simd_scatter(lpLanes, 0, lpLanes->dwNumLanes, dwKsByte, abPlane);
+    }
+}
+
+/*
+ * AVX2, 32 lanes per pass
+ */
+
+TEA_CORE_INLINE TEA_SIMD_TARGET_AVX2 __m256i tea_simd_ror256(__m256i x, int n) {
+    if (n == 0) {
+        return x;
+    }
+    __m256i vMask = _mm256_set1_epi8(0xFF >> n);
+    return _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(x, n), vMask), _mm256_andnot_si256(vMask, _mm256_slli_epi16(x, 8 - n)));
+}
+
+// s ? t : f, bitwise
+#define TEA_SIMD_SEL256(s, t, f) _mm256_xor_si256((f), _mm256_and_si256(_mm256_xor_si256((f), (t)), (s)))
+
+TEA_CORE_INLINE TEA_SIMD_TARGET_AVX2 __m256i tea_simd_filter256(const __m256i *avLut, const __m256i *avLutDiff, __m256i vLo, __m256i vHi, const uint8_t *abRot) {
+    __m256i x0 = tea_simd_ror256(vLo, abRot[0]);
+    __m256i x1 = tea_simd_ror256(vLo, abRot[1]);
+    __m256i x2 = tea_simd_ror256(vHi, abRot[2]);
+    __m256i x3 = tea_simd_ror256(vHi, abRot[3]);
+    __m256i m[8];
+
+    // First level against constants: the xor of each pair is precomputed
+    for (int i = 0; i < 8; i++) {
+        m[i] = _mm256_xor_si256(avLut[2 * i], _mm256_and_si256(avLutDiff[i], x0));
+    }
+    for (int i = 0; i < 4; i++) {
+        m[i] = TEA_SIMD_SEL256(x1, m[2 * i + 1], m[2 * i]);
+    }
+    m[0] = TEA_SIMD_SEL256(x2, m[1], m[0]);
+    m[1] = TEA_SIMD_SEL256(x2, m[3], m[2]);
+    return TEA_SIMD_SEL256(x3, m[1], m[0]);
+}
+
+TEA_CORE_INLINE TEA_SIMD_TARGET_AVX2 void tea_simd_keystream_avx2(const TeaVariant *lpVariant, const TeaSimdLanes *lpLanes) {
+    const uint32_t dwKeyLen = lpVariant->dwKeyLen;
+    uint8_t abReorderLo[16], abReorderHi[16];
+    uint8_t abPlane[32] __attribute__((aligned(32)));
+    __m256i avLutA[16], avLutB[16], avLutDiffA[8], avLutDiffB[8], avSboxRows[16];
+    __m256i K[10], R[8];
+
+    for (int i = 0; i < 16; i++) {
+        avSboxRows[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(lpVariant->abSbox + 16 * i)));
+        avLutA[i] = _mm256_set1_epi8(lpVariant->awLutSliced[i] & 0xFF);
+        avLutB[i] = _mm256_set1_epi8(lpVariant->awLutSliced[i] >> 8);
+    }
+    for (int i = 0; i < 8; i++) {
+        avLutDiffA[i] = _mm256_xor_si256(avLutA[2 * i], avLutA[2 * i + 1]);
+        avLutDiffB[i] = _mm256_xor_si256(avLutB[2 * i], avLutB[2 * i + 1]);
+    }
+    tea_simd_reorder_tables(lpVariant, abReorderLo, abReorderHi);
+    __m256i vReorderLo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)abReorderLo));
+    __m256i vReorderHi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)abReorderHi));
+    __m256i vNibble = _mm256_set1_epi8(0x0F);
+    __m256i vRowBias = _mm256_set1_epi8(0x70);
+
+    for (uint32_t dwFirstLane = 0; dwFirstLane < lpLanes->dwNumLanes; dwFirstLane += 32) {
+        uint32_t dwNumLanes = lpLanes->dwNumLanes - dwFirstLane < 32 ? lpLanes->dwNumLanes - dwFirstLane : 32;
+        for (int i = 0; i < dwKeyLen; i++) {
+            K[i] = _mm256_load_si256((const __m256i *)&lpLanes->aabKey[i][dwFirstLane]);
+        }
+        for (int i = 0; i < 8; i++) {
+            R[i] = _mm256_load_si256((const __m256i *)&lpLanes->aabIv[i][dwFirstLane]);
+        }
+
+        for (uint32_t dwKsByte = 0; dwKsByte < lpLanes->dwNumKsBytes; dwKsByte++) {
+            uint32_t dwRounds = dwKsByte ? lpVariant->dwByteRounds : lpVariant->dwInitRounds;
+            for (uint32_t r = 0; r < dwRounds; r++) {
+                // Key step: row h of the S-box answers where the high nibble is h. Saturating
+                // 0x70 onto the index sets bit 7, so VPSHUFB yields 0, everywhere else.
+                __m256i vIdx = _mm256_xor_si256(K[lpVariant->dwSboxTapA], K[lpVariant->dwSboxTapB]);
+                __m256i vSboxOut = _mm256_setzero_si256();
+                for (int h = 0; h < 16; h++) {
+                    __m256i vRowIdx = _mm256_adds_epu8(_mm256_xor_si256(vIdx, _mm256_set1_epi8(h << 4)), vRowBias);
+                    vSboxOut = _mm256_or_si256(vSboxOut, _mm256_shuffle_epi8(avSboxRows[h], vRowIdx));
+                }
+                if (lpVariant->dwSboxXorTap >= 0) {
+                    vSboxOut = _mm256_xor_si256(vSboxOut, K[lpVariant->dwSboxXorTap]);
+                }
+                for (int i = 0; i + 1 < dwKeyLen; i++) {
+                    K[i] = K[i + 1];
+                }
+                K[dwKeyLen - 1] = vSboxOut;
+
+                // IV step
+                uint32_t a = lpVariant->dwFilterShiftA / 8, b = lpVariant->dwFilterShiftB / 8;
+                __m256i vDerivA = tea_simd_filter256(avLutA, avLutDiffA, R[a], R[a + 1], lpVariant->abFilterRot);
+                __m256i vDerivB = tea_simd_filter256(avLutB, avLutDiffB, R[b], R[b + 1], lpVariant->abFilterRot);
+                __m256i vSt = R[lpVariant->dwReorderShift / 8];
+                __m256i vReord = _mm256_or_si256(_mm256_shuffle_epi8(vReorderLo, _mm256_and_si256(vSt, vNibble)),
+                                                 _mm256_shuffle_epi8(vReorderHi, _mm256_and_si256(_mm256_srli_epi16(vSt, 4), vNibble)));
+                __m256i vNew = _mm256_xor_si256(_mm256_xor_si256(R[7], vReord), vSboxOut);
+                vNew = _mm256_xor_si256(vNew, lpVariant->bNewFromLutB ? vDerivB : vDerivA);
+                if (lpVariant->dwExtraTapShift >= 0) {
+                    vNew = _mm256_xor_si256(vNew, R[lpVariant->dwExtraTapShift / 8]);
+                }
+                for (int i = 7; i > 0; i--) {
+                    R[i] = R[i - 1];
+                }
+                R[0] = vNew;
+                R[lpVariant->dwMixShift / 8] = _mm256_xor_si256(R[lpVariant->dwMixShift / 8], lpVariant->bNewFromLutB ? vDerivA : vDerivB);
+            }
+            _mm256_store_si256((__m256i *)abPlane, R[7]);
+            tea_simd_scatter(lpLanes, dwFirstLane, dwNumLanes, dwKsByte, abPlane);
+        }
+    }
+}
+
+#endif /* HAVE_TEA_SIMD_H */
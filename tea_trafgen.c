@@ -0,0 +1,289 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "carrier_svc.h"
+#include "trafgen.h"
+
+typedef struct {
+    TRAFGEN *lpGen;
+    FILE *lpCapture;
+    FILE *lpSchedule;
+    uint64_t qwRecords;
+    uint32_t dwLastTeaType;
+    uint8_t abLastKey[10];
+    uint32_t adwEckGeneration[TRAFGEN_MAX_CARRIERS];
+    uint8_t aabEck[TRAFGEN_MAX_CARRIERS][10];
+    const TrafgenCarrier *lpCarriers;
+} CaptureOutput;
+
+typedef struct {
+    TRAFGEN *lpGen;
+    CARRIER_SVC *lpSvc;
+    uint64_t qwMismatches;
+} QueueOutput;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_hex(const char *lpszHex, uint8_t *lpOut, uint32_t dwMaxLen, uint32_t *lpdwLen) {
+    uint32_t dwLen = strlen(lpszHex);
+    if (dwLen % 2 || dwLen / 2 > dwMaxLen) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < dwLen / 2; i++) {
+        unsigned int dwByte;
+        if (sscanf(&lpszHex[2 * i], "%2x", &dwByte) != 1) {
+            return -1;
+        }
+        lpOut[i] = dwByte;
+    }
+    *lpdwLen = dwLen / 2;
+    return 0;
+}
+
+// Appends the record, and a schedule entry whenever its key differs from the previous record's
+static int output_capture(void *lpArg, const TrafgenBurst *lpBurst) {
+    CaptureOutput *lpOut = lpArg;
+    uint8_t abRecord[CAPTURE_RECORD_HEADER_LEN + TRAFGEN_MAX_BURST_BYTES];
+
+    if (lpOut->lpSchedule) {
+        uint32_t dwCarrier = lpBurst->dwCarrier;
+        if (lpOut->adwEckGeneration[dwCarrier] != lpBurst->dwGeneration) {
+            trafgen_eck(lpOut->lpGen, dwCarrier, lpBurst->dwGeneration, lpOut->aabEck[dwCarrier]);
+            lpOut->adwEckGeneration[dwCarrier] = lpBurst->dwGeneration;
+        }
+        uint32_t dwTeaType = lpOut->lpCarriers[dwCarrier].dwTeaType;
+        if (dwTeaType != lpOut->dwLastTeaType || memcmp(lpOut->aabEck[dwCarrier], lpOut->abLastKey, 10)) {
+            fprintf(lpOut->lpSchedule, "%llu %u ", (unsigned long long)lpOut->qwRecords, dwTeaType);
+            for (int i = 0; i < 10; i++) {
+                fprintf(lpOut->lpSchedule, "%02x", lpOut->aabEck[dwCarrier][i]);
+            }
+            fprintf(lpOut->lpSchedule, "\n");
+            lpOut->dwLastTeaType = dwTeaType;
+            memcpy(lpOut->abLastKey, lpOut->aabEck[dwCarrier], 10);
+        }
+    }
+
+    uint32_t dwLen = trafgen_capture_record(lpBurst, abRecord);
+    lpOut->qwRecords++;
+    return fwrite(abRecord, 1, dwLen, lpOut->lpCapture) == dwLen ? 0 : -1;
+}
+
+// A full shard queue is counted as dropped by the service, as it would be for a live feed
+static int output_queue(void *lpArg, const TrafgenBurst *lpBurst) {
+    QueueOutput *lpOut = lpArg;
+    CarrierBurst stBurst = { 0 };
+
+    stBurst.dwCarrier = lpBurst->dwCarrier;
+    stBurst.stFn = lpBurst->stFn;
+    stBurst.bHnKnown = 1;
+    stBurst.dwBitLen = lpBurst->dwBitLen;
+    stBurst.qwTag = lpBurst->qwSeq;
+    memcpy(stBurst.abData, lpBurst->abData, (lpBurst->dwBitLen + 7) / 8);
+    carrier_svc_submit(lpOut->lpSvc, &stBurst);
+    return 0;
+}
+
+static void check_decrypted(void *lpArg, uint32_t dwWorker, const CarrierBurst *lpBurst) {
+    QueueOutput *lpOut = lpArg;
+    TrafgenBurst stBurst = { .dwBitLen = lpBurst->dwBitLen, .qwSeq = lpBurst->qwTag };
+    uint8_t abPlaintext[TRAFGEN_MAX_BURST_BYTES];
+
+    trafgen_plaintext(lpOut->lpGen, &stBurst, abPlaintext);
+    if (memcmp(abPlaintext, lpBurst->abData, (lpBurst->dwBitLen + 7) / 8)) {
+        __atomic_add_fetch(&lpOut->qwMismatches, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void usage(const char *lpszName) {
+    fprintf(stderr, "Usage: %s [options] <capture out | - | queue>\n", lpszName);
+    fprintf(stderr, "  -c carriers      number of carriers, 1 to %u (1)\n", TRAFGEN_MAX_CARRIERS);
+    fprintf(stderr, "  -t slots         timeslots per carrier, 1 to 4 (4)\n");
+    fprintf(stderr, "  -m mix           TEA variants assigned to carriers in turn, e.g. 123 (1)\n");
+    fprintf(stderr, "  -e cck|sck|mix   ECK derivation, mix alternates per carrier (cck)\n");
+    fprintf(stderr, "  -b bits          burst length, 1 to %u (%u)\n", TRAFGEN_MAX_BURST_BITS, TRAFGEN_MAX_BURST_BITS);
+    fprintf(stderr, "  -H hex           known plaintext header of every burst\n");
+    fprintf(stderr, "  -r hyperframes   key rollover period, 0 = never (0)\n");
+    fprintf(stderr, "  -x speed         multiple of real time, 0 = as fast as possible (1)\n");
+    fprintf(stderr, "  -n bursts        bursts to emit (100000)\n");
+    fprintf(stderr, "  -s seed          (1)\n");
+    fprintf(stderr, "  -k schedule      write the capture_decrypt key schedule\n");
+    fprintf(stderr, "  -w workers       carrier_svc workers for the queue output, 0 = all cpus (0)\n");
+    fprintf(stderr, "The capture goes to a file or - for stdout; queue decrypts in process with carrier_svc\n");
+    fprintf(stderr, "and checks the plaintext, which needs -r 0.\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    TrafgenConfig stConfig = { .qwSeed = 1, .stStart = { 1, 1, 1, 0, 0 }, .dwBitLen = TRAFGEN_MAX_BURST_BITS, .dSpeed = 1 };
+    TrafgenCarrier astCarriers[TRAFGEN_MAX_CARRIERS];
+    uint32_t dwNumCarriers = 1, dwNumSlots = 4, dwNumWorkers = 0;
+    const char *lpszMix = "1", *lpszEck = "cck", *lpszSchedule = NULL;
+    uint64_t qwMaxBursts = 100000;
+    int iOpt;
+
+    while ((iOpt = getopt(argc, argv, "c:t:m:e:b:H:r:x:n:s:k:w:")) != -1) {
+        switch (iOpt) {
+        case 'c': dwNumCarriers = atoi(optarg); break;
+        case 't': dwNumSlots = atoi(optarg); break;
+        case 'm': lpszMix = optarg; break;
+        case 'e': lpszEck = optarg; break;
+        case 'b': stConfig.dwBitLen = atoi(optarg); break;
+        case 'r': stConfig.dwRolloverHyperframes = atoi(optarg); break;
+        case 'x': stConfig.dSpeed = atof(optarg); break;
+        case 'n': qwMaxBursts = strtoull(optarg, NULL, 10); break;
+        case 's': stConfig.qwSeed = strtoull(optarg, NULL, 0); break;
+        case 'k': lpszSchedule = optarg; break;
+        case 'w': dwNumWorkers = atoi(optarg); break;
+        case 'H':
+            if (parse_hex(optarg, stConfig.abHeader, TRAFGEN_MAX_HEADER, &stConfig.dwHeaderLen) != 0) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || dwNumCarriers < 1 || dwNumCarriers > TRAFGEN_MAX_CARRIERS || strlen(lpszMix) == 0 ||
+            strspn(lpszMix, "123") != strlen(lpszMix) || (strcmp(lpszEck, "cck") && strcmp(lpszEck, "sck") && strcmp(lpszEck, "mix"))) {
+        usage(argv[0]);
+    }
+    const char *lpszOutput = argv[optind];
+    int bQueue = !strcmp(lpszOutput, "queue");
+    if (bQueue && stConfig.dwRolloverHyperframes) {
+        fprintf(stderr, "The queue output keeps its carriers' keys, use -r 0\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Distinct cells, each a different cn/la/cc/ssi
+    for (uint32_t i = 0; i < dwNumCarriers; i++) {
+        TrafgenCarrier *lpCarrier = &astCarriers[i];
+        uint32_t dwLa = (i * 7 + 1) & 0x3FFF;
+        memset(lpCarrier, 0, sizeof(*lpCarrier));
+        lpCarrier->dwTeaType = lpszMix[i % strlen(lpszMix)] - '0';
+        lpCarrier->bSck = !strcmp(lpszEck, "sck") || (!strcmp(lpszEck, "mix") && (i & 1));
+        lpCarrier->abCn[0] = (i >> 8) & 0x0F;
+        lpCarrier->abCn[1] = i;
+        lpCarrier->abLa[0] = dwLa >> 8;
+        lpCarrier->abLa[1] = dwLa;
+        lpCarrier->bCc = (i * 5 + 3) & 0x3F;
+        lpCarrier->abSsi[0] = 0x10;
+        lpCarrier->abSsi[1] = i >> 8;
+        lpCarrier->abSsi[2] = i;
+        lpCarrier->dwNumSlots = dwNumSlots;
+    }
+
+    TRAFGEN *lpGen = trafgen_create(&stConfig, astCarriers, dwNumCarriers);
+    if (lpGen == NULL) {
+        fprintf(stderr, "Bad generator configuration\n");
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *lpReport = stdout;
+    uint64_t qwEmitted;
+    double dStart, dElapsed;
+    int iResult = 0;
+
+    if (bQueue) {
+        QueueOutput stOut = { lpGen };
+        KeyhierKeySet stKeys;
+        CarrierStats stTotal = { 0 };
+
+        stOut.lpSvc = carrier_svc_create(dwNumWorkers, CARRIER_SVC_FLAG_PIN, check_decrypted, &stOut);
+        if (stOut.lpSvc == NULL) {
+            perror("carrier_svc_create failed");
+            exit(EXIT_FAILURE);
+        }
+        trafgen_key_set(lpGen, 0, &stKeys);
+        for (uint32_t i = 0; i < dwNumCarriers; i++) {
+            CarrierConfig stCarrier = { astCarriers[i].dwTeaType, astCarriers[i].bSck };
+            memcpy(stCarrier.abCn, astCarriers[i].abCn, 2);
+            memcpy(stCarrier.abLa, astCarriers[i].abLa, 2);
+            stCarrier.bCc = astCarriers[i].bCc;
+            memcpy(stCarrier.abSsi, astCarriers[i].abSsi, 3);
+            memcpy(stCarrier.abKey, astCarriers[i].bSck ? stKeys.aabScks[0] : stKeys.abCck, 10);
+            carrier_svc_add_carrier(stOut.lpSvc, &stCarrier);
+        }
+
+        dStart = now();
+        qwEmitted = trafgen_run(lpGen, qwMaxBursts, output_queue, &stOut);
+        carrier_svc_flush(stOut.lpSvc);
+        dElapsed = now() - dStart;
+
+        for (uint32_t i = 0; i < dwNumCarriers; i++) {
+            CarrierStats stStats;
+            carrier_svc_get_stats(stOut.lpSvc, i, &stStats);
+            stTotal.qwBursts += stStats.qwBursts;
+            stTotal.qwDropped += stStats.qwDropped;
+            stTotal.qwTotalLatencyNs += stStats.qwTotalLatencyNs;
+            if (stStats.qwMaxLatencyNs > stTotal.qwMaxLatencyNs) {
+                stTotal.qwMaxLatencyNs = stStats.qwMaxLatencyNs;
+            }
+        }
+        printf("%llu bursts, %.3f s, %.0f bursts/s: %llu decrypted, %llu dropped, %llu wrong plaintext\n",
+               (unsigned long long)qwEmitted, dElapsed, qwEmitted / dElapsed, (unsigned long long)stTotal.qwBursts,
+               (unsigned long long)stTotal.qwDropped, (unsigned long long)stOut.qwMismatches);
+        printf("latency mean %.1f us, max %.1f us\n",
+               stTotal.qwBursts ? stTotal.qwTotalLatencyNs / 1e3 / stTotal.qwBursts : 0, stTotal.qwMaxLatencyNs / 1e3);
+        carrier_svc_destroy(stOut.lpSvc);
+        iResult = stOut.qwMismatches ? -1 : 0;
+    } else {
+        CaptureOutput stOut = { lpGen };
+        uint8_t abHeader[CAPTURE_FILE_HEADER_LEN];
+
+        stOut.lpCarriers = astCarriers;
+        memset(stOut.adwEckGeneration, 0xFF, sizeof(stOut.adwEckGeneration));
+        if (!strcmp(lpszOutput, "-")) {
+            stOut.lpCapture = stdout;
+            lpReport = stderr;
+        } else {
+            stOut.lpCapture = fopen(lpszOutput, "wb");
+        }
+        if (stOut.lpCapture == NULL || (lpszSchedule && (stOut.lpSchedule = fopen(lpszSchedule, "w")) == NULL)) {
+            perror("Can't open output");
+            exit(EXIT_FAILURE);
+        }
+
+        trafgen_capture_header(abHeader);
+        fwrite(abHeader, 1, sizeof(abHeader), stOut.lpCapture);
+        dStart = now();
+        qwEmitted = trafgen_run(lpGen, qwMaxBursts, output_capture, &stOut);
+        if (fflush(stOut.lpCapture) != 0 || (stOut.lpSchedule && fclose(stOut.lpSchedule) != 0)) {
+            iResult = -1;
+        }
+        dElapsed = now() - dStart;
+        if (stOut.lpCapture != stdout && fclose(stOut.lpCapture) != 0) {
+            iResult = -1;
+        }
+        if (qwEmitted < qwMaxBursts || iResult != 0) {
+            perror("Can't write output");
+            iResult = -1;
+        }
+        fprintf(lpReport, "%llu bursts, %.3f s, %.0f bursts/s\n", (unsigned long long)qwEmitted, dElapsed, qwEmitted / dElapsed);
+    }
+
+    trafgen_destroy(lpGen);
+    return iResult == 0 ? 0 : EXIT_FAILURE;
+}
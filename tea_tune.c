@@ -0,0 +1,282 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "hurdle.h"
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+#include "tea_simd.h"
+#include "tune.h"
+#include "workpool.h"
+
+#define KS_LEN          54              // a full burst
+#define BATCH_LANES     16384           // large enough to keep every thread busy
+
+/*
+ * Measures the dispatcher choices on this machine and writes a tuning
+ * profile (see tune.h). Every choice is measured with the ones made before
+ * it in place: the kernel of each TEA variant and its lane crossover, the
+ * HURDLE batch path, then the thread count and finally the chunk size of
+ * a threaded keystream batch.
+ */
+
+static const uint32_t g_adwLaneCounts[] = { 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64 };
+#define NUM_LANE_COUNTS (sizeof(g_adwLaneCounts) / sizeof(g_adwLaneCounts[0]))
+
+static const uint32_t g_adwChunkLanes[] = { 64, 128, 256, 512, 1024, 4096 };
+#define NUM_CHUNK_LANES (sizeof(g_adwChunkLanes) / sizeof(g_adwChunkLanes[0]))
+
+static double g_dSeconds = 0.05;
+static uint32_t g_adwIvs[BATCH_LANES];
+static uint8_t g_abKeys[BATCH_LANES * 16];
+static uint8_t g_abOut[BATCH_LANES * KS_LEN];
+
+typedef struct {
+    uint32_t dwTeaType;
+    uint32_t dwNumLanes;
+    WORKPOOL *lpPool;
+} TuneCase;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Best of three rounds of g_dSeconds after one warm-up call, in units per second; the best round is the one least disturbed
+static double measure(uint64_t (*fnRun)(const TuneCase *lpCase), const TuneCase *lpCase) {
+    double dBest = 0;
+    fnRun(lpCase);
+    for (int r = 0; r < 3; r++) {
+        uint64_t qwUnits = 0;
+        double dStart = now_seconds(), dElapsed;
+        do {
+            qwUnits += fnRun(lpCase);
+            dElapsed = now_seconds() - dStart;
+        } while (dElapsed < g_dSeconds);
+        dBest = qwUnits / dElapsed > dBest ? qwUnits / dElapsed : dBest;
+    }
+    return dBest;
+}
+
+static uint64_t run_lanes(const TuneCase *lpCase) {
+    switch (lpCase->dwTeaType) {
+    case 1: tea1_keystream_lanes(lpCase->dwNumLanes, g_adwIvs, g_abKeys, KS_LEN, g_abOut); break;
+    case 2: tea2_keystream_lanes(lpCase->dwNumLanes, g_adwIvs, g_abKeys, KS_LEN, g_abOut); break;
+    case 3: tea3_keystream_lanes(lpCase->dwNumLanes, g_adwIvs, g_abKeys, KS_LEN, g_abOut); break;
+    }
+    return (uint64_t)lpCase->dwNumLanes * KS_LEN;
+}
+
+static uint64_t run_batch_keystream(const TuneCase *lpCase) {
+    batch_keystream(lpCase->lpPool, lpCase->dwTeaType, lpCase->dwNumLanes, g_adwIvs, g_abKeys, KS_LEN, g_abOut);
+    return (uint64_t)lpCase->dwNumLanes * KS_LEN;
+}
+
+static uint64_t run_batch_hurdle(const TuneCase *lpCase) {
+    batch_hurdle(lpCase->lpPool, lpCase->dwNumLanes, g_abKeys, g_abOut, g_abOut + BATCH_LANES * 8, HURDLE_ENCRYPT);
+    return lpCase->dwNumLanes;
+}
+
+/*
+ * The widest kernel is not always the fastest (AVX-512 clocks down on some
+ * parts), so every level is timed at full width. The crossover is the
+ * smallest lane count from which the chosen kernel keeps beating the scalar
+ * code.
+ */
+static void tune_tea(TuneProfile *lpProfile, uint32_t dwTeaType, TeaSimdLevel eCpuLevel) {
+    double aadRates[TEA_SIMD_AVX512 + 1][NUM_LANE_COUNTS];
+    TuneCase stCase = { dwTeaType, 0, NULL };
+
+    printf("TEA%u keystream, MB/s\n  lanes ", dwTeaType);
+    for (int n = 0; n < NUM_LANE_COUNTS; n++) {
+        printf("%7u", g_adwLaneCounts[n]);
+    }
+    printf("\n");
+
+    lpProfile->adwTeaMinLanes[dwTeaType - 1] = 1;
+    for (int eLevel = TEA_SIMD_SCALAR; eLevel <= eCpuLevel; eLevel++) {
+        lpProfile->aeTeaLevel[dwTeaType - 1] = eLevel;
+        tune_set(lpProfile);
+        printf("  %-6s", tea_simd_level_name(eLevel));
+        for (int n = 0; n < NUM_LANE_COUNTS; n++) {
+            stCase.dwNumLanes = g_adwLaneCounts[n];
+            aadRates[eLevel][n] = measure(run_lanes, &stCase);
+            printf("%7.1f", aadRates[eLevel][n] / 1e6);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    TeaSimdLevel eBest = TEA_SIMD_SCALAR;
+    for (int eLevel = TEA_SIMD_SCALAR; eLevel <= eCpuLevel; eLevel++) {
+        eBest = aadRates[eLevel][NUM_LANE_COUNTS - 1] > aadRates[eBest][NUM_LANE_COUNTS - 1] ? eLevel : eBest;
+    }
+    uint32_t dwMinLanes = TEA_SIMD_MIN_LANES;
+    if (eBest != TEA_SIMD_SCALAR) {
+        int n = NUM_LANE_COUNTS - 1;
+        while (n > 0 && aadRates[eBest][n - 1] > aadRates[TEA_SIMD_SCALAR][n - 1]) {
+            n--;
+        }
+        dwMinLanes = g_adwLaneCounts[n];
+    }
+    lpProfile->aeTeaLevel[dwTeaType - 1] = eBest;
+    lpProfile->adwTeaMinLanes[dwTeaType - 1] = dwMinLanes;
+    tune_set(lpProfile);
+    printf("  -> %s from %u lanes\n", tea_simd_level_name(eBest), dwMinLanes);
+}
+
+static void tune_hurdle(TuneProfile *lpProfile) {
+    TuneCase stCase = { 0, 4096, NULL };
+    double dBest = 0;
+    TuneHurdleImpl eBest = TUNE_HURDLE_OTF;
+
+    printf("HURDLE batch, Mblocks/s\n");
+    for (int eImpl = TUNE_HURDLE_SCHEDULE; eImpl <= TUNE_HURDLE_OTF; eImpl++) {
+        lpProfile->eHurdleImpl = eImpl;
+        tune_set(lpProfile);
+        double dRate = measure(run_batch_hurdle, &stCase);
+        printf("  %-8s %7.2f\n", tune_hurdle_impl_name(eImpl), dRate / 1e6);
+        if (dRate > dBest) {
+            dBest = dRate;
+            eBest = eImpl;
+        }
+    }
+    lpProfile->eHurdleImpl = eBest;
+    tune_set(lpProfile);
+    printf("  -> %s\n", tune_hurdle_impl_name(eBest));
+}
+
+// The fewest threads within 3% of the best rate, 0 (one per cpu) if that takes all of them
+static void tune_threads(TuneProfile *lpProfile, uint32_t dwNumCpus) {
+    double adRates[64];
+    uint32_t adwThreads[64], dwNum = 0;
+    double dBest = 0;
+
+    for (uint32_t t = 1; t < dwNumCpus && dwNum < 63; t *= 2) {
+        adwThreads[dwNum++] = t;
+    }
+    adwThreads[dwNum++] = dwNumCpus;
+
+    printf("TEA1 batch of %u, MB/s\n", BATCH_LANES);
+    for (uint32_t i = 0; i < dwNum; i++) {
+        TuneCase stCase = { 1, BATCH_LANES, workpool_create(adwThreads[i], WORKPOOL_FLAG_PIN) };
+        adRates[i] = stCase.lpPool ? measure(run_batch_keystream, &stCase) : 0;
+        dBest = adRates[i] > dBest ? adRates[i] : dBest;
+        printf("  %4u threads %9.1f\n", adwThreads[i], adRates[i] / 1e6);
+        if (stCase.lpPool) {
+            workpool_destroy(stCase.lpPool);
+        }
+    }
+    uint32_t i = 0;
+    while (adRates[i] < 0.97 * dBest) {
+        i++;
+    }
+    lpProfile->dwThreads = adwThreads[i] == dwNumCpus ? 0 : adwThreads[i];
+    tune_set(lpProfile);
+    printf("  -> %u threads\n", adwThreads[i]);
+}
+
+// Larger chunks cost fewer scheduler round trips but balance worse; ties go to the smaller one
+static void tune_chunk(TuneProfile *lpProfile) {
+    TuneCase stCase = { 1, BATCH_LANES, workpool_create(0, WORKPOOL_FLAG_PIN) };
+    double dBest = 0;
+    uint32_t dwBest = TEA_SIMD_MAX_LANES;
+
+    printf("TEA1 batch chunk lanes, MB/s\n");
+    for (int i = 0; i < NUM_CHUNK_LANES && stCase.lpPool; i++) {
+        lpProfile->dwBatchChunkLanes = g_adwChunkLanes[i];
+        tune_set(lpProfile);
+        double dRate = measure(run_batch_keystream, &stCase);
+        printf("  %5u %9.1f\n", g_adwChunkLanes[i], dRate / 1e6);
+        if (dRate > 1.02 * dBest) {
+            dBest = dRate;
+            dwBest = g_adwChunkLanes[i];
+        }
+    }
+    if (stCase.lpPool) {
+        workpool_destroy(stCase.lpPool);
+    }
+    lpProfile->dwBatchChunkLanes = dwBest;
+    tune_set(lpProfile);
+    printf("  -> %u\n", dwBest);
+}
+
+int main(int argc, char *argv[]) {
+    const char *lpszOutput = TUNE_DEFAULT_PATH;
+    int bWrite = 1, iOpt;
+
+    while ((iOpt = getopt(argc, argv, "o:s:n")) != -1) {
+        switch (iOpt) {
+        case 'o':
+            lpszOutput = optarg;
+            break;
+        case 's':
+            g_dSeconds = atof(optarg);
+            break;
+        case 'n':
+            bWrite = 0;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-o profile] [-s seconds per measurement round] [-n]\n", argv[0]);
+            fprintf(stderr, "       measures the implementation choices on this machine and writes a tuning profile,\n");
+            fprintf(stderr, "       by default to %s; -n only prints the results\n", TUNE_DEFAULT_PATH);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < BATCH_LANES; i++) {
+        g_adwIvs[i] = i * 0x9E3779B9u;
+    }
+    for (int i = 0; i < sizeof(g_abKeys); i++) {
+        g_abKeys[i] = i * 37 + 5;
+    }
+
+    // Start from the defaults rather than a profile already installed, and measure every level the cpu has
+    TuneProfile stProfile;
+    tune_defaults(&stProfile);
+    tune_set(&stProfile);
+    tea_simd_set_level(TEA_SIMD_AVX512);
+    TeaSimdLevel eCpuLevel = tea_simd_level();
+    WORKPOOL *lpPool = workpool_create(0, 0);
+    uint32_t dwNumCpus = lpPool ? workpool_num_workers(lpPool) : 1;
+    if (lpPool) {
+        workpool_destroy(lpPool);
+    }
+    printf("%u cpus, widest kernel %s\n\n", dwNumCpus, tea_simd_level_name(eCpuLevel));
+
+    for (uint32_t t = 1; t <= TUNE_NUM_TEA; t++) {
+        tune_tea(&stProfile, t, eCpuLevel);
+    }
+    tune_hurdle(&stProfile);
+    tune_threads(&stProfile, dwNumCpus);
+    tune_chunk(&stProfile);
+
+    if (bWrite) {
+        if (tune_save(lpszOutput, &stProfile) != 0) {
+            perror("Can't write the profile");
+            exit(EXIT_FAILURE);
+        }
+        printf("\nProfile written to %s\n", lpszOutput);
+    }
+    return 0;
+}
@@ -18,12 +18,41 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <time.h>
 
 #include "hurdle.h"
 #include "tea1.h"
 #include "tea2.h"
 #include "tea3.h"
 #include "taa1.h"
+#include "common.h"
+#include "tea1_search.h"
+#include "tea1_orbit.h"
+#include "tea1_targets.h"
+#include "ivsync.h"
+#include "kpt.h"
+#include "workpool.h"
+#include "batch.h"
+#include "stats.h"
+#include "keygen.h"
+#include "keyhier.h"
+#include "keysearch.h"
+#include "carrier_svc.h"
+#include "capture.h"
+#include "ks_shm.h"
+#include "jobsrv.h"
+#include "hugemem.h"
+#include "lathist.h"
+#include "tea_simd.h"
+#include "tune.h"
+#include "trafgen.h"
+#include "sealsearch.h"
 
 #define TEST_VECTORS_SETUP_EX2(tag,elts,invoke,cmp,print_expected,print_computed,...) { \
     printf ("Testing %s...%*c", (tag), (int)(40 - strlen(tag)), ' '); \
@@ -472,6 +501,50 @@ void test_HURDLE() {
     );
 }
 
+void test_HURDLE_compact() {
+    TEST_VECTORS_INVERTIBLE("HURDLE_encrypt_compact","HURDLE_decrypt_compact",abCiphertext,abPlaintext,
+        uint8_t abPlaintext[8];
+        uint8_t abKey[16];
+        uint8_t abCiphertext[8];,
+        HURDLE_COMPACT_CTX stCipher;
+        HURDLE_set_key_compact(astVectors[i].abKey, &stCipher);
+        HURDLE_encrypt_compact(astVectors[i].abComputed, astVectors[i].abPlaintext, &stCipher, HURDLE_ENCRYPT);,
+        HURDLE_COMPACT_CTX stCipher;
+        HURDLE_set_key_compact(astVectors[i].abKey, &stCipher);
+        HURDLE_encrypt_compact(astVectors[i].abComputed, astVectors[i].abCiphertext, &stCipher, HURDLE_DECRYPT);, {
+            {
+                { 0xca, 0xfe, 0xba, 0xbe, 0xde, 0xad, 0xbe, 0xef },
+                { 0xab, 0xcd, 0xef, 0x12, 0xc0, 0x01, 0xf0, 0x0d, 0xde, 0xad, 0xbe, 0xef, 0xca, 0xfe, 0xba, 0xbe},
+                { 0x4b, 0xf1, 0x55, 0x08, 0x81, 0x2e, 0x06, 0xf0 },
+            }, {
+                { 0x22, 0x22, 0x66, 0x66, 0x22, 0x22, 0xee, 0xee },
+                { 0x99, 0x99, 0x00, 0x99, 0x99, 0x11, 0x88, 0x99, 0x22, 0x77, 0x99, 0x33, 0x66, 0x99, 0x44, 0x55 },
+                { 0xb4, 0xda, 0x66, 0x98, 0xd3, 0x6b, 0x16, 0x52 }
+            }
+        }
+    );
+}
+
+void test_HURDLE_otf() {
+    TEST_VECTORS_INVERTIBLE("HURDLE_encrypt_otf","HURDLE_decrypt_otf",abCiphertext,abPlaintext,
+        uint8_t abPlaintext[8];
+        uint8_t abKey[16];
+        uint8_t abCiphertext[8];,
+        HURDLE_encrypt_otf(astVectors[i].abComputed, astVectors[i].abPlaintext, astVectors[i].abKey, HURDLE_ENCRYPT);,
+        HURDLE_encrypt_otf(astVectors[i].abComputed, astVectors[i].abCiphertext, astVectors[i].abKey, HURDLE_DECRYPT);, {
+            {
+                { 0xca, 0xfe, 0xba, 0xbe, 0xde, 0xad, 0xbe, 0xef },
+                { 0xab, 0xcd, 0xef, 0x12, 0xc0, 0x01, 0xf0, 0x0d, 0xde, 0xad, 0xbe, 0xef, 0xca, 0xfe, 0xba, 0xbe},
+                { 0x4b, 0xf1, 0x55, 0x08, 0x81, 0x2e, 0x06, 0xf0 },
+            }, {
+                { 0x22, 0x22, 0x66, 0x66, 0x22, 0x22, 0xee, 0xee },
+                { 0x99, 0x99, 0x00, 0x99, 0x99, 0x11, 0x88, 0x99, 0x22, 0x77, 0x99, 0x33, 0x66, 0x99, 0x44, 0x55 },
+                { 0xb4, 0xda, 0x66, 0x98, 0xd3, 0x6b, 0x16, 0x52 }
+            }
+        }
+    );
+}
+
 void test_TEA1() {
     TEST_VECTORS_SETUP("TEA1", 10,
         uint32_t dwFrameNumbers;
@@ -505,6 +578,1806 @@ void test_TEA3() {
     );
 }
 
+void test_tea_xor() {
+    const char *lpTag = "TEA bit-granular xor";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t abKey[10] = { 0xA7,0x98,0x39,0xE4,0xBA,0x88,0xEE,0x54,0xA0,0x29 };
+    uint32_t dwIv = 0x01234567;
+    uint8_t bSuccess = 1;
+
+    for (uint32_t dwTeaType = 1; dwTeaType <= 3; dwTeaType++) {
+        uint8_t abKs[40];
+        if (dwTeaType == 1) tea1(dwIv, abKey, sizeof(abKs), abKs);
+        if (dwTeaType == 2) tea2(dwIv, abKey, sizeof(abKs), abKs);
+        if (dwTeaType == 3) tea3(dwIv, abKey, sizeof(abKs), abKs);
+
+        // Unaligned starts and ends, including segments within a single byte
+        static const uint32_t adwCases[][2] = { { 0, 80 }, { 3, 5 }, { 5, 2 }, { 7, 137 }, { 12, 0 }, { 9, 255 }, { 0, 1 } };
+        for (int c = 0; c < sizeof(adwCases) / sizeof(adwCases[0]); c++) {
+            uint32_t dwOffset = adwCases[c][0];
+            uint32_t dwLen = adwCases[c][1];
+            uint8_t abBuf[40], abExpected[40];
+            for (int i = 0; i < sizeof(abBuf); i++) {
+                abBuf[i] = abExpected[i] = i * 37 + 11;
+            }
+            for (uint32_t b = 0; b < dwLen; b++) {
+                uint32_t dwPos = dwOffset + b;
+                abExpected[dwPos / 8] ^= ((abKs[b / 8] >> (7 - b % 8)) & 1) << (7 - dwPos % 8);
+            }
+            if (dwTeaType == 1) tea1_xor(dwIv, abKey, dwOffset, dwLen, abBuf);
+            if (dwTeaType == 2) tea2_xor(dwIv, abKey, dwOffset, dwLen, abBuf);
+            if (dwTeaType == 3) tea3_xor(dwIv, abKey, dwOffset, dwLen, abBuf);
+            bSuccess &= (memcmp(abBuf, abExpected, sizeof(abBuf)) == 0);
+        }
+
+        // Two logical channels of one slot in two buffers, the second one starting mid keystream byte
+        uint8_t abBuf0[12] = { 0 }, abBuf1[12] = { 0 };
+        TeaXorSegment astSegments[] = {
+            { 0, 4, 60, abBuf0 },
+            { 60, 1, 84, abBuf1 },
+        };
+        if (dwTeaType == 1) tea1_xor_scatter(dwIv, abKey, astSegments, 2);
+        if (dwTeaType == 2) tea2_xor_scatter(dwIv, abKey, astSegments, 2);
+        if (dwTeaType == 3) tea3_xor_scatter(dwIv, abKey, astSegments, 2);
+        for (int s = 0; s < 2; s++) {
+            for (uint32_t b = 0; b < 96; b++) {
+                const TeaXorSegment *lpSegment = &astSegments[s];
+                uint8_t bGot = (lpSegment->lpBuf[b / 8] >> (7 - b % 8)) & 1;
+                uint8_t bWant = 0;
+                if (b >= lpSegment->dwBitOffset && b < lpSegment->dwBitOffset + lpSegment->dwBitLen) {
+                    uint32_t k = lpSegment->dwKsBitOffset + b - lpSegment->dwBitOffset;
+                    bWant = (abKs[k / 8] >> (7 - k % 8)) & 1;
+                }
+                bSuccess &= (bGot == bWant);
+            }
+        }
+    }
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_tea_lanes() {
+    const char *lpTag = "byte-lane vector TEA";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    enum { MAX_LANES = 100, KS_BYTES = TEA_KEY_STREAM_MAX_KS_BYTES };
+    static const uint32_t adwNumLanes[] = { 1, 5, 17, 64, 100 };
+    static const uint32_t adwNumKsBytes[] = { 1, 2, KS_BYTES };
+    static uint32_t adwIvs[MAX_LANES];
+    static uint8_t abKeys[MAX_LANES * 10], abOut[MAX_LANES * KS_BYTES + 1];
+    uint8_t bSuccess = 1;
+
+    for (int i = 0; i < MAX_LANES; i++) {
+        adwIvs[i] = 0x9E3779B9u * (i + 1);
+    }
+    for (int i = 0; i < sizeof(abKeys); i++) {
+        abKeys[i] = i * 29 + 11;
+    }
+
+    // Every level this cpu runs, on full and partial passes, against the scalar generators
+    TeaSimdLevel eSaved = tea_simd_level();
+    tea_simd_set_level(TEA_SIMD_AVX512);
+    TeaSimdLevel eMax = tea_simd_level();
+    for (int eLevel = TEA_SIMD_SCALAR; eLevel <= eMax; eLevel++) {
+        tea_simd_set_level(eLevel);
+        for (uint32_t dwTeaType = 1; dwTeaType <= 3; dwTeaType++) {
+            for (int n = 0; n < sizeof(adwNumLanes) / sizeof(adwNumLanes[0]); n++) {
+                for (int k = 0; k < sizeof(adwNumKsBytes) / sizeof(adwNumKsBytes[0]); k++) {
+                    uint32_t dwNumLanes = adwNumLanes[n], dwNumKsBytes = adwNumKsBytes[k];
+                    memset(abOut, 0xA5, sizeof(abOut));
+                    if (dwTeaType == 1) tea1_keystream_lanes(dwNumLanes, adwIvs, abKeys, dwNumKsBytes, abOut);
+                    if (dwTeaType == 2) tea2_keystream_lanes(dwNumLanes, adwIvs, abKeys, dwNumKsBytes, abOut);
+                    if (dwTeaType == 3) tea3_keystream_lanes(dwNumLanes, adwIvs, abKeys, dwNumKsBytes, abOut);
+                    for (int i = 0; i < dwNumLanes; i++) {
+                        uint8_t abKs[KS_BYTES];
+                        if (dwTeaType == 1) tea1(adwIvs[i], &abKeys[i * 10], dwNumKsBytes, abKs);
+                        if (dwTeaType == 2) tea2(adwIvs[i], &abKeys[i * 10], dwNumKsBytes, abKs);
+                        if (dwTeaType == 3) tea3(adwIvs[i], &abKeys[i * 10], dwNumKsBytes, abKs);
+                        bSuccess &= (memcmp(abKs, &abOut[i * dwNumKsBytes], dwNumKsBytes) == 0);
+                    }
+                    // Nothing is written past the last lane
+                    bSuccess &= (abOut[dwNumLanes * dwNumKsBytes] == 0xA5);
+                }
+            }
+        }
+    }
+    tea_simd_set_level(eSaved);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_tune() {
+    const char *lpTag = "tuning profile";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    enum { LANES = 150, KS_BYTES = 20 };
+    static uint32_t adwIvs[LANES];
+    static uint8_t abKeys[LANES * 16], abOut[LANES * KS_BYTES], abBlocks[LANES * 8], abExpected[LANES * 8];
+    TuneProfile stSaved, stProfile, stLoaded;
+    char szPath[64];
+    uint8_t bSuccess = 1;
+
+    tune_get(&stSaved);
+    snprintf(szPath, sizeof(szPath), "/tmp/tetra_tune_test.%d", (int)getpid());
+
+    // A saved profile loads back as is
+    tune_defaults(&stProfile);
+    stProfile.aeTeaLevel[1] = TEA_SIMD_AVX2;
+    stProfile.adwTeaMinLanes[2] = 9;
+    stProfile.dwBatchChunkLanes = 256;
+    stProfile.eHurdleImpl = TUNE_HURDLE_COMPACT;
+    stProfile.dwThreads = 2;
+    tune_defaults(&stLoaded);
+    bSuccess &= (tune_save(szPath, &stProfile) == 0 && tune_load(szPath, &stLoaded) == 0);
+    bSuccess &= !memcmp(&stProfile, &stLoaded, sizeof(TuneProfile));
+
+    // Missing keys keep their values; a bad line rejects the whole file
+    static const struct {
+        const char *lpszText;
+        int iResult;
+    } astFiles[] = {
+        { "# only one\n\nthreads 3   # comment\n", 0 },
+        { "threads 3\ntea4_simd avx2\n", -1 },
+        { "tea1_simd sse\n", -1 },
+        { "tea1_min_lanes 0\n", -1 },
+        { "batch_chunk_lanes 64 128\n", -1 },
+        { "hurdle_impl\n", -1 },
+    };
+    for (int i = 0; i < sizeof(astFiles) / sizeof(astFiles[0]); i++) {
+        FILE *lpFile = fopen(szPath, "w");
+        if (lpFile) {
+            fputs(astFiles[i].lpszText, lpFile);
+            fclose(lpFile);
+        }
+        stLoaded = stProfile;
+        bSuccess &= (lpFile && tune_load(szPath, &stLoaded) == astFiles[i].iResult);
+        bSuccess &= (stLoaded.dwThreads == (astFiles[i].iResult == 0 ? 3 : 2) && stLoaded.dwBatchChunkLanes == 256);
+    }
+    unlink(szPath);
+    bSuccess &= (tune_load(szPath, &stLoaded) == -1);
+
+    // Whatever the profile picks, the batches compute the same
+    for (int i = 0; i < LANES; i++) {
+        adwIvs[i] = 0x9E3779B9u * (i + 3);
+        abBlocks[i * 8] = i;
+    }
+    for (int i = 0; i < sizeof(abKeys); i++) {
+        abKeys[i] = i * 13 + 7;
+    }
+    for (int i = 0; i < LANES; i++) {
+        HURDLE_encrypt_otf(&abExpected[i * 8], &abBlocks[i * 8], &abKeys[i * 16], HURDLE_ENCRYPT);
+    }
+    WORKPOOL *lpPool = workpool_create(2, 0);
+    for (int eLevel = TEA_SIMD_SCALAR; eLevel <= TEA_SIMD_AVX512; eLevel++) {
+        for (uint32_t dwMinLanes = 1; dwMinLanes <= TEA_SIMD_MAX_LANES; dwMinLanes *= 8) {
+            tune_defaults(&stProfile);
+            for (int t = 0; t < TUNE_NUM_TEA; t++) {
+                stProfile.aeTeaLevel[t] = eLevel;
+                stProfile.adwTeaMinLanes[t] = dwMinLanes;
+            }
+            stProfile.dwBatchChunkLanes = 7 + dwMinLanes;
+            stProfile.eHurdleImpl = eLevel;
+            tune_set(&stProfile);
+            for (uint32_t dwTeaType = 1; dwTeaType <= 3; dwTeaType++) {
+                batch_keystream(lpPool, dwTeaType, LANES, adwIvs, abKeys, KS_BYTES, abOut);
+                for (int i = 0; i < LANES; i += 7) {
+                    uint8_t abKs[KS_BYTES];
+                    if (dwTeaType == 1) tea1(adwIvs[i], &abKeys[i * 10], KS_BYTES, abKs);
+                    if (dwTeaType == 2) tea2(adwIvs[i], &abKeys[i * 10], KS_BYTES, abKs);
+                    if (dwTeaType == 3) tea3(adwIvs[i], &abKeys[i * 10], KS_BYTES, abKs);
+                    bSuccess &= !memcmp(abKs, &abOut[i * KS_BYTES], KS_BYTES);
+                }
+            }
+            memset(abOut, 0, sizeof(abOut));
+            batch_hurdle(lpPool, LANES, abKeys, abBlocks, abOut, HURDLE_ENCRYPT);
+            bSuccess &= !memcmp(abOut, abExpected, LANES * 8);
+        }
+    }
+    if (lpPool) {
+        workpool_destroy(lpPool);
+    }
+
+    // workpool_create(0, ...) takes the tuned thread count
+    stProfile.dwThreads = 3;
+    tune_set(&stProfile);
+    lpPool = workpool_create(0, 0);
+    bSuccess &= (lpPool && workpool_num_workers(lpPool) == 3);
+    if (lpPool) {
+        workpool_destroy(lpPool);
+    }
+    tune_set(&stSaved);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_key_stream() {
+    const char *lpTag = "shared key stream across IVs";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t bSuccess = 1;
+    uint8_t abKey[10] = { 0xA7, 0x98, 0x39, 0xE4, 0xBA, 0x88, 0xEE, 0x54, 0xA0, 0x29 };
+    uint8_t abMask[TEA_KEY_STREAM_MAX_KS_BYTES];
+    memset(abMask, 0x81, sizeof(abMask));
+
+    // Short and long observations in mixed order, so the stream is extended on demand
+    static const uint32_t adwLens[5] = { 3, 54, 1, 20, 54 };
+    for (uint32_t dwTeaType = 1; dwTeaType <= 3 && bSuccess; dwTeaType++) {
+        for (int k = 0; k < 64; k++) {
+            TeaKeyStream stStream;
+            uint32_t dwKeyReg = tea1_init_key_register(abKey);
+            abKey[k % 10] ^= k * 0x1D;
+            if (dwTeaType == 1) tea1_key_stream_init(&stStream, dwKeyReg);
+            if (dwTeaType == 2) tea2_key_stream_init(&stStream, abKey);
+            if (dwTeaType == 3) tea3_key_stream_init(&stStream, abKey);
+
+            for (int f = 0; f < 5; f++) {
+                uint32_t dwIv = 0x1000 * k + f;
+                uint8_t abKs[TEA_KEY_STREAM_MAX_KS_BYTES];
+                if (dwTeaType == 1) tea1_inner(tea1_expand_iv(dwIv), dwKeyReg, adwLens[f], abKs);
+                if (dwTeaType == 2) tea2(dwIv, abKey, adwLens[f], abKs);
+                if (dwTeaType == 3) tea3(dwIv, abKey, adwLens[f], abKs);
+                // Every other observation is corrupted in its last byte
+                if (f & 1) {
+                    abKs[adwLens[f] - 1] ^= 0x80;
+                }
+
+                int bShared = -1, bSingle = -1;
+                if (dwTeaType == 1) {
+                    Tea1Filter stFilter = { dwIv, adwLens[f] };
+                    memcpy(stFilter.abKs, abKs, adwLens[f]);
+                    memcpy(stFilter.abMask, abMask, adwLens[f]);
+                    bSingle = tea1_filter_match(&stFilter, dwKeyReg);
+                    bShared = tea1_match_key_stream(&stStream, dwIv, abKs, abMask, adwLens[f]);
+                }
+                if (dwTeaType == 2) {
+                    bSingle = tea2_match(dwIv, abKey, abKs, abMask, adwLens[f]);
+                    bShared = tea2_match_key_stream(&stStream, dwIv, abKs, abMask, adwLens[f]);
+                }
+                if (dwTeaType == 3) {
+                    bSingle = tea3_match(dwIv, abKey, abKs, abMask, adwLens[f]);
+                    bShared = tea3_match_key_stream(&stStream, dwIv, abKs, abMask, adwLens[f]);
+                }
+                bSuccess &= (bSingle == bShared && bShared == !(f & 1));
+            }
+        }
+    }
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_tea1_orbit() {
+    const char *lpTag = "TEA1 orbit ordered search";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t bSuccess = 1;
+    uint8_t abMask[TEA_KEY_STREAM_MAX_KS_BYTES];
+    memset(abMask, 0xFF, sizeof(abMask));
+
+    // A slid stream matches exactly when a fresh stream of the successor register does
+    TeaKeyStream stSlid, stFresh;
+    uint32_t dwKeyReg = 0x5EC7A11D;
+    tea1_key_stream_init(&stSlid, dwKeyReg);
+    for (int n = 0; n < 3 * TEA_KEY_STREAM_MAX_ROUNDS && bSuccess; n++) {
+        uint8_t abKs[TEA_KEY_STREAM_MAX_KS_BYTES];
+        uint32_t dwLen = 1 + n % TEA_KEY_STREAM_MAX_KS_BYTES;
+        tea1_inner(tea1_expand_iv(n), dwKeyReg, dwLen, abKs);
+        abKs[dwLen - 1] ^= (n & 1);
+        tea1_key_stream_init(&stFresh, dwKeyReg);
+        bSuccess &= (tea1_match_key_stream(&stSlid, n, abKs, abMask, dwLen) == !(n & 1));
+        bSuccess &= (tea1_match_key_stream(&stFresh, n, abKs, abMask, dwLen) == !(n & 1));
+        dwKeyReg = tea1_key_stream_slide(&stSlid, dwKeyReg);
+    }
+
+    // The key is found, and every hit is a key that passes the filter
+    FrameNumbers stFn = { 1, 6, 30, 110, 0 };
+    Tea1Filter stFilter = { build_iv(&stFn), 4 };
+    dwKeyReg = 0x00000003;
+    tea1_inner(tea1_expand_iv(stFilter.dwIv), dwKeyReg, 4, stFilter.abKs);
+    memset(stFilter.abMask, 0xFF, 4);
+
+    TEA1_ORBIT_CTX stOrbit;
+    bSuccess &= (tea1_orbit_init(&stOrbit, &stFilter, 1) == 0);
+    bSuccess &= (tea1_orbit_run(&stOrbit, 4) == 4);
+    bSuccess &= (stOrbit.dwNumHits >= 1);
+    int bFound = 0;
+    for (uint32_t i = 0; i < stOrbit.dwNumHits; i++) {
+        bFound |= (stOrbit.lpdwHits[i] == dwKeyReg);
+        bSuccess &= tea1_filter_match(&stFilter, stOrbit.lpdwHits[i]);
+    }
+    bSuccess &= bFound;
+    tea1_orbit_free(&stOrbit);
+
+    // Weak filter, sequential and parallel: hits are exactly the visited registers passing it
+    stFilter.dwNumKsBytes = 1;
+    stFilter.abMask[0] = 0xF0;
+    WORKPOOL *lpPool = workpool_create(4, 0);
+    bSuccess &= (lpPool != NULL);
+    for (int p = 0; p < 2 && bSuccess; p++) {
+        bSuccess &= (tea1_orbit_init(&stOrbit, &stFilter, 1) == 0);
+        while (stOrbit.qwNextStart < 4) {
+            tea1_orbit_run_parallel(&stOrbit, p ? lpPool : NULL, 4 - stOrbit.qwNextStart);
+        }
+        uint64_t qwVisited = 0;
+        uint32_t dwHits = 0;
+        for (uint64_t w = 0; w < TEA1_ORBIT_BITMAP_BYTES / 8; w++) {
+            for (uint64_t qwBits = stOrbit.lpqwVisited[w]; qwBits; qwBits &= qwBits - 1) {
+                uint32_t dwReg = 64 * w + __builtin_ctzll(qwBits);
+                if (tea1_filter_match(&stFilter, dwReg)) {
+                    bSuccess &= (dwHits < stOrbit.dwNumHits && stOrbit.lpdwHits[dwHits] == dwReg);
+                    dwHits++;
+                }
+                qwVisited++;
+            }
+        }
+        bSuccess &= (dwHits == stOrbit.dwNumHits && qwVisited == stOrbit.qwNumVisited);
+        bSuccess &= (qwVisited >= 4 && qwVisited <= 4 * TEA1_ORBIT_MAX_WALK);
+        tea1_orbit_free(&stOrbit);
+    }
+    workpool_destroy(lpPool);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_kpt_search() {
+    const char *lpTag = "kpt harvester + TEA1 search";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    // Two predictable header fields: a partially known first byte, and two full bytes at offset 3
+    static const uint8_t abMask0[] = { 0xF0 };
+    static const uint8_t abPlain0[] = { 0x30 };
+    static const uint8_t abMask1[] = { 0xFF, 0xFF };
+    static const uint8_t abPlain1[] = { 0x12, 0x34 };
+    KptTemplate astTemplates[] = {
+        { 0, 1, abMask0, abPlain0 },
+        { 3, 2, abMask1, abPlain1 },
+    };
+    FrameNumbers astFn[] = {
+        { 1, 6, 30, 110, 0 }, { 2, 6, 30, 110, 0 }, { 3, 7, 30, 110, 0 }, { 2, 6, 30, 110, 0 },
+    };
+    uint32_t dwKeyReg = 0x5A5A1234;
+    uint8_t bSuccess = 1;
+
+    KPT_HARVESTER stHarvester;
+    TEA1_SEARCH_CTX stSearch;
+    kpt_init(&stHarvester, astTemplates, 2);
+    tea1_search_init_range(&stSearch, dwKeyReg - 3000, dwKeyReg + 3000);
+
+    for (int i = 0; i < sizeof(astFn) / sizeof(astFn[0]); i++) {
+        uint8_t abBurst[8] = { 0x3C, 0xAA, 0xBB, 0x12, 0x34, 0xCC, 0xDD, 0xEE };
+        uint8_t abKs[8];
+        tea1_inner(tea1_expand_iv(build_iv(&astFn[i])), dwKeyReg, sizeof(abKs), abKs);
+        for (int j = 0; j < sizeof(abBurst); j++) {
+            abBurst[j] ^= abKs[j];
+        }
+
+        // The first burst only carries the partial byte, later bursts carry everything
+        KptRecord stRecord = { astFn[i], i == 0 ? 1 : sizeof(abBurst), abBurst };
+        int bChanged = kpt_push(&stHarvester, &stRecord);
+        bSuccess &= (bChanged == (i < 3));
+        bSuccess &= (kpt_feed_search(&stHarvester, &stSearch) == bChanged);
+        tea1_search_run(&stSearch, 2000);
+    }
+    while (!tea1_search_done(&stSearch)) {
+        tea1_search_run(&stSearch, 2000);
+    }
+
+    bSuccess &= (stSearch.dwNumHits == 1 && stSearch.lpdwHits[0] == dwKeyReg);
+    bSuccess &= (stSearch.dwNumFilters == 3 && tea1_filter_known_bits(&stSearch.astFilters[0]) == 20);
+    tea1_search_free(&stSearch);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+static int test_fn_equal(const FrameNumbers *a, const FrameNumbers *b) {
+    return a->tn == b->tn && a->fn == b->fn && a->mn == b->mn && a->hn == b->hn && a->dir == b->dir;
+}
+
+void test_ivsync() {
+    const char *lpTag = "frame number sync";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t bSuccess = 1;
+    uint8_t abKey[10] = { 0xA7, 0x98, 0x39, 0xE4, 0xBA, 0x88, 0xEE, 0x54, 0xA0, 0x29 };
+    WORKPOOL *lpPool = workpool_create(3, 0);
+
+    // Slot arithmetic wraps multiframes, hyperframes and the 15-bit hn
+    FrameNumbers stFn = { 4, 18, 60, 0x7FFF, 1 }, stNext;
+    ivsync_advance(&stFn, 1, &stNext);
+    bSuccess &= (stNext.tn == 1 && stNext.fn == 1 && stNext.mn == 1 && stNext.hn == 0 && stNext.dir == 1);
+    ivsync_advance(&stNext, -1, &stNext);
+    bSuccess &= test_fn_equal(&stNext, &stFn);
+
+    // Two bursts 3 frames and a timeslot apart across a hyperframe boundary, the second one half a slot in
+    FrameNumbers stTruth = { 2, 17, 60, 201, 0 }, stSecond;
+    int32_t dwOffset = 3 * 4 + 1;
+    ivsync_advance(&stTruth, dwOffset, &stSecond);
+    bSuccess &= (stSecond.tn == 3 && stSecond.fn == 2 && stSecond.mn == 1 && stSecond.hn == 202);
+
+    for (uint32_t dwTeaType = 1; dwTeaType <= 3 && lpPool; dwTeaType++) {
+        IvsyncBurst astBursts[2];
+        uint8_t abKs[54];
+        memset(astBursts, 0, sizeof(astBursts));
+        for (int b = 0; b < 2; b++) {
+            FrameNumbers stBurstFn = b ? stSecond : stTruth;
+            if (dwTeaType == 1) tea1(build_iv(&stBurstFn), abKey, 54, abKs);
+            if (dwTeaType == 2) tea2(build_iv(&stBurstFn), abKey, 54, abKs);
+            if (dwTeaType == 3) tea3(build_iv(&stBurstFn), abKey, 54, abKs);
+            uint32_t dwFirst = b ? 27 : 0;
+            for (uint32_t i = dwFirst; i < dwFirst + 5; i++) {
+                astBursts[b].abKs[i] = abKs[i] & 0xF0;
+                astBursts[b].abMask[i] = 0xF0;
+            }
+            astBursts[b].dwNumKsBytes = dwFirst + 5;
+        }
+        astBursts[1].dwSlotOffset = dwOffset;
+
+        // tn and dir known, the rest only roughly
+        FrameNumbers stMin = { 2, 1, 55, 0, 0 }, stMax = { 2, 18, 60, 255, 0 };
+        IVSYNC_CTX stSeq, stPar;
+        bSuccess &= (ivsync_init(&stSeq, dwTeaType, abKey, astBursts, 2, &stMin, &stMax) == 0 && stSeq.qwNumCandidates == 18 * 6 * 256);
+        bSuccess &= (ivsync_init(&stPar, dwTeaType, abKey, astBursts, 2, &stMin, &stMax) == 0);
+        while (!ivsync_done(&stSeq)) {
+            ivsync_run(&stSeq, 5000);
+        }
+        while (!ivsync_done(&stPar)) {
+            ivsync_run_parallel(&stPar, lpPool, 10000);
+        }
+        bSuccess &= (stSeq.dwNumHits == 1 && stPar.dwNumHits == 1);
+        bSuccess &= bSuccess && test_fn_equal(&stSeq.lpHits[0].stFn, &stTruth);
+        bSuccess &= bSuccess && (stSeq.lpHits[0].qwIndex == stPar.lpHits[0].qwIndex);
+        ivsync_free(&stSeq);
+        ivsync_free(&stPar);
+
+        // A single nibble matches about 1 in 16 IVs, in the same order sequentially and in parallel
+        if (dwTeaType == 1) {
+            FrameNumbers stAllMin, stAllMax;
+            ivsync_space_all(&stAllMin, &stAllMax);
+            stAllMax.hn = 3;
+            astBursts[0].dwNumKsBytes = 1;
+            bSuccess &= (ivsync_init_tea1_reg(&stSeq, tea1_init_key_register(abKey), astBursts, 1, &stAllMin, &stAllMax) == 0);
+            bSuccess &= (ivsync_init_tea1_reg(&stPar, tea1_init_key_register(abKey), astBursts, 1, &stAllMin, &stAllMax) == 0);
+            ivsync_run(&stSeq, ~0ULL);
+            ivsync_run_parallel(&stPar, lpPool, ~0ULL);
+            bSuccess &= (ivsync_done(&stSeq) && ivsync_done(&stPar) && stSeq.dwNumHits > 1000 && stSeq.dwNumHits == stPar.dwNumHits);
+            for (uint32_t i = 0; i < stSeq.dwNumHits && bSuccess; i++) {
+                bSuccess &= (stSeq.lpHits[i].qwIndex == stPar.lpHits[i].qwIndex && test_fn_equal(&stSeq.lpHits[i].stFn, &stPar.lpHits[i].stFn));
+            }
+            ivsync_free(&stSeq);
+            ivsync_free(&stPar);
+        }
+    }
+    bSuccess &= (lpPool != NULL);
+    if (lpPool) {
+        workpool_destroy(lpPool);
+    }
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+static void test_target(Tea1Filter *lpTarget, FrameNumbers *lpFn, uint32_t dwKeyReg, uint32_t dwNumKsBytes) {
+    memset(lpTarget, 0, sizeof(*lpTarget));
+    lpTarget->dwIv = build_iv(lpFn);
+    lpTarget->dwNumKsBytes = dwNumKsBytes;
+    tea1_inner(tea1_expand_iv(lpTarget->dwIv), dwKeyReg, dwNumKsBytes, lpTarget->abKs);
+    memset(lpTarget->abMask, 0xFF, dwNumKsBytes);
+}
+
+void test_tea1_targets() {
+    const char *lpTag = "TEA1 multi-target search";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    enum { NUM_TARGETS = 56, SPAN = 20000 };
+    FrameNumbers stFnA = { 1, 6, 30, 110, 0 }, stFnB = { 3, 2, 17, 4021, 1 };
+    uint32_t dwBase = 0x5EED0000;
+    static Tea1Filter astTargets[NUM_TARGETS];
+    uint32_t adwKeys[NUM_TARGETS];
+    uint8_t bSuccess = 1;
+
+    // Two full groups with 4 and 3 known bytes, a partially known target, a duplicate and one key out of range
+    for (int i = 0; i < NUM_TARGETS; i++) {
+        adwKeys[i] = dwBase + (uint32_t)((i * 2654435761u) % (2 * SPAN)) - SPAN;
+        if (i < 40) {
+            test_target(&astTargets[i], &stFnA, adwKeys[i], 6);
+        } else {
+            test_target(&astTargets[i], &stFnB, adwKeys[i], 3);
+        }
+    }
+    astTargets[50].abMask[0] = 0xF0;
+    astTargets[50].abMask[2] = 0x3C;
+    adwKeys[51] = adwKeys[7];
+    astTargets[51] = astTargets[7];
+    adwKeys[52] = dwBase + 3 * SPAN;
+    test_target(&astTargets[52], &stFnB, adwKeys[52], 5);
+
+    TEA1_TARGETS_CTX stSeq, stPar;
+    WORKPOOL *lpPool = workpool_create(3, 0);
+    bSuccess &= (tea1_targets_init_range(&stSeq, astTargets, NUM_TARGETS, dwBase - SPAN, dwBase + SPAN) == 0);
+    bSuccess &= (tea1_targets_init_range(&stPar, astTargets, NUM_TARGETS, dwBase - SPAN, dwBase + SPAN) == 0);
+    bSuccess &= (stSeq.dwNumGroups == 4 && stSeq.qwNumCandidates == 4 * 2 * SPAN);
+    while (!tea1_targets_done(&stSeq)) {
+        tea1_targets_run(&stSeq, 30000);
+    }
+    while (lpPool && !tea1_targets_done(&stPar)) {
+        tea1_targets_run_parallel(&stPar, lpPool, 100000);
+    }
+    bSuccess &= (stSeq.dwNumHits == stPar.dwNumHits);
+    bSuccess &= (memcmp(stSeq.lpHits, stPar.lpHits, stSeq.dwNumHits * sizeof(Tea1TargetHit)) == 0);
+
+    // Every target in range finds its key, and every hit passes all known bits
+    for (int i = 0; i < NUM_TARGETS; i++) {
+        int bFound = 0;
+        for (uint32_t h = 0; h < stSeq.dwNumHits; h++) {
+            bFound |= (stSeq.lpHits[h].dwTarget == i && stSeq.lpHits[h].dwKeyReg == adwKeys[i]);
+        }
+        bSuccess &= (bFound == (i != 52));
+    }
+    for (uint32_t h = 0; h < stSeq.dwNumHits; h++) {
+        bSuccess &= tea1_filter_match(&astTargets[stSeq.lpHits[h].dwTarget], stSeq.lpHits[h].dwKeyReg);
+    }
+
+    // The partially known target finds exactly what a single-target search over the range finds
+    TEA1_SEARCH_CTX stSingle;
+    tea1_search_init_range(&stSingle, dwBase - SPAN, dwBase + SPAN);
+    tea1_search_set_filters(&stSingle, &astTargets[50], 1);
+    tea1_search_run(&stSingle, UINT64_MAX);
+    uint32_t dwNum50 = 0;
+    for (uint32_t h = 0; h < stSeq.dwNumHits; h++) {
+        if (stSeq.lpHits[h].dwTarget == 50) {
+            bSuccess &= (dwNum50 < stSingle.dwNumHits && stSeq.lpHits[h].dwKeyReg == stSingle.lpdwHits[dwNum50]);
+            dwNum50++;
+        }
+    }
+    bSuccess &= (dwNum50 == stSingle.dwNumHits && dwNum50 >= 1);
+    tea1_search_free(&stSingle);
+
+    tea1_targets_free(&stSeq);
+    tea1_targets_free(&stPar);
+    if (lpPool) {
+        workpool_destroy(lpPool);
+    }
+    bSuccess &= (lpPool != NULL);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+// Collects the multiples of 7, failing on the chunk holding *lpArg when it is set
+static int test_collect_sevens(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd,
+                               void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity) {
+    const uint64_t *lpqwFail = lpArg;
+    for (uint64_t n = qwBegin; n < qwEnd; n++) {
+        if (lpqwFail && n == *lpqwFail) {
+            return -1;
+        }
+        if (n % 7 == 0 && workpool_hits_append(lppHits, lpdwNum, lpdwCapacity, &n, sizeof(n))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int test_cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void test_workpool() {
+    const char *lpTag = "workpool search + batch";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    FrameNumbers stFn = { 1, 6, 30, 110, 0 };
+    uint32_t dwKeyReg = 0x00C0FFEE;
+    uint8_t bSuccess = 1;
+
+    WORKPOOL *lpPool = workpool_create(3, 0);
+    bSuccess &= (lpPool != NULL && workpool_num_workers(lpPool) == 3);
+
+    // Parallel and sequential sweeps over the same range agree
+    Tea1Filter stFilter = { build_iv(&stFn), 2, { 0 }, { 0xFF, 0x0F } };
+    tea1_inner(tea1_expand_iv(stFilter.dwIv), dwKeyReg, 2, stFilter.abKs);
+    stFilter.abKs[1] &= 0x0F;
+
+    TEA1_SEARCH_CTX stSeq, stPar;
+    tea1_search_init_range(&stSeq, dwKeyReg - 50000, dwKeyReg + 50000);
+    tea1_search_init_range(&stPar, dwKeyReg - 50000, dwKeyReg + 50000);
+    tea1_search_set_filters(&stSeq, &stFilter, 1);
+    tea1_search_set_filters(&stPar, &stFilter, 1);
+    tea1_search_run(&stSeq, UINT64_MAX);
+    while (!tea1_search_done(&stPar)) {
+        tea1_search_run_parallel(&stPar, lpPool, 30000);
+    }
+    bSuccess &= (stSeq.dwNumHits == stPar.dwNumHits && stSeq.dwNumHits >= 1);
+    bSuccess &= (memcmp(stSeq.lpdwHits, stPar.lpdwHits, stSeq.dwNumHits * sizeof(uint32_t)) == 0);
+    tea1_search_free(&stSeq);
+    tea1_search_free(&stPar);
+
+    // A start past the end, or past the keyspace, is an empty range rather than an underflow
+    tea1_search_init_range(&stSeq, dwKeyReg + 1000, dwKeyReg);
+    tea1_search_init_range(&stPar, TEA1_SEARCH_KEYSPACE + 5, UINT64_MAX);
+    tea1_search_set_filters(&stSeq, &stFilter, 1);
+    tea1_search_set_filters(&stPar, &stFilter, 1);
+    bSuccess &= (tea1_search_done(&stSeq) && tea1_search_run(&stSeq, UINT64_MAX) == 0 && stSeq.dwNumHits == 0);
+    bSuccess &= (tea1_search_done(&stPar) && tea1_search_run_parallel(&stPar, lpPool, UINT64_MAX) == 0 && stPar.dwNumHits == 0);
+    tea1_search_free(&stSeq);
+    tea1_search_free(&stPar);
+
+    // Batch keystream and HURDLE match the single-shot primitives
+    enum { NUM_LANES = 200, KS_BYTES = 12 };
+    static uint32_t adwIvs[NUM_LANES];
+    static uint8_t abKeys[NUM_LANES * 16], abBlocks[NUM_LANES * 8], abOut[NUM_LANES * KS_BYTES];
+    for (int i = 0; i < NUM_LANES; i++) {
+        adwIvs[i] = 0x01234567u * (i + 1);
+    }
+    for (int i = 0; i < sizeof(abKeys); i++) {
+        abKeys[i] = i * 7 + 3;
+    }
+    for (int i = 0; i < sizeof(abBlocks); i++) {
+        abBlocks[i] = i * 13 + 1;
+    }
+    for (uint32_t dwTeaType = 1; dwTeaType <= 3; dwTeaType++) {
+        batch_keystream(lpPool, dwTeaType, NUM_LANES, adwIvs, abKeys, KS_BYTES, abOut);
+        for (int i = 0; i < NUM_LANES; i++) {
+            uint8_t abKs[KS_BYTES];
+            if (dwTeaType == 1) tea1(adwIvs[i], &abKeys[i * 10], KS_BYTES, abKs);
+            if (dwTeaType == 2) tea2(adwIvs[i], &abKeys[i * 10], KS_BYTES, abKs);
+            if (dwTeaType == 3) tea3(adwIvs[i], &abKeys[i * 10], KS_BYTES, abKs);
+            bSuccess &= (memcmp(abKs, &abOut[i * KS_BYTES], KS_BYTES) == 0);
+        }
+    }
+    batch_hurdle(lpPool, NUM_LANES, abKeys, abBlocks, abOut, HURDLE_ENCRYPT);
+    for (int i = 0; i < NUM_LANES; i++) {
+        HURDLE_CTX stCipher;
+        uint8_t abBlock[8];
+        HURDLE_set_key(&abKeys[i * 16], &stCipher);
+        HURDLE_encrypt(abBlock, &abBlocks[i * 8], &stCipher, HURDLE_ENCRYPT);
+        bSuccess &= (memcmp(abBlock, &abOut[i * 8], 8) == 0);
+    }
+
+    // Collected hits are merged in order, and a failed pass leaves the earlier ones untouched
+    uint64_t *lpqwHits = NULL;
+    uint32_t dwNumHits = 0, dwCapacity = 0;
+    uint64_t qwFail = 150000;
+    bSuccess &= (workpool_run_collect(lpPool, 0, 100000, 1000, test_collect_sevens, NULL,
+                                      &lpqwHits, &dwNumHits, &dwCapacity, sizeof(uint64_t), test_cmp_u64) == 0);
+    bSuccess &= (dwNumHits == 14286);
+    for (uint32_t i = 0; i < dwNumHits && bSuccess; i++) {
+        bSuccess &= (lpqwHits[i] == i * 7ULL);
+    }
+    bSuccess &= (workpool_run_collect(lpPool, 100000, 200000, 1000, test_collect_sevens, &qwFail,
+                                      &lpqwHits, &dwNumHits, &dwCapacity, sizeof(uint64_t), test_cmp_u64) == -1);
+    bSuccess &= (dwNumHits == 14286);
+    free(lpqwHits);
+    workpool_destroy(lpPool);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_keysearch() {
+    const char *lpTag = "candidate generators + TEA2/3 search";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t bSuccess = 1;
+    uint8_t abKey[KEYGEN_KEY_LEN], abKeys[3 * KEYGEN_KEY_LEN];
+    KeyGenerator stGen;
+
+    // Mask: nibble and byte positions, last position fastest
+    bSuccess &= (keygen_mask_init(&stGen, "?h?d000000000000000?b") == -1);
+    bSuccess &= (keygen_mask_init(&stGen, "?h1?d00000000000000?b") == 0 && stGen.qwNumCandidates == 16 * 10 * 256);
+    stGen.fnFill(stGen.lpCtx, 256 * 10 + 255, 2, abKeys);
+    static const uint8_t abMaskKeys[] = { 0x11, 0x30, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0x11, 0x31, 0, 0, 0, 0, 0, 0, 0, 0x00 };
+    bSuccess &= (memcmp(abKeys, abMaskKeys, sizeof(abMaskKeys)) == 0);
+    keygen_free(&stGen);
+
+    // Seed models reproduce the C library generators
+    srand(12345);
+    for (int i = 0; i < KEYGEN_KEY_LEN; i++) {
+        abKey[i] = rand() & 0xFF;
+    }
+    bSuccess &= (keygen_prng_init(&stGen, KEYGEN_PRNG_GLIBC, 12340, 10) == 0);
+    stGen.fnFill(stGen.lpCtx, 5, 1, abKeys);
+    bSuccess &= (memcmp(abKeys, abKey, KEYGEN_KEY_LEN) == 0);
+    keygen_free(&stGen);
+
+    // Wordlist with unusable lines, searched for two observations under different keys
+    static const uint8_t abKeyA[KEYGEN_KEY_LEN] = { 0xA7, 0x98, 0x39, 0xE4, 0xBA, 0x88, 0xEE, 0x54, 0xA0, 0x29 };
+    static const uint8_t abKeyB[KEYGEN_KEY_LEN] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA };
+    char szPath[] = "/tmp/keysearch_XXXXXX";
+    int fd = mkstemp(szPath);
+    FILE *lpFile = fd >= 0 ? fdopen(fd, "w") : NULL;
+    bSuccess &= (lpFile != NULL);
+    if (lpFile) {
+        fprintf(lpFile, "00000000000000000000\nnot a key\n\n112233445566778899aa\r\n");
+        for (int i = 0; i < 5000; i++) {
+            fprintf(lpFile, "%020x\n", i * 7919);
+        }
+        fprintf(lpFile, "A79839E4BA88EE54A029");
+        fclose(lpFile);
+    }
+
+    for (uint32_t dwTeaType = 2; dwTeaType <= 3; dwTeaType++) {
+        Tea1Filter astFilters[2] = {
+            { 0x01234567, 2, { 0 }, { 0xFF, 0xFF } },
+            { 0x12345678, 3, { 0 }, { 0xFF, 0xFF, 0xFF } },
+        };
+        uint8_t abKs[3];
+        if (dwTeaType == 2) tea2(astFilters[0].dwIv, (uint8_t *)abKeyA, 2, astFilters[0].abKs);
+        if (dwTeaType == 2) tea2(astFilters[1].dwIv, (uint8_t *)abKeyB, 3, astFilters[1].abKs);
+        if (dwTeaType == 3) tea3(astFilters[0].dwIv, (uint8_t *)abKeyA, 2, astFilters[0].abKs);
+        if (dwTeaType == 3) tea3(astFilters[1].dwIv, (uint8_t *)abKeyB, 3, astFilters[1].abKs);
+        memcpy(abKs, astFilters[1].abKs, 3);
+        bSuccess &= ((dwTeaType == 2 ? tea2_match : tea3_match)(astFilters[1].dwIv, abKeyB, abKs, astFilters[1].abMask, 3) == 1);
+        abKs[2] ^= 0x10;
+        bSuccess &= ((dwTeaType == 2 ? tea2_match : tea3_match)(astFilters[1].dwIv, abKeyB, abKs, astFilters[1].abMask, 3) == 0);
+
+        KEYSEARCH_CTX stSeq, stPar;
+        WORKPOOL *lpPool = workpool_create(3, 0);
+        bSuccess &= (keygen_wordlist_open(&stGen, szPath, KEYGEN_WORDLIST_HEX) == 0 && stGen.qwNumCandidates == 5003);
+        bSuccess &= (keysearch_init(&stSeq, dwTeaType, &stGen, astFilters, 2) == 0);
+        bSuccess &= (keysearch_init(&stPar, dwTeaType, &stGen, astFilters, 2) == 0);
+        Tea1Filter astBad[2] = { astFilters[0], astFilters[0] };
+        astBad[1].dwNumKsBytes = 0;
+        bSuccess &= (keysearch_init(&stSeq, dwTeaType, &stGen, astBad, 2) == -1);
+        astBad[1].dwNumKsBytes = TEA_KEY_STREAM_MAX_KS_BYTES + 1;
+        bSuccess &= (keysearch_init(&stSeq, dwTeaType, &stGen, astBad, 2) == -1);
+        bSuccess &= (keysearch_init(&stSeq, dwTeaType, &stGen, astFilters, 2) == 0);
+        while (!keysearch_done(&stSeq)) {
+            keysearch_run(&stSeq, 700);
+        }
+        while (!keysearch_done(&stPar) && lpPool) {
+            keysearch_run_parallel(&stPar, lpPool, 3000);
+        }
+        bSuccess &= (stSeq.dwNumHits == 2 && stPar.dwNumHits == 2);
+        bSuccess &= bSuccess && (memcmp(stSeq.lpHits, stPar.lpHits, 2 * sizeof(KeysearchHit)) == 0);
+        bSuccess &= bSuccess && (stSeq.lpHits[0].qwIndex == 1 && stSeq.lpHits[0].dwIv == 0x12345678 &&
+                                 memcmp(stSeq.lpHits[0].abKey, abKeyB, KEYGEN_KEY_LEN) == 0);
+        bSuccess &= bSuccess && (stSeq.lpHits[1].qwIndex == 5002 && stSeq.lpHits[1].dwFilter == 0 &&
+                                 memcmp(stSeq.lpHits[1].abKey, abKeyA, KEYGEN_KEY_LEN) == 0);
+        keysearch_free(&stSeq);
+        keysearch_free(&stPar);
+        keygen_free(&stGen);
+        if (lpPool) {
+            workpool_destroy(lpPool);
+        }
+    }
+    unlink(szPath);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+#define CARRIER_TEST_BURSTS (3 * 4 * 4 * 18 * 2)
+static CarrierBurst g_astCarrierOut[CARRIER_TEST_BURSTS];
+static uint32_t g_dwCarrierOutCount;
+
+static void test_carrier_output(void *lpArg, uint32_t dwWorker, const CarrierBurst *lpBurst) {
+    g_astCarrierOut[lpBurst->qwTag] = *lpBurst;
+    __atomic_fetch_add(&g_dwCarrierOutCount, 1, __ATOMIC_RELAXED);
+}
+
+void test_carrier_svc() {
+    const char *lpTag = "multi-carrier decrypt service";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t bSuccess = 1;
+    CarrierConfig astConfigs[3] = {
+        { 1, 0, { 0x01, 0x23 }, { 0x12, 0x34 }, 0x2A, { 0 }, { 0xA7, 0x98, 0x39, 0xE4, 0xBA, 0x88, 0xEE, 0x54, 0xA0, 0x29 } },
+        { 2, 1, { 0x0F, 0xED }, { 0 }, 0, { 0x12, 0x34, 0x56 }, { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA } },
+        { 3, 0, { 0x00, 0x42 }, { 0x3F, 0xFF }, 0x01, { 0 }, { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A } },
+    };
+
+    // Once in the middle of the hyperframe range and once across the wrap of hn from 0xFFFF to 0
+    static const uint16_t awFirstHn[2] = { 5, 0xFFFF };
+    for (int p = 0; p < 2 && bSuccess; p++) {
+        g_dwCarrierOutCount = 0;
+        CARRIER_SVC *lpSvc = carrier_svc_create(2, 0, test_carrier_output, NULL);
+        bSuccess &= (lpSvc != NULL);
+        for (int i = 0; i < 3 && lpSvc; i++) {
+            bSuccess &= (carrier_svc_add_carrier(lpSvc, &astConfigs[i]) == i);
+        }
+
+        // Two half bursts per frame across a multiframe wrap; only the first frame carries the hyperframe number
+        static const uint8_t abMn[4] = { 59, 60, 1, 2 };
+        uint32_t dwTag = 0;
+        for (int m = 0; m < 4 && lpSvc; m++) {
+            for (uint8_t fn = 1; fn <= 18; fn++) {
+                for (uint32_t dwCarrier = 0; dwCarrier < 3; dwCarrier++) {
+                    for (uint8_t tn = 1; tn <= 4; tn++) {
+                        for (int h = 0; h < 2; h++) {
+                            CarrierBurst stBurst = { dwCarrier, { tn, fn, abMn[m], awFirstHn[p], 0 }, m == 0 && fn == 1, 216 * h, 216, dwTag++ };
+                            memset(stBurst.abData, 0x5A + h, sizeof(stBurst.abData));
+                            bSuccess &= (carrier_svc_submit(lpSvc, &stBurst) == 0);
+                        }
+                    }
+                }
+            }
+        }
+        if (lpSvc) {
+            carrier_svc_flush(lpSvc);
+        }
+        bSuccess &= (g_dwCarrierOutCount == CARRIER_TEST_BURSTS);
+
+        for (uint32_t i = 0; i < CARRIER_TEST_BURSTS && bSuccess; i++) {
+            CarrierBurst *lpOut = &g_astCarrierOut[i];
+            CarrierConfig *lpConfig = &astConfigs[lpOut->dwCarrier];
+            uint8_t abEck[10], abKs[54], abExpected[27];
+            if (lpConfig->bSck) {
+                tb6(lpConfig->abKey, lpConfig->abCn, lpConfig->abSsi, abEck);
+            } else {
+                tb5(lpConfig->abCn, lpConfig->abLa, &lpConfig->bCc, lpConfig->abKey, abEck);
+            }
+            FrameNumbers stFn = lpOut->stFn;
+            stFn.hn = (stFn.mn >= 59) ? awFirstHn[p] : (uint16_t)(awFirstHn[p] + 1);
+            if (lpConfig->dwTeaType == 1) tea1(build_iv(&stFn), abEck, 54, abKs);
+            if (lpConfig->dwTeaType == 2) tea2(build_iv(&stFn), abEck, 54, abKs);
+            if (lpConfig->dwTeaType == 3) tea3(build_iv(&stFn), abEck, 54, abKs);
+            int h = lpOut->dwKsBitOffset / 216;
+            for (int j = 0; j < 27; j++) {
+                abExpected[j] = (0x5A + h) ^ abKs[27 * h + j];
+            }
+            bSuccess &= (lpOut->stFn.hn == stFn.hn && memcmp(lpOut->abData, abExpected, 27) == 0 && lpOut->abData[27] == 0x5A + h);
+        }
+
+        for (uint32_t dwCarrier = 0; dwCarrier < 3 && lpSvc; dwCarrier++) {
+            CarrierStats stStats;
+            bSuccess &= (carrier_svc_get_stats(lpSvc, dwCarrier, &stStats) == 0);
+            bSuccess &= (stStats.qwBursts == CARRIER_TEST_BURSTS / 3 && stStats.qwDropped == 0);
+            bSuccess &= (stStats.qwLate == 0 && stStats.qwSkippedFrames == 0);
+        }
+        if (lpSvc) {
+            carrier_svc_destroy(lpSvc);
+        }
+    }
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_keyhier() {
+    const char *lpTag = "key hierarchy rollover";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t bSuccess = 1;
+    KeyhierKeySet *lpSets = calloc(2, sizeof(KeyhierKeySet));
+    KeyhierCell astCells[2] = {
+        { 1, { 0x01, 0x23 }, { 0x12, 0x34 }, 0x2A, { 0x12, 0x34, 0x56 } },
+        { 2, { 0x0F, 0xED }, { 0x3F, 0xFF }, 0x01, { 0xAB, 0xCD, 0xEF } },
+    };
+    if (lpSets == NULL) {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+        return;
+    }
+    for (int s = 0; s < 2; s++) {
+        for (int i = 0; i < 10; i++) {
+            lpSets[s].abCck[i] = 0x10 * s + i;
+            lpSets[s].aabScks[4][i] = 0x40 + s + i;
+        }
+        lpSets[s].dwSckMask = 1 << 4;
+        lpSets[s].dwNumGroups = 40;
+        for (uint32_t g = 0; g < 40; g++) {
+            lpSets[s].adwGssis[g] = 1000 + 7 * ((g * 13) % 40);
+            for (int i = 0; i < 10; i++) {
+                lpSets[s].aabGcks[g][i] = g ^ (0x80 * s) ^ (i << 3);
+            }
+        }
+    }
+
+    KEYHIER *lpMgr = keyhier_create(&lpSets[0]);
+    bSuccess &= (lpMgr != NULL);
+    for (int c = 0; c < 2 && lpMgr; c++) {
+        bSuccess &= (keyhier_add_cell(lpMgr, &astCells[c]) == c);
+    }
+    if (lpMgr) {
+        bSuccess &= (keyhier_schedule(lpMgr, &lpSets[1], 100) == 0);
+        while (!keyhier_ready(lpMgr)) {
+            usleep(1000);
+        }
+    }
+
+    // Every key of both sets against the primitives, chosen by hyperframe, both before and after the rollover
+    for (int bRolled = 0; bRolled < 2 && lpMgr; bRolled++) {
+        keyhier_advance(lpMgr, bRolled ? 101 : 100);
+        for (uint32_t c = 0; c < 2; c++) {
+            KeyhierCell stCell = astCells[c];
+            for (int s = 0; s < 2; s++) {
+                uint16_t wHn = s ? 100 : 99;
+                KeyhierTeaKey stKey;
+                uint8_t abEck[10], abMgck[10];
+                int bExpectOld = (s == 0 && !bRolled);
+
+                tb5(stCell.abCn, stCell.abLa, &stCell.bCc, lpSets[bExpectOld ? 0 : 1].abCck, abEck);
+                bSuccess &= (keyhier_lookup(lpMgr, c, KEYHIER_CCK, 0, wHn, &stKey) == 0 && memcmp(stKey.abEck, abEck, 10) == 0);
+                bSuccess &= (stKey.dwTeaType == stCell.dwTeaType && (c || stKey.dwKeyReg == (uint32_t)tea1_init_key_register(abEck)));
+
+                tb6(lpSets[bExpectOld ? 0 : 1].aabScks[4], stCell.abCn, stCell.abSsi, abEck);
+                bSuccess &= (keyhier_lookup(lpMgr, c, KEYHIER_SCK, 5, wHn, &stKey) == 0 && memcmp(stKey.abEck, abEck, 10) == 0);
+                bSuccess &= (keyhier_lookup(lpMgr, c, KEYHIER_SCK, 4, wHn, &stKey) == -1);
+
+                for (uint32_t g = 0; g < 40; g++) {
+                    ta71(lpSets[bExpectOld ? 0 : 1].aabGcks[g], lpSets[bExpectOld ? 0 : 1].abCck, abMgck);
+                    tb5(stCell.abCn, stCell.abLa, &stCell.bCc, abMgck, abEck);
+                    bSuccess &= (keyhier_lookup(lpMgr, c, KEYHIER_GCK, lpSets[0].adwGssis[g], wHn, &stKey) == 0);
+                    bSuccess &= (memcmp(stKey.abEck, abEck, 10) == 0);
+                }
+                bSuccess &= (keyhier_lookup(lpMgr, c, KEYHIER_GCK, 1001, wHn, &stKey) == -1);
+
+                uint8_t abKs[20], abExpected[20];
+                keyhier_keystream(&stKey, 0x12345, sizeof(abKs), abKs);
+                if (c == 0) tea1(0x12345, abEck, sizeof(abExpected), abExpected);
+                if (c == 1) tea2(0x12345, abEck, sizeof(abExpected), abExpected);
+                bSuccess &= (memcmp(abKs, abExpected, sizeof(abKs)) == 0);
+            }
+        }
+    }
+
+    // A cell added after the rollover gets keys too, and nothing ever stalled
+    KeyhierStats stStats;
+    KeyhierTeaKey stKey;
+    if (lpMgr) {
+        bSuccess &= (keyhier_add_cell(lpMgr, &astCells[1]) == 2 && keyhier_lookup(lpMgr, 2, KEYHIER_GCK, 1007, 101, &stKey) == 0);
+        bSuccess &= (keyhier_lookup(lpMgr, 3, KEYHIER_CCK, 0, 101, &stKey) == -1);
+        keyhier_get_stats(lpMgr, &stStats);
+        bSuccess &= (stStats.qwStalls == 0 && stStats.qwRollovers == 1 && stStats.qwDerived == 5 * 42);
+
+        // Due before it is derived, a lookup derives its own key
+        keyhier_schedule(lpMgr, &lpSets[0], 200);
+        uint8_t abEck[10];
+        tb5(astCells[0].abCn, astCells[0].abLa, &astCells[0].bCc, lpSets[0].abCck, abEck);
+        bSuccess &= (keyhier_lookup(lpMgr, 0, KEYHIER_CCK, 0, 200, &stKey) == 0 && memcmp(stKey.abEck, abEck, 10) == 0);
+        keyhier_destroy(lpMgr);
+    }
+    free(lpSets);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_capture() {
+    const char *lpTag = "capture decrypt";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t bSuccess = 1;
+    char szPath[] = "/tmp/capture_XXXXXX";
+    int fd = mkstemp(szPath);
+    FILE *lpFile = fd >= 0 ? fdopen(fd, "w") : NULL;
+    bSuccess &= (lpFile != NULL);
+    if (lpFile) {
+        fprintf(lpFile, "# first record, type, key\n0 1 a79839e4ba88ee54a029\n\n700 0 00000000000000000000\n");
+        fprintf(lpFile, "900 2 112233445566778899AA\n1500 3 0102030405060708090a\n");
+        fclose(lpFile);
+    }
+    CaptureKeyChange *lpSchedule = NULL;
+    uint32_t dwNumChanges = 0, dwLine;
+    bSuccess &= (capture_load_schedule(szPath, &lpSchedule, &dwNumChanges, &dwLine) == 0 && dwNumChanges == 4);
+    bSuccess &= bSuccess && (lpSchedule[2].qwFirstRecord == 900 && lpSchedule[2].dwTeaType == 2 && lpSchedule[2].abKey[9] == 0xAA);
+    lpFile = fopen(szPath, "w");
+    if (lpFile) {
+        fprintf(lpFile, "5 1 a79839e4ba88ee54a029\n3 1 a79839e4ba88ee54a029\n");
+        fclose(lpFile);
+    }
+    CaptureKeyChange *lpBad;
+    uint32_t dwNumBad;
+    bSuccess &= (capture_load_schedule(szPath, &lpBad, &dwNumBad, &dwLine) == -1 && dwLine == 2);
+    unlink(szPath);
+
+    // Frames of one or two records of varying length and keystream offset
+    uint32_t dwNumRecords = 2000;
+    uint64_t qwLen = CAPTURE_FILE_HEADER_LEN + dwNumRecords * (CAPTURE_RECORD_HEADER_LEN + 64);
+    uint8_t *lpIn = calloc(1, qwLen), *lpOut = calloc(1, qwLen), *lpExpected = calloc(1, qwLen);
+    CaptureRecordHeader *lpHeaders = calloc(dwNumRecords, sizeof(CaptureRecordHeader));
+    bSuccess &= (lpIn && lpOut && lpExpected && lpHeaders && lpSchedule);
+    uint64_t qwOffset = CAPTURE_FILE_HEADER_LEN;
+    uint32_t dwFrame = 0;
+    for (uint32_t i = 0; i < dwNumRecords && bSuccess; i++) {
+        if (i % 3 != 1) {
+            dwFrame++;
+        }
+        CaptureRecordHeader stHeader = { 1 + dwFrame % 4, 1 + (dwFrame / 4) % 18, 1 + (dwFrame / 72) % 60, i & 1, 77, 1 + (i * 37) % 432, (i * 13) % 100, 0 };
+        memcpy(lpIn + qwOffset, &stHeader, CAPTURE_RECORD_HEADER_LEN);
+        lpHeaders[i] = stHeader;
+        qwOffset += CAPTURE_RECORD_HEADER_LEN;
+        for (int j = 0; j < (stHeader.wBitLen + 7) / 8; j++) {
+            lpIn[qwOffset++] = i + j;
+        }
+    }
+    qwLen = qwOffset;
+    memcpy(lpIn, CAPTURE_MAGIC "\x01\0\0\0\0\0\0\0", CAPTURE_FILE_HEADER_LEN);
+
+    // Reference: one keystream per record, xored bit by bit
+    if (bSuccess) {
+        memcpy(lpExpected, lpIn, qwLen);
+    }
+    qwOffset = CAPTURE_FILE_HEADER_LEN;
+    for (uint32_t i = 0, k = 0; i < dwNumRecords && bSuccess; i++) {
+        CaptureRecordHeader *lpHeader = &lpHeaders[i];
+        uint8_t *lpPayload = lpExpected + qwOffset + CAPTURE_RECORD_HEADER_LEN;
+        qwOffset += CAPTURE_RECORD_HEADER_LEN + (lpHeader->wBitLen + 7) / 8;
+        while (k + 1 < dwNumChanges && lpSchedule[k + 1].qwFirstRecord <= i) {
+            k++;
+        }
+        uint8_t abKs[100];
+        FrameNumbers stFn = { lpHeader->tn, lpHeader->fn, lpHeader->mn, lpHeader->hn, lpHeader->dir };
+        uint32_t dwNumKsBytes = (lpHeader->wKsBitOffset + lpHeader->wBitLen + 7) / 8;
+        switch (lpSchedule[k].dwTeaType) {
+        case 0: continue;
+        case 1: tea1(build_iv(&stFn), lpSchedule[k].abKey, dwNumKsBytes, abKs); break;
+        case 2: tea2(build_iv(&stFn), lpSchedule[k].abKey, dwNumKsBytes, abKs); break;
+        case 3: tea3(build_iv(&stFn), lpSchedule[k].abKey, dwNumKsBytes, abKs); break;
+        }
+        for (uint32_t b = 0; b < lpHeader->wBitLen; b++) {
+            uint32_t dwKsBit = lpHeader->wKsBitOffset + b;
+            lpPayload[b / 8] ^= ((abKs[dwKsBit / 8] >> (7 - dwKsBit % 8)) & 1) << (7 - b % 8);
+        }
+    }
+
+    // Sequential with the default chunk size, parallel with many small chunks, and in place
+    CaptureSummary stSummary;
+    WORKPOOL *lpPool = workpool_create(3, 0);
+    bSuccess &= bSuccess && (capture_decrypt(NULL, lpIn, lpOut, qwLen, lpSchedule, dwNumChanges, 0, &stSummary) == 0);
+    bSuccess &= bSuccess && (stSummary.qwRecords == dwNumRecords && stSummary.qwKeystreams < stSummary.qwRecords);
+    bSuccess &= bSuccess && (memcmp(lpOut, lpExpected, qwLen) == 0);
+    if (bSuccess) {
+        memset(lpOut, 0, qwLen);
+    }
+    bSuccess &= bSuccess && (capture_decrypt(lpPool, lpIn, lpOut, qwLen, lpSchedule, dwNumChanges, 500, &stSummary) == 0);
+    bSuccess &= bSuccess && (memcmp(lpOut, lpExpected, qwLen) == 0);
+    bSuccess &= bSuccess && (capture_decrypt(lpPool, lpIn, lpIn, qwLen, lpSchedule, dwNumChanges, 300, &stSummary) == 0);
+    bSuccess &= bSuccess && (memcmp(lpIn, lpExpected, qwLen) == 0);
+
+    // Truncated capture and out of range frame numbers
+    bSuccess &= bSuccess && (capture_decrypt(lpPool, lpExpected, lpOut, qwLen - 1, lpSchedule, dwNumChanges, 0, &stSummary) == -1);
+    bSuccess &= bSuccess && (stSummary.qwErrorOffset > CAPTURE_FILE_HEADER_LEN);
+    if (bSuccess) {
+        lpExpected[CAPTURE_FILE_HEADER_LEN + 1] = 19;
+    }
+    bSuccess &= bSuccess && (capture_decrypt(lpPool, lpExpected, lpOut, qwLen, lpSchedule, dwNumChanges, 0, &stSummary) == -1);
+    bSuccess &= bSuccess && (stSummary.qwErrorOffset == CAPTURE_FILE_HEADER_LEN);
+
+    if (lpPool) {
+        workpool_destroy(lpPool);
+    }
+    free(lpHeaders);
+    free(lpExpected);
+    free(lpOut);
+    free(lpIn);
+    free(lpSchedule);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_ks_shm() {
+    const char *lpTag = "shared memory keystream daemon";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t bSuccess = 1;
+    uint8_t abKey2[10] = { 0xA7, 0x98, 0x39, 0xE4, 0xBA, 0x88, 0xEE, 0x54, 0xA0, 0x29 };
+    uint8_t abKey1[10] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA };
+    uint8_t abKs[KS_SHM_MAX_KS_BYTES], abExpected[KS_SHM_MAX_KS_BYTES];
+    KsShmClientStats stStatsA, stStatsB, stStatsC;
+    KsShmServerStats stServerStats;
+    char szShm[64], szSocket[64];
+
+    snprintf(szShm, sizeof(szShm), "/tetra_ks_test.%d", (int)getpid());
+    snprintf(szSocket, sizeof(szSocket), "/tmp/tetra_ks_test.%d.sock", (int)getpid());
+    KS_SHM_SERVER *lpServer = ks_shm_server_create(szShm, szSocket, 2);
+    KS_SHM_CLIENT *lpA = ks_shm_client_open(szShm, szSocket);
+    KS_SHM_CLIENT *lpB = ks_shm_client_open(szShm, szSocket);
+    bSuccess &= (lpServer && lpA && lpB && ks_shm_client_connected(lpA) && ks_shm_client_connected(lpB));
+
+    if (bSuccess) {
+        // Both clients load the same key: A's request fills the cache, B reads it without asking
+        int iA = ks_shm_client_load_key(lpA, 2, abKey2);
+        int iB = ks_shm_client_load_key(lpB, 2, abKey2);
+        int iA1 = ks_shm_client_load_key(lpA, 1, abKey1);
+        tea2(0x1234, abKey2, 54, abExpected);
+        bSuccess &= (ks_shm_client_keystream(lpA, iA, 0x1234, 54, abKs) == 0 && !memcmp(abKs, abExpected, 54));
+        bSuccess &= (ks_shm_client_keystream(lpB, iB, 0x1234, 30, abKs) == 0 && !memcmp(abKs, abExpected, 30));
+        tea1(0x1234, abKey1, 20, abExpected);
+        bSuccess &= (ks_shm_client_keystream(lpA, iA1, 0x1234, 20, abKs) == 0 && !memcmp(abKs, abExpected, 20));
+        bSuccess &= (ks_shm_client_keystream(lpA, iA1, 0x1234, KS_SHM_MAX_KS_BYTES + 1, abKs) == -1);
+
+        // The key outlives A's unload while B holds it
+        bSuccess &= (ks_shm_client_unload_key(lpA, iA) == 0 && ks_shm_client_unload_key(lpA, iA) == -1);
+        tea2(0x5678, abKey2, 54, abExpected);
+        bSuccess &= (ks_shm_client_keystream(lpB, iB, 0x5678, 54, abKs) == 0 && !memcmp(abKs, abExpected, 54));
+
+        ks_shm_client_get_stats(lpA, &stStatsA);
+        ks_shm_client_get_stats(lpB, &stStatsB);
+        ks_shm_server_get_stats(lpServer, &stServerStats);
+        bSuccess &= (stStatsA.qwRequests == 2 && stStatsA.qwCacheHits == 0 && stStatsA.qwLocal == 0);
+        bSuccess &= (stStatsB.qwRequests == 1 && stStatsB.qwCacheHits == 1 && stStatsB.qwLocal == 0);
+        bSuccess &= (stServerStats.qwRequests == 3 && stServerStats.qwRejected == 0);
+
+        // A daemon stalled past the deadline: B generates locally and stays connected, the worker frees the slot when done
+        ks_shm_server_set_delay(lpServer, 3 * KS_SHM_TIMEOUT_NS / 1000);
+        tea2(0x7777, abKey2, 54, abExpected);
+        bSuccess &= (ks_shm_client_keystream(lpB, iB, 0x7777, 54, abKs) == 0 && !memcmp(abKs, abExpected, 54));
+        ks_shm_client_get_stats(lpB, &stStatsB);
+        bSuccess &= (ks_shm_client_connected(lpB) && stStatsB.qwLocal == 1);
+        ks_shm_server_set_delay(lpServer, 0);
+        for (int i = 0; i < 100 && stServerStats.qwAbandoned == 0; i++) {
+            usleep(10000);
+            ks_shm_server_get_stats(lpServer, &stServerStats);
+        }
+        bSuccess &= (stServerStats.qwAbandoned == 1);
+
+        // After that the daemon serves B again, through a full round of the slots
+        for (uint32_t i = 0; i < KS_SHM_NUM_SLOTS + 1; i++) {
+            tea2(0x8000 + i, abKey2, 20, abExpected);
+            bSuccess &= (ks_shm_client_keystream(lpB, iB, 0x8000 + i, 20, abKs) == 0 && !memcmp(abKs, abExpected, 20));
+        }
+        ks_shm_client_get_stats(lpB, &stStatsB);
+        bSuccess &= (stStatsB.qwRequests == 1 + KS_SHM_NUM_SLOTS + 1 && stStatsB.qwLocal == 1);
+
+        // Once the daemon is gone the client times out once and then generates locally
+        ks_shm_server_destroy(lpServer);
+        lpServer = NULL;
+        tea2(0x9ABC, abKey2, 54, abExpected);
+        bSuccess &= (ks_shm_client_keystream(lpB, iB, 0x9ABC, 54, abKs) == 0 && !memcmp(abKs, abExpected, 54));
+        bSuccess &= (ks_shm_client_keystream(lpB, iB, 0x9ABC, 54, abKs) == 0 && !memcmp(abKs, abExpected, 54));
+        ks_shm_client_get_stats(lpB, &stStatsB);
+        bSuccess &= (!ks_shm_client_connected(lpB) && stStatsB.qwLocal == 3);
+    }
+
+    // No daemon at all
+    KS_SHM_CLIENT *lpC = ks_shm_client_open("/tetra_ks_test.absent", "/tmp/tetra_ks_test.absent.sock");
+    int iC = ks_shm_client_load_key(lpC, 3, abKey2);
+    tea3(0x4242, abKey2, 40, abExpected);
+    bSuccess &= (!ks_shm_client_connected(lpC) && iC >= 0);
+    bSuccess &= (ks_shm_client_keystream(lpC, iC, 0x4242, 40, abKs) == 0 && !memcmp(abKs, abExpected, 40));
+    bSuccess &= (ks_shm_client_load_key(lpC, 4, abKey2) == -1 && ks_shm_client_keystream(lpC, iC + 1, 0x4242, 40, abKs) == -1);
+    ks_shm_client_get_stats(lpC, &stStatsC);
+    bSuccess &= (stStatsC.qwLocal == 1);
+
+    ks_shm_client_close(lpC);
+    if (lpA) ks_shm_client_close(lpA);
+    if (lpB) ks_shm_client_close(lpB);
+    if (lpServer) ks_shm_server_destroy(lpServer);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+static uint64_t test_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+void test_jobsrv_slow_client() {
+    const char *lpTag = "job server + dripping client";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    JobsrvJob stJob;
+    JobsrvJobStatus stStatus;
+    FrameNumbers stFn = { 2, 9, 41, 1234, 0 };
+    struct sockaddr_un stAddr;
+    uint8_t bSuccess = 1;
+
+    memset(&stAddr, 0, sizeof(stAddr));
+    stAddr.sun_family = AF_UNIX;
+    snprintf(stAddr.sun_path, sizeof(stAddr.sun_path), "/tmp/tetra_jobs_slow.%d.sock", (int)getpid());
+    memset(&stJob, 0, sizeof(stJob));
+    stJob.eType = JOBSRV_TEA1_SEARCH;
+    stJob.qwNumUnits = 1000;
+    stJob.stSearch.dwNumFilters = 1;
+    test_target(&stJob.stSearch.astFilters[0], &stFn, 17, 2);
+
+    JOBSRV_SERVER *lpServer = jobsrv_server_create(stAddr.sun_path, NULL);
+    JOBSRV_CLIENT *lpClient = jobsrv_client_connect(stAddr.sun_path);
+    int iJob = lpClient ? jobsrv_client_submit(lpClient, &stJob) : -1;
+    int fdSlow = socket(AF_UNIX, SOCK_STREAM, 0);
+    bSuccess &= (lpServer && iJob >= 0 && fdSlow >= 0 && connect(fdSlow, (struct sockaddr *)&stAddr, sizeof(stAddr)) == 0);
+
+    // A status request one byte every 150 ms, each byte well within any per-recv timeout; the other client is served all along
+    uint32_t adwRequest[3] = { 2, sizeof(int32_t), iJob };
+    uint64_t qwSlowest = 0;
+    for (uint32_t i = 0; bSuccess && i < sizeof(adwRequest); i++) {
+        send(fdSlow, (uint8_t *)adwRequest + i, 1, MSG_NOSIGNAL);
+        uint64_t qwStart = test_now_ms();
+        bSuccess &= (jobsrv_client_status(lpClient, iJob, &stStatus) == 0);
+        qwSlowest = test_now_ms() - qwStart > qwSlowest ? test_now_ms() - qwStart : qwSlowest;
+        usleep(150000);
+    }
+    bSuccess &= (qwSlowest < 500);
+
+    // The message missed its deadline, so the connection was closed instead of answered
+    struct pollfd stPoll = { fdSlow, POLLIN, 0 };
+    uint8_t abReply[64];
+    bSuccess &= (poll(&stPoll, 1, 2000) == 1 && recv(fdSlow, abReply, sizeof(abReply), 0) <= 0);
+
+    if (fdSlow >= 0) close(fdSlow);
+    if (lpClient) jobsrv_client_close(lpClient);
+    if (lpServer) jobsrv_server_destroy(lpServer);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+static pid_t test_jobsrv_worker(const char *lpszAddress) {
+    pid_t iPid = fork();
+    if (iPid == 0) {
+        JOBSRV_CLIENT *lpClient = jobsrv_client_connect(lpszAddress);
+        if (lpClient && jobsrv_client_set_output_dir(lpClient, "/tmp") == 0) {
+            jobsrv_client_work(lpClient, NULL, 1);
+            jobsrv_client_close(lpClient);
+        }
+        _exit(0);
+    }
+    return iPid;
+}
+
+void test_jobsrv_weak_filter() {
+    const char *lpTag = "job server + weak filter";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    JobsrvConfig stConfig = { 50, 300, 4096, 4096, 2 };
+    FrameNumbers stFn = { 2, 9, 41, 1234, 0 };
+    JobsrvJob stJob;
+    JobsrvJobStatus stStatus;
+    char szSocket[64];
+    uint8_t bSuccess = 1;
+
+    // One keystream byte matches every 256th key, so the first lease finds far more hits than it may report
+    snprintf(szSocket, sizeof(szSocket), "/tmp/tetra_jobs_weak.%d.sock", (int)getpid());
+    memset(&stJob, 0, sizeof(stJob));
+    stJob.eType = JOBSRV_TEA1_SEARCH;
+    stJob.qwNumUnits = 65536;
+    stJob.stSearch.dwNumFilters = 1;
+    test_target(&stJob.stSearch.astFilters[0], &stFn, 1234, 1);
+
+    JOBSRV_SERVER *lpServer = jobsrv_server_create(szSocket, &stConfig);
+    JOBSRV_CLIENT *lpClient = jobsrv_client_connect(szSocket);
+    int iJob = lpClient ? jobsrv_client_submit(lpClient, &stJob) : -1;
+    bSuccess &= (lpServer && iJob >= 0);
+    if (bSuccess) {
+        waitpid(test_jobsrv_worker(szSocket), NULL, 0);
+    }
+    bSuccess &= (jobsrv_client_status(lpClient, iJob, &stStatus) == 0 && stStatus.eState == JOBSRV_FAILED);
+    bSuccess &= (stStatus.qwNumHits == 2 && stStatus.dwActiveLeases == 0 && stStatus.qwUnitsDone < stJob.qwNumUnits);
+
+    if (lpClient) jobsrv_client_close(lpClient);
+    if (lpServer) jobsrv_server_destroy(lpServer);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+static int test_jobsrv_cmp_hits(const void *lpA, const void *lpB) {
+    const JobsrvHit *lpHitA = lpA, *lpHitB = lpB;
+    return lpHitA->qwUnit < lpHitB->qwUnit ? -1 : lpHitA->qwUnit > lpHitB->qwUnit;
+}
+
+void test_jobsrv() {
+    const char *lpTag = "job server + lease expiry";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    enum { SEARCH_KEYS = 60000, PRE_KEYS = 10000, PRE_BYTES = 8 };
+    FrameNumbers stFn = { 2, 9, 41, 1234, 0 };
+    uint32_t dwBase = 0x4B1D0000;
+    JobsrvConfig stConfig = { 50, 300, 2048, 16384 };
+    JobsrvJob stSearch, stPre, stBad;
+    JobsrvJobStatus stStatus;
+    JobsrvStats stStats;
+    static JobsrvHit astHits[64];
+    char szSocket[64], szPath[64];
+    uint8_t bSuccess = 1;
+
+    snprintf(szSocket, sizeof(szSocket), "/tmp/tetra_jobs_test.%d.sock", (int)getpid());
+    snprintf(szPath, sizeof(szPath), "/tmp/tetra_jobs_test.%d.ks", (int)getpid());
+    unlink(szPath);
+    bSuccess &= (jobsrv_server_create("0.0.0.0:7999", NULL) == NULL);
+
+    memset(&stSearch, 0, sizeof(stSearch));
+    stSearch.eType = JOBSRV_TEA1_SEARCH;
+    stSearch.qwStartKey = dwBase;
+    stSearch.qwNumUnits = SEARCH_KEYS;
+    stSearch.stSearch.dwNumFilters = 1;
+    test_target(&stSearch.stSearch.astFilters[0], &stFn, dwBase + 31337, 2);
+    memset(&stPre, 0, sizeof(stPre));
+    stPre.eType = JOBSRV_PRECOMPUTE;
+    stPre.qwStartKey = dwBase;
+    stPre.qwNumUnits = PRE_KEYS;
+    stPre.stPrecompute.dwIv = build_iv(&stFn);
+    stPre.stPrecompute.dwNumKsBytes = PRE_BYTES;
+    strcpy(stPre.stPrecompute.szPath, szPath + strlen("/tmp/"));
+    stBad = stSearch;
+    stBad.qwStartKey = TEA1_SEARCH_KEYSPACE - 10;
+
+    JOBSRV_SERVER *lpServer = jobsrv_server_create(szSocket, &stConfig);
+    JOBSRV_CLIENT *lpClient = jobsrv_client_connect(szSocket);
+    bSuccess &= (lpServer && lpClient);
+    int iSearch = lpClient ? jobsrv_client_submit(lpClient, &stSearch) : -1;
+    int iPre = lpClient ? jobsrv_client_submit(lpClient, &stPre) : -1;
+    bSuccess &= (iSearch >= 0 && iPre >= 0 && iSearch != iPre && jobsrv_client_submit(lpClient, &stBad) == -1);
+
+    // Output paths stay inside the workers' output directory
+    const char *alpszBadPaths[] = { "/tmp/x", "../x", "a/../../x", "..", "" };
+    for (int i = 0; i < 5; i++) {
+        JobsrvJob stEscape = stPre;
+        strcpy(stEscape.stPrecompute.szPath, alpszBadPaths[i]);
+        bSuccess &= (lpClient && jobsrv_client_submit(lpClient, &stEscape) == -1);
+    }
+
+    // Stop the first worker while it holds a lease; the lease expires and the others take it over
+    pid_t iStalled = bSuccess ? test_jobsrv_worker(szSocket) : -1;
+    for (int i = 0; iStalled > 0 && i < 1000; i++) {
+        if (jobsrv_client_status(lpClient, iSearch, &stStatus) == 0 && stStatus.dwActiveLeases) {
+            // A report sent just before the stop is taken along with the first status request, the second sees the result
+            kill(iStalled, SIGSTOP);
+            if (jobsrv_client_status(lpClient, iSearch, &stStatus) == 0 && jobsrv_client_status(lpClient, iSearch, &stStatus) == 0 &&
+                    stStatus.dwActiveLeases) {
+                break;
+            }
+            kill(iStalled, SIGCONT);
+        }
+        usleep(100);
+    }
+    pid_t aiWorkers[2] = { test_jobsrv_worker(szSocket), test_jobsrv_worker(szSocket) };
+    for (int i = 0; i < 2; i++) {
+        waitpid(aiWorkers[i], NULL, 0);
+    }
+    if (iStalled > 0) {
+        kill(iStalled, SIGCONT);
+        waitpid(iStalled, NULL, 0);
+    }
+
+    // Hits arrive in report order, in pages
+    uint32_t dwNumHits = 0;
+    int iNum;
+    while (lpClient && dwNumHits < 60 && (iNum = jobsrv_client_hits(lpClient, iSearch, dwNumHits, &astHits[dwNumHits], 3)) > 0) {
+        dwNumHits += iNum;
+    }
+    qsort(astHits, dwNumHits, sizeof(JobsrvHit), test_jobsrv_cmp_hits);
+
+    TEA1_SEARCH_CTX stSeq;
+    tea1_search_init_range(&stSeq, dwBase, dwBase + SEARCH_KEYS);
+    tea1_search_set_filters(&stSeq, stSearch.stSearch.astFilters, 1);
+    tea1_search_run(&stSeq, UINT64_MAX);
+    bSuccess &= (dwNumHits == stSeq.dwNumHits && dwNumHits >= 1);
+    for (uint32_t i = 0; i < dwNumHits && i < stSeq.dwNumHits; i++) {
+        bSuccess &= (astHits[i].dwValue == stSeq.lpdwHits[i] && astHits[i].qwUnit == stSeq.lpdwHits[i] - dwBase);
+    }
+    tea1_search_free(&stSeq);
+
+    bSuccess &= (jobsrv_client_status(lpClient, iSearch, &stStatus) == 0 && stStatus.eState == JOBSRV_DONE);
+    bSuccess &= (stStatus.qwUnitsDone == SEARCH_KEYS && stStatus.qwNumHits == dwNumHits && stStatus.dwActiveLeases == 0);
+    bSuccess &= (stStatus.qwUnitsPerSec > 0);
+    bSuccess &= (jobsrv_client_status(lpClient, iPre, &stStatus) == 0 && stStatus.eState == JOBSRV_DONE);
+
+    // The precomputed file holds every key's keystream at its slot
+    FILE *lpFile = fopen(szPath, "rb");
+    static uint8_t abFile[PRE_KEYS * PRE_BYTES];
+    bSuccess &= (lpFile && fread(abFile, 1, sizeof(abFile), lpFile) == sizeof(abFile) && fgetc(lpFile) == EOF);
+    uint64_t qwIvReg = tea1_expand_iv(build_iv(&stFn));
+    for (uint32_t i = 0; i < PRE_KEYS; i += 997) {
+        uint8_t abKs[PRE_BYTES];
+        tea1_inner(qwIvReg, dwBase + i, PRE_BYTES, abKs);
+        bSuccess &= !memcmp(abKs, &abFile[i * PRE_BYTES], PRE_BYTES);
+    }
+    if (lpFile) {
+        fclose(lpFile);
+    }
+    unlink(szPath);
+
+    // The stalled worker's report came too late and was dropped
+    if (lpServer) {
+        jobsrv_server_get_stats(lpServer, &stStats);
+        bSuccess &= (stStats.qwExpired >= 1 && stStats.qwLateReports >= 1 && stStats.qwUnitsDone == SEARCH_KEYS + PRE_KEYS);
+    }
+    bSuccess &= (jobsrv_client_remove(lpClient, iSearch) == 0 && jobsrv_client_remove(lpClient, iSearch) == -1);
+    bSuccess &= (jobsrv_client_status(lpClient, iSearch, &stStatus) == -1);
+
+    if (lpClient) jobsrv_client_close(lpClient);
+    if (lpServer) jobsrv_server_destroy(lpServer);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+static int test_trafgen_stop(void *lpArg, const TrafgenBurst *lpBurst) {
+    return ++*(uint32_t *)lpArg == 5;
+}
+
+void test_trafgen() {
+    const char *lpTag = "trafgen";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    // Starts in the last frame of hyperframe 5 and rolls over every hyperframe
+    TrafgenConfig stConfig = { 0x5EED, { 1, 18, 60, 5, 1 }, 1, 300, 4, { 0xDE, 0xAD, 0xBE, 0xEF }, 0 };
+    TrafgenCarrier astCarriers[3] = {
+        { 1, 0, { 0x01, 0x23 }, { 0x12, 0x34 }, 0x05, { 0 }, 4 },
+        { 2, 1, { 0x0F, 0xFF }, { 0x3F, 0xFF }, 0x3F, { 0xAB, 0xCD, 0xEF }, 2 },
+        { 3, 0, { 0x00, 0x07 }, { 0x00, 0x01 }, 0x00, { 0 }, 1 },
+    };
+    static TrafgenBurst astBursts[8 * 3];
+    static uint8_t abCapture[CAPTURE_FILE_HEADER_LEN + 8 * 3 * (CAPTURE_RECORD_HEADER_LEN + TRAFGEN_MAX_BURST_BYTES)];
+    CaptureKeyChange astSchedule[8 * 3];
+    uint32_t dwNumBursts = 0, dwCaptureLen = CAPTURE_FILE_HEADER_LEN;
+    uint8_t bSuccess = 1;
+
+    TrafgenCarrier stBad = astCarriers[0];
+    stBad.abCn[0] = 0x10;
+    bSuccess &= (trafgen_create(&stConfig, &stBad, 1) == NULL);
+
+    TRAFGEN *lpGen = trafgen_create(&stConfig, astCarriers, 3);
+    bSuccess &= (lpGen != NULL);
+    trafgen_capture_header(abCapture);
+
+    // Two hyperframe boundaries' worth of timeslots: 3 + 2 + 1 + 1 bursts per frame
+    for (int t = 0; t < 8 && bSuccess; t++) {
+        uint32_t dwNum = trafgen_tick(lpGen, &astBursts[dwNumBursts]);
+        bSuccess &= (dwNum == (t % 4 == 0 ? 3 : t % 4 == 1 ? 2 : 1));
+        for (uint32_t i = dwNumBursts; i < dwNumBursts + dwNum && bSuccess; i++) {
+            TrafgenBurst *lpBurst = &astBursts[i];
+            TrafgenCarrier *lpCarrier = &astCarriers[lpBurst->dwCarrier];
+            FrameNumbers stFn = t < 4 ? (FrameNumbers){ t + 1, 18, 60, 5, 1 } : (FrameNumbers){ t - 3, 1, 1, 6, 1 };
+            bSuccess &= (lpBurst->stFn.tn == stFn.tn && lpBurst->stFn.fn == stFn.fn && lpBurst->stFn.mn == stFn.mn && lpBurst->stFn.hn == stFn.hn);
+            bSuccess &= (lpBurst->stFn.dir == 1 && lpBurst->dwGeneration == t / 4 && lpBurst->qwSeq == i);
+
+            // ECK from the key set the generator reports, as the cell would derive it
+            KeyhierKeySet stKeys;
+            uint8_t abEck[10], abExpectedEck[10], abKs[38], abPlaintext[38];
+            bSuccess &= (trafgen_key_set(lpGen, lpBurst->dwGeneration, &stKeys) == 5 + lpBurst->dwGeneration);
+            if (lpCarrier->bSck) {
+                tb6(stKeys.aabScks[0], lpCarrier->abCn, lpCarrier->abSsi, abExpectedEck);
+            } else {
+                tb5(lpCarrier->abCn, lpCarrier->abLa, &lpCarrier->bCc, stKeys.abCck, abExpectedEck);
+            }
+            bSuccess &= (trafgen_eck(lpGen, lpBurst->dwCarrier, lpBurst->dwGeneration, abEck) == 0 && memcmp(abEck, abExpectedEck, 10) == 0);
+
+            switch (lpCarrier->dwTeaType) {
+            case 1: tea1(build_iv(&stFn), abEck, sizeof(abKs), abKs); break;
+            case 2: tea2(build_iv(&stFn), abEck, sizeof(abKs), abKs); break;
+            case 3: tea3(build_iv(&stFn), abEck, sizeof(abKs), abKs); break;
+            }
+            trafgen_plaintext(lpGen, lpBurst, abPlaintext);
+            abKs[37] &= 0xF0;
+            for (int j = 0; j < sizeof(abKs); j++) {
+                bSuccess &= ((lpBurst->abData[j] ^ abKs[j]) == abPlaintext[j]);
+            }
+            bSuccess &= (memcmp(abPlaintext, stConfig.abHeader, 4) == 0 && (abPlaintext[37] & 0x0F) == 0);
+
+            astSchedule[i] = (CaptureKeyChange){ i, lpCarrier->dwTeaType };
+            memcpy(astSchedule[i].abKey, abEck, 10);
+            dwCaptureLen += trafgen_capture_record(lpBurst, &abCapture[dwCaptureLen]);
+        }
+        dwNumBursts += dwNum;
+    }
+    bSuccess &= (dwNumBursts == 14 && astBursts[0].dwGeneration == 0 && astBursts[13].dwGeneration == 1);
+
+    // The capture decrypts back to the plaintext
+    CaptureSummary stSummary;
+    bSuccess &= bSuccess && (capture_decrypt(NULL, abCapture, abCapture, dwCaptureLen, astSchedule, dwNumBursts, 0, &stSummary) == 0);
+    bSuccess &= (stSummary.qwRecords == dwNumBursts);
+    for (uint32_t i = 0, dwOffset = CAPTURE_FILE_HEADER_LEN; i < dwNumBursts && bSuccess; i++) {
+        uint8_t abPlaintext[38];
+        trafgen_plaintext(lpGen, &astBursts[i], abPlaintext);
+        dwOffset += CAPTURE_RECORD_HEADER_LEN;
+        bSuccess &= (memcmp(&abCapture[dwOffset], abPlaintext, sizeof(abPlaintext)) == 0);
+        dwOffset += sizeof(abPlaintext);
+    }
+
+    uint32_t dwCalls = 0;
+    bSuccess &= bSuccess && (trafgen_run(lpGen, 100, test_trafgen_stop, &dwCalls) == 5 && dwCalls == 5);
+    if (lpGen) {
+        trafgen_destroy(lpGen);
+    }
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_sealsearch() {
+    const char *lpTag = "sealsearch";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t abKeys[4 * 16], abDcks[3 * 10];
+    uint8_t abGck[10] = { 0x63,0x09,0x5a,0xeb,0x26,0xf0,0xe7,0x26,0x28,0xd0 }, abGckN[2] = { 0x0e, 0x63 }, abGckVn[2] = { 0xbe, 0xc4 };
+    uint8_t abCck[10] = { 0x10,0x6a,0x40,0xc6,0xf7,0xb0,0x89,0xb7,0xac,0x41 }, abCckId[2] = { 0x00, 0x2a };
+    uint8_t abSealed[2 * SEALSEARCH_SEALED_LEN];
+    uint8_t bSuccess = 1;
+
+    for (int i = 0; i < sizeof(abKeys); i++) {
+        abKeys[i] = i * 29 + 3;
+    }
+    for (int i = 0; i < sizeof(abDcks); i++) {
+        abDcks[i] = i * 13 + 7;
+    }
+
+    // GCK and its GSKO sealed under key 2 with the same VN; two full sweeps, sequential and parallel, must agree
+    ta81(abGck, abGckVn, abGckN, &abKeys[2 * 16], abSealed);
+    ta81(abCck, abGckVn, abGckN, &abKeys[2 * 16], &abSealed[SEALSEARCH_SEALED_LEN]);
+    SEALSEARCH_CTX stSeq, stPar;
+    WORKPOOL *lpPool = workpool_create(3, 0);
+    bSuccess &= (lpPool != NULL);
+    bSuccess &= (sealsearch_init(&stSeq, SEALSEARCH_TA82, abSealed, 2, abKeys, 4, 0, SEALSEARCH_NUM_VNS) == 0);
+    bSuccess &= (sealsearch_init(&stPar, SEALSEARCH_TA82, abSealed, 2, abKeys, 4, 0, SEALSEARCH_NUM_VNS) == 0);
+    bSuccess &= bSuccess && (sealsearch_run(&stSeq, NULL, 100000) == 100000 && !sealsearch_done(&stSeq));
+    bSuccess &= bSuccess && (sealsearch_run(&stSeq, NULL, UINT64_MAX) == 4 * 65536 - 100000 && sealsearch_done(&stSeq));
+    bSuccess &= bSuccess && (sealsearch_run(&stPar, lpPool, UINT64_MAX) == 4 * 65536 && sealsearch_run(&stPar, lpPool, 1) == 0);
+    bSuccess &= (stSeq.dwNumHits == stPar.dwNumHits && memcmp(stSeq.lpHits, stPar.lpHits, stSeq.dwNumHits * sizeof(SealsearchHit)) == 0);
+
+    uint32_t dwFound = 0;
+    for (uint32_t i = 0; i < stPar.dwNumHits; i++) {
+        SealsearchHit *lpHit = &stPar.lpHits[i];
+        uint8_t abUnsealed[10], abKeyN[2], bMf = 1;
+        ta82(&abSealed[lpHit->dwBlock * SEALSEARCH_SEALED_LEN], lpHit->abVn, &abKeys[lpHit->dwKey * 16], abUnsealed, &bMf, abKeyN);
+        bSuccess &= (bMf == 0 && memcmp(abUnsealed, lpHit->abUnsealed, 10) == 0 && memcmp(abKeyN, lpHit->abKeyN, 2) == 0);
+        bSuccess &= (lpHit->qwIndex == lpHit->dwKey * 65536ULL + (lpHit->abVn[0] << 8 | lpHit->abVn[1]));
+        if (lpHit->dwKey == 2 && memcmp(lpHit->abVn, abGckVn, 2) == 0) {
+            bSuccess &= (memcmp(lpHit->abUnsealed, lpHit->dwBlock ? abCck : abGck, 10) == 0 && memcmp(lpHit->abKeyN, abGckN, 2) == 0);
+            dwFound |= 1 << lpHit->dwBlock;
+        }
+    }
+    bSuccess &= (dwFound == 3);
+    sealsearch_free(&stSeq);
+    sealsearch_free(&stPar);
+
+    // CCK sealed under DCK 1, with a known CCK-id range around the right one
+    ta31(abCck, abCckId, &abDcks[10], abSealed);
+    bSuccess &= (sealsearch_init(&stPar, SEALSEARCH_TA32, abSealed, 1, abDcks, 3, 0x20, 16) == 0);
+    bSuccess &= bSuccess && (sealsearch_run(&stPar, lpPool, UINT64_MAX) == 3 * 16);
+    bSuccess &= (stPar.dwNumHits == 1 && stPar.lpHits[0].dwKey == 1 && memcmp(stPar.lpHits[0].abVn, abCckId, 2) == 0);
+    bSuccess &= (stPar.dwNumHits == 1 && stPar.lpHits[0].qwIndex == 16 + 0x0a && memcmp(stPar.lpHits[0].abUnsealed, abCck, 10) == 0);
+    sealsearch_free(&stPar);
+
+    bSuccess &= (sealsearch_init(&stPar, SEALSEARCH_TA32, abSealed, 1, abDcks, 3, 0xFFF0, 17) == -1);
+    bSuccess &= (sealsearch_init(&stPar, SEALSEARCH_TA32, abSealed, SEALSEARCH_MAX_BLOCKS + 1, abDcks, 3, 0, 1) == -1);
+    workpool_destroy(lpPool);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_hugemem() {
+    const char *lpTag = "huge page arena";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t bSuccess = 1;
+    HugememBlock stBlock;
+
+    // Whatever pages back it, a block is zeroed and usable; huge ones are 2 MiB aligned
+    static const uint32_t adwFlags[] = { 0, HUGEMEM_FLAG_NO_THP, HUGEMEM_FLAG_HUGETLB | HUGEMEM_FLAG_POPULATE };
+    for (int f = 0; f < 3; f++) {
+        bSuccess &= (hugemem_alloc(&stBlock, 3 * HUGEMEM_HUGE_PAGE + 100, adwFlags[f], 0) == 0);
+        uint8_t *lpBase = stBlock.lpBase;
+        bSuccess &= (stBlock.qwSize >= 3 * HUGEMEM_HUGE_PAGE + 100 && lpBase[0] == 0 && lpBase[stBlock.qwSize - 1] == 0);
+        bSuccess &= (stBlock.ePages == HUGEMEM_PAGES_SMALL || ((uintptr_t)lpBase & (HUGEMEM_HUGE_PAGE - 1)) == 0);
+        bSuccess &= (f != 1 || stBlock.ePages == HUGEMEM_PAGES_SMALL);
+        memset(lpBase, 0x5A, stBlock.qwSize);
+        hugemem_free(&stBlock);
+        bSuccess &= (stBlock.lpBase == NULL);
+    }
+
+    // Arena allocations are zeroed, cache line aligned and disjoint, including oversized ones
+    HUGEMEM_ARENA *lpArena = hugemem_arena_create(1 << 16, 0, -1);
+    uint8_t *alpAllocs[40];
+    size_t aqwSizes[40];
+    for (int i = 0; i < 40; i++) {
+        aqwSizes[i] = i == 17 ? 100000 : 1 + i * 997;
+        alpAllocs[i] = hugemem_arena_alloc(lpArena, aqwSizes[i]);
+        bSuccess &= (alpAllocs[i] != NULL && ((uintptr_t)alpAllocs[i] & 63) == 0);
+        for (size_t j = 0; j < aqwSizes[i] && bSuccess; j++) {
+            bSuccess &= (alpAllocs[i][j] == 0);
+        }
+        memset(alpAllocs[i], i + 1, aqwSizes[i]);
+    }
+    for (int i = 0; i < 40; i++) {
+        for (size_t j = 0; j < aqwSizes[i]; j++) {
+            bSuccess &= (alpAllocs[i][j] == i + 1);
+        }
+    }
+    hugemem_arena_destroy(lpArena);
+
+    // Every replica holds the table, and the local one is one of them
+    uint32_t adwTable[1024];
+    HugememReplica stReplica;
+    for (int i = 0; i < 1024; i++) {
+        adwTable[i] = i * 2654435761u;
+    }
+    bSuccess &= (hugemem_num_nodes() >= 1 && hugemem_replicate(&stReplica, adwTable, sizeof(adwTable), 0) == 0);
+    bSuccess &= (stReplica.dwNumCopies == hugemem_num_nodes());
+    for (uint32_t i = 0; i < stReplica.dwNumCopies; i++) {
+        bSuccess &= (memcmp(stReplica.astCopies[i].lpBase, adwTable, sizeof(adwTable)) == 0);
+    }
+    bSuccess &= (memcmp(hugemem_replica_local(&stReplica), adwTable, sizeof(adwTable)) == 0);
+    hugemem_replica_free(&stReplica);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_lathist() {
+    const char *lpTag = "latency histograms";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t bSuccess = 1;
+
+    // Every value lands in a bucket that covers it and is at most 1/16 wide
+    for (uint64_t v = 0; v < (1ULL << 42); v = v < 100000 ? v + 1 : v + v / 7) {
+        uint32_t dwBucket = lathist_bucket(v);
+        uint64_t qwHigh = lathist_bucket_high(dwBucket);
+        bSuccess &= (dwBucket < LATHIST_NUM_BUCKETS);
+        bSuccess &= (dwBucket == LATHIST_NUM_BUCKETS - 1 || (qwHigh >= v && qwHigh - v <= v / LATHIST_SUB_BUCKETS));
+        bSuccess &= (dwBucket == 0 || lathist_bucket(lathist_bucket_high(dwBucket - 1)) == dwBucket - 1);
+    }
+
+    LathistSnapshot *lpSnapshot = malloc(sizeof(LathistSnapshot));
+    LathistHistogram *lpMerged = calloc(1, sizeof(LathistHistogram));
+    bSuccess &= (lpSnapshot != NULL && lpMerged != NULL);
+    if (lpSnapshot && lpMerged) {
+        // 1 .. 1000 ns recorded directly: percentiles come out within a bucket of the exact value
+        lathist_reset();
+        for (uint64_t v = 1; v <= 1000; v++) {
+            lathist_record(LATHIST_XOR, v);
+        }
+        lathist_snapshot(lpSnapshot);
+        LathistHistogram *lpHist = &lpSnapshot->astStages[LATHIST_XOR];
+        uint64_t qwP50 = lathist_percentile(lpHist, 50.0), qwP99 = lathist_percentile(lpHist, 99.0);
+        bSuccess &= (lpHist->qwCount == 1000 && lpHist->qwSumNs == 500500);
+        bSuccess &= (qwP50 >= 500 && qwP50 < 532 && qwP99 >= 990 && qwP99 < 1024);
+        bSuccess &= (lathist_percentile(lpHist, 100.0) == lpHist->qwMaxNs && lpHist->qwMaxNs >= 1000 && lpHist->qwMaxNs < 1024);
+        bSuccess &= (lathist_percentile(&lpSnapshot->astStages[LATHIST_IV], 50.0) == 0);
+
+        lathist_merge(lpMerged, lpHist);
+        lathist_merge(lpMerged, lpHist);
+        bSuccess &= (lpMerged->qwCount == 2000 && lathist_percentile(lpMerged, 50.0) == qwP50);
+
+        // The window drops what was recorded before its oldest tick
+        for (int i = 0; i < LATHIST_WINDOW_TICKS; i++) {
+            lathist_tick();
+        }
+        lathist_record(LATHIST_XOR, 5000);
+        lathist_window(lpSnapshot);
+        bSuccess &= (lpHist->qwCount == 1 && lpHist->qwSumNs == 5000 && lpHist->qwMaxNs >= 5000 && lpHist->qwMaxNs < 5400);
+
+        // The decrypt service only records its stages while switched on
+        CarrierConfig stConfig = { 1, 0, { 0x01, 0x23 }, { 0x12, 0x34 }, 0x2A, { 0 }, { 0 } };
+        for (int bEnabled = 0; bEnabled < 2; bEnabled++) {
+            lathist_set_enabled(bEnabled);
+            lathist_reset();
+            g_dwCarrierOutCount = 0;
+            CARRIER_SVC *lpSvc = carrier_svc_create(1, 0, test_carrier_output, NULL);
+            bSuccess &= (lpSvc != NULL && carrier_svc_add_carrier(lpSvc, &stConfig) == 0);
+            for (uint32_t i = 0; i < 8 && lpSvc; i++) {
+                CarrierBurst stBurst = { 0, { 1, 1 + i, 1, 0, 0 }, 1, 0, 216, i };
+                bSuccess &= (carrier_svc_submit(lpSvc, &stBurst) == 0);
+            }
+            if (lpSvc) {
+                carrier_svc_flush(lpSvc);
+                carrier_svc_destroy(lpSvc);
+            }
+            lathist_snapshot(lpSnapshot);
+            bSuccess &= (lpSnapshot->astStages[LATHIST_KEY].qwCount == bEnabled);
+            bSuccess &= (lpSnapshot->astStages[LATHIST_QUEUE].qwCount == 8 * bEnabled);
+            bSuccess &= (lpSnapshot->astStages[LATHIST_KEYSTREAM].qwCount == 8 * bEnabled);
+            bSuccess &= (lpSnapshot->astStages[LATHIST_TOTAL].qwCount == 8 * bEnabled);
+        }
+        lathist_set_enabled(0);
+        bSuccess &= (lathist_export_json("/dev/null", 0) == 0 && lathist_export_prometheus("/dev/null", 1) == 0);
+    }
+    free(lpSnapshot);
+    free(lpMerged);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
+void test_stats() {
+    const char *lpTag = "stats";
+    printf("Testing %s...%*c", lpTag, (int)(40 - strlen(lpTag)), ' ');
+
+    uint8_t abKey[16] = { 0 };
+    uint8_t abKs[10];
+    uint8_t bSuccess = 1;
+    StatsSnapshot stSnapshot;
+
+    stats_reset();
+    tea1(0x11111111, abKey, sizeof(abKs), abKs);
+    HURDLE_enc_cbc(abKey, abKey, abKey);
+    tea2_match(0x11111111, abKey, abKs, abKs, sizeof(abKs));
+    stats_snapshot(&stSnapshot);
+
+#ifdef TETRA_STATS
+    uint64_t qwExpected = 1;
+#else
+    uint64_t qwExpected = 0;
+#endif
+    bSuccess &= (stSnapshot.astProbes[STATS_TEA1].qwCalls == qwExpected);
+    bSuccess &= (stSnapshot.astProbes[STATS_TEA1].qwKsBytes == 10 * qwExpected);
+    bSuccess &= (stSnapshot.astProbes[STATS_TEA1_CLOCK].qwRounds == (54 + 9 * 19) * qwExpected);
+    bSuccess &= (stSnapshot.astProbes[STATS_HURDLE_ENCRYPT].qwBlocks == 2 * qwExpected);
+    bSuccess &= (stSnapshot.astProbes[STATS_HURDLE_SET_KEY].qwKeySchedules == qwExpected);
+    bSuccess &= (stSnapshot.astProbes[STATS_HURDLE_F].qwRounds == 32 * qwExpected);
+    bSuccess &= (stSnapshot.astProbes[STATS_TEA1_EXPAND_IV].qwCalls == qwExpected);
+    bSuccess &= (stSnapshot.astProbes[STATS_TEA2_MATCH].qwCalls == qwExpected);
+
+    stats_reset();
+    stats_snapshot(&stSnapshot);
+    bSuccess &= (stSnapshot.astProbes[STATS_TEA1].qwCalls == 0);
+    bSuccess &= (stats_export_json("/dev/null") == 0 && stats_export_prometheus("/dev/null") == 0);
+
+    if (bSuccess) {
+        printf("[\x1b[32m OK \x1b[0m]\n");
+    } else {
+        printf("[\x1b[31mFAIL\x1b[0m]\n");
+    }
+}
+
 int main() {
     
     test_transform_80_to_120_alt();
@@ -527,7 +2400,32 @@ int main() {
     test_tb7();
 
     test_HURDLE();
+    test_HURDLE_compact();
+    test_HURDLE_otf();
     test_TEA1();
     test_TEA2();
     test_TEA3();
+    test_tea_xor();
+    test_key_stream();
+    test_tea_lanes();
+    test_tune();
+
+    test_kpt_search();
+    test_tea1_orbit();
+    test_tea1_targets();
+    test_ivsync();
+    test_workpool();
+    test_keysearch();
+    test_carrier_svc();
+    test_keyhier();
+    test_capture();
+    test_ks_shm();
+    test_jobsrv();
+    test_jobsrv_slow_client();
+    test_jobsrv_weak_filter();
+    test_trafgen();
+    test_sealsearch();
+    test_hugemem();
+    test_lathist();
+    test_stats();
 }
@@ -0,0 +1,269 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "taa1.h"
+#include "tea1.h"
+#include "tea2.h"
+#include "tea3.h"
+#include "trafgen.h"
+
+struct TRAFGEN {
+    TrafgenConfig stConfig;
+    TrafgenCarrier astCarriers[TRAFGEN_MAX_CARRIERS];
+    uint32_t dwNumCarriers;
+
+    FrameNumbers stFn;                  // of the next timeslot
+    uint64_t qwHyperframes;             // since the start
+    uint32_t dwGeneration;
+    uint8_t aabEck[TRAFGEN_MAX_CARRIERS][10];   // under dwGeneration
+    uint64_t qwSeq;
+
+    // Scratch for one timeslot: the lanes of one TEA variant and the bursts handed out by trafgen_run
+    uint32_t adwLaneBurst[TRAFGEN_MAX_CARRIERS];
+    uint32_t adwIvs[TRAFGEN_MAX_CARRIERS];
+    uint8_t abKeys[TRAFGEN_MAX_CARRIERS * 10];
+    uint8_t abKs[TRAFGEN_MAX_CARRIERS * TRAFGEN_MAX_BURST_BYTES];
+    TrafgenBurst astBursts[TRAFGEN_MAX_CARRIERS];
+};
+
+static uint64_t trafgen_mix(uint64_t qwX) {
+    qwX += 0x9E3779B97F4A7C15ULL;
+    qwX = (qwX ^ (qwX >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    qwX = (qwX ^ (qwX >> 27)) * 0x94D049BB133111EBULL;
+    return qwX ^ (qwX >> 31);
+}
+
+// CCK (bSck 0) or SCK (bSck 1) of a key set
+static void trafgen_key(const TRAFGEN *lpGen, uint32_t dwGeneration, uint32_t bSck, uint8_t *lpKeyOut) {
+    uint64_t qwA = trafgen_mix(lpGen->stConfig.qwSeed ^ trafgen_mix(((uint64_t)dwGeneration << 1) | bSck));
+    uint64_t qwB = trafgen_mix(qwA);
+    memcpy(lpKeyOut, &qwA, 8);
+    memcpy(lpKeyOut + 8, &qwB, 2);
+}
+
+static void trafgen_set_generation(TRAFGEN *lpGen, uint32_t dwGeneration) {
+    lpGen->dwGeneration = dwGeneration;
+    for (uint32_t i = 0; i < lpGen->dwNumCarriers; i++) {
+        trafgen_eck(lpGen, i, dwGeneration, lpGen->aabEck[i]);
+    }
+}
+
+TRAFGEN *trafgen_create(const TrafgenConfig *lpConfig, const TrafgenCarrier *lpCarriers, uint32_t dwNumCarriers) {
+    const FrameNumbers *lpStart = &lpConfig->stStart;
+    if (dwNumCarriers == 0 || dwNumCarriers > TRAFGEN_MAX_CARRIERS || lpConfig->dwBitLen == 0 || lpConfig->dwBitLen > TRAFGEN_MAX_BURST_BITS ||
+            lpConfig->dwHeaderLen > TRAFGEN_MAX_HEADER || lpConfig->dwHeaderLen * 8 > lpConfig->dwBitLen || lpConfig->dSpeed < 0 ||
+            lpStart->fn < 1 || lpStart->fn > 18 || lpStart->mn < 1 || lpStart->mn > 60 || lpStart->dir > 1) {
+        return NULL;
+    }
+    // Ranges tb5 asserts on: 12-bit cn, 14-bit la, 6-bit cc
+    for (uint32_t i = 0; i < dwNumCarriers; i++) {
+        const TrafgenCarrier *lpCarrier = &lpCarriers[i];
+        if (lpCarrier->dwTeaType < 1 || lpCarrier->dwTeaType > 3 || lpCarrier->dwNumSlots < 1 || lpCarrier->dwNumSlots > 4 ||
+                (lpCarrier->abCn[0] & 0xF0) || (lpCarrier->abLa[0] & 0xC0) || (lpCarrier->bCc & 0xC0)) {
+            return NULL;
+        }
+    }
+
+    TRAFGEN *lpGen = calloc(1, sizeof(TRAFGEN));
+    if (lpGen == NULL) {
+        return NULL;
+    }
+    lpGen->stConfig = *lpConfig;
+    memcpy(lpGen->astCarriers, lpCarriers, dwNumCarriers * sizeof(TrafgenCarrier));
+    lpGen->dwNumCarriers = dwNumCarriers;
+    lpGen->stFn = *lpStart;
+    lpGen->stFn.tn = 1;
+    trafgen_set_generation(lpGen, 0);
+    return lpGen;
+}
+
+void trafgen_destroy(TRAFGEN *lpGen) {
+    free(lpGen);
+}
+
+void trafgen_plaintext(const TRAFGEN *lpGen, const TrafgenBurst *lpBurst, uint8_t *lpOut) {
+    uint32_t dwNumBytes = (lpBurst->dwBitLen + 7) / 8;
+    uint64_t qwState = trafgen_mix(lpGen->stConfig.qwSeed + lpBurst->qwSeq * 0xD1B54A32D192ED03ULL);
+
+    for (uint32_t i = 0; i < dwNumBytes; i += 8) {
+        uint64_t qwBytes = trafgen_mix(qwState + i);
+        memcpy(&lpOut[i], &qwBytes, dwNumBytes - i < 8 ? dwNumBytes - i : 8);
+    }
+    memcpy(lpOut, lpGen->stConfig.abHeader, lpGen->stConfig.dwHeaderLen);
+    if (lpBurst->dwBitLen & 7) {
+        lpOut[dwNumBytes - 1] &= 0xFF << (8 - (lpBurst->dwBitLen & 7));
+    }
+}
+
+int trafgen_eck(const TRAFGEN *lpGen, uint32_t dwCarrier, uint32_t dwGeneration, uint8_t *lpEckOut) {
+    if (dwCarrier >= lpGen->dwNumCarriers) {
+        return -1;
+    }
+    TrafgenCarrier stCarrier = lpGen->astCarriers[dwCarrier];
+    uint8_t abKey[10];
+    trafgen_key(lpGen, dwGeneration, stCarrier.bSck, abKey);
+    if (stCarrier.bSck) {
+        tb6(abKey, stCarrier.abCn, stCarrier.abSsi, lpEckOut);
+    } else {
+        tb5(stCarrier.abCn, stCarrier.abLa, &stCarrier.bCc, abKey, lpEckOut);
+    }
+    return 0;
+}
+
+uint16_t trafgen_key_set(const TRAFGEN *lpGen, uint32_t dwGeneration, KeyhierKeySet *lpKeysOut) {
+    memset(lpKeysOut, 0, sizeof(*lpKeysOut));
+    trafgen_key(lpGen, dwGeneration, 0, lpKeysOut->abCck);
+    trafgen_key(lpGen, dwGeneration, 1, lpKeysOut->aabScks[0]);
+    lpKeysOut->dwSckMask = 1;
+    return lpGen->stConfig.stStart.hn + (uint64_t)dwGeneration * lpGen->stConfig.dwRolloverHyperframes;
+}
+
+static void trafgen_advance(TRAFGEN *lpGen) {
+    FrameNumbers *lpFn = &lpGen->stFn;
+    if (++lpFn->tn <= 4) {
+        return;
+    }
+    lpFn->tn = 1;
+    if (++lpFn->fn <= 18) {
+        return;
+    }
+    lpFn->fn = 1;
+    if (++lpFn->mn <= 60) {
+        return;
+    }
+    lpFn->mn = 1;
+    lpFn->hn++;
+    lpGen->qwHyperframes++;
+    uint32_t dwRollover = lpGen->stConfig.dwRolloverHyperframes;
+    if (dwRollover && lpGen->qwHyperframes / dwRollover != lpGen->dwGeneration) {
+        trafgen_set_generation(lpGen, lpGen->qwHyperframes / dwRollover);
+    }
+}
+
+uint32_t trafgen_tick(TRAFGEN *lpGen, TrafgenBurst *lpBursts) {
+    uint32_t dwNumKsBytes = (lpGen->stConfig.dwBitLen + 7) / 8;
+    uint32_t dwIv = build_iv(&lpGen->stFn);
+    uint32_t dwNumBursts = 0;
+
+    for (uint32_t i = 0; i < lpGen->dwNumCarriers; i++) {
+        if (lpGen->astCarriers[i].dwNumSlots < lpGen->stFn.tn) {
+            continue;
+        }
+        TrafgenBurst *lpBurst = &lpBursts[dwNumBursts++];
+        lpBurst->dwCarrier = i;
+        lpBurst->dwGeneration = lpGen->dwGeneration;
+        lpBurst->stFn = lpGen->stFn;
+        lpBurst->dwBitLen = lpGen->stConfig.dwBitLen;
+        lpBurst->qwSeq = lpGen->qwSeq++;
+        lpBurst->qwEmitNs = 0;
+        trafgen_plaintext(lpGen, lpBurst, lpBurst->abData);
+    }
+
+    // All carriers share the timeslot's IV, so every variant's keystreams are one batch of byte lanes
+    for (uint32_t dwTeaType = 1; dwTeaType <= 3; dwTeaType++) {
+        uint32_t dwNumLanes = 0;
+        for (uint32_t i = 0; i < dwNumBursts; i++) {
+            uint32_t dwCarrier = lpBursts[i].dwCarrier;
+            if (lpGen->astCarriers[dwCarrier].dwTeaType == dwTeaType) {
+                lpGen->adwLaneBurst[dwNumLanes] = i;
+                lpGen->adwIvs[dwNumLanes] = dwIv;
+                memcpy(&lpGen->abKeys[dwNumLanes * 10], lpGen->aabEck[dwCarrier], 10);
+                dwNumLanes++;
+            }
+        }
+        if (dwNumLanes == 0) {
+            continue;
+        }
+        if (dwTeaType == 1) tea1_keystream_lanes(dwNumLanes, lpGen->adwIvs, lpGen->abKeys, dwNumKsBytes, lpGen->abKs);
+        if (dwTeaType == 2) tea2_keystream_lanes(dwNumLanes, lpGen->adwIvs, lpGen->abKeys, dwNumKsBytes, lpGen->abKs);
+        if (dwTeaType == 3) tea3_keystream_lanes(dwNumLanes, lpGen->adwIvs, lpGen->abKeys, dwNumKsBytes, lpGen->abKs);
+
+        for (uint32_t n = 0; n < dwNumLanes; n++) {
+            uint8_t *lpData = lpBursts[lpGen->adwLaneBurst[n]].abData;
+            for (uint32_t j = 0; j < dwNumKsBytes; j++) {
+                lpData[j] ^= lpGen->abKs[n * dwNumKsBytes + j];
+            }
+            if (lpGen->stConfig.dwBitLen & 7) {
+                lpData[dwNumKsBytes - 1] &= 0xFF << (8 - (lpGen->stConfig.dwBitLen & 7));
+            }
+        }
+    }
+
+    trafgen_advance(lpGen);
+    return dwNumBursts;
+}
+
+static uint64_t trafgen_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t trafgen_run(TRAFGEN *lpGen, uint64_t qwMaxBursts, TrafgenOutputFn fnOutput, void *lpArg) {
+    uint64_t qwEmitted = 0;
+    uint64_t qwStartNs = trafgen_now_ns();
+    uint64_t qwTicks = 0;
+
+    while (qwEmitted < qwMaxBursts) {
+        uint32_t dwNumBursts = trafgen_tick(lpGen, lpGen->astBursts);
+
+        // Timeslot k goes out k timeslots after the start; a consumer that held us up is not made up for by sleeping less later
+        if (lpGen->stConfig.dSpeed > 0) {
+            uint64_t qwDueNs = qwStartNs + (uint64_t)(qwTicks * TRAFGEN_TIMESLOT_NS / lpGen->stConfig.dSpeed);
+            uint64_t qwNowNs = trafgen_now_ns();
+            if (qwDueNs > qwNowNs) {
+                struct timespec ts = { qwDueNs / 1000000000ULL, qwDueNs % 1000000000ULL };
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            }
+        }
+        qwTicks++;
+
+        for (uint32_t i = 0; i < dwNumBursts && qwEmitted < qwMaxBursts; i++) {
+            lpGen->astBursts[i].qwEmitNs = trafgen_now_ns();
+            qwEmitted++;
+            if (fnOutput(lpArg, &lpGen->astBursts[i]) != 0) {
+                return qwEmitted;
+            }
+        }
+    }
+    return qwEmitted;
+}
+
+void trafgen_capture_header(uint8_t *lpOut) {
+    memset(lpOut, 0, CAPTURE_FILE_HEADER_LEN);
+    memcpy(lpOut, CAPTURE_MAGIC, 8);
+    lpOut[8] = CAPTURE_VERSION;
+}
+
+uint32_t trafgen_capture_record(const TrafgenBurst *lpBurst, uint8_t *lpOut) {
+    uint32_t dwNumBytes = (lpBurst->dwBitLen + 7) / 8;
+    lpOut[0] = lpBurst->stFn.tn;
+    lpOut[1] = lpBurst->stFn.fn;
+    lpOut[2] = lpBurst->stFn.mn;
+    lpOut[3] = lpBurst->stFn.dir;
+    lpOut[4] = lpBurst->stFn.hn;
+    lpOut[5] = lpBurst->stFn.hn >> 8;
+    lpOut[6] = lpBurst->dwBitLen;
+    lpOut[7] = lpBurst->dwBitLen >> 8;
+    memset(&lpOut[8], 0, 4);
+    memcpy(&lpOut[CAPTURE_RECORD_HEADER_LEN], lpBurst->abData, dwNumBytes);
+    return CAPTURE_RECORD_HEADER_LEN + dwNumBytes;
+}
@@ -0,0 +1,93 @@
+#ifndef HAVE_TRAFGEN_H
+#define HAVE_TRAFGEN_H
+
+#include <inttypes.h>
+
+#include "common.h"
+#include "keyhier.h"
+
+/*
+ * Synthetic encrypted TETRA traffic, as a repeatable load source for the
+ * decrypt, search and sync code. Every carrier is a cell sending one burst
+ * per timeslot it uses, encrypted the way the cell would:
+ *
+ *   frame numbers  tn fastest, then fn 1 to 18, mn 1 to 60 and hn, so bursts
+ *                  come out in air order, all carriers of a timeslot together
+ *   keys           ECK = tb5(cn, la, cc, CCK) or tb6(SCK, cn, ssi) with the
+ *                  carrier's TEA variant; a new CCK/SCK set takes over every
+ *                  dwRolloverHyperframes hyperframes
+ *   plaintext      the known header (e.g. a MAC header for kpt) followed by
+ *                  pseudo random bytes
+ *
+ * Everything follows from qwSeed, so a stream can be regenerated and checked
+ * with trafgen_plaintext and trafgen_eck. trafgen_run paces the stream at
+ * dSpeed times real time (a timeslot lasts 85/6 ms) or emits as fast as it
+ * can, to a callback that may write a capture file or pipe (see
+ * trafgen_capture_record) or submit to an in-process queue.
+ */
+
+#define TRAFGEN_MAX_CARRIERS    256
+#define TRAFGEN_MAX_BURST_BITS  432
+#define TRAFGEN_MAX_BURST_BYTES (TRAFGEN_MAX_BURST_BITS / 8)
+#define TRAFGEN_MAX_HEADER      16
+#define TRAFGEN_TIMESLOT_NS     14166667ULL     // 85/6 ms
+
+typedef struct {
+    uint32_t dwTeaType;
+    uint32_t bSck;                      // ECK from the SCK with tb6 instead of the CCK with tb5
+    uint8_t abCn[2];                    // big endian, as taken by tb5/tb6
+    uint8_t abLa[2];
+    uint8_t bCc;
+    uint8_t abSsi[3];
+    uint32_t dwNumSlots;                // timeslots 1 .. dwNumSlots carry traffic
+} TrafgenCarrier;
+
+typedef struct {
+    uint64_t qwSeed;
+    FrameNumbers stStart;               // frame numbers of the first burst, tn is ignored
+    uint32_t dwRolloverHyperframes;     // 0 keeps the first key set
+    uint32_t dwBitLen;                  // per burst, 1 to 432
+    uint32_t dwHeaderLen;               // known plaintext bytes at the start of every burst
+    uint8_t abHeader[TRAFGEN_MAX_HEADER];
+    double dSpeed;                      // trafgen_run pace relative to real time, 0 = as fast as possible
+} TrafgenConfig;
+
+typedef struct {
+    uint32_t dwCarrier;
+    uint32_t dwGeneration;              // key set, see trafgen_eck
+    FrameNumbers stFn;
+    uint32_t dwBitLen;
+    uint64_t qwSeq;                     // position in the stream
+    uint64_t qwEmitNs;                  // CLOCK_MONOTONIC when trafgen_run handed it out
+    uint8_t abData[TRAFGEN_MAX_BURST_BYTES];    // ciphertext, MSB first, unused bits of the last byte zero
+} TrafgenBurst;
+
+// Nonzero stops trafgen_run
+typedef int (*TrafgenOutputFn)(void *lpArg, const TrafgenBurst *lpBurst);
+
+typedef struct TRAFGEN TRAFGEN;
+
+// NULL if a carrier or the configuration is out of range
+TRAFGEN *trafgen_create(const TrafgenConfig *lpConfig, const TrafgenCarrier *lpCarriers, uint32_t dwNumCarriers);
+void trafgen_destroy(TRAFGEN *lpGen);
+
+// Bursts of the next timeslot into lpBursts (room for dwNumCarriers), returns how many; 0 if no carrier uses it
+uint32_t trafgen_tick(TRAFGEN *lpGen, TrafgenBurst *lpBursts);
+
+// Emits until qwMaxBursts are out or the output function returns nonzero, returns the number emitted
+uint64_t trafgen_run(TRAFGEN *lpGen, uint64_t qwMaxBursts, TrafgenOutputFn fnOutput, void *lpArg);
+
+/*
+ * Ground truth: the plaintext of a burst, the ECK of a carrier under a key
+ * set, and the key set in keyhier form (CCK, and the SCK as SCKN 1) with the
+ * hyperframe it takes over at.
+ */
+void trafgen_plaintext(const TRAFGEN *lpGen, const TrafgenBurst *lpBurst, uint8_t *lpOut);
+int trafgen_eck(const TRAFGEN *lpGen, uint32_t dwCarrier, uint32_t dwGeneration, uint8_t *lpEckOut);
+uint16_t trafgen_key_set(const TRAFGEN *lpGen, uint32_t dwGeneration, KeyhierKeySet *lpKeysOut);
+
+// Capture file header and record of a burst (see capture.h); returns the record length
+void trafgen_capture_header(uint8_t *lpOut);
+uint32_t trafgen_capture_record(const TrafgenBurst *lpBurst, uint8_t *lpOut);
+
+#endif /* HAVE_TRAFGEN_H */
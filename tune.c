@@ -0,0 +1,165 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "tea_simd.h"
+#include "tune.h"
+#include "workpool.h"
+
+#define TUNE_MAX_CHUNK_LANES (1 << 16)
+
+// What the dispatchers did before there were profiles
+#define TUNE_DEFAULTS { \
+    { TEA_SIMD_AVX512, TEA_SIMD_AVX512, TEA_SIMD_AVX512 }, \
+    { TEA_SIMD_MIN_LANES, TEA_SIMD_MIN_LANES, TEA_SIMD_MIN_LANES }, \
+    TEA_SIMD_MAX_LANES, \
+    TUNE_HURDLE_OTF, \
+    0, \
+}
+
+static const TuneProfile g_stTuneDefaults = TUNE_DEFAULTS;
+static TuneProfile g_stTuneProfile = TUNE_DEFAULTS;
+
+// A missing or bad profile leaves the defaults
+__attribute__((constructor))
+static void tune_init_from_file(void) {
+    TuneProfile stProfile = g_stTuneDefaults;
+    const char *lpszPath = getenv("TETRA_TUNE");
+
+    if (tune_load(lpszPath ? lpszPath : TUNE_DEFAULT_PATH, &stProfile) == 0) {
+        tune_set(&stProfile);
+    }
+}
+
+void tune_defaults(TuneProfile *lpProfile) {
+    *lpProfile = g_stTuneDefaults;
+}
+
+// Field by field, so a dispatcher reading while the profile is replaced sees old or new values but no torn ones
+void tune_get(TuneProfile *lpProfileOut) {
+    const uint32_t *lpdwIn = (const uint32_t *)&g_stTuneProfile;
+    uint32_t *lpdwOut = (uint32_t *)lpProfileOut;
+    for (int i = 0; i < sizeof(TuneProfile) / sizeof(uint32_t); i++) {
+        lpdwOut[i] = __atomic_load_n(&lpdwIn[i], __ATOMIC_RELAXED);
+    }
+}
+
+void tune_set(const TuneProfile *lpProfile) {
+    const uint32_t *lpdwIn = (const uint32_t *)lpProfile;
+    uint32_t *lpdwOut = (uint32_t *)&g_stTuneProfile;
+    for (int i = 0; i < sizeof(TuneProfile) / sizeof(uint32_t); i++) {
+        __atomic_store_n(&lpdwOut[i], lpdwIn[i], __ATOMIC_RELAXED);
+    }
+}
+
+const char *tune_hurdle_impl_name(TuneHurdleImpl eImpl) {
+    switch (eImpl) {
+    case TUNE_HURDLE_SCHEDULE: return "schedule";
+    case TUNE_HURDLE_COMPACT:  return "compact";
+    default:                   return "otf";
+    }
+}
+
+static int tune_parse_uint(const char *lpszValue, uint32_t dwMin, uint32_t dwMax, uint32_t *lpdwOut) {
+    char *lpszEnd;
+    unsigned long dwValue = strtoul(lpszValue, &lpszEnd, 10);
+    if (lpszEnd == lpszValue || *lpszEnd || dwValue < dwMin || dwValue > dwMax) {
+        return -1;
+    }
+    *lpdwOut = dwValue;
+    return 0;
+}
+
+static int tune_parse_line(const char *lpszKey, const char *lpszValue, TuneProfile *lpProfile) {
+    for (int i = 0; i < TUNE_NUM_TEA; i++) {
+        char szLevelKey[32], szLanesKey[32];
+        snprintf(szLevelKey, sizeof(szLevelKey), "tea%d_simd", i + 1);
+        snprintf(szLanesKey, sizeof(szLanesKey), "tea%d_min_lanes", i + 1);
+        if (!strcmp(lpszKey, szLevelKey)) {
+            for (int j = TEA_SIMD_SCALAR; j <= TEA_SIMD_AVX512; j++) {
+                if (!strcmp(lpszValue, tea_simd_level_name(j))) {
+                    lpProfile->aeTeaLevel[i] = j;
+                    return 0;
+                }
+            }
+            return -1;
+        }
+        if (!strcmp(lpszKey, szLanesKey)) {
+            return tune_parse_uint(lpszValue, 1, TEA_SIMD_MAX_LANES, &lpProfile->adwTeaMinLanes[i]);
+        }
+    }
+    if (!strcmp(lpszKey, "batch_chunk_lanes")) {
+        return tune_parse_uint(lpszValue, 1, TUNE_MAX_CHUNK_LANES, &lpProfile->dwBatchChunkLanes);
+    }
+    if (!strcmp(lpszKey, "threads")) {
+        return tune_parse_uint(lpszValue, 0, WORKPOOL_MAX_WORKERS, &lpProfile->dwThreads);
+    }
+    if (!strcmp(lpszKey, "hurdle_impl")) {
+        for (int j = TUNE_HURDLE_SCHEDULE; j <= TUNE_HURDLE_OTF; j++) {
+            if (!strcmp(lpszValue, tune_hurdle_impl_name(j))) {
+                lpProfile->eHurdleImpl = j;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+int tune_load(const char *lpszPath, TuneProfile *lpProfile) {
+    FILE *lpFile = fopen(lpszPath, "r");
+    if (lpFile == NULL) {
+        return -1;
+    }
+
+    // Keys missing from the file keep the values passed in
+    TuneProfile stProfile = *lpProfile;
+    char szLine[256], szKey[64], szValue[64], szExtra[2];
+    int iResult = 0;
+    while (iResult == 0 && fgets(szLine, sizeof(szLine), lpFile)) {
+        char *lpszComment = strchr(szLine, '#');
+        if (lpszComment) {
+            *lpszComment = 0;
+        }
+        int iFields = sscanf(szLine, "%63s %63s %1s", szKey, szValue, szExtra);
+        if (iFields > 0) {
+            iResult = iFields == 2 ? tune_parse_line(szKey, szValue, &stProfile) : -1;
+        }
+    }
+    fclose(lpFile);
+
+    if (iResult == 0) {
+        *lpProfile = stProfile;
+    }
+    return iResult;
+}
+
+int tune_save(const char *lpszPath, const TuneProfile *lpProfile) {
+    FILE *lpFile = fopen(lpszPath, "w");
+    if (lpFile == NULL) {
+        return -1;
+    }
+    fprintf(lpFile, "# tetracrypto tuning profile, see tune.h\n");
+    for (int i = 0; i < TUNE_NUM_TEA; i++) {
+        fprintf(lpFile, "tea%d_simd %s\n", i + 1, tea_simd_level_name(lpProfile->aeTeaLevel[i]));
+        fprintf(lpFile, "tea%d_min_lanes %u\n", i + 1, lpProfile->adwTeaMinLanes[i]);
+    }
+    fprintf(lpFile, "batch_chunk_lanes %u\n", lpProfile->dwBatchChunkLanes);
+    fprintf(lpFile, "hurdle_impl %s\n", tune_hurdle_impl_name(lpProfile->eHurdleImpl));
+    fprintf(lpFile, "threads %u\n", lpProfile->dwThreads);
+    return fclose(lpFile) == 0 ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+#ifndef HAVE_TUNE_H
+#define HAVE_TUNE_H
+
+#include <inttypes.h>
+
+/*
+ * Tuning profile read by the runtime dispatchers: the widest byte-lane kernel
+ * each TEA variant runs on and the lane count from which it beats the scalar
+ * code, the lanes per workpool chunk of a batch, the HURDLE path batch_hurdle
+ * takes and the number of threads workpool_create(0, ...) starts.
+ *
+ * tea_tune measures these on the machine and writes the profile; the library
+ * loads it at startup from the file named by TETRA_TUNE, or from
+ * TUNE_DEFAULT_PATH. Without a profile the built-in defaults apply. The
+ * TETRA_SIMD cap (see tea_simd.c) still applies on top of the profile.
+ *
+ * The file holds one "key value" pair per line, # starts a comment:
+ *   tea1_simd avx512          scalar, avx2 or avx512; also tea2_, tea3_
+ *   tea1_min_lanes 4
+ *   batch_chunk_lanes 64
+ *   hurdle_impl otf           schedule, compact or otf
+ *   threads 8                 0 = one per allowed cpu
+ */
+
+#define TUNE_DEFAULT_PATH   "/etc/tetracrypto/tune.conf"
+#define TUNE_NUM_TEA        3
+
+typedef enum {
+    TUNE_HURDLE_SCHEDULE,               // HURDLE_set_key + HURDLE_encrypt
+    TUNE_HURDLE_COMPACT,                // HURDLE_set_key_compact + HURDLE_encrypt_compact
+    TUNE_HURDLE_OTF,                    // HURDLE_encrypt_otf
+} TuneHurdleImpl;
+
+typedef struct {
+    uint32_t aeTeaLevel[TUNE_NUM_TEA];  // TeaSimdLevel of TEA1..3
+    uint32_t adwTeaMinLanes[TUNE_NUM_TEA];
+    uint32_t dwBatchChunkLanes;
+    uint32_t eHurdleImpl;               // TuneHurdleImpl
+    uint32_t dwThreads;
+} TuneProfile;
+
+void tune_defaults(TuneProfile *lpProfile);
+void tune_get(TuneProfile *lpProfileOut);
+void tune_set(const TuneProfile *lpProfile);
+
+// Returns 0, or -1 if the file can't be read or holds an unknown key or a bad value; lpProfile is only written on success
+int tune_load(const char *lpszPath, TuneProfile *lpProfile);
+int tune_save(const char *lpszPath, const TuneProfile *lpProfile);
+
+const char *tune_hurdle_impl_name(TuneHurdleImpl eImpl);
+
+#endif /* HAVE_TUNE_H */
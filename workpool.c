@@ -0,0 +1,429 @@
+// Copyright 2023, Midnight Blue.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "tune.h"
+#include "workpool.h"
+
+#define CACHE_LINE 64
+
+/*
+ * Each deque holds a contiguous run of chunk indices, packed as lo | hi << 32
+ * so both ends can be moved with a single CAS. The owner pops from lo, thieves
+ * take the upper half. Chunk indices are handed out exactly once, so a packed
+ * value never reappears and the CAS is ABA-free.
+ */
+typedef struct {
+    _Atomic uint64_t qwSpan;
+    uint32_t dwIndex;
+    uint32_t dwNode;
+    pthread_t hThread;
+    struct WORKPOOL *lpPool;
+} __attribute__((aligned(CACHE_LINE))) WorkpoolWorker;
+
+struct WORKPOOL {
+    WorkpoolWorker *lpWorkers;
+    uint32_t dwNumWorkers;
+
+    pthread_mutex_t hRunLock;   // serializes workpool_run callers
+    pthread_mutex_t hLock;
+    pthread_cond_t hWake;
+    pthread_cond_t hDone;
+    uint64_t qwJobSeq;
+    uint32_t dwBusy;
+    int bShutdown;
+
+    WorkpoolChunkFn fnChunk;
+    void *lpArg;
+    uint64_t qwBegin;
+    uint64_t qwEnd;
+    uint64_t qwChunkSize;
+
+    atomic_int bStop __attribute__((aligned(CACHE_LINE)));
+};
+
+#define SPAN(lo, hi) ((uint64_t)(lo) | ((uint64_t)(hi) << 32))
+#define SPAN_LO(s)   ((uint32_t)(s))
+#define SPAN_HI(s)   ((uint32_t)((s) >> 32))
+
+static int workpool_pop(WorkpoolWorker *lpWorker, uint32_t *lpdwChunk) {
+    uint64_t qwSpan = atomic_load_explicit(&lpWorker->qwSpan, memory_order_acquire);
+    while (SPAN_LO(qwSpan) < SPAN_HI(qwSpan)) {
+        if (atomic_compare_exchange_weak_explicit(&lpWorker->qwSpan, &qwSpan,
+                SPAN(SPAN_LO(qwSpan) + 1, SPAN_HI(qwSpan)), memory_order_acq_rel, memory_order_acquire)) {
+            *lpdwChunk = SPAN_LO(qwSpan);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int workpool_steal_from(WorkpoolWorker *lpThief, WorkpoolWorker *lpVictim) {
+    uint64_t qwSpan = atomic_load_explicit(&lpVictim->qwSpan, memory_order_acquire);
+    while (SPAN_LO(qwSpan) < SPAN_HI(qwSpan)) {
+        uint32_t dwLo = SPAN_LO(qwSpan);
+        uint32_t dwHi = SPAN_HI(qwSpan);
+        uint32_t dwSplit = dwHi - (dwHi - dwLo + 1) / 2;
+        if (atomic_compare_exchange_weak_explicit(&lpVictim->qwSpan, &qwSpan,
+                SPAN(dwLo, dwSplit), memory_order_acq_rel, memory_order_acquire)) {
+            // Own deque is empty, nobody else can be modifying it
+            atomic_store_explicit(&lpThief->qwSpan, SPAN(dwSplit, dwHi), memory_order_release);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int workpool_steal(WorkpoolWorker *lpWorker) {
+    WORKPOOL *lpPool = lpWorker->lpPool;
+    uint32_t dwNum = lpPool->dwNumWorkers;
+
+    // Prefer victims on the same NUMA node, then anyone
+    for (int bRemote = 0; bRemote < 2; bRemote++) {
+        for (uint32_t i = 1; i < dwNum; i++) {
+            WorkpoolWorker *lpVictim = &lpPool->lpWorkers[(lpWorker->dwIndex + i) % dwNum];
+            if ((lpVictim->dwNode != lpWorker->dwNode) != bRemote) {
+                continue;
+            }
+            if (workpool_steal_from(lpWorker, lpVictim)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void workpool_work(WorkpoolWorker *lpWorker) {
+    WORKPOOL *lpPool = lpWorker->lpPool;
+    uint32_t dwChunk;
+
+    while (!atomic_load_explicit(&lpPool->bStop, memory_order_relaxed)) {
+        if (!workpool_pop(lpWorker, &dwChunk) && !(workpool_steal(lpWorker) && workpool_pop(lpWorker, &dwChunk))) {
+            break;
+        }
+        uint64_t qwBegin = lpPool->qwBegin + dwChunk * lpPool->qwChunkSize;
+        uint64_t qwEnd = lpPool->qwEnd - qwBegin > lpPool->qwChunkSize ? qwBegin + lpPool->qwChunkSize : lpPool->qwEnd;
+        lpPool->fnChunk(lpPool->lpArg, lpWorker->dwIndex, qwBegin, qwEnd);
+    }
+}
+
+static void *workpool_thread(void *lpArg) {
+    WorkpoolWorker *lpWorker = lpArg;
+    WORKPOOL *lpPool = lpWorker->lpPool;
+    uint64_t qwSeenSeq = 0;
+
+    pthread_mutex_lock(&lpPool->hLock);
+    for (;;) {
+        while (!lpPool->bShutdown && lpPool->qwJobSeq == qwSeenSeq) {
+            pthread_cond_wait(&lpPool->hWake, &lpPool->hLock);
+        }
+        if (lpPool->bShutdown) {
+            break;
+        }
+        qwSeenSeq = lpPool->qwJobSeq;
+        pthread_mutex_unlock(&lpPool->hLock);
+
+        workpool_work(lpWorker);
+
+        pthread_mutex_lock(&lpPool->hLock);
+        if (--lpPool->dwBusy == 0) {
+            pthread_cond_signal(&lpPool->hDone);
+        }
+    }
+    pthread_mutex_unlock(&lpPool->hLock);
+    return NULL;
+}
+
+static uint32_t workpool_cpu_node(int dwCpu) {
+    char szPath[64];
+    struct dirent *lpEnt;
+    uint32_t dwNode = 0;
+
+    snprintf(szPath, sizeof(szPath), "/sys/devices/system/cpu/cpu%d", dwCpu);
+    DIR *lpDir = opendir(szPath);
+    if (lpDir == NULL) {
+        return 0;
+    }
+    while ((lpEnt = readdir(lpDir)) != NULL) {
+        if (sscanf(lpEnt->d_name, "node%" SCNu32, &dwNode) == 1) {
+            break;
+        }
+    }
+    closedir(lpDir);
+    return dwNode;
+}
+
+WORKPOOL *workpool_create(uint32_t dwNumWorkers, uint32_t dwFlags) {
+    cpu_set_t stCpus;
+    int aiCpus[CPU_SETSIZE];
+    int dwNumCpus = 0;
+
+    CPU_ZERO(&stCpus);
+    if (sched_getaffinity(0, sizeof(stCpus), &stCpus) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &stCpus)) {
+                aiCpus[dwNumCpus++] = i;
+            }
+        }
+    }
+
+    // 0 takes the thread count of the tuning profile, or one worker per allowed cpu
+    if (dwNumWorkers == 0) {
+        TuneProfile stTune;
+        tune_get(&stTune);
+        dwNumWorkers = stTune.dwThreads;
+    }
+    if (dwNumWorkers == 0) {
+        dwNumWorkers = dwNumCpus ? dwNumCpus : sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (dwNumWorkers > WORKPOOL_MAX_WORKERS) {
+        dwNumWorkers = WORKPOOL_MAX_WORKERS;
+    }
+
+    WORKPOOL *lpPool = aligned_alloc(CACHE_LINE, sizeof(WORKPOOL));
+    if (lpPool == NULL) {
+        return NULL;
+    }
+    memset(lpPool, 0, sizeof(*lpPool));
+    lpPool->lpWorkers = aligned_alloc(CACHE_LINE, dwNumWorkers * sizeof(WorkpoolWorker));
+    if (lpPool->lpWorkers == NULL) {
+        free(lpPool);
+        return NULL;
+    }
+    memset(lpPool->lpWorkers, 0, dwNumWorkers * sizeof(WorkpoolWorker));
+    pthread_mutex_init(&lpPool->hRunLock, NULL);
+    pthread_mutex_init(&lpPool->hLock, NULL);
+    pthread_cond_init(&lpPool->hWake, NULL);
+    pthread_cond_init(&lpPool->hDone, NULL);
+
+    for (uint32_t i = 0; i < dwNumWorkers; i++) {
+        WorkpoolWorker *lpWorker = &lpPool->lpWorkers[i];
+        lpWorker->dwIndex = i;
+        lpWorker->lpPool = lpPool;
+        if (dwNumCpus) {
+            lpWorker->dwNode = workpool_cpu_node(aiCpus[i % dwNumCpus]);
+        }
+
+        if (pthread_create(&lpWorker->hThread, NULL, workpool_thread, lpWorker) != 0) {
+            lpPool->dwNumWorkers = i;
+            workpool_destroy(lpPool);
+            return NULL;
+        }
+        lpPool->dwNumWorkers = i + 1;
+
+        if ((dwFlags & WORKPOOL_FLAG_PIN) && dwNumCpus) {
+            cpu_set_t stPin;
+            CPU_ZERO(&stPin);
+            CPU_SET(aiCpus[i % dwNumCpus], &stPin);
+            pthread_setaffinity_np(lpWorker->hThread, sizeof(stPin), &stPin);
+        }
+    }
+    return lpPool;
+}
+
+void workpool_destroy(WORKPOOL *lpPool) {
+    if (lpPool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&lpPool->hLock);
+    lpPool->bShutdown = 1;
+    pthread_cond_broadcast(&lpPool->hWake);
+    pthread_mutex_unlock(&lpPool->hLock);
+
+    for (uint32_t i = 0; i < lpPool->dwNumWorkers; i++) {
+        pthread_join(lpPool->lpWorkers[i].hThread, NULL);
+    }
+    pthread_cond_destroy(&lpPool->hDone);
+    pthread_cond_destroy(&lpPool->hWake);
+    pthread_mutex_destroy(&lpPool->hLock);
+    pthread_mutex_destroy(&lpPool->hRunLock);
+    free(lpPool->lpWorkers);
+    free(lpPool);
+}
+
+uint32_t workpool_num_workers(const WORKPOOL *lpPool) {
+    return lpPool ? lpPool->dwNumWorkers : 1;
+}
+
+int workpool_run(WORKPOOL *lpPool, uint64_t qwBegin, uint64_t qwEnd, uint64_t qwChunkSize, WorkpoolChunkFn fnChunk, void *lpArg) {
+    if (qwEnd <= qwBegin) {
+        return 0;
+    }
+    if (qwChunkSize == 0) {
+        qwChunkSize = 1;
+    }
+
+    // Without a pool the job simply runs on the calling thread
+    if (lpPool == NULL) {
+        for (uint64_t qwPos = qwBegin; qwPos < qwEnd; ) {
+            uint64_t qwNext = qwEnd - qwPos > qwChunkSize ? qwPos + qwChunkSize : qwEnd;
+            fnChunk(lpArg, 0, qwPos, qwNext);
+            qwPos = qwNext;
+        }
+        return 0;
+    }
+
+    // Chunk indices are 32 bits wide
+    uint64_t qwNumChunks = (qwEnd - qwBegin + qwChunkSize - 1) / qwChunkSize;
+    while (qwNumChunks > UINT32_MAX) {
+        qwChunkSize *= 2;
+        qwNumChunks = (qwEnd - qwBegin + qwChunkSize - 1) / qwChunkSize;
+    }
+
+    pthread_mutex_lock(&lpPool->hRunLock);
+    atomic_store(&lpPool->bStop, 0);
+
+    uint32_t dwNum = lpPool->dwNumWorkers;
+    for (uint32_t i = 0; i < dwNum; i++) {
+        uint32_t dwLo = qwNumChunks * i / dwNum;
+        uint32_t dwHi = qwNumChunks * (i + 1) / dwNum;
+        atomic_store_explicit(&lpPool->lpWorkers[i].qwSpan, SPAN(dwLo, dwHi), memory_order_relaxed);
+    }
+
+    pthread_mutex_lock(&lpPool->hLock);
+    lpPool->fnChunk = fnChunk;
+    lpPool->lpArg = lpArg;
+    lpPool->qwBegin = qwBegin;
+    lpPool->qwEnd = qwEnd;
+    lpPool->qwChunkSize = qwChunkSize;
+    lpPool->dwBusy = dwNum;
+    lpPool->qwJobSeq++;
+    pthread_cond_broadcast(&lpPool->hWake);
+    while (lpPool->dwBusy) {
+        pthread_cond_wait(&lpPool->hDone, &lpPool->hLock);
+    }
+    pthread_mutex_unlock(&lpPool->hLock);
+
+    int bStopped = atomic_load(&lpPool->bStop);
+    pthread_mutex_unlock(&lpPool->hRunLock);
+    return bStopped;
+}
+
+void workpool_stop(WORKPOOL *lpPool) {
+    if (lpPool) {
+        atomic_store_explicit(&lpPool->bStop, 1, memory_order_relaxed);
+    }
+}
+
+int workpool_stopped(const WORKPOOL *lpPool) {
+    return lpPool ? atomic_load_explicit(&((WORKPOOL *)lpPool)->bStop, memory_order_relaxed) : 0;
+}
+
+/*
+ * The typed hit pointer is only ever read and written through memcpy, so the
+ * callers' SomeHit ** can be handled as untyped storage.
+ */
+static int workpool_hits_reserve(void *lppHits, uint32_t *lpdwCapacity, uint32_t dwNeeded, uint32_t dwElemSize) {
+    if (dwNeeded <= *lpdwCapacity) {
+        return 0;
+    }
+    uint32_t dwCapacity = *lpdwCapacity ? *lpdwCapacity : 16;
+    while (dwCapacity < dwNeeded) {
+        dwCapacity *= 2;
+    }
+    void *lpData;
+    memcpy(&lpData, lppHits, sizeof(lpData));
+    lpData = realloc(lpData, (size_t)dwCapacity * dwElemSize);
+    if (lpData == NULL) {
+        return -1;
+    }
+    memcpy(lppHits, &lpData, sizeof(lpData));
+    *lpdwCapacity = dwCapacity;
+    return 0;
+}
+
+int workpool_hits_append(void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity, const void *lpHit, uint32_t dwElemSize) {
+    if (workpool_hits_reserve(lppHits, lpdwCapacity, *lpdwNum + 1, dwElemSize) != 0) {
+        return -1;
+    }
+    uint8_t *lpData;
+    memcpy(&lpData, lppHits, sizeof(lpData));
+    memcpy(lpData + (size_t)(*lpdwNum)++ * dwElemSize, lpHit, dwElemSize);
+    return 0;
+}
+
+// One worker's hits, padded so workers never share a cache line
+typedef struct {
+    void *lpHits;
+    uint32_t dwNumHits;
+    uint32_t dwCapacity;
+    int bFailed;
+} __attribute__((aligned(CACHE_LINE))) WorkpoolWorkerHits;
+
+typedef struct {
+    WorkpoolCollectFn fnScan;
+    void *lpArg;
+    WorkpoolWorkerHits *lpWorkers;
+} WorkpoolCollectJob;
+
+static void workpool_collect_chunk(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd) {
+    WorkpoolCollectJob *lpJob = lpArg;
+    WorkpoolWorkerHits *lpHits = &lpJob->lpWorkers[dwWorker];
+
+    // Once a hit is lost the pass is thrown away anyway
+    if (!lpHits->bFailed && lpJob->fnScan(lpJob->lpArg, dwWorker, qwBegin, qwEnd, &lpHits->lpHits, &lpHits->dwNumHits, &lpHits->dwCapacity)) {
+        lpHits->bFailed = 1;
+    }
+}
+
+int workpool_run_collect(WORKPOOL *lpPool, uint64_t qwBegin, uint64_t qwEnd, uint64_t qwChunkSize, WorkpoolCollectFn fnScan, void *lpArg,
+                         void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity, uint32_t dwElemSize, int (*fnCmp)(const void *, const void *)) {
+    uint32_t dwNumWorkers = workpool_num_workers(lpPool);
+    uint32_t dwFirstNew = *lpdwNum;
+
+    WorkpoolWorkerHits *lpWorkers = aligned_alloc(CACHE_LINE, dwNumWorkers * sizeof(WorkpoolWorkerHits));
+    if (lpWorkers == NULL) {
+        return -1;
+    }
+    memset(lpWorkers, 0, dwNumWorkers * sizeof(WorkpoolWorkerHits));
+
+    WorkpoolCollectJob stJob = { fnScan, lpArg, lpWorkers };
+    int bFailed = workpool_run(lpPool, qwBegin, qwEnd, qwChunkSize, workpool_collect_chunk, &stJob);
+
+    uint64_t qwTotal = dwFirstNew;
+    for (uint32_t i = 0; i < dwNumWorkers; i++) {
+        bFailed |= lpWorkers[i].bFailed;
+        qwTotal += lpWorkers[i].dwNumHits;
+    }
+    bFailed |= qwTotal > UINT32_MAX || workpool_hits_reserve(lppHits, lpdwCapacity, qwTotal, dwElemSize) != 0;
+
+    uint8_t *lpData;
+    memcpy(&lpData, lppHits, sizeof(lpData));
+    for (uint32_t i = 0; i < dwNumWorkers; i++) {
+        if (!bFailed && lpWorkers[i].dwNumHits) {
+            memcpy(lpData + (size_t)*lpdwNum * dwElemSize, lpWorkers[i].lpHits, (size_t)lpWorkers[i].dwNumHits * dwElemSize);
+            *lpdwNum += lpWorkers[i].dwNumHits;
+        }
+        free(lpWorkers[i].lpHits);
+    }
+    free(lpWorkers);
+
+    if (bFailed) {
+        return -1;
+    }
+    if (fnCmp && *lpdwNum > dwFirstNew) {
+        qsort(lpData + (size_t)dwFirstNew * dwElemSize, *lpdwNum - dwFirstNew, dwElemSize, fnCmp);
+    }
+    return 0;
+}
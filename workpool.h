@@ -0,0 +1,51 @@
+#ifndef HAVE_WORKPOOL_H
+#define HAVE_WORKPOOL_H
+
+#include <inttypes.h>
+
+/*
+ * Work-stealing scheduler for range jobs (key space sweeps, keystream and
+ * HURDLE batches). A job [qwBegin, qwEnd) is cut into chunks that are dealt
+ * out to per-worker deques; idle workers steal half of a victim's remaining
+ * chunks, preferring victims on their own NUMA node.
+ */
+
+#define WORKPOOL_MAX_WORKERS 1024
+
+#define WORKPOOL_FLAG_PIN  1   // pin worker n to the n-th allowed cpu
+
+typedef struct WORKPOOL WORKPOOL;
+
+// Invoked once per chunk, dwWorker identifies the calling worker (0 .. num_workers-1)
+typedef void (*WorkpoolChunkFn)(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd);
+
+// dwNumWorkers 0 uses the tuned thread count (see tune.h), or one per allowed cpu
+WORKPOOL *workpool_create(uint32_t dwNumWorkers, uint32_t dwFlags);
+void workpool_destroy(WORKPOOL *lpPool);
+uint32_t workpool_num_workers(const WORKPOOL *lpPool);
+
+int workpool_run(WORKPOOL *lpPool, uint64_t qwBegin, uint64_t qwEnd, uint64_t qwChunkSize, WorkpoolChunkFn fnChunk, void *lpArg);
+void workpool_stop(WORKPOOL *lpPool);
+int workpool_stopped(const WORKPOOL *lpPool);
+
+/*
+ * Hit arrays as the search contexts keep them: a malloc'd array at *lppHits
+ * (any element type, passed as the address of the typed pointer) with
+ * *lpdwNum elements of dwElemSize bytes and room for *lpdwCapacity.
+ */
+int workpool_hits_append(void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity, const void *lpHit, uint32_t dwElemSize);
+
+// Scans [qwBegin, qwEnd) appending to the given hit array with workpool_hits_append; returns -1 once a hit could not be stored
+typedef int (*WorkpoolCollectFn)(void *lpArg, uint32_t dwWorker, uint64_t qwBegin, uint64_t qwEnd,
+                                 void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity);
+
+/*
+ * workpool_run with a private hit array per worker, merged into the caller's
+ * array afterwards with the new hits sorted by fnCmp (NULL leaves them in
+ * worker order). A pass that was stopped or failed to store a hit leaves the
+ * caller's array as it was and returns -1, so its range can be rescanned.
+ */
+int workpool_run_collect(WORKPOOL *lpPool, uint64_t qwBegin, uint64_t qwEnd, uint64_t qwChunkSize, WorkpoolCollectFn fnScan, void *lpArg,
+                         void *lppHits, uint32_t *lpdwNum, uint32_t *lpdwCapacity, uint32_t dwElemSize, int (*fnCmp)(const void *, const void *));
+
+#endif /* HAVE_WORKPOOL_H */